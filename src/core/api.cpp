@@ -39,6 +39,7 @@
 #include "film.h"
 #include "medium.h"
 #include "stats.h"
+#include "texcache.h"
 
 // API Additional Headers
 #include "accelerators/bvh.h"
@@ -59,6 +60,9 @@
 #include "integrators/path.h"
 #include "integrators/sppm.h"
 #include "integrators/volpath.h"
+#include "integrators/vcm.h"
+#include "integrators/lighttracer.h"
+#include "integrators/wavefront.h"
 #include "integrators/whitted.h"
 #include "lights/diffuse.h"
 #include "lights/distant.h"
@@ -427,6 +431,27 @@ std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
     } while (false) /* swallow trailing semicolon */
 
 // Object Creation Function Definitions
+
+// Screen-space adaptive shapes refine against the scene's camera when it
+// is a perspective one. Shapes inside an object definition are given in
+// the instance's space, whose placement in the world isn't known until
+// (possibly many) _ObjectInstance_ calls, so they're refined uniformly.
+static bool GetSubdivisionCamera(SubdivisionCamera *camera) {
+    if (renderOptions->CameraName != "perspective" ||
+        renderOptions->currentInstance)
+        return false;
+    const ParamSet &params = renderOptions->CameraParams;
+    Float fov = params.FindOneFloat("fov", 90.);
+    Float halffov = params.FindOneFloat("halffov", -1.f);
+    if (halffov > 0.f) fov = 2.f * halffov;
+    int xres = renderOptions->FilmParams.FindOneInt("xresolution", 1280);
+    int yres = renderOptions->FilmParams.FindOneInt("yresolution", 720);
+    // The field of view spans the shorter image axis
+    camera->p = renderOptions->CameraToWorld[0](Point3f(0, 0, 0));
+    camera->pixelsPerRadian = std::min(xres, yres) / Radians(fov);
+    return true;
+}
+
 std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
                                                const Transform *object2world,
                                                const Transform *world2object,
@@ -525,9 +550,12 @@ std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
     else if (name == "heightfield")
         shapes = CreateHeightfield(object2world, world2object,
                                    reverseOrientation, paramSet);
-    else if (name == "loopsubdiv")
-        shapes = CreateLoopSubdiv(object2world, world2object,
-                                  reverseOrientation, paramSet);
+    else if (name == "loopsubdiv") {
+        SubdivisionCamera camera;
+        shapes = CreateLoopSubdiv(
+            object2world, world2object, reverseOrientation, paramSet,
+            GetSubdivisionCamera(&camera) ? &camera : nullptr);
+    }
     else if (name == "nurbs")
         shapes = CreateNURBS(object2world, world2object, reverseOrientation,
                              paramSet);
@@ -597,7 +625,8 @@ std::shared_ptr<Material> MakeMaterial(const std::string &name,
 
     if ((name == "subsurface" || name == "kdsubsurface") &&
         (renderOptions->IntegratorName != "path" &&
-         (renderOptions->IntegratorName != "volpath")))
+         renderOptions->IntegratorName != "volpath" &&
+         renderOptions->IntegratorName != "wavefront"))
         Warning(
             "Subsurface scattering material \"%s\" used, but \"%s\" "
             "integrator doesn't support subsurface scattering. "
@@ -1608,8 +1637,15 @@ void pbrtWorldEnd() {
     if (PbrtOptions.cat || PbrtOptions.toPly) {
         printf("%*sWorldEnd\n", catIndentCount, "");
     } else {
+        std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
         std::unique_ptr<Integrator> integrator(renderOptions->MakeIntegrator());
         std::unique_ptr<Scene> scene(renderOptions->MakeScene());
+        std::chrono::steady_clock::time_point sceneBuilt =
+            std::chrono::steady_clock::now();
+        ReportWallTime("Scene construction",
+                       std::chrono::duration<double>(sceneBuilt - start)
+                           .count());
 
         // This is kind of ugly; we directly override the current profiler
         // state to switch from parsing/scene construction related stuff to
@@ -1621,6 +1657,10 @@ void pbrtWorldEnd() {
         ProfilerState = ProfToBits(Prof::IntegratorRender);
 
         if (scene && integrator) integrator->Render(*scene);
+        ReportWallTime("Rendering",
+                       std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - sceneBuilt)
+                           .count());
 
         CHECK_EQ(CurrentProfilerState(), ProfToBits(Prof::IntegratorRender));
         ProfilerState = ProfToBits(Prof::SceneConstruction);
@@ -1633,6 +1673,7 @@ void pbrtWorldEnd() {
     currentApiState = APIState::OptionsBlock;
     ImageTexture<Float, Float>::ClearCache();
     ImageTexture<RGBSpectrum, Spectrum>::ClearCache();
+    FreeTextureCache();
     renderOptions.reset(new RenderOptions);
 
     if (!PbrtOptions.cat && !PbrtOptions.toPly) {
@@ -1641,9 +1682,17 @@ void pbrtWorldEnd() {
         if (!PbrtOptions.quiet) {
             PrintStats(stdout);
             ReportProfilerResults(stdout);
-            ClearStats();
-            ClearProfiler();
         }
+        if (!PbrtOptions.statsJSONFile.empty())
+            WriteStatsJSON(PbrtOptions.statsJSONFile);
+        ClearStats();
+        // Scenes with several world blocks append their stacks to the
+        // first one's.
+        static bool stacksWritten = false;
+        if (!PbrtOptions.profileStacksFile.empty() &&
+            WriteProfileStacks(PbrtOptions.profileStacksFile, stacksWritten))
+            stacksWritten = true;
+        ClearProfiler();
     }
 
     for (int i = 0; i < MaxTransforms; ++i) curTransform[i] = Transform();
@@ -1687,8 +1736,16 @@ Integrator *RenderOptions::MakeIntegrator() const {
         integrator = CreatePathIntegrator(IntegratorParams, sampler, camera);
     else if (IntegratorName == "volpath")
         integrator = CreateVolPathIntegrator(IntegratorParams, sampler, camera);
+    else if (IntegratorName == "wavefront")
+        integrator =
+            CreateWavefrontPathIntegrator(IntegratorParams, sampler, camera);
     else if (IntegratorName == "bdpt") {
         integrator = CreateBDPTIntegrator(IntegratorParams, sampler, camera);
+    } else if (IntegratorName == "vcm") {
+        integrator = CreateVCMIntegrator(IntegratorParams, sampler, camera);
+    } else if (IntegratorName == "lighttracer") {
+        integrator =
+            CreateLightTracerIntegrator(IntegratorParams, sampler, camera);
     } else if (IntegratorName == "mlt") {
         integrator = CreateMLTIntegrator(IntegratorParams, camera);
     } else if (IntegratorName == "ambientocclusion") {
@@ -33,7 +33,9 @@
 
 // core/fileutil.cpp*
 #include "fileutil.h"
+#include <cstdio>
 #include <cstdlib>
+#include <vector>
 #include <climits>
 #ifndef PBRT_IS_WINDOWS
 #include <libgen.h>
@@ -126,4 +128,35 @@ void SetSearchDirectory(const std::string &dirname) {
     searchDirectory = dirname;
 }
 
+bool HashFile(const std::string &filename, uint64_t *hash) {
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) return false;
+    // Hash the file's contents 64 bits at a time with MurmurHash64A-style
+    // mixing; the final partial word is zero-padded.
+    const uint64_t m = 0xc6a4a7935bd1e995ull;
+    uint64_t h = 0x2545f4914f6cdd1dull;
+    std::vector<uint64_t> buf(1 << 17);
+    size_t nRead, total = 0;
+    while ((nRead = fread(buf.data(), 1, buf.size() * sizeof(uint64_t), f)) >
+           0) {
+        size_t nWords = (nRead + 7) / 8;
+        if (nRead % 8)
+            memset((char *)buf.data() + nRead, 0, nWords * 8 - nRead);
+        for (size_t i = 0; i < nWords; ++i) {
+            uint64_t k = buf[i] * m;
+            k ^= k >> 47;
+            h = (h ^ (k * m)) * m;
+        }
+        total += nRead;
+    }
+    bool ok = !ferror(f);
+    fclose(f);
+    h ^= total;
+    h ^= h >> 47;
+    h *= m;
+    h ^= h >> 47;
+    *hash = h;
+    return ok;
+}
+
 }  // namespace pbrt
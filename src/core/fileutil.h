@@ -52,6 +52,7 @@ std::string AbsolutePath(const std::string &filename);
 std::string ResolveFilename(const std::string &filename);
 std::string DirectoryContaining(const std::string &filename);
 void SetSearchDirectory(const std::string &dirname);
+bool HashFile(const std::string &filename, uint64_t *hash);
 
 inline bool HasExtension(const std::string &value, const std::string &ending) {
     if (ending.size() > value.size()) return false;
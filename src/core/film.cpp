@@ -141,28 +141,46 @@ void Film::SetImage(const Spectrum *img) const {
 
 void Film::AddSplat(const Point2f &p, Spectrum v) {
     ProfilePhase pp(Prof::SplatFilm);
+    int offset;
+    Float xyz[3];
+    if (!SplatValue(p, v, &offset, xyz)) return;
+    for (int i = 0; i < 3; ++i) pixels[offset].splatXYZ[i].Add(xyz[i]);
+}
 
+bool Film::SplatValue(const Point2f &p, Spectrum v, int *offset,
+                      Float xyz[3]) const {
     if (v.HasNaNs()) {
         LOG(ERROR) << StringPrintf("Ignoring splatted spectrum with NaN values "
                                    "at (%f, %f)", p.x, p.y);
-        return;
+        return false;
     } else if (v.y() < 0.) {
         LOG(ERROR) << StringPrintf("Ignoring splatted spectrum with negative "
                                    "luminance %f at (%f, %f)", v.y(), p.x, p.y);
-        return;
+        return false;
     } else if (std::isinf(v.y())) {
         LOG(ERROR) << StringPrintf("Ignoring splatted spectrum with infinite "
                                    "luminance at (%f, %f)", p.x, p.y);
-        return;
+        return false;
     }
 
-    if (!InsideExclusive((Point2i)p, croppedPixelBounds)) return;
+    Point2i pi = (Point2i)p;
+    if (!InsideExclusive(pi, croppedPixelBounds)) return false;
     if (v.y() > maxSampleLuminance)
         v *= maxSampleLuminance / v.y();
-    Float xyz[3];
     v.ToXYZ(xyz);
-    Pixel &pixel = GetPixel((Point2i)p);
-    for (int i = 0; i < 3; ++i) pixel.splatXYZ[i].Add(xyz[i]);
+    int width = croppedPixelBounds.pMax.x - croppedPixelBounds.pMin.x;
+    *offset = (pi.x - croppedPixelBounds.pMin.x) +
+              (pi.y - croppedPixelBounds.pMin.y) * width;
+    return true;
+}
+
+void Film::AddSplats(const std::vector<Float> &xyz) {
+    ProfilePhase pp(Prof::SplatFilm);
+    int nPixels = croppedPixelBounds.Area();
+    CHECK_EQ(3 * (size_t)nPixels, xyz.size());
+    for (int i = 0; i < nPixels; ++i)
+        for (int c = 0; c < 3; ++c)
+            if (xyz[3 * i + c] != 0) pixels[i].splatXYZ[c].Add(xyz[3 * i + c]);
 }
 
 void Film::WriteImage(Float splatScale) {
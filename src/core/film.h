@@ -68,6 +68,14 @@ class Film {
     void MergeFilmTile(std::unique_ptr<FilmTile> tile);
     void SetImage(const Spectrum *img) const;
     void AddSplat(const Point2f &p, Spectrum v);
+    // Computes the XYZ value that _AddSplat()_ would add for _v_ at _p_
+    // and the offset of its pixel in _croppedPixelBounds_, returning false
+    // if the splat is ignored; with _AddSplats()_, this lets callers
+    // accumulate splats in an image of their own.
+    bool SplatValue(const Point2f &p, Spectrum v, int *offset,
+                    Float xyz[3]) const;
+    // Adds an image of XYZ splat values covering _croppedPixelBounds_
+    void AddSplats(const std::vector<Float> &xyz);
     void WriteImage(Float splatScale = 1);
     void Clear();
 
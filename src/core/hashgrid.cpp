@@ -0,0 +1,128 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// core/hashgrid.cpp*
+#include "hashgrid.h"
+#include "parallel.h"
+#include "stats.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace pbrt {
+
+STAT_INT_DISTRIBUTION("Hash grid/Buckets per item", bucketsPerItem);
+
+// HashGrid Utility Functions
+static bool IsEmpty(const Bounds3f &b) {
+    return b.pMin.x > b.pMax.x || b.pMin.y > b.pMax.y || b.pMin.z > b.pMax.z;
+}
+
+// HashGrid Method Definitions
+void HashGrid::Build(int nItems,
+                     const std::function<Bounds3f(int)> &itemBounds,
+                     Float cellSize) {
+    // Compute the grid bounds and resolution
+    std::vector<Bounds3f> itemBoxes(nItems);
+    bounds = Bounds3f();
+    for (int i = 0; i < nItems; ++i) {
+        itemBoxes[i] = itemBounds(i);
+        if (!IsEmpty(itemBoxes[i])) bounds = Union(bounds, itemBoxes[i]);
+    }
+    items.clear();
+    bucketOffsets.assign(1, 0);
+    if (IsEmpty(bounds)) return;
+    Vector3f diag = bounds.Diagonal();
+    for (int i = 0; i < 3; ++i)
+        gridRes[i] = (int)Clamp(diag[i] / cellSize, 1, 1 << 20);
+    const int hashSize = RoundUpPow2(nItems);
+    hashMask = hashSize - 1;
+    const int chunkSize = 4096;
+    const int64_t nChunks = (nItems + chunkSize - 1) / chunkSize;
+
+    // Count the items in each bucket
+    std::unique_ptr<std::atomic<uint32_t>[]> counts(
+        new std::atomic<uint32_t>[hashSize]);
+    for (int h = 0; h < hashSize; ++h) counts[h] = 0;
+    bucketOffsets.assign(hashSize + 1, 0);
+    ParallelFor([&](int64_t chunk) {
+        std::vector<uint32_t> buckets;
+        int end = std::min<int>((chunk + 1) * chunkSize, nItems);
+        for (int i = chunk * chunkSize; i < end; ++i) {
+            ItemBuckets(itemBoxes[i], &buckets);
+            if (!buckets.empty()) ReportValue(bucketsPerItem, buckets.size());
+            for (uint32_t h : buckets)
+                counts[h].fetch_add(1, std::memory_order_relaxed);
+        }
+    }, nChunks);
+
+    // Turn the counts into offsets, leaving each bucket's end offset in
+    // _counts_ so that the items can be placed by decrementing it
+    for (int h = 0; h < hashSize; ++h) {
+        bucketOffsets[h + 1] = bucketOffsets[h] + counts[h];
+        counts[h] = bucketOffsets[h + 1];
+    }
+    items.resize(bucketOffsets[hashSize]);
+
+    // Place the items in their buckets
+    ParallelFor([&](int64_t chunk) {
+        std::vector<uint32_t> buckets;
+        int end = std::min<int>((chunk + 1) * chunkSize, nItems);
+        for (int i = chunk * chunkSize; i < end; ++i) {
+            ItemBuckets(itemBoxes[i], &buckets);
+            for (uint32_t h : buckets)
+                items[counts[h].fetch_sub(1, std::memory_order_relaxed) - 1] =
+                    i;
+        }
+    }, nChunks);
+}
+
+void HashGrid::ItemBuckets(const Bounds3f &b,
+                           std::vector<uint32_t> *buckets) const {
+    buckets->clear();
+    if (IsEmpty(b)) return;
+    Point3i pMin, pMax;
+    ToCell(b.pMin, &pMin);
+    ToCell(b.pMax, &pMax);
+    for (int z = pMin.z; z <= pMax.z; ++z)
+        for (int y = pMin.y; y <= pMax.y; ++y)
+            for (int x = pMin.x; x <= pMax.x; ++x) {
+                // Distinct cells may hash to the same bucket, but the item
+                // must only be stored there once
+                uint32_t h = Hash(Point3i(x, y, z));
+                if (std::find(buckets->begin(), buckets->end(), h) ==
+                    buckets->end())
+                    buckets->push_back(h);
+            }
+}
+
+}  // namespace pbrt
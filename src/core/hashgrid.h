@@ -0,0 +1,117 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_HASHGRID_H
+#define PBRT_CORE_HASHGRID_H
+
+// core/hashgrid.h*
+#include "pbrt.h"
+#include "geometry.h"
+#include <functional>
+#include <vector>
+
+namespace pbrt {
+
+// HashGrid Declarations
+
+// A uniform grid over items with spatial extent, for looking up the items
+// that may overlap a point. Grid cells are hashed into a fixed number of
+// buckets, and the indices of the items in each bucket are stored
+// contiguously in a single array, so that lookups don't chase pointers.
+// The grid is built in parallel with a counting sort of the items by
+// bucket.
+class HashGrid {
+  public:
+    // HashGrid Public Methods
+    // Builds the grid for items _0_ through _nItems-1_ with the given
+    // bounds; each item is stored in all of the cells that it overlaps.
+    // Cells are cubes with side length _cellSize_, and items with empty
+    // bounds aren't stored.
+    void Build(int nItems, const std::function<Bounds3f(int)> &itemBounds,
+               Float cellSize);
+    // Calls _func_ with the index of every item whose cell shares a bucket
+    // with the cell containing _p_, which includes all of the items whose
+    // bounds contain _p_
+    template <typename Func>
+    void ForEachCandidate(const Point3f &p, Func func) const {
+        Point3i pi;
+        if (items.empty() || !ToCell(p, &pi)) return;
+        uint32_t h = Hash(pi);
+        for (uint32_t i = bucketOffsets[h]; i < bucketOffsets[h + 1]; ++i)
+            func(items[i]);
+    }
+    size_t BytesUsed() const {
+        return bucketOffsets.capacity() * sizeof(uint32_t) +
+               items.capacity() * sizeof(int);
+    }
+
+  private:
+    // HashGrid Private Methods
+    // Returns the distinct buckets of the cells that _b_ overlaps
+    void ItemBuckets(const Bounds3f &b, std::vector<uint32_t> *buckets) const;
+    bool ToCell(const Point3f &p, Point3i *pi) const {
+        bool inBounds = true;
+        Vector3f pg = bounds.Offset(p);
+        for (int i = 0; i < 3; ++i) {
+            (*pi)[i] = (int)(gridRes[i] * pg[i]);
+            inBounds &= ((*pi)[i] >= 0 && (*pi)[i] < gridRes[i]);
+            (*pi)[i] = Clamp((*pi)[i], 0, gridRes[i] - 1);
+        }
+        return inBounds;
+    }
+    uint32_t Hash(const Point3i &p) const {
+        // Multiply as unsigned values, whose overflow is well defined
+        return (((uint32_t)p.x * 73856093u) ^ ((uint32_t)p.y * 19349663u) ^
+                ((uint32_t)p.z * 83492791u)) &
+               hashMask;
+    }
+
+    // HashGrid Private Data
+    Bounds3f bounds;
+    int gridRes[3];
+    // The number of buckets is a power of two, so that hashing doesn't
+    // need a division
+    uint32_t hashMask;
+    // Bucket _h_'s items are _items[bucketOffsets[h]]_ up to
+    // _items[bucketOffsets[h + 1]]_
+    std::vector<uint32_t> bucketOffsets;
+    std::vector<int> items;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_HASHGRID_H
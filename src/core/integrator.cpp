@@ -34,6 +34,7 @@
 #include "integrator.h"
 #include "scene.h"
 #include "interaction.h"
+#include "lightdistrib.h"
 #include "sampling.h"
 #include "parallel.h"
 #include "film.h"
@@ -42,10 +43,12 @@
 #include "progressreporter.h"
 #include "camera.h"
 #include "stats.h"
+#include <chrono>
 
 namespace pbrt {
 
 STAT_COUNTER("Integrator/Camera rays traced", nCameraRays);
+STAT_FLOAT_DISTRIBUTION("Integrator/Tile render time (ms)", tileTime);
 
 // Integrator Method Definitions
 Integrator::~Integrator() {}
@@ -105,6 +108,24 @@ Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
                           scene, sampler, arena, handleMedia) / lightPdf;
 }
 
+Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
+                               MemoryArena &arena, Sampler &sampler,
+                               bool handleMedia,
+                               const LightDistribution &lightDistrib) {
+    ProfilePhase p(Prof::DirectLighting);
+    // Choose a single light to sample for _it_ using _lightDistrib_
+    if (scene.lights.empty()) return Spectrum(0.f);
+    Float lightPdf;
+    int lightNum =
+        lightDistrib.Sample(it.p, it.n, sampler.Get1D(), &lightPdf);
+    Point2f uLight = sampler.Get2D();
+    Point2f uScattering = sampler.Get2D();
+    if (lightNum == -1) return Spectrum(0.f);
+    const std::shared_ptr<Light> &light = scene.lights[lightNum];
+    return EstimateDirect(it, uScattering, *light, uLight,
+                          scene, sampler, arena, handleMedia) / lightPdf;
+}
+
 Spectrum EstimateDirect(const Interaction &it, const Point2f &uScattering,
                         const Light &light, const Point2f &uLight,
                         const Scene &scene, Sampler &sampler,
@@ -227,6 +248,18 @@ std::unique_ptr<Distribution1D> ComputeLightPowerDistribution(
 // SamplerIntegrator Method Definitions
 void SamplerIntegrator::Render(const Scene &scene) {
     Preprocess(scene, *sampler);
+    RenderSamples(scene, 0, sampler->samplesPerPixel, true, "Rendering");
+    LOG(INFO) << "Rendering finished";
+
+    // Save final image after rendering
+    camera->film->WriteImage();
+}
+
+void SamplerIntegrator::RenderSamples(const Scene &scene, int64_t firstSample,
+                                      int64_t endSample, bool addToFilm,
+                                      const std::string &title) {
+    CHECK_LT(firstSample, endSample);
+    CHECK_LE(endSample, sampler->samplesPerPixel);
     // Render image tiles in parallel
 
     // Compute number of tiles, _nTiles_, to use for parallel rendering
@@ -235,16 +268,26 @@ void SamplerIntegrator::Render(const Scene &scene) {
     const int tileSize = 16;
     Point2i nTiles((sampleExtent.x + tileSize - 1) / tileSize,
                    (sampleExtent.y + tileSize - 1) / tileSize);
-    ProgressReporter reporter(nTiles.x * nTiles.y, "Rendering");
+    ProgressReporter reporter(nTiles.x * nTiles.y, title);
+
+    // Samplers that aren't _GlobalSampler_s draw sample values from an RNG
+    // seeded by _Clone()_ rather than indexing them by sample number, so
+    // later passes need their own seeds to avoid repeating earlier ones.
+    bool globalSampler =
+        dynamic_cast<GlobalSampler *>(sampler.get()) != nullptr;
+    int64_t nTileCount = nTiles.x * nTiles.y;
     {
         ParallelFor2D([&](Point2i tile) {
             // Render section of image corresponding to _tile_
+            std::chrono::steady_clock::time_point tileStart =
+                std::chrono::steady_clock::now();
 
             // Allocate _MemoryArena_ for tile
             MemoryArena arena;
 
             // Get sampler instance for tile
             int seed = tile.y * nTiles.x + tile.x;
+            if (!globalSampler) seed += (int)(firstSample * nTileCount);
             std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
 
             // Compute sample bounds for tile
@@ -272,6 +315,7 @@ void SamplerIntegrator::Render(const Scene &scene) {
                 // debugging.
                 if (!InsideExclusive(pixel, pixelBounds))
                     continue;
+                if (firstSample > 0) tileSampler->SetSampleNumber(firstSample);
 
                 do {
                     // Initialize _CameraSample_ for current sample
@@ -317,25 +361,26 @@ void SamplerIntegrator::Render(const Scene &scene) {
                         ray << " -> L = " << L;
 
                     // Add camera ray's contribution to image
-                    filmTile->AddSample(cameraSample.pFilm, L, rayWeight);
+                    if (addToFilm)
+                        filmTile->AddSample(cameraSample.pFilm, L, rayWeight);
 
                     // Free _MemoryArena_ memory from computing image sample
                     // value
                     arena.Reset();
-                } while (tileSampler->StartNextSample());
+                } while (tileSampler->StartNextSample() &&
+                         tileSampler->CurrentSampleNumber() < endSample);
             }
             LOG(INFO) << "Finished image tile " << tileBounds;
 
             // Merge image tile into _Film_
-            camera->film->MergeFilmTile(std::move(filmTile));
+            if (addToFilm) camera->film->MergeFilmTile(std::move(filmTile));
+            std::chrono::duration<double, std::milli> tileDuration =
+                std::chrono::steady_clock::now() - tileStart;
+            ReportValue(tileTime, tileDuration.count());
             reporter.Update();
         }, nTiles);
         reporter.Done();
     }
-    LOG(INFO) << "Rendering finished";
-
-    // Save final image after rendering
-    camera->film->WriteImage();
 }
 
 Spectrum SamplerIntegrator::SpecularReflect(
@@ -65,6 +65,10 @@ Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
                                MemoryArena &arena, Sampler &sampler,
                                bool handleMedia = false,
                                const Distribution1D *lightDistrib = nullptr);
+Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
+                               MemoryArena &arena, Sampler &sampler,
+                               bool handleMedia,
+                               const LightDistribution &lightDistrib);
 Spectrum EstimateDirect(const Interaction &it, const Point2f &uShading,
                         const Light &light, const Point2f &uLight,
                         const Scene &scene, Sampler &sampler,
@@ -96,12 +100,21 @@ class SamplerIntegrator : public Integrator {
                               MemoryArena &arena, int depth) const;
 
   protected:
+    // SamplerIntegrator Protected Methods
+    // Renders the pixel samples with indices in [_firstSample_,
+    // _endSample_); integrators that take several passes over the image
+    // (e.g., to train sampling structures) only add the final one to the
+    // film.
+    void RenderSamples(const Scene &scene, int64_t firstSample,
+                       int64_t endSample, bool addToFilm,
+                       const std::string &title);
+
     // SamplerIntegrator Protected Data
     std::shared_ptr<const Camera> camera;
+    std::shared_ptr<Sampler> sampler;
 
   private:
     // SamplerIntegrator Private Data
-    std::shared_ptr<Sampler> sampler;
     const Bounds2i pixelBounds;
 };
 
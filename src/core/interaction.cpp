@@ -148,6 +148,32 @@ void SurfaceInteraction::ComputeDifferentials(
     }
 }
 
+RayDifferential SurfaceInteraction::SpawnRayCone(const RayDifferential &ray,
+                                                 const Vector3f &wi,
+                                                 Float spread) const {
+    RayDifferential rd = SpawnRay(wi);
+    if (!ray.hasDifferentials) return rd;
+
+    // Approximate the footprint of _ray_ at this point by a cone
+    Float width = std::max(dpdx.Length(), dpdy.Length());
+    Vector3f d = Normalize(ray.d);
+    Float angle =
+        std::max((Normalize(ray.rxDirection) - d).Length(),
+                 (Normalize(ray.ryDirection) - d).Length()) + spread;
+    if (width == 0 && angle == 0) return rd;
+
+    // Encode the widened cone as offset rays around _wi_
+    Vector3f wn = Normalize(wi), u1, u2;
+    CoordinateSystem(wn, &u1, &u2);
+    Float slope = std::tan(std::min(angle, (Float)1.25));
+    rd.hasDifferentials = true;
+    rd.rxOrigin = rd.o + width * u1;
+    rd.ryOrigin = rd.o + width * u2;
+    rd.rxDirection = wn + slope * u1;
+    rd.ryDirection = wn + slope * u2;
+    return rd;
+}
+
 Spectrum SurfaceInteraction::Le(const Vector3f &w) const {
     const AreaLight *area = primitive->GetAreaLight();
     return area ? area->L(*this, w) : Spectrum(0.f);
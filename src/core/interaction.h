@@ -113,6 +113,12 @@ class MediumInteraction : public Interaction {
     const PhaseFunction *phase;
 };
 
+// Returns the half-angle of a cone subtending the solid angle $1/p$ that a
+// sampled direction with density _pdf_ represents.
+inline Float LobeSpreadAngle(Float pdf) {
+    return pdf > 0 ? std::min(1 / std::sqrt(Pi * pdf), PiOver2) : PiOver2;
+}
+
 // SurfaceInteraction Declarations
 class SurfaceInteraction : public Interaction {
   public:
@@ -132,6 +138,8 @@ class SurfaceInteraction : public Interaction {
         bool allowMultipleLobes = false,
         TransportMode mode = TransportMode::Radiance);
     void ComputeDifferentials(const RayDifferential &r) const;
+    RayDifferential SpawnRayCone(const RayDifferential &r, const Vector3f &wi,
+                                 Float spread) const;
     Spectrum Le(const Vector3f &w) const;
 
     // SurfaceInteraction Public Data
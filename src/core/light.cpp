@@ -56,6 +56,102 @@ Light::Light(int flags, const Transform &LightToWorld,
 
 Light::~Light() {}
 
+// LightBounds Utility Functions
+static Float SafeSqrt(Float x) { return std::sqrt(std::max((Float)0, x)); }
+
+// Returns $\cos(\max(0, \theta_a - \theta_b))$ given the sines and cosines
+// of the two angles.
+static Float CosSubClamped(Float sinTheta_a, Float cosTheta_a,
+                           Float sinTheta_b, Float cosTheta_b) {
+    if (cosTheta_a > cosTheta_b) return 1;
+    return cosTheta_a * cosTheta_b + sinTheta_a * sinTheta_b;
+}
+
+// Returns $\sin(\max(0, \theta_a - \theta_b))$ given the sines and cosines
+// of the two angles.
+static Float SinSubClamped(Float sinTheta_a, Float cosTheta_a,
+                           Float sinTheta_b, Float cosTheta_b) {
+    if (cosTheta_a > cosTheta_b) return 0;
+    return sinTheta_a * cosTheta_b - cosTheta_a * sinTheta_b;
+}
+
+// LightBounds Method Definitions
+Float LightBounds::Importance(const Point3f &p, const Normal3f &n) const {
+    // Compute clamped squared distance to the center of the bounds
+    Point3f pc = Centroid();
+    Float d2 = DistanceSquared(p, pc);
+    d2 = std::max(d2, bounds.Diagonal().Length() / 2);
+    if (d2 == 0) return 0;
+
+    // Compute sine and cosine of the angle between _w_ and the direction
+    // from the bounds to _p_
+    Vector3f wi = Normalize(p - pc);
+    Float cosTheta_w = Dot(w, wi);
+    if (twoSided) cosTheta_w = std::abs(cosTheta_w);
+    Float sinTheta_w = SafeSqrt(1 - cosTheta_w * cosTheta_w);
+
+    // Compute the half-angle of the cone of directions that _bounds_
+    // subtends as seen from _p_
+    Float radius2 = DistanceSquared(pc, bounds.pMax);
+    Float cosTheta_b = DistanceSquared(p, pc) < radius2
+                           ? -1
+                           : SafeSqrt(1 - radius2 / DistanceSquared(p, pc));
+    Float sinTheta_b = SafeSqrt(1 - cosTheta_b * cosTheta_b);
+
+    // Compute the minimum angle between the emission cone and _p_
+    Float sinTheta_o = SafeSqrt(1 - cosTheta_o * cosTheta_o);
+    Float cosTheta_x =
+        CosSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+    Float sinTheta_x =
+        SinSubClamped(sinTheta_w, cosTheta_w, sinTheta_o, cosTheta_o);
+    Float cosThetap =
+        CosSubClamped(sinTheta_x, cosTheta_x, sinTheta_b, cosTheta_b);
+    if (cosThetap <= cosTheta_e) return 0;
+    Float importance = phi * cosThetap / d2;
+
+    // Account for the cosine at the receiving surface, if there is one
+    if (n != Normal3f(0, 0, 0)) {
+        Float cosTheta_i = AbsDot(wi, n);
+        Float sinTheta_i = SafeSqrt(1 - cosTheta_i * cosTheta_i);
+        importance *=
+            CosSubClamped(sinTheta_i, cosTheta_i, sinTheta_b, cosTheta_b);
+    }
+    return std::max(importance, (Float)0);
+}
+
+LightBounds Union(const LightBounds &a, const LightBounds &b) {
+    if (a.phi == 0) return b;
+    if (b.phi == 0) return a;
+
+    // Compute the smallest cone containing both emission cones
+    Vector3f w;
+    Float cosTheta_o;
+    Float theta_a = std::acos(Clamp(a.cosTheta_o, -1, 1));
+    Float theta_b = std::acos(Clamp(b.cosTheta_o, -1, 1));
+    Float theta_d = std::acos(Clamp(Dot(a.w, b.w), -1, 1));
+    if (std::min(theta_d + theta_b, Pi) <= theta_a) {
+        w = a.w;
+        cosTheta_o = a.cosTheta_o;
+    } else if (std::min(theta_d + theta_a, Pi) <= theta_b) {
+        w = b.w;
+        cosTheta_o = b.cosTheta_o;
+    } else {
+        Float theta_o = (theta_a + theta_d + theta_b) / 2;
+        Vector3f wr = Cross(a.w, b.w);
+        if (theta_o >= Pi || wr.LengthSquared() == 0) {
+            w = a.w;
+            cosTheta_o = -1;
+        } else {
+            // Rotate _a.w_ towards _b.w_ to find the new cone's axis
+            w = Rotate(Degrees(theta_o - theta_a), wr)(a.w);
+            cosTheta_o = std::cos(theta_o);
+        }
+    }
+    return LightBounds(Union(a.bounds, b.bounds), w, a.phi + b.phi,
+                       cosTheta_o, std::min(a.cosTheta_e, b.cosTheta_e),
+                       a.twoSided || b.twoSided);
+}
+
 bool VisibilityTester::Unoccluded(const Scene &scene) const {
     return !scene.IntersectP(p0.SpawnRayTo(p1));
 }
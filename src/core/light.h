@@ -58,6 +58,35 @@ inline bool IsDeltaLight(int flags) {
            flags & (int)LightFlags::DeltaDirection;
 }
 
+// LightBounds Declarations
+struct LightBounds {
+    // LightBounds Public Methods
+    LightBounds() {}
+    LightBounds(const Bounds3f &bounds, const Vector3f &w, Float phi,
+                Float cosTheta_o, Float cosTheta_e, bool twoSided)
+        : bounds(bounds),
+          w(Normalize(w)),
+          phi(phi),
+          cosTheta_o(cosTheta_o),
+          cosTheta_e(cosTheta_e),
+          twoSided(twoSided) {}
+    Point3f Centroid() const { return (bounds.pMin + bounds.pMax) / 2; }
+    Float Importance(const Point3f &p, const Normal3f &n) const;
+
+    // LightBounds Public Data
+
+    // Emission is bounded by the cone of directions around _w_ with
+    // half-angle $\theta_o + \theta_e$; _phi_ bounds the emitted
+    // intensity along the cone's axis.
+    Bounds3f bounds;
+    Vector3f w;
+    Float phi = 0;
+    Float cosTheta_o = 1, cosTheta_e = 1;
+    bool twoSided = false;
+};
+
+LightBounds Union(const LightBounds &a, const LightBounds &b);
+
 // Light Declarations
 class Light {
   public:
@@ -78,6 +107,11 @@ class Light {
     virtual void Pdf_Le(const Ray &ray, const Normal3f &nLight, Float *pdfPos,
                         Float *pdfDir) const = 0;
 
+    // Lights that can bound their spatial and directional emission return
+    // true and initialize |*lb|; light sampling schemes that use these
+    // bounds treat the others like infinite lights.
+    virtual bool Bounds(LightBounds *lb) const { return false; }
+
     // Light Public Data
     const int flags;
     const int nSamples;
@@ -39,29 +39,55 @@
 #include "scene.h"
 #include "stats.h"
 #include "integrator.h"
+#include <algorithm>
 #include <numeric>
 
 namespace pbrt {
 
 LightDistribution::~LightDistribution() {}
 
+int LightDistribution::Sample(const Point3f &p, const Normal3f &n, Float u,
+                              Float *pmf) const {
+    int lightIndex = Lookup(p)->SampleDiscrete(u, pmf);
+    return *pmf > 0 ? lightIndex : -1;
+}
+
+Float LightDistribution::Pmf(const Point3f &p, const Normal3f &n,
+                             int lightIndex) const {
+    return Lookup(p)->DiscretePDF(lightIndex);
+}
+
 std::unique_ptr<LightDistribution> CreateLightSampleDistribution(
-    const std::string &name, const Scene &scene) {
+    const std::string &name, const Scene &scene, int maxSparseLights,
+    size_t maxBytes) {
+    if (maxSparseLights < 1 ||
+        maxSparseLights > SpatialLightDistribution::MaxSparseLights) {
+        Warning("\"sparselights\" must be between 1 and %d. Clamping %d.",
+                SpatialLightDistribution::MaxSparseLights, maxSparseLights);
+        maxSparseLights = Clamp(maxSparseLights, 1,
+                                SpatialLightDistribution::MaxSparseLights);
+    }
     if (name == "uniform" || scene.lights.size() == 1)
         return std::unique_ptr<LightDistribution>{
             new UniformLightDistribution(scene)};
     else if (name == "power")
         return std::unique_ptr<LightDistribution>{
             new PowerLightDistribution(scene)};
+    else if (name == "poweralias")
+        return std::unique_ptr<LightDistribution>{
+            new PowerLightDistribution(scene, true)};
     else if (name == "spatial")
+        return std::unique_ptr<LightDistribution>{new SpatialLightDistribution(
+            scene, 64, maxSparseLights, maxBytes)};
+    else if (name == "bvh")
         return std::unique_ptr<LightDistribution>{
-            new SpatialLightDistribution(scene)};
+            new BVHLightDistribution(scene)};
     else {
         Error(
             "Light sample distribution type \"%s\" unknown. Using \"spatial\".",
             name.c_str());
-        return std::unique_ptr<LightDistribution>{
-            new SpatialLightDistribution(scene)};
+        return std::unique_ptr<LightDistribution>{new SpatialLightDistribution(
+            scene, 64, maxSparseLights, maxBytes)};
     }
 }
 
@@ -74,28 +100,90 @@ const Distribution1D *UniformLightDistribution::Lookup(const Point3f &p) const {
     return distrib.get();
 }
 
-PowerLightDistribution::PowerLightDistribution(const Scene &scene)
-    : distrib(ComputeLightPowerDistribution(scene)) {}
+PowerLightDistribution::PowerLightDistribution(const Scene &scene,
+                                               bool useAliasTable)
+    : distrib(ComputeLightPowerDistribution(scene)) {
+    if (useAliasTable && distrib)
+        alias.reset(
+            new AliasDistribution1D(&distrib->func[0], distrib->Count()));
+}
 
 const Distribution1D *PowerLightDistribution::Lookup(const Point3f &p) const {
     return distrib.get();
 }
 
+int PowerLightDistribution::Sample(const Point3f &p, const Normal3f &n,
+                                   Float u, Float *pmf) const {
+    if (!alias) return LightDistribution::Sample(p, n, u, pmf);
+    int lightIndex = alias->SampleDiscrete(u, pmf);
+    return *pmf > 0 ? lightIndex : -1;
+}
+
+Float PowerLightDistribution::Pmf(const Point3f &p, const Normal3f &n,
+                                  int lightIndex) const {
+    if (!alias) return LightDistribution::Pmf(p, n, lightIndex);
+    return alias->DiscretePDF(lightIndex);
+}
+
 ///////////////////////////////////////////////////////////////////////////
 // SpatialLightDistribution
 
 STAT_COUNTER("SpatialLightDistribution/Distributions created", nCreated);
 STAT_RATIO("SpatialLightDistribution/Lookups per distribution", nLookups, nDistributions);
 STAT_INT_DISTRIBUTION("SpatialLightDistribution/Hash probes per lookup", nProbesPerLookup);
+STAT_PERCENT("SpatialLightDistribution/Sparse cache hits", nSparseHits,
+             nSparseLookups);
+STAT_COUNTER("SpatialLightDistribution/Sparse cache evictions",
+             nSparseEvictions);
+STAT_PERCENT("SpatialLightDistribution/Sparse cache occupancy",
+             nSparseOccupied, nSparseEntries);
+STAT_PERCENT("SpatialLightDistribution/Voxels with sparse distributions",
+             nSparseVoxels, nVoxelsSampled);
+STAT_MEMORY_COUNTER("Memory/Light distributions", lightDistribBytes);
+
+PBRT_CONSTEXPR int SpatialLightDistribution::MaxSparseLights;
+PBRT_CONSTEXPR int SpatialLightDistribution::SparseCacheWays;
 
 // Voxel coordinates are packed into a uint64_t for hash table lookups;
 // 10 bits are allocated to each coordinate.  invalidPackedPos is an impossible
 // packed coordinate value, which we use to represent
 static const uint64_t invalidPackedPos = 0xffffffffffffffff;
 
+// Compute a hash value from the packed voxel coordinates.  We could
+// just take packedPos mod the hash table size, but since packedPos
+// isn't necessarily well distributed on its own, it's worthwhile to do
+// a little work to make sure that its bits values are individually
+// fairly random. For details of and motivation for the following, see:
+// http://zimbry.blogspot.ch/2011/09/better-bit-mixing-improving-on.html
+static uint64_t MixBits(uint64_t hash) {
+    hash ^= (hash >> 31);
+    hash *= 0x7fb5d329728ea185;
+    hash ^= (hash >> 27);
+    hash *= 0x81dadef4bc2dd44d;
+    hash ^= (hash >> 33);
+    return hash;
+}
+
+// Hash table entries of voxels that use sparse distributions point to this
+// placeholder rather than to a distribution of their own.
+static Distribution1D *SparsePlaceholder() {
+    static Distribution1D placeholder(nullptr, 0);
+    return &placeholder;
+}
+
 SpatialLightDistribution::SpatialLightDistribution(const Scene &scene,
-                                                   int maxVoxels)
-    : scene(scene) {
+                                                   int maxVoxels,
+                                                   int maxSparseLights,
+                                                   size_t maxBytes)
+    : scene(scene),
+      distributionBytes(sizeof(Distribution1D) +
+                        (2 * scene.lights.size() + 1) * sizeof(Float)),
+      maxDistributionBytes(maxBytes - maxBytes / 4),
+      totalDistributionBytes(0),
+      powerDistrib(ComputeLightPowerDistribution(scene)),
+      maxSparseBytes(maxBytes / 4),
+      nSparseSets(0),
+      sparseClock(0) {
     // Compute the number of voxels so that the widest scene bounding box
     // dimension has maxVoxels voxels and the other dimensions have a number
     // of voxels so that voxels are roughly cube shaped.
@@ -116,10 +204,40 @@ SpatialLightDistribution::SpatialLightDistribution(const Scene &scene,
         hashTable[i].packedPos.store(invalidPackedPos);
         hashTable[i].distribution.store(nullptr);
     }
+    lightDistribBytes += hashTableSize * sizeof(HashEntry) + distributionBytes;
+
+    CHECK_LE(maxSparseLights, MaxSparseLights);
+    nSparseLights = std::min<int>(maxSparseLights, scene.lights.size());
 
     LOG(INFO) << "SpatialLightDistribution: scene bounds " << b <<
         ", voxel res (" << nVoxels[0] << ", " << nVoxels[1] << ", " <<
-        nVoxels[2] << ")";
+        nVoxels[2] << "), " << maxDistributionBytes / distributionBytes <<
+        " full distributions";
+}
+
+void SpatialLightDistribution::AllocateSparseCache() const {
+    // Allocate as many sparse distribution cache sets as fit in
+    // maxSparseBytes, but no more than are needed to hold every voxel.
+    size_t entryBytes = sizeof(SparseEntry) +
+                        nSparseLights * sizeof(std::atomic<int>) +
+                        (nSparseLights + 1) * sizeof(std::atomic<Float>);
+    size_t nVoxelSets = (size_t(nVoxels[0]) * nVoxels[1] * nVoxels[2] +
+                         SparseCacheWays - 1) / SparseCacheWays;
+    nSparseSets = std::max<size_t>(
+        1, std::min(maxSparseBytes / (SparseCacheWays * entryBytes),
+                    2 * nVoxelSets));
+    size_t nEntries = nSparseSets * SparseCacheWays;
+    sparseEntries.reset(new SparseEntry[nEntries]);
+    for (size_t i = 0; i < nEntries; ++i) {
+        sparseEntries[i].packedPos.store(invalidPackedPos);
+        sparseEntries[i].version.store(0);
+        sparseEntries[i].lastUse.store(0);
+    }
+    sparseLights.reset(new std::atomic<int>[nEntries * nSparseLights]);
+    sparseCDFs.reset(new std::atomic<Float>[nEntries * (nSparseLights + 1)]);
+    lightDistribBytes += nEntries * entryBytes;
+    LOG(INFO) << "SpatialLightDistribution: " << nEntries <<
+        " sparse cache entries of " << nSparseLights << " lights";
 }
 
 SpatialLightDistribution::~SpatialLightDistribution() {
@@ -127,42 +245,52 @@ SpatialLightDistribution::~SpatialLightDistribution() {
     // the buckets.
     for (size_t i = 0; i < hashTableSize; ++i) {
         HashEntry &entry = hashTable[i];
-        if (entry.distribution.load())
-            delete entry.distribution.load();
+        Distribution1D *dist = entry.distribution.load();
+        if (!dist) continue;
+        ++nVoxelsSampled;
+        if (dist == SparsePlaceholder())
+            ++nSparseVoxels;
+        else
+            delete dist;
+    }
+    for (size_t i = 0; i < nSparseSets * SparseCacheWays; ++i) {
+        ++nSparseEntries;
+        if (sparseEntries[i].packedPos.load() != invalidPackedPos)
+            ++nSparseOccupied;
     }
 }
 
-const Distribution1D *SpatialLightDistribution::Lookup(const Point3f &p) const {
-    ProfilePhase _(Prof::LightDistribLookup);
-    ++nLookups;
-
+uint64_t SpatialLightDistribution::PackedVoxel(const Point3f &p,
+                                               Point3i *pi) const {
     // First, compute integer voxel coordinates for the given point |p|
     // with respect to the overall voxel grid.
     Vector3f offset = scene.WorldBound().Offset(p);  // offset in [0,1].
-    Point3i pi;
     for (int i = 0; i < 3; ++i)
         // The clamp should almost never be necessary, but is there to be
         // robust to computed intersection points being slightly outside
         // the scene bounds due to floating-point roundoff error.
-        pi[i] = Clamp(int(offset[i] * nVoxels[i]), 0, nVoxels[i] - 1);
+        (*pi)[i] = Clamp(int(offset[i] * nVoxels[i]), 0, nVoxels[i] - 1);
 
     // Pack the 3D integer voxel coordinates into a single 64-bit value.
-    uint64_t packedPos = (uint64_t(pi[0]) << 40) | (uint64_t(pi[1]) << 20) | pi[2];
+    uint64_t packedPos = (uint64_t((*pi)[0]) << 40) |
+                         (uint64_t((*pi)[1]) << 20) | (*pi)[2];
     CHECK_NE(packedPos, invalidPackedPos);
+    return packedPos;
+}
 
-    // Compute a hash value from the packed voxel coordinates.  We could
-    // just take packedPos mod the hash table size, but since packedPos
-    // isn't necessarily well distributed on its own, it's worthwhile to do
-    // a little work to make sure that its bits values are individually
-    // fairly random. For details of and motivation for the following, see:
-    // http://zimbry.blogspot.ch/2011/09/better-bit-mixing-improving-on.html
-    uint64_t hash = packedPos;
-    hash ^= (hash >> 31);
-    hash *= 0x7fb5d329728ea185;
-    hash ^= (hash >> 27);
-    hash *= 0x81dadef4bc2dd44d;
-    hash ^= (hash >> 33);
-    hash %= hashTableSize;
+const Distribution1D *SpatialLightDistribution::Lookup(const Point3f &p) const {
+    const Distribution1D *distrib = LookupDistribution(p);
+    return distrib ? distrib : powerDistrib.get();
+}
+
+const Distribution1D *SpatialLightDistribution::LookupDistribution(
+    const Point3f &p) const {
+    ProfilePhase _(Prof::LightDistribLookup);
+    ++nLookups;
+
+    Point3i pi;
+    uint64_t packedPos = PackedVoxel(p, &pi);
+    uint64_t hash = MixBits(packedPos) % hashTableSize;
     CHECK_GE(hash, 0);
 
     // Now, see if the hash table already has an entry for the voxel. We'll
@@ -197,7 +325,7 @@ const Distribution1D *SpatialLightDistribution::Lookup(const Point3f &p) const {
             }
             // We have a valid sampling distribution.
             ReportValue(nProbesPerLookup, nProbes);
-            return dist;
+            return dist == SparsePlaceholder() ? nullptr : dist;
         } else if (entryPackedPos != invalidPackedPos) {
             // The hash table entry we're checking has already been
             // allocated for another voxel. Advance to the next entry with
@@ -220,20 +348,27 @@ const Distribution1D *SpatialLightDistribution::Lookup(const Point3f &p) const {
                 // other threads looking up the distribution for this voxel
                 // will spin wait until the distribution pointer is
                 // written.
-                Distribution1D *dist = ComputeDistribution(pi);
+                // Voxels that would exceed the memory budget for full
+                // distributions use sparse ones instead.
+                Distribution1D *dist;
+                if (totalDistributionBytes.fetch_add(distributionBytes) +
+                        distributionBytes > maxDistributionBytes) {
+                    totalDistributionBytes -= distributionBytes;
+                    dist = SparsePlaceholder();
+                } else
+                    dist = ComputeDistribution(pi);
                 entry.distribution.store(dist, std::memory_order_release);
                 ReportValue(nProbesPerLookup, nProbes);
-                return dist;
+                return dist == SparsePlaceholder() ? nullptr : dist;
             }
         }
     }
 }
 
-Distribution1D *
-SpatialLightDistribution::ComputeDistribution(Point3i pi) const {
+std::vector<Float> SpatialLightDistribution::ComputeContributions(
+    Point3i pi) const {
     ProfilePhase _(Prof::LightDistribCreation);
     ++nCreated;
-    ++nDistributions;
 
     // Compute the world-space bounding box of the voxel corresponding to
     // |pi|.
@@ -294,9 +429,432 @@ SpatialLightDistribution::ComputeDistribution(Point3i pi) const {
     }
     LOG(INFO) << "Initialized light distribution in voxel pi= " <<  pi <<
         ", avgContrib = " << avgContrib;
+    return lightContrib;
+}
 
+Distribution1D *
+SpatialLightDistribution::ComputeDistribution(Point3i pi) const {
+    ++nDistributions;
     // Compute a sampling distribution from the accumulated contributions.
+    std::vector<Float> lightContrib = ComputeContributions(pi);
+    lightDistribBytes += (2 * lightContrib.size() + 1) * sizeof(Float);
     return new Distribution1D(&lightContrib[0], int(lightContrib.size()));
 }
 
+void SpatialLightDistribution::ComputeSparseDistribution(
+    Point3i pi, SparseDistribution *sd) const {
+    std::vector<Float> lightContrib = ComputeContributions(pi);
+
+    // Find the _nSparseLights_ lights with the largest contributions and
+    // store them in order of their indices
+    std::vector<int> order(lightContrib.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::nth_element(order.begin(), order.begin() + nSparseLights, order.end(),
+                     [&](int a, int b) {
+                         return lightContrib[a] > lightContrib[b];
+                     });
+    std::sort(order.begin(), order.begin() + nSparseLights);
+
+    // Compute the CDF over the stored lights and the remaining ones
+    Float sum = 0;
+    for (int i = 0; i < nSparseLights; ++i) {
+        sd->lights[i] = order[i];
+        sum += lightContrib[order[i]];
+        sd->cdf[i] = sum;
+    }
+    for (size_t i = nSparseLights; i < order.size(); ++i)
+        sum += lightContrib[order[i]];
+    sd->cdf[nSparseLights] = sum;
+    for (int i = 0; i <= nSparseLights; ++i) sd->cdf[i] /= sum;
+    sd->cdf[nSparseLights] = 1;
+}
+
+void SpatialLightDistribution::LookupSparse(const Point3f &p,
+                                            SparseDistribution *sd) const {
+    std::call_once(sparseCacheAllocated, [&]() { AllocateSparseCache(); });
+    ++nSparseLookups;
+    Point3i pi;
+    uint64_t packedPos = PackedVoxel(p, &pi);
+    size_t set = MixBits(packedPos) % nSparseSets;
+    uint32_t now = sparseClock.load(std::memory_order_relaxed);
+
+    // Look for the voxel in its cache set, copying out the distribution of
+    // a matching entry that isn't modified while it's being read.
+    for (int way = 0; way < SparseCacheWays; ++way) {
+        size_t index = set * SparseCacheWays + way;
+        SparseEntry &entry = sparseEntries[index];
+        uint32_t version = entry.version.load(std::memory_order_acquire);
+        if ((version & 1) ||
+            entry.packedPos.load(std::memory_order_relaxed) != packedPos)
+            continue;
+        for (int i = 0; i < nSparseLights; ++i)
+            sd->lights[i] = sparseLights[index * nSparseLights + i].load(
+                std::memory_order_relaxed);
+        for (int i = 0; i <= nSparseLights; ++i)
+            sd->cdf[i] = sparseCDFs[index * (nSparseLights + 1) + i].load(
+                std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (entry.version.load(std::memory_order_relaxed) != version) continue;
+
+        ++nSparseHits;
+        if (entry.lastUse.load(std::memory_order_relaxed) != now)
+            entry.lastUse.store(now, std::memory_order_relaxed);
+        return;
+    }
+
+    // Compute the distribution and store it in the set's empty or least
+    // recently used entry.  If another thread is updating that entry, the
+    // distribution just isn't cached.
+    ComputeSparseDistribution(pi, sd);
+    now = sparseClock.fetch_add(1, std::memory_order_relaxed) + 1;
+    size_t index = set * SparseCacheWays;
+    uint32_t maxAge = 0;
+    for (int way = 0; way < SparseCacheWays; ++way) {
+        size_t i = set * SparseCacheWays + way;
+        if (sparseEntries[i].packedPos.load(std::memory_order_relaxed) ==
+            invalidPackedPos) {
+            index = i;
+            break;
+        }
+        uint32_t age =
+            now - sparseEntries[i].lastUse.load(std::memory_order_relaxed);
+        if (age >= maxAge) {
+            maxAge = age;
+            index = i;
+        }
+    }
+    SparseEntry &entry = sparseEntries[index];
+    uint32_t version = entry.version.load(std::memory_order_relaxed);
+    if ((version & 1) ||
+        !entry.version.compare_exchange_strong(version, version + 1,
+                                               std::memory_order_acquire))
+        return;
+    if (entry.packedPos.load(std::memory_order_relaxed) != invalidPackedPos)
+        ++nSparseEvictions;
+    entry.packedPos.store(packedPos, std::memory_order_relaxed);
+    entry.lastUse.store(now, std::memory_order_relaxed);
+    for (int i = 0; i < nSparseLights; ++i)
+        sparseLights[index * nSparseLights + i].store(
+            sd->lights[i], std::memory_order_relaxed);
+    for (int i = 0; i <= nSparseLights; ++i)
+        sparseCDFs[index * (nSparseLights + 1) + i].store(
+            sd->cdf[i], std::memory_order_relaxed);
+    entry.version.store(version + 2, std::memory_order_release);
+}
+
+int SpatialLightDistribution::Sample(const Point3f &p, const Normal3f &n,
+                                     Float u, Float *pmf) const {
+    ProfilePhase _(Prof::LightDistribLookup);
+    if (const Distribution1D *distrib = LookupDistribution(p)) {
+        int lightIndex = distrib->SampleDiscrete(u, pmf);
+        return *pmf > 0 ? lightIndex : -1;
+    }
+    SparseDistribution sd;
+    LookupSparse(p, &sd);
+
+    // Find the CDF bucket that _u_ falls in
+    int bucket = std::min<int>(
+        std::upper_bound(sd.cdf, sd.cdf + nSparseLights + 1, u) - sd.cdf,
+        nSparseLights);
+    Float cdfStart = bucket > 0 ? sd.cdf[bucket - 1] : 0;
+    Float bucketPmf = sd.cdf[bucket] - cdfStart;
+    if (bucketPmf == 0) {
+        *pmf = 0;
+        return -1;
+    }
+    if (bucket < nSparseLights) {
+        *pmf = bucketPmf;
+        return sd.lights[bucket];
+    }
+
+    // Sample one of the lights that aren't stored uniformly, skipping over
+    // the stored ones
+    int nRemaining = int(scene.lights.size()) - nSparseLights;
+    Float ur = std::min((u - cdfStart) / bucketPmf, OneMinusEpsilon);
+    int lightIndex = std::min(int(ur * nRemaining), nRemaining - 1);
+    for (int i = 0; i < nSparseLights && sd.lights[i] <= lightIndex; ++i)
+        ++lightIndex;
+    *pmf = bucketPmf / nRemaining;
+    return lightIndex;
+}
+
+Float SpatialLightDistribution::Pmf(const Point3f &p, const Normal3f &n,
+                                    int lightIndex) const {
+    if (const Distribution1D *distrib = LookupDistribution(p))
+        return distrib->DiscretePDF(lightIndex);
+    SparseDistribution sd;
+    LookupSparse(p, &sd);
+    const int *stored =
+        std::lower_bound(sd.lights, sd.lights + nSparseLights, lightIndex);
+    if (stored != sd.lights + nSparseLights && *stored == lightIndex) {
+        int bucket = stored - sd.lights;
+        return sd.cdf[bucket] - (bucket > 0 ? sd.cdf[bucket - 1] : 0);
+    }
+    int nRemaining = int(scene.lights.size()) - nSparseLights;
+    if (nRemaining == 0) return 0;
+    return (sd.cdf[nSparseLights] - sd.cdf[nSparseLights - 1]) / nRemaining;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// BVHLightDistribution
+
+STAT_COUNTER("BVHLightDistribution/Nodes", nBVHNodes);
+STAT_COUNTER("BVHLightDistribution/Unbounded lights", nUnboundedLights);
+STAT_MEMORY_COUNTER("Memory/Light BVH", lightBVHBytes);
+STAT_PERCENT("BVHLightDistribution/Samples with no contributing light",
+             nNoLightSamples, nBVHSamples);
+
+// Light bit trails are set to these values for lights that aren't in the
+// BVH; they can't occur for lights in the tree, whose depth is limited to
+// 62 levels.
+static const uint64_t unboundedBitTrail = 0xffffffffffffffff;
+static const uint64_t zeroPowerBitTrail = 0xfffffffffffffffe;
+
+// Returns the surface area orientation heuristic cost of a node with the
+// given bounds, following Conty Estevez and Kulla's "Importance Sampling
+// of Many Lights with Adaptive Tree Splitting".
+static Float LightBoundsCost(const LightBounds &b, const Bounds3f &bounds,
+                             int dim) {
+    Float theta_o = std::acos(Clamp(b.cosTheta_o, -1, 1));
+    Float theta_e = std::acos(Clamp(b.cosTheta_e, -1, 1));
+    Float theta_w = std::min(theta_o + theta_e, Pi);
+    Float sinTheta_o =
+        std::sqrt(std::max((Float)0, 1 - b.cosTheta_o * b.cosTheta_o));
+    Float M_omega = 2 * Pi * (1 - b.cosTheta_o) +
+                    Pi / 2 * (2 * theta_w * sinTheta_o -
+                              std::cos(theta_o - 2 * theta_w) -
+                              2 * theta_o * sinTheta_o + b.cosTheta_o);
+    // Penalize thin boxes that are split along their short dimensions
+    Vector3f d = bounds.Diagonal();
+    Float Kr = d[dim] > 0 ? d[bounds.MaximumExtent()] / d[dim] : 1;
+    return b.phi * M_omega * Kr * b.bounds.SurfaceArea();
+}
+
+BVHLightDistribution::BVHLightDistribution(const Scene &scene, int maxVoxels)
+    : scene(scene), lightBitTrails(scene.lights.size(), zeroPowerBitTrail) {
+    // Partition the lights into those that can be stored in the BVH and
+    // those that can't
+    std::vector<std::pair<int, LightBounds>> bvhLights;
+    for (size_t i = 0; i < scene.lights.size(); ++i) {
+        LightBounds lb;
+        if (!scene.lights[i]->Bounds(&lb)) {
+            unboundedLights.push_back(i);
+            lightBitTrails[i] = unboundedBitTrail;
+            ++nUnboundedLights;
+        } else if (lb.phi > 0)
+            bvhLights.push_back(std::make_pair(int(i), lb));
+    }
+    if (!bvhLights.empty()) BuildBVH(bvhLights, 0, bvhLights.size(), 0, 0);
+    nBVHNodes += nodes.size();
+    lightBVHBytes += nodes.size() * sizeof(LightBVHNode) +
+                     lightBitTrails.size() * sizeof(uint64_t);
+
+    // Initialize the voxel grid used for Lookup()
+    Vector3f diag = scene.WorldBound().Diagonal();
+    Float bmax = diag[scene.WorldBound().MaximumExtent()];
+    for (int i = 0; i < 3; ++i)
+        nVoxels[i] = std::max(1, int(std::round(diag[i] / bmax * maxVoxels)));
+    threadDistributions.resize(MaxThreadIndex(),
+                               std::make_pair(invalidPackedPos, nullptr));
+
+    LOG(INFO) << "BVHLightDistribution: " << bvhLights.size() <<
+        " lights in BVH with " << nodes.size() << " nodes, " <<
+        unboundedLights.size() << " unbounded lights";
+}
+
+int BVHLightDistribution::BuildBVH(
+    std::vector<std::pair<int, LightBounds>> &bvhLights, int start, int end,
+    uint64_t bitTrail, int depth) {
+    CHECK_LT(start, end);
+    CHECK_LT(depth, 63);
+    // Initialize a leaf node if only a single light remains
+    if (end - start == 1) {
+        int nodeIndex = nodes.size();
+        int lightIndex = bvhLights[start].first;
+        nodes.push_back({bvhLights[start].second, lightIndex, true});
+        lightBitTrails[lightIndex] = bitTrail;
+        return nodeIndex;
+    }
+
+    // Compute the bounds of the lights and of their centroids
+    Bounds3f bounds, centroidBounds;
+    for (int i = start; i < end; ++i) {
+        const LightBounds &lb = bvhLights[i].second;
+        bounds = Union(bounds, lb.bounds);
+        centroidBounds = Union(centroidBounds, lb.Centroid());
+    }
+
+    // Find the lowest-cost split over 12 buckets along each dimension
+    Float minCost = Infinity;
+    int minCostSplitBucket = -1, minCostSplitDim = -1;
+    PBRT_CONSTEXPR int nBuckets = 12;
+    for (int dim = 0; dim < 3; ++dim) {
+        if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim]) continue;
+        LightBounds bucketLightBounds[nBuckets];
+        for (int i = start; i < end; ++i) {
+            const LightBounds &lb = bvhLights[i].second;
+            int b = nBuckets * centroidBounds.Offset(lb.Centroid())[dim];
+            b = Clamp(b, 0, nBuckets - 1);
+            bucketLightBounds[b] = Union(bucketLightBounds[b], lb);
+        }
+
+        for (int i = 0; i < nBuckets - 1; ++i) {
+            LightBounds b0, b1;
+            for (int j = 0; j <= i; ++j)
+                b0 = Union(b0, bucketLightBounds[j]);
+            for (int j = i + 1; j < nBuckets; ++j)
+                b1 = Union(b1, bucketLightBounds[j]);
+            Float cost = LightBoundsCost(b0, bounds, dim) +
+                         LightBoundsCost(b1, bounds, dim);
+            if (cost > 0 && cost < minCost) {
+                minCost = cost;
+                minCostSplitBucket = i;
+                minCostSplitDim = dim;
+            }
+        }
+    }
+
+    // Partition the lights according to the chosen split
+    int mid;
+    if (minCostSplitDim == -1)
+        mid = (start + end) / 2;
+    else {
+        auto pmid = std::partition(
+            &bvhLights[start], &bvhLights[end - 1] + 1,
+            [=](const std::pair<int, LightBounds> &l) {
+                Point3f pc = l.second.Centroid();
+                int b = nBuckets * centroidBounds.Offset(pc)[minCostSplitDim];
+                return Clamp(b, 0, nBuckets - 1) <= minCostSplitBucket;
+            });
+        mid = pmid - &bvhLights[0];
+        if (mid == start || mid == end) mid = (start + end) / 2;
+    }
+
+    // Build the children; the first child immediately follows its parent
+    int nodeIndex = nodes.size();
+    nodes.push_back(LightBVHNode());
+    BuildBVH(bvhLights, start, mid, bitTrail, depth + 1);
+    int secondChild = BuildBVH(bvhLights, mid, end,
+                               bitTrail | (uint64_t(1) << depth), depth + 1);
+    LightBounds lb = Union(nodes[nodeIndex + 1].lightBounds,
+                           nodes[secondChild].lightBounds);
+    nodes[nodeIndex] = {lb, secondChild, false};
+    return nodeIndex;
+}
+
+int BVHLightDistribution::Sample(const Point3f &p, const Normal3f &n, Float u,
+                                 Float *pmf) const {
+    ProfilePhase _(Prof::LightDistribLookup);
+    ++nBVHSamples;
+    // Choose between the unbounded lights and the BVH
+    Float pUnbounded = Float(unboundedLights.size()) /
+                       Float(unboundedLights.size() + (nodes.empty() ? 0 : 1));
+    if (u < pUnbounded) {
+        int index = std::min(int(u / pUnbounded * unboundedLights.size()),
+                             int(unboundedLights.size()) - 1);
+        *pmf = pUnbounded / unboundedLights.size();
+        return unboundedLights[index];
+    }
+    if (nodes.empty()) {
+        ++nNoLightSamples;
+        return -1;
+    }
+    u = std::min((u - pUnbounded) / (1 - pUnbounded), OneMinusEpsilon);
+
+    // Traverse the BVH, choosing children according to their importance
+    int nodeIndex = 0;
+    *pmf = 1 - pUnbounded;
+    while (true) {
+        const LightBVHNode &node = nodes[nodeIndex];
+        if (node.isLeaf) {
+            if (nodeIndex > 0 || node.lightBounds.Importance(p, n) > 0)
+                return node.childOrLightIndex;
+            break;
+        }
+        Float ci[2] = {
+            nodes[nodeIndex + 1].lightBounds.Importance(p, n),
+            nodes[node.childOrLightIndex].lightBounds.Importance(p, n)};
+        if (ci[0] == 0 && ci[1] == 0) break;
+        Float p0 = ci[0] / (ci[0] + ci[1]);
+        if (u < p0) {
+            nodeIndex = nodeIndex + 1;
+            u = std::min(u / p0, OneMinusEpsilon);
+            *pmf *= p0;
+        } else {
+            nodeIndex = node.childOrLightIndex;
+            u = std::min((u - p0) / (1 - p0), OneMinusEpsilon);
+            *pmf *= 1 - p0;
+        }
+    }
+    ++nNoLightSamples;
+    *pmf = 0;
+    return -1;
+}
+
+Float BVHLightDistribution::Pmf(const Point3f &p, const Normal3f &n,
+                                int lightIndex) const {
+    uint64_t bitTrail = lightBitTrails[lightIndex];
+    Float pUnbounded = Float(unboundedLights.size()) /
+                       Float(unboundedLights.size() + (nodes.empty() ? 0 : 1));
+    if (bitTrail == unboundedBitTrail)
+        return pUnbounded / unboundedLights.size();
+    if (bitTrail == zeroPowerBitTrail) return 0;
+
+    // Follow the light's bit trail down the BVH to compute its probability
+    int nodeIndex = 0;
+    Float pmf = 1 - pUnbounded;
+    while (true) {
+        const LightBVHNode &node = nodes[nodeIndex];
+        if (node.isLeaf) {
+            DCHECK_EQ(lightIndex, node.childOrLightIndex);
+            if (nodeIndex == 0 && node.lightBounds.Importance(p, n) == 0)
+                return 0;
+            return pmf;
+        }
+        Float ci[2] = {
+            nodes[nodeIndex + 1].lightBounds.Importance(p, n),
+            nodes[node.childOrLightIndex].lightBounds.Importance(p, n)};
+        if (ci[bitTrail & 1] == 0) return 0;
+        pmf *= ci[bitTrail & 1] / (ci[0] + ci[1]);
+        nodeIndex = (bitTrail & 1) ? node.childOrLightIndex : nodeIndex + 1;
+        bitTrail >>= 1;
+    }
+}
+
+const Distribution1D *BVHLightDistribution::Lookup(const Point3f &p) const {
+    ProfilePhase _(Prof::LightDistribLookup);
+    // Compute the packed coordinates of the voxel containing |p|
+    Vector3f offset = scene.WorldBound().Offset(p);
+    Point3i pi;
+    for (int i = 0; i < 3; ++i)
+        pi[i] = Clamp(int(offset[i] * nVoxels[i]), 0, nVoxels[i] - 1);
+    uint64_t packedPos =
+        (uint64_t(pi[0]) << 40) | (uint64_t(pi[1]) << 20) | pi[2];
+
+    // Return this thread's most recent distribution if it's for the voxel
+    std::pair<uint64_t, const Distribution1D *> &cached =
+        threadDistributions[ThreadIndex];
+    if (cached.first == packedPos) return cached.second;
+
+    std::lock_guard<std::mutex> lock(distributionsMutex);
+    std::unique_ptr<Distribution1D> &distrib = distributions[packedPos];
+    if (!distrib) {
+        // Compute the light probabilities at the center of the voxel,
+        // ensuring that all lights have a nonzero probability as in
+        // SpatialLightDistribution::ComputeDistribution().
+        ProfilePhase _(Prof::LightDistribCreation);
+        Point3f pc = scene.WorldBound().Lerp(
+            Point3f((pi[0] + .5f) / nVoxels[0], (pi[1] + .5f) / nVoxels[1],
+                    (pi[2] + .5f) / nVoxels[2]));
+        std::vector<Float> lightPmf(scene.lights.size());
+        for (size_t i = 0; i < scene.lights.size(); ++i)
+            lightPmf[i] = Pmf(pc, Normal3f(), i);
+        Float minPmf = .001f / lightPmf.size();
+        for (Float &pmf : lightPmf) pmf = std::max(pmf, minPmf);
+        distrib.reset(new Distribution1D(&lightPmf[0], int(lightPmf.size())));
+    }
+    cached = std::make_pair(packedPos, distrib.get());
+    return distrib.get();
+}
+
 }  // namespace pbrt
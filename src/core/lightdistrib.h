@@ -35,6 +35,7 @@
 
 #include "pbrt.h"
 #include "geometry.h"
+#include "light.h"
 #include "sampling.h"
 #include <atomic>
 #include <functional>
@@ -54,10 +55,27 @@ class LightDistribution {
     // Given a point |p| in space, this method returns a (hopefully
     // effective) sampling distribution for light sources at that point.
     virtual const Distribution1D *Lookup(const Point3f &p) const = 0;
+
+    // Chooses a light source to sample for illumination at |p|, where |n|
+    // is the surface normal at |p| (or zero for points in participating
+    // media). Returns the light's index in Scene::lights and its sampling
+    // probability in |*pmf|, or -1 if no light can contribute. The
+    // default implementation samples the distribution from Lookup().
+    virtual int Sample(const Point3f &p, const Normal3f &n, Float u,
+                       Float *pmf) const;
+
+    // Returns the probability that Sample() chooses the light with index
+    // |lightIndex| at |p|.
+    virtual Float Pmf(const Point3f &p, const Normal3f &n,
+                      int lightIndex) const;
 };
 
+// |maxSparseLights| and |maxBytes| configure SpatialLightDistribution;
+// they come from the "sparselights" and "lightcachemaxmb" parameters of
+// the integrators that use it.
 std::unique_ptr<LightDistribution> CreateLightSampleDistribution(
-    const std::string &name, const Scene &scene);
+    const std::string &name, const Scene &scene, int maxSparseLights = 64,
+    size_t maxBytes = 64 * 1024 * 1024);
 
 // The simplest possible implementation of LightDistribution: this returns
 // a uniform distribution over all light sources, ignoring the provided
@@ -83,30 +101,74 @@ class UniformLightDistribution : public LightDistribution {
 // and if different lights are relatively important in some areas of the
 // scene and unimportant in others. (This was the default sampling method
 // used for the BDPT integrator and MLT integrator in the printed book,
-// though also without the PowerLightDistribution class.)
+// though also without the PowerLightDistribution class.)  If
+// |useAliasTable| is set, Sample() uses an alias table rather than a
+// binary search over the CDF, so that a light is chosen in O(1) time.
+// Lookup() always returns the CDF-based distribution.
 class PowerLightDistribution : public LightDistribution {
   public:
-    PowerLightDistribution(const Scene &scene);
+    PowerLightDistribution(const Scene &scene, bool useAliasTable = false);
     const Distribution1D *Lookup(const Point3f &p) const;
+    int Sample(const Point3f &p, const Normal3f &n, Float u, Float *pmf) const;
+    Float Pmf(const Point3f &p, const Normal3f &n, int lightIndex) const;
 
   private:
     std::unique_ptr<Distribution1D> distrib;
+    std::unique_ptr<AliasDistribution1D> alias;
 };
 
 // A spatially-varying light distribution that adjusts the probability of
 // sampling a light source based on an estimate of its contribution to a
 // region of space.  A fixed voxel grid is imposed over the scene bounds
 // and a sampling distribution is computed as needed for each voxel.
+//
+// Full distributions over all lights are computed for as many voxels as
+// fit in three quarters of |maxBytes|.  Under memory pressure, once those
+// are used up, Sample() and Pmf() give further voxels compact
+// distributions that store their |maxSparseLights| most important lights,
+// with the remaining lights sampled uniformly.  These are kept in a
+// fixed-size cache in the rest of |maxBytes|, evicting the least recently
+// used voxel when full.  For those voxels, Lookup() returns a distribution
+// proportional to the lights' power, shared by all of them.
 class SpatialLightDistribution : public LightDistribution {
   public:
-    SpatialLightDistribution(const Scene &scene, int maxVoxels = 64);
+    SpatialLightDistribution(const Scene &scene, int maxVoxels = 64,
+                             int maxSparseLights = 64,
+                             size_t maxBytes = 64 * 1024 * 1024);
     ~SpatialLightDistribution();
     const Distribution1D *Lookup(const Point3f &p) const;
+    int Sample(const Point3f &p, const Normal3f &n, Float u, Float *pmf) const;
+    Float Pmf(const Point3f &p, const Normal3f &n, int lightIndex) const;
+
+    static PBRT_CONSTEXPR int MaxSparseLights = 256;
 
   private:
+    // SparseDistribution stores the sampling probabilities of a voxel's
+    // most important lights, sorted by light index, followed by the
+    // probability of sampling any of the remaining ones, as a CDF.
+    struct SparseDistribution {
+        int lights[MaxSparseLights];
+        Float cdf[MaxSparseLights + 1];
+    };
+
+    // Compute the packed voxel coordinates for the point "p", returning
+    // the integer voxel coordinates in "pi".
+    uint64_t PackedVoxel(const Point3f &p, Point3i *pi) const;
+    // Estimate the contribution of each light to the voxel with integer
+    // coordinates given by "pi".
+    std::vector<Float> ComputeContributions(Point3i pi) const;
     // Compute the sampling distribution for the voxel with integer
     // coordiantes given by "pi".
     Distribution1D *ComputeDistribution(Point3i pi) const;
+    // Find the full distribution for the voxel containing "p", or return
+    // nullptr if the voxel doesn't fit in the memory budget for full
+    // distributions.
+    const Distribution1D *LookupDistribution(const Point3f &p) const;
+    void ComputeSparseDistribution(Point3i pi, SparseDistribution *sd) const;
+    void AllocateSparseCache() const;
+    // Find the sparse distribution for the voxel containing "p", either in
+    // the cache or by computing (and caching) it.
+    void LookupSparse(const Point3f &p, SparseDistribution *sd) const;
 
     const Scene &scene;
     int nVoxels[3];
@@ -122,6 +184,80 @@ class SpatialLightDistribution : public LightDistribution {
     };
     mutable std::unique_ptr<HashEntry[]> hashTable;
     size_t hashTableSize;
+    const size_t distributionBytes, maxDistributionBytes;
+    mutable std::atomic<size_t> totalDistributionBytes;
+    // Lookup() returns this for voxels without full distributions.
+    std::unique_ptr<Distribution1D> powerDistrib;
+
+    // The sparse distribution cache is set associative, with
+    // SparseCacheWays entries per set. Each entry's contents are guarded
+    // by a sequence lock: writers make _version_ odd while updating an
+    // entry and readers retry if it changed while they copied it, so
+    // lookups never block and entries can be replaced in place. It's
+    // allocated when the first voxel needs it.
+    static PBRT_CONSTEXPR int SparseCacheWays = 4;
+    struct SparseEntry {
+        std::atomic<uint64_t> packedPos;
+        std::atomic<uint32_t> version;
+        std::atomic<uint32_t> lastUse;
+    };
+    int nSparseLights;
+    const size_t maxSparseBytes;
+    mutable std::once_flag sparseCacheAllocated;
+    mutable size_t nSparseSets;
+    mutable std::unique_ptr<SparseEntry[]> sparseEntries;
+    mutable std::unique_ptr<std::atomic<int>[]> sparseLights;
+    mutable std::unique_ptr<std::atomic<Float>[]> sparseCDFs;
+    mutable std::atomic<uint32_t> sparseClock;
+};
+
+// A light distribution that organizes the lights in a bounding volume
+// hierarchy, where each node stores the spatial bounds, emitted power, and
+// a cone of emission directions of the lights below it.  Sample() walks
+// the tree from the root, choosing each child with probability
+// proportional to a conservative estimate of its contribution at the
+// shading point, so that lights are chosen in O(log n) time.  Lights that
+// can't be bounded (e.g. infinite lights) are sampled uniformly with a
+// probability proportional to their count.
+class BVHLightDistribution : public LightDistribution {
+  public:
+    BVHLightDistribution(const Scene &scene, int maxVoxels = 64);
+    const Distribution1D *Lookup(const Point3f &p) const;
+    int Sample(const Point3f &p, const Normal3f &n, Float u, Float *pmf) const;
+    Float Pmf(const Point3f &p, const Normal3f &n, int lightIndex) const;
+
+  private:
+    // BVHLightDistribution Private Declarations
+    struct LightBVHNode {
+        LightBounds lightBounds;
+        // Index of the second child for interior nodes (the first child
+        // immediately follows its parent) or of the light for leaves.
+        int childOrLightIndex;
+        bool isLeaf;
+    };
+
+    // BVHLightDistribution Private Methods
+    int BuildBVH(std::vector<std::pair<int, LightBounds>> &bvhLights,
+                 int start, int end, uint64_t bitTrail, int depth);
+
+    // BVHLightDistribution Private Data
+    const Scene &scene;
+    std::vector<int> unboundedLights;
+    std::vector<LightBVHNode> nodes;
+    // For each light in the BVH, the bits of lightBitTrails give the
+    // child taken at each level of the tree on the path to its leaf.
+    std::vector<uint64_t> lightBitTrails;
+
+    // Lookup() is used by integrators that need a complete distribution;
+    // these are computed from Pmf() as needed for the voxels of a grid
+    // over the scene bounds.  Each thread remembers the last voxel it
+    // looked up so that the mutex is rarely needed.
+    int nVoxels[3];
+    mutable std::mutex distributionsMutex;
+    mutable std::unordered_map<uint64_t, std::unique_ptr<Distribution1D>>
+        distributions;
+    mutable std::vector<std::pair<uint64_t, const Distribution1D *>>
+        threadDistributions;
 };
 
 }  // namespace pbrt
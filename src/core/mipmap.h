@@ -44,12 +44,20 @@
 #include "texture.h"
 #include "stats.h"
 #include "parallel.h"
+#include "texcache.h"
+// EWA filtering uses SSE2 when it's available and _Float_ is _float_
+#if defined(__SSE2__) && !defined(PBRT_FLOAT_AS_DOUBLE)
+#define PBRT_MIPMAP_SSE
+#include <emmintrin.h>
+#endif
 
 namespace pbrt {
 
 STAT_COUNTER("Texture/EWA lookups", nEWALookups);
 STAT_COUNTER("Texture/Trilinear lookups", nTrilerpLookups);
 STAT_MEMORY_COUNTER("Memory/Texture MIP maps", mipMapMemory);
+STAT_MEMORY_COUNTER("Memory/Texture MIP maps (half)", mipMapHalfMemory);
+STAT_MEMORY_COUNTER("Memory/Texture MIP maps (8-bit)", mipMapByteMemory);
 
 // MIPMap Helper Declarations
 enum class ImageWrap { Repeat, Black, Clamp };
@@ -58,22 +66,310 @@ struct ResampleWeight {
     Float weight[4];
 };
 
+// TexelChannels provides per-channel access to texel values so that
+// _TiledTexelArray_ can encode them in compact formats.
+template <typename T>
+struct TexelChannels {
+    static PBRT_CONSTEXPR int N = T::nSamples;
+    static Float Get(const T &v, int c) { return v[c]; }
+    static void Set(T *v, int c, Float x) { (*v)[c] = x; }
+    static T FromRGB(const Float rgb[3]) { return T::FromRGB(rgb); }
+};
+
+template <>
+struct TexelChannels<Float> {
+    static PBRT_CONSTEXPR int N = 1;
+    static Float Get(Float v, int c) { return v; }
+    static void Set(Float *v, int c, Float x) { *v = x; }
+    static Float FromRGB(const Float rgb[3]) {
+        return 0.212671f * rgb[0] + 0.715160f * rgb[1] + 0.072169f * rgb[2];
+    }
+};
+
+// TiledTexelArray Declarations
+
+// TiledTexelArray stores a 2D array of texels as square tiles of
+// $2^\roman{logTileSize}$ texels on a side; each tile is contiguous in
+// memory with its texels laid out in Morton order, so that the texels
+// accessed by a filter footprint are usually in a handful of cache lines.
+// Texels may be stored as 32-bit floats, half floats, or 8-bit sRGB-encoded
+// values. The tiles are either held in memory or fetched on demand from a
+// tiled image file through a _TextureCache_.
+template <typename T>
+class TiledTexelArray {
+  public:
+    // TiledTexelArray Public Methods
+    TiledTexelArray(int uRes, int vRes, int logTileSize, TexelFormat format)
+        : uRes(uRes),
+          vRes(vRes),
+          logTileSize(logTileSize),
+          nChannels(TexelChannels<T>::N),
+          format(format),
+          uTiles((uRes + TileSize() - 1) >> logTileSize),
+          vTiles((vRes + TileSize() - 1) >> logTileSize) {
+        CHECK(logTileSize >= 0 && logTileSize <= 7);
+        Init();
+        size_t bytes = tileBytes * uTiles * vTiles;
+        data = AllocAligned<uint8_t>(bytes);
+        memset(data, 0, bytes);
+    }
+    TiledTexelArray(TextureCache *cache, int fileId,
+                    const TiledImageHeader &header, int level)
+        : uRes(header.levels[level].resolution.x),
+          vRes(header.levels[level].resolution.y),
+          logTileSize(header.logTileSize),
+          nChannels(header.nChannels),
+          format(header.format),
+          uTiles(header.TileCount(level).x),
+          vTiles(header.TileCount(level).y),
+          cache(cache),
+          fileId(fileId),
+          level(level) {
+        CHECK(nChannels == TexelChannels<T>::N || nChannels == 3);
+        Init();
+    }
+    ~TiledTexelArray() { FreeAligned(data); }
+    int uSize() const { return uRes; }
+    int vSize() const { return vRes; }
+    int TileSize() const { return 1 << logTileSize; }
+    int Channels() const { return nChannels; }
+    TexelFormat Format() const { return format; }
+    size_t BytesUsed() const { return data ? tileBytes * uTiles * vTiles : 0; }
+    const uint8_t *Texels() const { return data; }
+    uint8_t *Texels() { return data; }
+    T Get(int u, int v) const {
+        DCHECK(u >= 0 && u < uRes && v >= 0 && v < vRes);
+        int tileIndex = (v >> logTileSize) * uTiles + (u >> logTileSize);
+        const uint8_t *tile = data ? data + tileIndex * tileBytes
+                                   : cache->GetTile(fileId, level, tileIndex);
+        const uint8_t *texel = tile + MortonOffset(u, v) * texelBytes;
+        T value;
+        if (nChannels == TexelChannels<T>::N)
+            for (int c = 0; c < TexelChannels<T>::N; ++c)
+                TexelChannels<T>::Set(&value, c, Decode(texel, c));
+        else {
+            Float rgb[3] = {Decode(texel, 0), Decode(texel, 1),
+                            Decode(texel, 2)};
+            value = TexelChannels<T>::FromRGB(rgb);
+        }
+        return value;
+    }
+    void Set(int u, int v, const T &value) {
+        DCHECK(data && u >= 0 && u < uRes && v >= 0 && v < vRes);
+        int tileIndex = (v >> logTileSize) * uTiles + (u >> logTileSize);
+        uint8_t *texel = data + tileIndex * tileBytes +
+                         MortonOffset(u, v) * texelBytes;
+        for (int c = 0; c < TexelChannels<T>::N; ++c)
+            Encode(TexelChannels<T>::Get(value, c), texel, c);
+    }
+#ifdef PBRT_MIPMAP_SSE
+    // Adds the texels of row _v_ from _u0_ through _u1_, which must all be
+    // inside the array, weighted by the EWA filter to _*sum_, and their
+    // weights to _*sumWts_. The squared radius of the texel at _u_ is
+    // $A s^2 + b s + c$, with $s = u - \roman{su}$; weights are looked up
+    // in _lut_ by it. Radii are computed four texels at a time and the
+    // (up to three) channels are accumulated in one SSE register.
+    void FilterRowEWA(int u0, int u1, int v, Float su, Float A, Float b,
+                      Float c, const Float *lut, int lutSize, __m128 *sum,
+                      Float *sumWts) const {
+        switch (format) {
+        case TexelFormat::Float:
+            filterRowEWA<TexelFormat::Float>(u0, u1, v, su, A, b, c, lut,
+                                             lutSize, sum, sumWts);
+            break;
+        case TexelFormat::Half:
+            filterRowEWA<TexelFormat::Half>(u0, u1, v, su, A, b, c, lut,
+                                            lutSize, sum, sumWts);
+            break;
+        default:
+            filterRowEWA<TexelFormat::Byte>(u0, u1, v, su, A, b, c, lut,
+                                            lutSize, sum, sumWts);
+        }
+    }
+#endif
+
+  private:
+    // TiledTexelArray Private Methods
+    void Init() {
+        texelBytes = nChannels * TexelFormatBytes(format);
+        tileBytes = texelBytes << (2 * logTileSize);
+        sRGB8ToLinear = SRGB8ToLinearTable();
+    }
+    // Returns the table that maps 8-bit sRGB values to linear ones. It's
+    // a function-local static so that its initialization is thread-safe
+    // when texel arrays are created from several threads.
+    static const Float *SRGB8ToLinearTable() {
+        static const struct Table {
+            Table() {
+                for (int i = 0; i < 256; ++i)
+                    values[i] = InverseGammaCorrect(i / 255.f);
+            }
+            Float values[256];
+        } table;
+        return table.values;
+    }
+    static uint32_t SpreadBits(uint32_t x) {
+        // Insert a zero bit between each of the low 8 bits of _x_
+        x = (x | (x << 4)) & 0x0f0f;
+        x = (x | (x << 2)) & 0x3333;
+        x = (x | (x << 1)) & 0x5555;
+        return x;
+    }
+    uint32_t MortonOffset(int u, int v) const {
+        uint32_t mask = TileSize() - 1;
+        return SpreadBits(u & mask) | (SpreadBits(v & mask) << 1);
+    }
+    Float Decode(const uint8_t *texel, int c) const {
+        switch (format) {
+        case TexelFormat::Float: {
+            float f;
+            memcpy(&f, texel + c * sizeof(float), sizeof(float));
+            return f;
+        }
+        case TexelFormat::Half: {
+            uint16_t h;
+            memcpy(&h, texel + c * sizeof(uint16_t), sizeof(uint16_t));
+            return HalfToFloat(h);
+        }
+        default:
+            return sRGB8ToLinear[texel[c]];
+        }
+    }
+#ifdef PBRT_MIPMAP_SSE
+    template <TexelFormat F>
+    __m128 LoadTexel(const uint8_t *texel) const {
+        if (nChannels == 1) return _mm_set_ss(Decode(texel, 0));
+        switch (F) {
+        case TexelFormat::Float:
+            // Load the first two channels as one 64-bit value and the
+            // third on its own, so as not to read past the texel
+            return _mm_movelh_ps(
+                _mm_castpd_ps(_mm_load_sd((const double *)texel)),
+                _mm_load_ss((const float *)texel + 2));
+        case TexelFormat::Half: {
+            uint16_t h[3];
+            memcpy(h, texel, sizeof(h));
+            return _mm_setr_ps(HalfToFloat(h[0]), HalfToFloat(h[1]),
+                               HalfToFloat(h[2]), 0.f);
+        }
+        default:
+            return _mm_setr_ps(sRGB8ToLinear[texel[0]],
+                               sRGB8ToLinear[texel[1]],
+                               sRGB8ToLinear[texel[2]], 0.f);
+        }
+    }
+    template <TexelFormat F>
+    void filterRowEWA(int u0, int u1, int v, Float su, Float A, Float b,
+                      Float c, const Float *lut, int lutSize, __m128 *sum,
+                      Float *sumWts) const {
+        DCHECK(u0 >= 0 && u1 < uRes && v >= 0 && v < vRes);
+        int tileRow = (v >> logTileSize) * uTiles, tileIndex = -1;
+        uint32_t mask = TileSize() - 1, vBits = SpreadBits(v & mask) << 1;
+        const uint8_t *tile = nullptr;
+        const __m128 vA = _mm_set1_ps(A), vb = _mm_set1_ps(b),
+                     vc = _mm_set1_ps(c), one = _mm_set1_ps(1.f),
+                     lutScale = _mm_set1_ps(lutSize),
+                     lanes = _mm_setr_ps(0.f, 1.f, 2.f, 3.f);
+        __m128 acc = *sum;
+        Float wts = 0;
+        for (int u = u0; u <= u1; u += 4) {
+            // Find which of the next four texels are inside the ellipse
+            __m128 ss = _mm_add_ps(_mm_set1_ps(u - su), lanes);
+            __m128 r2 = _mm_add_ps(
+                _mm_mul_ps(_mm_add_ps(_mm_mul_ps(vA, ss), vb), ss), vc);
+            int inside = _mm_movemask_ps(_mm_cmplt_ps(r2, one)) &
+                         (0xf >> std::max(0, 3 - (u1 - u)));
+            if (!inside) continue;
+            alignas(16) int32_t index[4];
+            _mm_store_si128((__m128i *)index,
+                            _mm_cvttps_epi32(_mm_mul_ps(r2, lutScale)));
+
+            // Accumulate their weighted values
+            for (int k = 0; k < 4; ++k) {
+                if (!(inside & (1 << k))) continue;
+                int uk = u + k, t = tileRow + (uk >> logTileSize);
+                if (t != tileIndex) {
+                    tileIndex = t;
+                    tile = data ? data + t * tileBytes
+                                : cache->GetTile(fileId, level, t);
+                }
+                const uint8_t *texel =
+                    tile + (SpreadBits(uk & mask) | vBits) * texelBytes;
+                Float weight = lut[std::min(index[k], lutSize - 1)];
+                acc = _mm_add_ps(acc, _mm_mul_ps(LoadTexel<F>(texel),
+                                                 _mm_set1_ps(weight)));
+                wts += weight;
+            }
+        }
+        *sum = acc;
+        *sumWts += wts;
+    }
+#endif
+    void Encode(Float v, uint8_t *texel, int c) {
+        switch (format) {
+        case TexelFormat::Float: {
+            float f = v;
+            memcpy(texel + c * sizeof(float), &f, sizeof(float));
+            break;
+        }
+        case TexelFormat::Half: {
+            uint16_t h = FloatToHalf(v);
+            memcpy(texel + c * sizeof(uint16_t), &h, sizeof(uint16_t));
+            break;
+        }
+        default:
+            texel[c] = (uint8_t)Clamp(
+                std::round(255.f * GammaCorrect(Clamp(v, 0, 1))), 0, 255);
+        }
+    }
+
+    // TiledTexelArray Private Data
+    const int uRes, vRes, logTileSize, nChannels;
+    const TexelFormat format;
+    const int uTiles, vTiles;
+    size_t texelBytes, tileBytes;
+    uint8_t *data = nullptr;
+    TextureCache *cache = nullptr;
+    int fileId = -1, level = -1;
+    const Float *sRGB8ToLinear;
+};
+
 // MIPMap Declarations
 template <typename T>
 class MIPMap {
   public:
     // MIPMap Public Methods
     MIPMap(const Point2i &resolution, const T *data, bool doTri = false,
-           Float maxAniso = 8.f, ImageWrap wrapMode = ImageWrap::Repeat);
+           Float maxAniso = 8.f, ImageWrap wrapMode = ImageWrap::Repeat,
+           TexelFormat format = TexelFormat::Float, int tileSize = 4);
+    MIPMap(TextureCache *cache, int fileId, const TiledImageHeader &header,
+           bool doTri = false, Float maxAniso = 8.f,
+           ImageWrap wrapMode = ImageWrap::Repeat);
     int Width() const { return resolution[0]; }
     int Height() const { return resolution[1]; }
     int Levels() const { return pyramid.size(); }
-    const T &Texel(int level, int s, int t) const;
+    TexelFormat Format() const { return format; }
+    size_t BytesUsed() const {
+        size_t bytes = 0;
+        for (const auto &level : pyramid) bytes += level->BytesUsed();
+        return bytes;
+    }
+    T Texel(int level, int s, int t) const;
     T Lookup(const Point2f &st, Float width = 0.f) const;
-    T Lookup(const Point2f &st, Vector2f dstdx, Vector2f dstdy) const;
+    // EWA filtering uses the SSE kernel where it's available unless
+    // _vectorized_ is false; the scalar one is kept as a reference for
+    // tests and benchmarks.
+    T Lookup(const Point2f &st, Vector2f dstdx, Vector2f dstdy,
+             bool vectorized = true) const;
+    bool WriteTiled(const std::string &filename) const;
+    static MIPMap<T> *ReadTiled(const std::string &filename, bool doTri = false,
+                                Float maxAniso = 8.f,
+                                ImageWrap wrapMode = ImageWrap::Repeat);
 
   private:
     // MIPMap Private Methods
+    MIPMap(const TiledImageHeader &header, bool doTri, Float maxAniso,
+           ImageWrap wrapMode);
     std::unique_ptr<ResampleWeight[]> resampleWeights(int oldRes, int newRes) {
         CHECK_GE(newRes, oldRes);
         std::unique_ptr<ResampleWeight[]> wt(new ResampleWeight[newRes]);
@@ -99,15 +395,50 @@ class MIPMap {
     SampledSpectrum clamp(const SampledSpectrum &v) {
         return v.Clamp(0.f, Infinity);
     }
+    bool remapTexel(int *s, int *t, int sRes, int tRes) const {
+        // Compute texel $(s,t)$ accounting for boundary conditions
+        switch (wrapMode) {
+        case ImageWrap::Repeat:
+            *s = Mod(*s, sRes);
+            *t = Mod(*t, tRes);
+            break;
+        case ImageWrap::Clamp:
+            *s = Clamp(*s, 0, sRes - 1);
+            *t = Clamp(*t, 0, tRes - 1);
+            break;
+        case ImageWrap::Black:
+            if (*s < 0 || *s >= sRes || *t < 0 || *t >= tRes) return false;
+            break;
+        }
+        return true;
+    }
+    static void initWeightLut() {
+        if (weightLut[0] != 0.) return;
+        for (int i = 0; i < WeightLUTSize; ++i) {
+            Float alpha = 2;
+            Float r2 = Float(i) / Float(WeightLUTSize - 1);
+            weightLut[i] = std::exp(-alpha * r2) - std::exp(-alpha);
+        }
+    }
+    void countMemory() const {
+        size_t bytes = BytesUsed();
+        mipMapMemory += bytes;
+        if (format == TexelFormat::Half)
+            mipMapHalfMemory += bytes;
+        else if (format == TexelFormat::Byte)
+            mipMapByteMemory += bytes;
+    }
     T triangle(int level, const Point2f &st) const;
-    T EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1) const;
+    T EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1,
+          bool vectorized) const;
 
     // MIPMap Private Data
     const bool doTrilinear;
     const Float maxAnisotropy;
     const ImageWrap wrapMode;
+    TexelFormat format;
     Point2i resolution;
-    std::vector<std::unique_ptr<BlockedArray<T>>> pyramid;
+    std::vector<std::unique_ptr<TiledTexelArray<T>>> pyramid;
     static PBRT_CONSTEXPR int WeightLUTSize = 128;
     static Float weightLut[WeightLUTSize];
 };
@@ -115,12 +446,37 @@ class MIPMap {
 // MIPMap Method Definitions
 template <typename T>
 MIPMap<T>::MIPMap(const Point2i &res, const T *img, bool doTrilinear,
-                  Float maxAnisotropy, ImageWrap wrapMode)
+                  Float maxAnisotropy, ImageWrap wrapMode, TexelFormat format,
+                  int tileSize)
     : doTrilinear(doTrilinear),
       maxAnisotropy(maxAnisotropy),
       wrapMode(wrapMode),
+      format(format),
       resolution(res) {
     ProfilePhase _(Prof::MIPMapCreation);
+    CHECK(IsPowerOf2(tileSize)) << "Texel tile size must be a power of 2";
+
+    // Fall back to half-float storage if 8-bit texels can't represent image;
+    // ringing from resampling below is just clamped when texels are encoded
+    if (format == TexelFormat::Byte) {
+        std::atomic<bool> inRange(true);
+        ParallelFor([&](int t) {
+            if (!inRange) return;
+            for (int s = 0; s < res[0]; ++s)
+                for (int c = 0; c < TexelChannels<T>::N; ++c) {
+                    Float v = TexelChannels<T>::Get(img[t * res[0] + s], c);
+                    if (v < 0 || v > 1) {
+                        inRange = false;
+                        return;
+                    }
+                }
+        }, res[1], 32);
+        if (!inRange) {
+            LOG(INFO) << "Texel values outside [0,1]; using half-float "
+                         "MIPMap storage instead of 8-bit";
+            this->format = format = TexelFormat::Half;
+        }
+    }
 
     std::unique_ptr<T[]> resampledImage = nullptr;
     if (!IsPowerOf2(resolution[0]) || !IsPowerOf2(resolution[1])) {
@@ -181,64 +537,135 @@ MIPMap<T>::MIPMap(const Point2i &res, const T *img, bool doTrilinear,
         for (auto ptr : resampleBufs) delete[] ptr;
         resolution = resPow2;
     }
+    const T *levelTexels = resampledImage ? resampledImage.get() : img;
+
     // Initialize levels of MIPMap from image
     int nLevels = 1 + Log2Int(std::max(resolution[0], resolution[1]));
     pyramid.resize(nLevels);
-
-    // Initialize most detailed level of MIPMap
-    pyramid[0].reset(
-        new BlockedArray<T>(resolution[0], resolution[1],
-                            resampledImage ? resampledImage.get() : img));
-    for (int i = 1; i < nLevels; ++i) {
-        // Initialize $i$th MIPMap level from $i-1$st level
-        int sRes = std::max(1, pyramid[i - 1]->uSize() / 2);
-        int tRes = std::max(1, pyramid[i - 1]->vSize() / 2);
-        pyramid[i].reset(new BlockedArray<T>(sRes, tRes));
+    int logTileSize = Log2Int(tileSize);
+    std::unique_ptr<T[]> levelBuffer;
+    int sRes = resolution[0], tRes = resolution[1];
+    for (int i = 0; i < nLevels; ++i) {
+        // Store $i$th MIPMap level in tiled texel layout; coarser levels
+        // are filtered from the unquantized texels of the level above, so
+        // compact formats don't accumulate rounding error through the
+        // pyramid. Filtering and encoding happen in a single parallel pass
+        // over each level's rows.
+        int sPrev = sRes, tPrev = tRes;
+        if (i > 0) {
+            sRes = std::max(1, sRes / 2);
+            tRes = std::max(1, tRes / 2);
+        }
+        pyramid[i].reset(
+            new TiledTexelArray<T>(sRes, tRes, logTileSize, format));
+        TiledTexelArray<T> &level = *pyramid[i];
+        if (i == 0) {
+            ParallelFor([&](int t) {
+                for (int s = 0; s < sRes; ++s)
+                    level.Set(s, t, levelTexels[t * sRes + s]);
+            }, tRes, 16);
+            continue;
+        }
 
         // Filter four texels from finer level of pyramid
+        std::unique_ptr<T[]> filtered(new T[sRes * tRes]);
+        const T *finerTexels = levelTexels;
+        auto finer = [&](int s, int t) -> T {
+            if (!remapTexel(&s, &t, sPrev, tPrev)) return T(0.f);
+            return finerTexels[t * sPrev + s];
+        };
         ParallelFor([&](int t) {
-            for (int s = 0; s < sRes; ++s)
-                (*pyramid[i])(s, t) =
-                    .25f * (Texel(i - 1, 2 * s, 2 * t) +
-                            Texel(i - 1, 2 * s + 1, 2 * t) +
-                            Texel(i - 1, 2 * s, 2 * t + 1) +
-                            Texel(i - 1, 2 * s + 1, 2 * t + 1));
-        }, tRes, 16);
+            for (int s = 0; s < sRes; ++s) {
+                T v = .25f * (finer(2 * s, 2 * t) + finer(2 * s + 1, 2 * t) +
+                              finer(2 * s, 2 * t + 1) +
+                              finer(2 * s + 1, 2 * t + 1));
+                filtered[t * sRes + s] = v;
+                level.Set(s, t, v);
+            }
+        }, tRes, std::max(1, 4096 / sRes));
+        levelBuffer = std::move(filtered);
+        levelTexels = levelBuffer.get();
     }
 
     // Initialize EWA filter weights if needed
-    if (weightLut[0] == 0.) {
-        for (int i = 0; i < WeightLUTSize; ++i) {
-            Float alpha = 2;
-            Float r2 = Float(i) / Float(WeightLUTSize - 1);
-            weightLut[i] = std::exp(-alpha * r2) - std::exp(-alpha);
-        }
-    }
-    mipMapMemory += (4 * resolution[0] * resolution[1] * sizeof(T)) / 3;
+    initWeightLut();
+    countMemory();
 }
 
 template <typename T>
-const T &MIPMap<T>::Texel(int level, int s, int t) const {
-    CHECK_LT(level, pyramid.size());
-    const BlockedArray<T> &l = *pyramid[level];
-    // Compute texel $(s,t)$ accounting for boundary conditions
-    switch (wrapMode) {
-    case ImageWrap::Repeat:
-        s = Mod(s, l.uSize());
-        t = Mod(t, l.vSize());
-        break;
-    case ImageWrap::Clamp:
-        s = Clamp(s, 0, l.uSize() - 1);
-        t = Clamp(t, 0, l.vSize() - 1);
-        break;
-    case ImageWrap::Black: {
-        static const T black = 0.f;
-        if (s < 0 || s >= (int)l.uSize() || t < 0 || t >= (int)l.vSize())
-            return black;
-        break;
+MIPMap<T>::MIPMap(TextureCache *cache, int fileId,
+                  const TiledImageHeader &header, bool doTrilinear,
+                  Float maxAnisotropy, ImageWrap wrapMode)
+    : doTrilinear(doTrilinear),
+      maxAnisotropy(maxAnisotropy),
+      wrapMode(wrapMode),
+      format(header.format),
+      resolution(header.levels[0].resolution) {
+    // Create levels whose tiles are loaded on demand through _cache_
+    for (size_t i = 0; i < header.levels.size(); ++i)
+        pyramid.push_back(std::unique_ptr<TiledTexelArray<T>>(
+            new TiledTexelArray<T>(cache, fileId, header, i)));
+    initWeightLut();
+}
+
+template <typename T>
+bool MIPMap<T>::WriteTiled(const std::string &filename) const {
+    TiledImageHeader header;
+    header.nChannels = TexelChannels<T>::N;
+    header.format = format;
+    header.logTileSize = Log2Int(pyramid[0]->TileSize());
+    std::vector<const uint8_t *> levelTexels;
+    for (const auto &level : pyramid) {
+        CHECK(level->Texels() != nullptr);
+        header.levels.push_back({Point2i(level->uSize(), level->vSize()), 0});
+        levelTexels.push_back(level->Texels());
     }
+    return WriteTiledImage(filename, header, levelTexels);
+}
+
+template <typename T>
+MIPMap<T>::MIPMap(const TiledImageHeader &header, bool doTrilinear,
+                  Float maxAnisotropy, ImageWrap wrapMode)
+    : doTrilinear(doTrilinear),
+      maxAnisotropy(maxAnisotropy),
+      wrapMode(wrapMode),
+      format(header.format),
+      resolution(header.levels[0].resolution) {
+    // Allocate in-memory levels to be filled from a tiled image file
+    for (const TiledImageLevel &level : header.levels)
+        pyramid.push_back(std::unique_ptr<TiledTexelArray<T>>(
+            new TiledTexelArray<T>(level.resolution.x, level.resolution.y,
+                                   header.logTileSize, format)));
+    initWeightLut();
+}
+
+template <typename T>
+MIPMap<T> *MIPMap<T>::ReadTiled(const std::string &filename, bool doTrilinear,
+                                Float maxAnisotropy, ImageWrap wrapMode) {
+    ProfilePhase _(Prof::MIPMapCreation);
+    TiledImageHeader header;
+    if (!ReadTiledImageHeader(filename, &header)) return nullptr;
+    if (header.nChannels != TexelChannels<T>::N) {
+        Warning("%s: tiled image has %d channels but %d are needed",
+                filename.c_str(), header.nChannels, TexelChannels<T>::N);
+        return nullptr;
     }
-    return l(s, t);
+    std::unique_ptr<MIPMap<T>> mipmap(
+        new MIPMap<T>(header, doTrilinear, maxAnisotropy, wrapMode));
+    for (size_t i = 0; i < header.levels.size(); ++i)
+        if (!ReadTiledImageLevel(filename, header, i,
+                                 mipmap->pyramid[i]->Texels()))
+            return nullptr;
+    mipmap->countMemory();
+    return mipmap.release();
+}
+
+template <typename T>
+T MIPMap<T>::Texel(int level, int s, int t) const {
+    CHECK_LT(level, pyramid.size());
+    const TiledTexelArray<T> &l = *pyramid[level];
+    if (!remapTexel(&s, &t, l.uSize(), l.vSize())) return T(0.f);
+    return l.Get(s, t);
 }
 
 template <typename T>
@@ -274,7 +701,8 @@ T MIPMap<T>::triangle(int level, const Point2f &st) const {
 }
 
 template <typename T>
-T MIPMap<T>::Lookup(const Point2f &st, Vector2f dst0, Vector2f dst1) const {
+T MIPMap<T>::Lookup(const Point2f &st, Vector2f dst0, Vector2f dst1,
+                    bool vectorized) const {
     if (doTrilinear) {
         Float width = std::max(std::max(std::abs(dst0[0]), std::abs(dst0[1])),
                                std::max(std::abs(dst1[0]), std::abs(dst1[1])));
@@ -298,12 +726,13 @@ T MIPMap<T>::Lookup(const Point2f &st, Vector2f dst0, Vector2f dst1) const {
     // Choose level of detail for EWA lookup and perform EWA filtering
     Float lod = std::max((Float)0, Levels() - (Float)1 + Log2(minorLength));
     int ilod = std::floor(lod);
-    return Lerp(lod - ilod, EWA(ilod, st, dst0, dst1),
-                EWA(ilod + 1, st, dst0, dst1));
+    return Lerp(lod - ilod, EWA(ilod, st, dst0, dst1, vectorized),
+                EWA(ilod + 1, st, dst0, dst1, vectorized));
 }
 
 template <typename T>
-T MIPMap<T>::EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1) const {
+T MIPMap<T>::EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1,
+                 bool vectorized) const {
     if (level >= Levels()) return Texel(Levels() - 1, 0, 0);
     // Convert EWA coordinates to appropriate scale for level
     st[0] = st[0] * pyramid[level]->uSize() - 0.5f;
@@ -331,6 +760,57 @@ T MIPMap<T>::EWA(int level, Point2f st, Vector2f dst0, Vector2f dst1) const {
     int t0 = std::ceil(st[1] - 2 * invDet * vSqrt);
     int t1 = std::floor(st[1] + 2 * invDet * vSqrt);
 
+#ifdef PBRT_MIPMAP_SSE
+    // The per-row setup doesn't pay off for ellipses only a few texels wide
+    if (vectorized && s1 - s0 >= 8) {
+        // Filter just the span of each row inside the ellipse, found by
+        // solving $A s^2 + b s + (c - 1) = 0$ with $b = B t$ and $c = C
+        // t^2$; the span is rounded outward and texels are still tested
+        // individually. Rows that need texel coordinates remapped are
+        // filtered texel at a time.
+        const TiledTexelArray<T> &l = *pyramid[level];
+        __m128 sum = _mm_setzero_ps();
+        T remappedSum(0.f);
+        Float sumWts = 0, inv2A = 1 / (2 * A);
+        for (int it = t0; it <= t1; ++it) {
+            Float tt = it - st[1];
+            Float b = B * tt, c = C * tt * tt;
+            Float disc = b * b - 4 * A * (c - 1);
+            if (disc <= 0) continue;
+            Float sqrtDisc = std::sqrt(disc);
+            int rs0 = std::max(
+                s0, (int)std::floor(st[0] - (b + sqrtDisc) * inv2A));
+            int rs1 = std::min(
+                s1, (int)std::ceil(st[0] - (b - sqrtDisc) * inv2A));
+            if (it >= 0 && it < l.vSize() && rs0 >= 0 && rs1 < l.uSize()) {
+                l.FilterRowEWA(rs0, rs1, it, st[0], A, b, c, weightLut,
+                               WeightLUTSize, &sum, &sumWts);
+                continue;
+            }
+            for (int is = rs0; is <= rs1; ++is) {
+                Float ss = is - st[0];
+                Float r2 = (A * ss + b) * ss + c;
+                if (r2 < 1) {
+                    int index =
+                        std::min((int)(r2 * WeightLUTSize), WeightLUTSize - 1);
+                    Float weight = weightLut[index];
+                    remappedSum += Texel(level, is, it) * weight;
+                    sumWts += weight;
+                }
+            }
+        }
+        alignas(16) float channels[4];
+        _mm_store_ps(channels, sum);
+        T filtered;
+        if (l.Channels() == TexelChannels<T>::N)
+            for (int c = 0; c < TexelChannels<T>::N; ++c)
+                TexelChannels<T>::Set(&filtered, c, channels[c]);
+        else
+            filtered = TexelChannels<T>::FromRGB(channels);
+        return (filtered + remappedSum) / sumWts;
+    }
+#endif
+
     // Scan over ellipse bound and compute quadratic equation
     T sum(0.f);
     Float sumWts = 0;
@@ -149,6 +149,10 @@ class VisibilityTester;
 class AreaLight;
 struct Distribution1D;
 class Distribution2D;
+struct AliasDistribution1D;
+class AliasDistribution2D;
+class HierarchicalDistribution2D;
+class LightDistribution;
 //#define PBRT_FLOAT_AS_DOUBLE
 #ifdef PBRT_FLOAT_AS_DOUBLE
 typedef double Float;
@@ -175,7 +179,15 @@ struct Options {
     bool quickRender = false;
     bool quiet = false;
     bool cat = false, toPly = false;
+    bool perfCounters = false;
+    // Test-only: count software clock events in place of the hardware
+    // performance counters.
+    bool perfCountersSoftware = false;
+    int textureCacheMB = 512;
+    std::string mipCacheDir;
     std::string imageFile;
+    std::string profileStacksFile;
+    std::string statsJSONFile;
     // x0, x1, y0, y1
     Float cropWindow[2][2];
 };
@@ -234,6 +246,44 @@ inline double BitsToFloat(uint64_t ui) {
     return f;
 }
 
+inline uint16_t FloatToHalf(float f) {
+    // Convert _f_ to IEEE 754 binary16, rounding to nearest even
+    uint32_t bits = FloatToBits(f);
+    uint16_t sign = (bits >> 16) & 0x8000;
+    bits &= 0x7fffffff;
+    uint16_t h;
+    if (bits >= 0x47800000)
+        // Overflow to infinity, or infinity/NaN
+        h = bits > 0x7f800000 ? 0x7e00 : 0x7c00;
+    else if (bits < 0x38800000) {
+        // Use FP addition to round subnormal halves and zero
+        const uint32_t denormMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+        float v = BitsToFloat(bits) + BitsToFloat(denormMagic);
+        h = FloatToBits(v) - denormMagic;
+    } else {
+        uint32_t mantOdd = (bits >> 13) & 1;
+        bits += ((uint32_t)(15 - 127) << 23) + 0xfff + mantOdd;
+        h = bits >> 13;
+    }
+    return h | sign;
+}
+
+inline float HalfToFloat(uint16_t h) {
+    const uint32_t shiftedExp = 0x7c00 << 13;
+    uint32_t bits = (h & 0x7fff) << 13;
+    uint32_t exp = shiftedExp & bits;
+    bits += (127 - 15) << 23;
+    if (exp == shiftedExp)
+        // Infinity or NaN
+        bits += (128 - 16) << 23;
+    else if (exp == 0) {
+        // Zero or subnormal; renormalize
+        bits += 1 << 23;
+        bits = FloatToBits(BitsToFloat(bits) - BitsToFloat((uint32_t)113 << 23));
+    }
+    return BitsToFloat(bits | ((uint32_t)(h & 0x8000) << 16));
+}
+
 inline float NextFloatUp(float v) {
     // Handle infinity and negative zero for _NextFloatUp()_
     if (std::isinf(v) && v > 0.) return v;
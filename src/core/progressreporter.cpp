@@ -67,7 +67,7 @@ ProgressReporter::ProgressReporter(int64_t totalWork, const std::string &title)
         SuspendProfiler();
         std::shared_ptr<Barrier> barrier = std::make_shared<Barrier>(2);
         updateThread = std::thread([this, barrier]() {
-            ProfilerWorkerThreadInit();
+            ProfilerWorkerThreadInit(false);
             ProfilerState = 0;
             barrier->Wait();
             PrintBar();
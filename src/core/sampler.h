@@ -69,6 +69,7 @@ class Sampler {
                           currentPixel.y, currentPixelSampleIndex);
     }
     int64_t CurrentSampleNumber() const { return currentPixelSampleIndex; }
+    const Point2i &CurrentPixel() const { return currentPixel; }
 
     // Sampler Public Data
     const int64_t samplesPerPixel;
@@ -35,6 +35,7 @@
 #include "sampling.h"
 #include "geometry.h"
 #include "shape.h"
+#include "parallel.h"
 
 namespace pbrt {
 
@@ -170,4 +171,112 @@ Distribution2D::Distribution2D(const Float *func, int nu, int nv) {
     pMarginal.reset(new Distribution1D(&marginalFunc[0], nv));
 }
 
+AliasDistribution1D::AliasDistribution1D(const Float *f, int n)
+    : func(f, f + n), bins(n) {
+    // Compute the function's integral and each entry's probability times _n_
+    double sum = 0;
+    for (Float v : func) sum += v;
+    funcInt = sum / n;
+    std::vector<double> p(n);
+    for (int i = 0; i < n; ++i) p[i] = sum > 0 ? func[i] * n / sum : 1;
+
+    // Fill each underfull bin from an overfull entry (Vose's method)
+    std::vector<int> under, over;
+    for (int i = 0; i < n; ++i) (p[i] < 1 ? under : over).push_back(i);
+    while (!under.empty() && !over.empty()) {
+        int u = under.back(), o = over.back();
+        under.pop_back();
+        bins[u] = {(Float)p[u], o};
+        p[o] -= 1 - p[u];
+        if (p[o] < 1) {
+            over.pop_back();
+            under.push_back(o);
+        }
+    }
+    // Entries left over due to round-off are kept with certainty
+    for (int i : over) bins[i] = {1, i};
+    for (int i : under) bins[i] = {1, i};
+}
+
+AliasDistribution2D::AliasDistribution2D(const Float *func, int nu, int nv) {
+    pConditionalV.reserve(nv);
+    for (int v = 0; v < nv; ++v)
+        pConditionalV.emplace_back(new AliasDistribution1D(&func[v * nu], nu));
+    std::vector<Float> marginalFunc;
+    marginalFunc.reserve(nv);
+    for (int v = 0; v < nv; ++v)
+        marginalFunc.push_back(pConditionalV[v]->funcInt);
+    pMarginal.reset(new AliasDistribution1D(&marginalFunc[0], nv));
+}
+
+HierarchicalDistribution2D::HierarchicalDistribution2D(const Float *data,
+                                                       int nu, int nv) {
+    // Lay out the pyramid's levels
+    Point2i r(nu, nv);
+    size_t size = 0;
+    while (true) {
+        res.push_back(r);
+        offset.push_back(size);
+        size += (size_t)r.x * r.y;
+        if (r.x == 1 && r.y == 1) break;
+        r = Point2i((r.x + 1) / 2, (r.y + 1) / 2);
+    }
+
+    // Sum each level's 2x2 blocks into the level above it
+    sums.resize(size);
+    std::copy(data, data + (size_t)nu * nv, sums.begin());
+    for (size_t level = 1; level < res.size(); ++level)
+        ParallelFor([&](int64_t v) {
+            for (int u = 0; u < res[level].x; ++u)
+                sums[offset[level] + v * res[level].x + u] =
+                    (Sum(level - 1, 2 * u, 2 * v) +
+                     Sum(level - 1, 2 * u + 1, 2 * v)) +
+                    (Sum(level - 1, 2 * u, 2 * v + 1) +
+                     Sum(level - 1, 2 * u + 1, 2 * v + 1));
+        }, res[level].y, 64);
+    funcInt = sums.back() / ((Float)nu * nv);
+}
+
+Point2f HierarchicalDistribution2D::SampleContinuous(const Point2f &uSample,
+                                                     Float *pdf) const {
+    // Descend the pyramid, remapping _u_ at each choice so that it can be
+    // reused for the next one
+    Point2f u = uSample;
+    int iu = 0, iv = 0;
+    for (int level = (int)res.size() - 2; level >= 0; --level) {
+        iu *= 2;
+        iv *= 2;
+        Float s00 = Sum(level, iu, iv), s10 = Sum(level, iu + 1, iv);
+        Float s01 = Sum(level, iu, iv + 1), s11 = Sum(level, iu + 1, iv + 1);
+
+        // Choose the column of children in proportion to its sum
+        Float left = s00 + s01, total = left + (s10 + s11);
+        if (u[0] * total >= left && total > left) {
+            u[0] = (u[0] * total - left) / (total - left);
+            ++iu;
+            s00 = s10;
+            s01 = s11;
+        } else if (left > 0)
+            u[0] = u[0] * total / left;
+        u[0] = std::min(u[0], OneMinusEpsilon);
+
+        // Choose the child within the column
+        Float column = s00 + s01;
+        if (u[1] * column >= s00 && column > s00) {
+            u[1] = (u[1] * column - s00) / (column - s00);
+            ++iv;
+        } else if (s00 > 0)
+            u[1] = u[1] * column / s00;
+        u[1] = std::min(u[1], OneMinusEpsilon);
+    }
+    *pdf = funcInt > 0 ? sums[iv * res[0].x + iu] / funcInt : 0;
+
+    // Keep round-off from moving the point into the next texel, so that
+    // _Pdf()_ returns the same density for it
+    Point2f p((iu + u[0]) / res[0].x, (iv + u[1]) / res[0].y);
+    while (int(p[0] * res[0].x) > iu) p[0] = NextFloatDown(p[0]);
+    while (int(p[1] * res[0].y) > iv) p[1] = NextFloatDown(p[1]);
+    return p;
+}
+
 }  // namespace pbrt
@@ -146,6 +146,115 @@ class Distribution2D {
     std::unique_ptr<Distribution1D> pMarginal;
 };
 
+// A piecewise-constant 1D distribution with the interface of
+// _Distribution1D_ that is sampled with Walker's alias method: each sample
+// costs one table lookup rather than a binary search over the CDF, though
+// unlike inverting the CDF the mapping from _u_ to _x_ isn't monotonic.
+struct AliasDistribution1D {
+    // AliasDistribution1D Public Methods
+    AliasDistribution1D(const Float *f, int n);
+    int Count() const { return (int)func.size(); }
+    Float SampleContinuous(Float u, Float *pdf, int *off = nullptr) const {
+        Float du;
+        int offset = SampleDiscrete(u, nullptr, &du);
+        if (off) *off = offset;
+        if (pdf) *pdf = (funcInt > 0) ? func[offset] / funcInt : 0;
+        return (offset + du) / Count();
+    }
+    int SampleDiscrete(Float u, Float *pdf = nullptr,
+                       Float *uRemapped = nullptr) const {
+        // Choose a bin uniformly, and then its own entry or its alias
+        Float scaled = u * Count();
+        int bin = std::min((int)scaled, Count() - 1);
+        Float up = std::min(scaled - bin, OneMinusEpsilon);
+        const Bin &b = bins[bin];
+        int offset = up < b.q ? bin : b.alias;
+        if (pdf) *pdf = (funcInt > 0) ? func[offset] / (funcInt * Count()) : 0;
+        if (uRemapped)
+            *uRemapped = std::min(
+                up < b.q ? up / b.q : (up - b.q) / (1 - b.q), OneMinusEpsilon);
+        return offset;
+    }
+    Float DiscretePDF(int index) const {
+        CHECK(index >= 0 && index < Count());
+        return func[index] / (funcInt * Count());
+    }
+
+    // AliasDistribution1D Public Data
+    std::vector<Float> func;
+    Float funcInt;
+
+  private:
+    // AliasDistribution1D Private Data
+    struct Bin {
+        // The probability of keeping the bin's own entry
+        Float q;
+        int alias;
+    };
+    std::vector<Bin> bins;
+};
+
+// The alias-method counterpart of _Distribution2D_. Large tables are split
+// into rows so that each single-precision sample dimension only needs to
+// select among a row's or column's worth of entries.
+class AliasDistribution2D {
+  public:
+    // AliasDistribution2D Public Methods
+    AliasDistribution2D(const Float *data, int nu, int nv);
+    Point2f SampleContinuous(const Point2f &u, Float *pdf) const {
+        Float pdfs[2];
+        int v;
+        Float d1 = pMarginal->SampleContinuous(u[1], &pdfs[1], &v);
+        Float d0 = pConditionalV[v]->SampleContinuous(u[0], &pdfs[0]);
+        *pdf = pdfs[0] * pdfs[1];
+        return Point2f(d0, d1);
+    }
+    Float Pdf(const Point2f &p) const {
+        int iu = Clamp(int(p[0] * pConditionalV[0]->Count()), 0,
+                       pConditionalV[0]->Count() - 1);
+        int iv =
+            Clamp(int(p[1] * pMarginal->Count()), 0, pMarginal->Count() - 1);
+        return pConditionalV[iv]->func[iu] / pMarginal->funcInt;
+    }
+
+  private:
+    // AliasDistribution2D Private Data
+    std::vector<std::unique_ptr<AliasDistribution1D>> pConditionalV;
+    std::unique_ptr<AliasDistribution1D> pMarginal;
+};
+
+// A piecewise-constant 2D distribution sampled by hierarchical warping:
+// samples descend a pyramid of partial sums of the function, choosing
+// among each node's 2x2 children in proportion to their sums. It needs
+// about two thirds the memory of _Distribution2D_ and no per-row CDFs.
+class HierarchicalDistribution2D {
+  public:
+    // HierarchicalDistribution2D Public Methods
+    HierarchicalDistribution2D(const Float *data, int nu, int nv);
+    Point2f SampleContinuous(const Point2f &u, Float *pdf) const;
+    Float Pdf(const Point2f &p) const {
+        int iu = Clamp(int(p[0] * res[0].x), 0, res[0].x - 1);
+        int iv = Clamp(int(p[1] * res[0].y), 0, res[0].y - 1);
+        return funcInt > 0 ? sums[iv * res[0].x + iu] / funcInt : 0;
+    }
+    size_t BytesUsed() const { return sums.size() * sizeof(Float); }
+
+  private:
+    // HierarchicalDistribution2D Private Methods
+    Float Sum(int level, int u, int v) const {
+        if (u >= res[level].x || v >= res[level].y) return 0;
+        return sums[offset[level] + v * res[level].x + u];
+    }
+
+    // HierarchicalDistribution2D Private Data
+    // The levels of the pyramid are stored one after another in _sums_,
+    // starting with the function itself and ending with its total
+    std::vector<Point2i> res;
+    std::vector<size_t> offset;
+    std::vector<Float> sums;
+    Float funcInt;
+};
+
 // Sampling Inline Functions
 template <typename T>
 void Shuffle(T *samp, int count, int nDimensions, RNG &rng) {
@@ -0,0 +1,263 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// core/sdtree.cpp*
+#include "sdtree.h"
+
+namespace pbrt {
+
+// DTree Method Definitions
+void DTree::Record(const Vector3f &w, Float value) {
+    if (!(value > 0) || std::isinf(value)) return;
+    Point2f p = DirectionToCylindrical(w);
+    uint32_t index = 0;
+    while (true) {
+        int x = p.x >= .5f, y = p.y >= .5f;
+        Node &node = nodes[index];
+        node.sum[x + 2 * y].Add(value);
+        if (node.child[x + 2 * y] == 0) return;
+        index = node.child[x + 2 * y];
+        p = Point2f(2 * p.x - x, 2 * p.y - y);
+    }
+}
+
+Float DTree::Pdf(const Vector3f &w) const {
+    Point2f p = DirectionToCylindrical(w);
+    Float density = 1;
+    uint32_t index = 0;
+    while (true) {
+        const Node &node = nodes[index];
+        Float total = node.Total();
+        // Nodes that received no energy are sampled uniformly
+        if (total <= 0) break;
+        int x = p.x >= .5f, y = p.y >= .5f;
+        density *= 4 * node.sum[x + 2 * y] / total;
+        if (node.child[x + 2 * y] == 0) break;
+        index = node.child[x + 2 * y];
+        p = Point2f(2 * p.x - x, 2 * p.y - y);
+    }
+    return density * Inv4Pi;
+}
+
+Vector3f DTree::Sample(Point2f u) const {
+    Point2f origin(0, 0);
+    Float size = 1;
+    uint32_t index = 0;
+    while (true) {
+        const Node &node = nodes[index];
+        Float total = node.Total();
+        if (total <= 0) break;
+        // Choose the left or right half of the node, then the lower or
+        // upper quadrant within it, remapping _u_ after each choice
+        Float pLeft = (node.sum[0] + node.sum[2]) / total;
+        int x = u[0] < pLeft ? 0 : 1;
+        u[0] = x == 0 ? u[0] / pLeft : (u[0] - pLeft) / (1 - pLeft);
+        Float sLower = node.sum[x], sUpper = node.sum[x + 2];
+        Float pLower = sLower / (sLower + sUpper);
+        int y = u[1] < pLower ? 0 : 1;
+        u[1] = y == 0 ? u[1] / pLower : (u[1] - pLower) / (1 - pLower);
+        u = Point2f(std::min(u[0], OneMinusEpsilon),
+                    std::min(u[1], OneMinusEpsilon));
+
+        size /= 2;
+        origin += Vector2f(x * size, y * size);
+        if (node.child[x + 2 * y] == 0) break;
+        index = node.child[x + 2 * y];
+    }
+    return CylindricalToDirection(origin + Vector2f(size * u[0], size * u[1]));
+}
+
+Float DTree::Total() const { return nodes[0].Total(); }
+
+int DTree::Depth() const {
+    int maxDepth = 0;
+    std::vector<std::pair<uint32_t, int>> todo = {{0, 1}};
+    while (!todo.empty()) {
+        std::pair<uint32_t, int> n = todo.back();
+        todo.pop_back();
+        maxDepth = std::max(maxDepth, n.second);
+        for (int i = 0; i < 4; ++i)
+            if (nodes[n.first].child[i] != 0)
+                todo.push_back({nodes[n.first].child[i], n.second + 1});
+    }
+    return maxDepth;
+}
+
+void DTree::ResetSums() {
+    for (Node &node : nodes)
+        for (int i = 0; i < 4; ++i) node.sum[i] = 0;
+}
+
+void DTree::Refine(const DTree &prev, Float subdivisionThreshold,
+                   int maxDepth) {
+    Float total = prev.Total();
+    if (total <= 0) {
+        // Nothing was learned; keep the previous structure
+        *this = prev;
+        ResetSums();
+        return;
+    }
+    nodes.assign(1, Node());
+
+    // Walk both trees together; _prevIndex_ is -1 below the leaves of
+    // _prev_, where energy is assumed to be uniformly distributed
+    struct RefineTodo {
+        int prevIndex;
+        uint32_t index;
+        int depth;
+        Float fraction;
+    };
+    std::vector<RefineTodo> todo = {{0, 0, 1, 1}};
+    while (!todo.empty()) {
+        RefineTodo t = todo.back();
+        todo.pop_back();
+        for (int i = 0; i < 4; ++i) {
+            Float fraction;
+            int prevChild = -1;
+            if (t.prevIndex >= 0) {
+                const Node &prevNode = prev.nodes[t.prevIndex];
+                fraction = prevNode.sum[i] / total;
+                if (prevNode.child[i] != 0) prevChild = prevNode.child[i];
+            } else
+                fraction = t.fraction / 4;
+            if (t.depth < maxDepth && fraction > subdivisionThreshold) {
+                uint32_t child = nodes.size();
+                nodes.push_back(Node());
+                nodes[t.index].child[i] = child;
+                todo.push_back({prevChild, child, t.depth + 1, fraction});
+            }
+        }
+    }
+    nodes.shrink_to_fit();
+}
+
+// SDTree Method Definitions
+SDTree::SDTree(const Bounds3f &b) : nodes(1) {
+    // Use a slightly enlarged cube around the scene so that splits
+    // produce well-shaped cells
+    Point3f center = (b.pMin + b.pMax) / 2;
+    Float radius = 1.0001f * b.Diagonal()[b.MaximumExtent()] / 2 + 1e-4f;
+    bounds = Bounds3f(center - Vector3f(radius, radius, radius),
+                      center + Vector3f(radius, radius, radius));
+    nodes[0].dTree.reset(new DTreeWrapper);
+}
+
+DTreeWrapper *SDTree::Lookup(const Point3f &p) const {
+    Vector3f o = bounds.Offset(p);
+    for (int i = 0; i < 3; ++i) o[i] = Clamp(o[i], 0, 1);
+    int index = 0;
+    while (!nodes[index].dTree) {
+        const Node &node = nodes[index];
+        if (o[node.axis] < .5f) {
+            o[node.axis] *= 2;
+            index = node.children[0];
+        } else {
+            o[node.axis] = 2 * o[node.axis] - 1;
+            index = node.children[1];
+        }
+    }
+    return nodes[index].dTree.get();
+}
+
+void SDTree::Refine(int iteration, size_t maxBytes) {
+    size_t bytes = BytesUsed();
+
+    // Average the scattered radiance recorded in each leaf
+    for (Node &node : nodes)
+        if (node.dTree && node.dTree->nSamples > 0) {
+            node.dTree->outgoingRadiance =
+                node.dTree->outgoingSum / node.dTree->nSamples;
+            node.dTree->outgoingSum = 0;
+        }
+
+    // Split spatial leaves that received more samples than the threshold,
+    // which grows with the square root of the per-pass sample count.
+    // Children are visited after their parents, so leaves are split
+    // recursively until they fall below it.
+    const Float c = 12000;
+    uint64_t splitThreshold = c * std::sqrt((Float)(1ull << iteration));
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (!nodes[i].dTree || nodes[i].dTree->nSamples < splitThreshold)
+            continue;
+        size_t splitBytes = nodes[i].dTree->BytesUsed() + 2 * sizeof(Node);
+        if (bytes + splitBytes > maxBytes) continue;
+        bytes += splitBytes;
+
+        std::unique_ptr<DTreeWrapper> parent = std::move(nodes[i].dTree);
+        parent->nSamples = parent->nSamples / 2;
+        for (int j = 0; j < 2; ++j) {
+            Node child;
+            child.axis = (nodes[i].axis + 1) % 3;
+            child.dTree.reset(new DTreeWrapper(*parent));
+            nodes[i].children[j] = nodes.size();
+            nodes.push_back(std::move(child));
+        }
+    }
+
+    // Make the recorded distributions the sampling ones and refine the
+    // quadtrees that the next pass will record into
+    for (Node &node : nodes) {
+        if (!node.dTree) continue;
+        DTreeWrapper &w = *node.dTree;
+        size_t oldBytes = w.BytesUsed();
+        // Moving, rather than copying, releases the old sampling tree's
+        // memory
+        w.sampling = std::move(w.building);
+        w.building = DTree();
+        w.building.Refine(w.sampling, .01f, 20);
+        // Over the memory limit, keep recording with the sampling tree's
+        // structure, or with just a root node if even that doesn't fit
+        if (bytes + w.BytesUsed() > maxBytes + oldBytes) {
+            w.building = DTree(w.sampling);
+            w.building.ResetSums();
+        }
+        if (bytes + w.BytesUsed() > maxBytes + oldBytes) w.building = DTree();
+        bytes = bytes + w.BytesUsed() - oldBytes;
+        w.nSamples = 0;
+    }
+}
+
+size_t SDTree::BytesUsed() const {
+    size_t bytes = nodes.capacity() * sizeof(Node);
+    for (const Node &node : nodes)
+        if (node.dTree) bytes += node.dTree->BytesUsed();
+    return bytes;
+}
+
+int SDTree::NumLeaves() const {
+    int nLeaves = 0;
+    for (const Node &node : nodes)
+        if (node.dTree) ++nLeaves;
+    return nLeaves;
+}
+
+}  // namespace pbrt
@@ -0,0 +1,180 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_SDTREE_H
+#define PBRT_CORE_SDTREE_H
+
+// core/sdtree.h*
+#include "pbrt.h"
+#include "geometry.h"
+#include "parallel.h"
+#include "rng.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace pbrt {
+
+// Spatial-directional trees ("SD-trees") store a learned approximation of
+// the incident radiance in a scene for path guiding: a binary kd-tree over
+// space whose leaves each hold a quadtree over directions. The trees are
+// trained over a sequence of rendering passes; each pass records into
+// "building" quadtrees while sampling from the ones built by the previous
+// pass. See Muller et al., "Practical Path Guiding for Efficient
+// Light-Transport Simulation" (2017).
+
+// Directions are parameterized over $[0,1]^2$ with the equal-area
+// cylindrical mapping, so that densities over the square and over the
+// sphere differ by the constant factor $4\pi$.
+inline Point2f DirectionToCylindrical(const Vector3f &w) {
+    Float cosTheta = Clamp(w.z, -1, 1);
+    Float phi = std::atan2(w.y, w.x);
+    if (phi < 0) phi += 2 * Pi;
+    return Point2f(Clamp((cosTheta + 1) / 2, 0, 1),
+                   Clamp(phi * Inv2Pi, 0, OneMinusEpsilon));
+}
+
+inline Vector3f CylindricalToDirection(const Point2f &p) {
+    Float cosTheta = 2 * p.x - 1;
+    Float sinTheta = std::sqrt(std::max((Float)0, 1 - cosTheta * cosTheta));
+    Float phi = 2 * Pi * p.y;
+    return Vector3f(sinTheta * std::cos(phi), sinTheta * std::sin(phi),
+                    cosTheta);
+}
+
+// DTree Declarations
+class DTree {
+  public:
+    // DTree Public Methods
+    DTree() : nodes(1) {}
+    void Record(const Vector3f &w, Float value);
+    Float Pdf(const Vector3f &w) const;
+    Vector3f Sample(Point2f u) const;
+    Float Total() const;
+    int Depth() const;
+    size_t NumNodes() const { return nodes.size(); }
+    size_t BytesUsed() const { return nodes.capacity() * sizeof(Node); }
+    void ResetSums();
+    // Builds the structure of an empty tree from the energy recorded in
+    // _prev_: quadrants holding more than _subdivisionThreshold_ of the
+    // total are subdivided, down to _maxDepth_ levels.
+    void Refine(const DTree &prev, Float subdivisionThreshold, int maxDepth);
+
+  private:
+    // DTree Private Data
+    struct Node {
+        Node() {
+            for (int i = 0; i < 4; ++i) child[i] = 0;
+        }
+        Node(const Node &n) { *this = n; }
+        Node &operator=(const Node &n) {
+            for (int i = 0; i < 4; ++i) {
+                sum[i] = (Float)n.sum[i];
+                child[i] = n.child[i];
+            }
+            return *this;
+        }
+        Float Total() const { return sum[0] + sum[1] + sum[2] + sum[3]; }
+        // Quadrant $i$ covers $x \in [i \bmod 2, i \bmod 2 + 1)/2$ and $y
+        // \in [\lfloor i/2 \rfloor, \lfloor i/2 \rfloor + 1)/2$ of the
+        // node; a zero child index marks a leaf quadrant.
+        AtomicFloat sum[4];
+        uint32_t child[4];
+    };
+    std::vector<Node> nodes;
+};
+
+// DTreeWrapper Declarations
+struct DTreeWrapper {
+    DTreeWrapper() : nSamples(0) {}
+    DTreeWrapper(const DTreeWrapper &w)
+        : sampling(w.sampling),
+          building(w.building),
+          nSamples((uint64_t)w.nSamples),
+          outgoingSum((Float)w.outgoingSum),
+          outgoingRadiance(w.outgoingRadiance) {}
+    void Record(const Vector3f &w, Float value) {
+        building.Record(w, value);
+        ++nSamples;
+    }
+    // Records the luminance of the radiance scattered at a vertex in the
+    // leaf toward the previous vertex, excluding directly sampled light;
+    // it must be paired with a call to Record().
+    void RecordOutgoing(Float Lo) { outgoingSum.Add(Lo); }
+    Float Pdf(const Vector3f &w) const { return sampling.Pdf(w); }
+    Vector3f Sample(const Point2f &u) const { return sampling.Sample(u); }
+    size_t BytesUsed() const {
+        return sizeof(*this) + sampling.BytesUsed() + building.BytesUsed();
+    }
+
+    DTree sampling, building;
+    std::atomic<uint64_t> nSamples;
+    AtomicFloat outgoingSum;
+    // Average of the recorded scattered radiance from the last pass that
+    // recorded samples in the leaf
+    Float outgoingRadiance = 0;
+};
+
+// SDTree Declarations
+class SDTree {
+  public:
+    // SDTree Public Methods
+    SDTree(const Bounds3f &bounds);
+    DTreeWrapper *Lookup(const Point3f &p) const;
+    // Prepares the tree for the next pass after training pass _iteration_
+    // has finished: spatial leaves that received many samples are split,
+    // and the recorded quadtrees become the sampling distributions.
+    // Spatial splits and directional refinement stop once the tree would
+    // use more than _maxBytes_.
+    void Refine(int iteration, size_t maxBytes);
+    size_t BytesUsed() const;
+    int NumLeaves() const;
+
+  private:
+    // SDTree Private Data
+    struct Node {
+        int axis = 0;
+        int children[2] = {0, 0};
+        std::unique_ptr<DTreeWrapper> dTree;
+    };
+    std::vector<Node> nodes;
+    Bounds3f bounds;
+};
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_SDTREE_H
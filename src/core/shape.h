@@ -82,6 +82,13 @@ class Shape {
     // used in this case.
     virtual Float SolidAngle(const Point3f &p, int nSamples = 512) const;
 
+    // Shapes whose geometric normals all lie within a cone of directions
+    // can return its axis and the cosine of its half-angle here; by
+    // default, no bound is provided.
+    virtual bool NormalBounds(Vector3f *w, Float *cosTheta) const {
+        return false;
+    }
+
     // Shape Public Data
     const Transform *ObjectToWorld, *WorldToObject;
     const bool reverseOrientation;
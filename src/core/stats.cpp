@@ -39,18 +39,38 @@
 #include <cinttypes>
 #include <functional>
 #include <mutex>
+#include <set>
 #include <type_traits>
 #include "parallel.h"
 #include "stringprint.h"
 #ifdef PBRT_HAVE_ITIMER
 #include <sys/time.h>
 #endif  // PBRT_HAVE_ITIMER
+#ifndef PBRT_IS_WINDOWS
+#include <sys/resource.h>
+#endif  // !PBRT_IS_WINDOWS
+#ifdef PBRT_HAVE_BACKTRACE
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#endif  // PBRT_HAVE_BACKTRACE
+#ifdef PBRT_HAVE_PERF_EVENT
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif  // PBRT_HAVE_PERF_EVENT
 
 namespace pbrt {
 
 // Statistics Local Variables
 std::vector<std::function<void(StatsAccumulator &)>> *StatRegisterer::funcs;
 static StatsAccumulator statsAccumulator;
+// Wall-clock times reported by ReportWallTime(), in the order reported.
+static std::vector<std::pair<std::string, double>> wallTimes;
+// The process's peak memory use at the end of each of those phases.
+static std::vector<std::pair<std::string, int64_t>> phasePeakMemory;
 
 // For a given profiler state (i.e., a set of "on" bits corresponding to
 // profiling categories that are active), ProfileSample stores a count of
@@ -70,10 +90,113 @@ static const int profileHashSize = 256;
 static std::array<ProfileSample, profileHashSize> profileSamples;
 
 static std::chrono::system_clock::time_point profileStartTime;
+// Samples are taken at this rate (in Hz) of the process's CPU time.
+static const int profileSamplingRate = 100;
+
+// Each thread's samples are also counted by the innermost active category,
+// giving a per-thread breakdown of where time went. Threads past the end
+// of the table share its last row.
+static const int profileMaxThreads = 256;
+static std::array<std::array<std::atomic<uint64_t>,
+                             (int)Prof::NumProfCategories>,
+                  profileMaxThreads> threadSamples;
+
+#ifdef PBRT_HAVE_BACKTRACE
+// When call stacks are being recorded, the profiling signal handler also
+// captures the interrupted thread's stack and counts it in a fixed-size
+// hash table keyed by a hash of the return addresses; this is allocated
+// before the timer starts, since the handler can't allocate memory.
+// Each entry is claimed by atomically setting its hash, after which the
+// thread that claimed it fills in the frames and then sets _ready_.
+static const int profileMaxStackDepth = 64;
+static const int profileStackHashSize = 1 << 14;
+struct StackSample {
+    std::atomic<uint64_t> hash{0};
+    std::atomic<uint64_t> count{0};
+    std::atomic<bool> ready{false};
+    int depth;
+    void *frames[profileMaxStackDepth];
+};
+static std::unique_ptr<StackSample[]> stackSamples;
+static std::atomic<uint64_t> droppedStackSamples{0};
+
+static uint64_t MixBits(uint64_t v) {
+    v ^= (v >> 31);
+    v *= 0x7fb5d329728ea185;
+    v ^= (v >> 27);
+    v *= 0x81dadef4bc2dd44d;
+    v ^= (v >> 33);
+    return v;
+}
+#endif  // PBRT_HAVE_BACKTRACE
+
+#ifdef PBRT_HAVE_PERF_EVENT
+// With PbrtOptions.perfCounters set, each thread opens a set of hardware
+// performance counters that raise a signal each time _period_ events have
+// been counted; the signal handler charges those events to the thread's
+// innermost active category. This gives unbiased per-category counts
+// without reading the counters at every ProfilePhase transition.
+struct PerfCounter {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+    uint64_t period;
+};
+static const PerfCounter hardwarePerfCounters[] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 10000000},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 10000000},
+    {"llcMisses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, 10000},
+    {"branchMisses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, 50000},
+};
+// With PbrtOptions.perfCountersSoftware set, the kernel's clocks take the
+// place of the hardware counters, in nanoseconds, so that the accounting
+// can be tested on systems without a PMU.
+static const PerfCounter softwarePerfCounters[] = {
+    {"taskClock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, 1000000},
+    {"cpuClock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK, 1000000},
+    {"taskClock4ms", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, 4000000},
+    {"cpuClock4ms", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK, 4000000},
+};
+enum { PerfCycles, PerfInstructions, PerfLLCMisses, PerfBranchMisses,
+       NumPerfCounters };
+static_assert(sizeof(hardwarePerfCounters) /
+                      sizeof(hardwarePerfCounters[0]) ==
+                  NumPerfCounters &&
+              sizeof(softwarePerfCounters) /
+                      sizeof(softwarePerfCounters[0]) ==
+                  NumPerfCounters,
+              "PerfCounter entries missing");
+static const PerfCounter *PerfCounters() {
+    return PbrtOptions.perfCountersSoftware ? softwarePerfCounters
+                                            : hardwarePerfCounters;
+}
+static std::array<std::array<std::array<std::atomic<uint64_t>,
+                                        NumPerfCounters>,
+                             (int)Prof::NumProfCategories>,
+                  profileMaxThreads> perfCounts;
+// The calling thread's counter file descriptors, or -1 if the counter
+// couldn't be opened.
+static PBRT_THREAD_LOCAL int threadPerfFds[NumPerfCounters] = {-1, -1, -1,
+                                                                 -1};
+static std::mutex perfFdsMutex;
+static std::vector<int> perfFds;
+static std::array<std::atomic<bool>, NumPerfCounters> perfCounterOpened;
+static std::atomic<int> perfCounterError{0};
+static void OpenPerfCounters();
+static void ClosePerfCounters();
+static void ReportPerfCounterOverflow(int, siginfo_t *, void *);
+#endif  // PBRT_HAVE_PERF_EVENT
 
 #ifdef PBRT_HAVE_ITIMER
 static void ReportProfileSample(int, siginfo_t *, void *);
+#ifdef PBRT_HAVE_BACKTRACE
+static void RecordStackSample();
+#endif  // PBRT_HAVE_BACKTRACE
 #endif  // PBRT_HAVE_ITIMER
+#ifdef PBRT_HAVE_BACKTRACE
+static const std::string &FrameName(void *pc,
+                                    std::map<void *, std::string> *names);
+#endif  // PBRT_HAVE_BACKTRACE
 
 // Statistics Definitions
 void ReportThreadStats() {
@@ -88,7 +211,40 @@ void StatRegisterer::CallCallbacks(StatsAccumulator &accum) {
 
 void PrintStats(FILE *dest) { statsAccumulator.Print(dest); }
 
-void ClearStats() { statsAccumulator.Clear(); }
+void ClearStats() {
+    statsAccumulator.Clear();
+    wallTimes.clear();
+    phasePeakMemory.clear();
+}
+
+// Returns the peak resident set size of the process so far, in bytes, or
+// -1 if it isn't available.
+static int64_t PeakMemoryBytes() {
+#ifndef PBRT_IS_WINDOWS
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+        return usage.ru_maxrss;
+#else
+        return int64_t(usage.ru_maxrss) * 1024;
+#endif
+    }
+#endif  // !PBRT_IS_WINDOWS
+    return -1;
+}
+
+void ReportWallTime(const std::string &title, double seconds) {
+    int64_t peakBytes = PeakMemoryBytes();
+    for (size_t i = 0; i < wallTimes.size(); ++i)
+        if (wallTimes[i].first == title) {
+            wallTimes[i].second += seconds;
+            phasePeakMemory[i].second =
+                std::max(phasePeakMemory[i].second, peakBytes);
+            return;
+        }
+    wallTimes.push_back(std::make_pair(title, seconds));
+    phasePeakMemory.push_back(std::make_pair(title, peakBytes));
+}
 
 static void getCategoryAndTitle(const std::string &str, std::string *category,
                                 std::string *title) {
@@ -186,6 +342,92 @@ void StatsAccumulator::Print(FILE *dest) {
     }
 }
 
+// Returns _str_ as a quoted JSON string.
+static std::string JSONString(const std::string &str) {
+    std::string result = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\')
+            result += std::string("\\") + c;
+        else if ((unsigned char)c < 0x20)
+            result += StringPrintf("\\u%04x", c);
+        else
+            result += c;
+    }
+    return result + "\"";
+}
+
+void StatsAccumulator::PrintJSON(FILE *dest) {
+    // Counters and memory counters are written as plain values keyed by
+    // their full "Category/Title" names.
+    const char *sep = "";
+    fprintf(dest, "  \"counters\": {");
+    for (auto &counter : counters) {
+        fprintf(dest, "%s\n    %s: %" PRId64, sep,
+                JSONString(counter.first).c_str(), counter.second);
+        sep = ",";
+    }
+    fprintf(dest, "\n  },\n  \"memory\": {");
+    sep = "";
+    for (auto &counter : memoryCounters) {
+        fprintf(dest, "%s\n    %s: %" PRId64, sep,
+                JSONString(counter.first).c_str(), counter.second);
+        sep = ",";
+    }
+    fprintf(dest, "\n  },\n  \"distributions\": {");
+    sep = "";
+    for (auto &sum : intDistributionSums) {
+        int64_t count = intDistributionCounts[sum.first];
+        if (count == 0) continue;
+        fprintf(dest,
+                "%s\n    %s: {\"count\": %" PRId64 ", \"mean\": %.9g, "
+                "\"min\": %" PRId64 ", \"max\": %" PRId64 "}",
+                sep, JSONString(sum.first).c_str(), count,
+                (double)sum.second / count, intDistributionMins[sum.first],
+                intDistributionMaxs[sum.first]);
+        sep = ",";
+    }
+    for (auto &sum : floatDistributionSums) {
+        int64_t count = floatDistributionCounts[sum.first];
+        if (count == 0) continue;
+        fprintf(dest,
+                "%s\n    %s: {\"count\": %" PRId64 ", \"mean\": %.9g, "
+                "\"min\": %.9g, \"max\": %.9g}",
+                sep, JSONString(sum.first).c_str(), count, sum.second / count,
+                floatDistributionMins[sum.first],
+                floatDistributionMaxs[sum.first]);
+        sep = ",";
+    }
+    // Percentages and ratios keep their numerators and denominators.
+    fprintf(dest, "\n  },\n  \"ratios\": {");
+    sep = "";
+    for (auto *fractions : {&percentages, &ratios})
+        for (auto &fraction : *fractions) {
+            fprintf(dest, "%s\n    %s: [%" PRId64 ", %" PRId64 "]", sep,
+                    JSONString(fraction.first).c_str(), fraction.second.first,
+                    fraction.second.second);
+            sep = ",";
+        }
+    fprintf(dest, "\n  },\n");
+
+    // Summarize the rays traced, with the rate at which they were traced if
+    // the rendering time was reported.
+    auto counter = [&](const char *name) {
+        auto iter = counters.find(name);
+        return iter == counters.end() ? 0 : iter->second;
+    };
+    int64_t nCameraRays = counter("Integrator/Camera rays traced");
+    int64_t nRays = counter("Intersections/Regular ray intersection tests");
+    int64_t nShadowRays = counter("Intersections/Shadow ray intersection tests");
+    double renderTime = 0;
+    for (const auto &t : wallTimes)
+        if (t.first == "Rendering") renderTime = t.second;
+    fprintf(dest,
+            "  \"rays\": {\"camera\": %" PRId64 ", \"intersection\": %" PRId64
+            ", \"shadow\": %" PRId64 ", \"perSecond\": %.9g}",
+            nCameraRays, nRays, nShadowRays,
+            renderTime > 0 ? (nRays + nShadowRays) / renderTime : 0.);
+}
+
 void StatsAccumulator::Clear() {
     counters.clear();
     memoryCounters.clear();
@@ -215,6 +457,37 @@ void InitProfiler() {
 
     ClearProfiler();
 
+#if defined(PBRT_HAVE_ITIMER) && defined(PBRT_HAVE_BACKTRACE)
+    stackSamples.reset();
+    if (!PbrtOptions.profileStacksFile.empty()) {
+        stackSamples.reset(new StackSample[profileStackHashSize]);
+        // The first call to backtrace() may load the unwinder, which
+        // mustn't happen in the signal handler.
+        void *frames[profileMaxStackDepth];
+        backtrace(frames, profileMaxStackDepth);
+    }
+#endif  // PBRT_HAVE_ITIMER && PBRT_HAVE_BACKTRACE
+
+#ifdef PBRT_HAVE_PERF_EVENT
+    if (PbrtOptions.perfCounters) {
+        OpenPerfCounters();
+        // The worker threads have opened theirs by now, so any failure
+        // has been recorded.
+        std::string missing;
+        for (int i = 0; i < NumPerfCounters; ++i)
+            if (!perfCounterOpened[i])
+                missing += std::string(missing.empty() ? "" : ", ") +
+                           PerfCounters()[i].name;
+        if (!missing.empty())
+            Warning("Unable to open hardware performance counters (%s): "
+                    "%s", missing.c_str(), strerror(perfCounterError));
+    }
+#else
+    if (PbrtOptions.perfCounters)
+        Warning("Hardware performance counters aren't supported on this "
+                "system.");
+#endif  // PBRT_HAVE_PERF_EVENT
+
     profileStartTime = std::chrono::system_clock::now();
 // Set timer to periodically interrupt the system for profiling
 #ifdef PBRT_HAVE_ITIMER
@@ -227,7 +500,7 @@ void InitProfiler() {
 
     static struct itimerval timer;
     timer.it_interval.tv_sec = 0;
-    timer.it_interval.tv_usec = 1000000 / 100;  // 100 Hz sampling
+    timer.it_interval.tv_usec = 1000000 / profileSamplingRate;
     timer.it_value = timer.it_interval;
 
     CHECK_EQ(setitimer(ITIMER_PROF, &timer, NULL), 0)
@@ -242,7 +515,7 @@ void SuspendProfiler() { ++profilerSuspendCount; }
 
 void ResumeProfiler() { CHECK_GE(--profilerSuspendCount, 0); }
 
-void ProfilerWorkerThreadInit() {
+void ProfilerWorkerThreadInit(bool countEvents) {
 #ifdef PBRT_HAVE_ITIMER
     // The per-thread initialization in the worker threads has to happen
     // *before* the profiling signal handler is installed.
@@ -255,6 +528,9 @@ void ProfilerWorkerThreadInit() {
     // allowed.
     ProfilerState = ProfToBits(Prof::SceneConstruction);
 #endif  // PBRT_HAVE_ITIMER
+#ifdef PBRT_HAVE_PERF_EVENT
+    if (PbrtOptions.perfCounters && countEvents) OpenPerfCounters();
+#endif  // PBRT_HAVE_PERF_EVENT
 }
 
 void ClearProfiler() {
@@ -262,6 +538,22 @@ void ClearProfiler() {
         ps.profilerState = 0;
         ps.count = 0;
     }
+    for (auto &thread : threadSamples)
+        for (std::atomic<uint64_t> &count : thread) count = 0;
+#ifdef PBRT_HAVE_PERF_EVENT
+    for (auto &thread : perfCounts)
+        for (auto &category : thread)
+            for (std::atomic<uint64_t> &count : category) count = 0;
+#endif  // PBRT_HAVE_PERF_EVENT
+#ifdef PBRT_HAVE_BACKTRACE
+    if (stackSamples)
+        for (int i = 0; i < profileStackHashSize; ++i) {
+            stackSamples[i].hash = 0;
+            stackSamples[i].count = 0;
+            stackSamples[i].ready = false;
+        }
+    droppedStackSamples = 0;
+#endif  // PBRT_HAVE_BACKTRACE
 }
 
 void CleanupProfiler() {
@@ -275,9 +567,122 @@ void CleanupProfiler() {
     CHECK_EQ(setitimer(ITIMER_PROF, &timer, NULL), 0)
         << "Timer could not be disabled: " << strerror(errno);
 #endif  // PBRT_HAVE_ITIMER
+#ifdef PBRT_HAVE_PERF_EVENT
+    ClosePerfCounters();
+#endif  // PBRT_HAVE_PERF_EVENT
     profilerRunning = false;
 }
 
+#ifdef PBRT_HAVE_PERF_EVENT
+static void OpenPerfCounters() {
+    // The handler must be in place before the first counter is enabled,
+    // since the default action for real-time signals is to terminate.
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = ReportPerfCounterOverflow;
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGRTMIN, &sa, NULL);
+
+    for (int i = 0; i < NumPerfCounters; ++i) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        const PerfCounter &counter = PerfCounters()[i];
+        attr.type = counter.type;
+        attr.config = counter.config;
+        attr.sample_period = counter.period;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        int fd = syscall(__NR_perf_event_open, &attr, 0 /* this thread */,
+                         -1 /* any CPU */, -1, PERF_FLAG_FD_CLOEXEC);
+        if (fd < 0) {
+            perfCounterError = errno;
+            continue;
+        }
+
+        // Have overflows delivered as a signal to this thread, with the
+        // counter's file descriptor in _si_fd_.
+        struct f_owner_ex owner;
+        owner.type = F_OWNER_TID;
+        owner.pid = syscall(SYS_gettid);
+        if (fcntl(fd, F_SETFL, O_ASYNC | O_NONBLOCK) != 0 ||
+            fcntl(fd, F_SETSIG, SIGRTMIN) != 0 ||
+            fcntl(fd, F_SETOWN_EX, &owner) != 0) {
+            perfCounterError = errno;
+            close(fd);
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(perfFdsMutex);
+            perfFds.push_back(fd);
+        }
+        threadPerfFds[i] = fd;
+        perfCounterOpened[i] = true;
+        // Enable the counter until its next overflow; the signal handler
+        // re-arms it.
+        ioctl(fd, PERF_EVENT_IOC_REFRESH, 1);
+    }
+}
+
+static void ClosePerfCounters() {
+    std::lock_guard<std::mutex> lock(perfFdsMutex);
+    for (int fd : perfFds) close(fd);
+    perfFds.clear();
+    for (int i = 0; i < NumPerfCounters; ++i) {
+        threadPerfFds[i] = -1;
+        perfCounterOpened[i] = false;
+    }
+    perfCounterError = 0;
+}
+
+static void ReportPerfCounterOverflow(int, siginfo_t *info, void *) {
+    int savedErrno = errno;
+    for (int i = 0; i < NumPerfCounters; ++i) {
+        if (threadPerfFds[i] != info->si_fd) continue;
+        if (profilerSuspendCount == 0 && ProfilerState != 0) {
+            int thread = std::min(ThreadIndex, profileMaxThreads - 1);
+            perfCounts[thread][Log2Int(ProfilerState)][i].fetch_add(
+                PerfCounters()[i].period, std::memory_order_relaxed);
+        }
+        ioctl(info->si_fd, PERF_EVENT_IOC_REFRESH, 1);
+        break;
+    }
+    errno = savedErrno;
+}
+
+// Returns true if any counts were recorded, so that the reports can skip
+// the counters if they weren't enabled or available.
+static bool HavePerfCounts() {
+    for (const auto &thread : perfCounts)
+        for (const auto &category : thread)
+            for (const std::atomic<uint64_t> &count : category)
+                if (count > 0) return true;
+    return false;
+}
+
+// Returns the number of events of type _counter_ per thousand
+// instructions, or -1 if there aren't enough to tell.
+static double PerKiloInstruction(
+    const std::array<uint64_t, NumPerfCounters> &counts, int counter) {
+    if (counts[PerfInstructions] == 0) return -1;
+    return 1000. * counts[counter] / counts[PerfInstructions];
+}
+
+static void ReportPerfCounts(
+    FILE *dest, const std::string &name,
+    const std::array<uint64_t, NumPerfCounters> &counts) {
+    double ipc = counts[PerfCycles] > 0
+                     ? (double)counts[PerfInstructions] / counts[PerfCycles]
+                     : 0;
+    fprintf(dest, "    %-38s %9.3f %6.2f %7.3f %7.3f\n", name.c_str(),
+            1e-9 * counts[PerfCycles], ipc,
+            PerKiloInstruction(counts, PerfLLCMisses),
+            PerKiloInstruction(counts, PerfBranchMisses));
+}
+#endif  // PBRT_HAVE_PERF_EVENT
+
 #ifdef PBRT_HAVE_ITIMER
 static void ReportProfileSample(int, siginfo_t *, void *) {
     if (profilerSuspendCount > 0) return;
@@ -295,7 +700,51 @@ static void ReportProfileSample(int, siginfo_t *, void *) {
     CHECK_NE(count, profileHashSize) << "Profiler hash table filled up!";
     profileSamples[h].profilerState = ProfilerState;
     ++profileSamples[h].count;
+
+    int thread = std::min(ThreadIndex, profileMaxThreads - 1);
+    threadSamples[thread][Log2Int(ProfilerState)].fetch_add(
+        1, std::memory_order_relaxed);
+
+#ifdef PBRT_HAVE_BACKTRACE
+    if (stackSamples) RecordStackSample();
+#endif  // PBRT_HAVE_BACKTRACE
+}
+
+#ifdef PBRT_HAVE_BACKTRACE
+PBRT_NOINLINE static void RecordStackSample() {
+    // Capture the stack, skipping this function, the signal handler, and
+    // the kernel's signal trampoline
+    const int skip = 3;
+    void *frames[profileMaxStackDepth + skip];
+    int depth = backtrace(frames, profileMaxStackDepth + skip) - skip;
+    if (depth <= 0) return;
+
+    // Find or claim the stack's entry in the hash table; zero is reserved
+    // for empty entries
+    uint64_t hash = MixBits(depth);
+    for (int i = 0; i < depth; ++i)
+        hash = MixBits(hash ^ (uint64_t)frames[i + skip]);
+    hash = std::max<uint64_t>(hash, 1);
+    int h = hash & (profileStackHashSize - 1);
+    const int maxProbes = 256;
+    for (int probe = 0; probe < maxProbes; ++probe) {
+        StackSample &ss = stackSamples[h];
+        uint64_t entryHash = ss.hash.load(std::memory_order_acquire);
+        if (entryHash == 0 &&
+            ss.hash.compare_exchange_strong(entryHash, hash)) {
+            ss.depth = depth;
+            for (int i = 0; i < depth; ++i) ss.frames[i] = frames[i + skip];
+            ss.ready.store(true, std::memory_order_release);
+        }
+        if (entryHash == 0 || entryHash == hash) {
+            ss.count.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (++h == profileStackHashSize) h = 0;
+    }
+    ++droppedStackSamples;
 }
+#endif  // PBRT_HAVE_BACKTRACE
 #endif  // PBRT_HAVE_ITIMER
 
 static std::string timeString(float pct, std::chrono::system_clock::time_point now) {
@@ -315,10 +764,13 @@ static std::string timeString(float pct, std::chrono::system_clock::time_point n
     return StringPrintf("%4d:%02d:%02d.%02d", h, m, s, ms);
 }
 
-void ReportProfilerResults(FILE *dest) {
-#ifdef PBRT_HAVE_ITIMER
-    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
-
+// Sums the profile samples for each nesting of categories (e.g.
+// "Integrator::Render()/Accelerator::Intersect()"), including them in
+// their parents' sums, and for each innermost category. Returns the total
+// number of samples.
+static uint64_t GatherProfileResults(
+    std::map<std::string, uint64_t> *hierarchicalResults,
+    std::map<std::string, uint64_t> *flatResults) {
     PBRT_CONSTEXPR int NumProfCategories = (int)Prof::NumProfCategories;
     uint64_t overallCount = 0;
     int used = 0;
@@ -331,8 +783,6 @@ void ReportProfilerResults(FILE *dest) {
     LOG(INFO) << "Used " << used << " / " << profileHashSize
               << " entries in profiler hash table";
 
-    std::map<std::string, uint64_t> flatResults;
-    std::map<std::string, uint64_t> hierarchicalResults;
     for (const ProfileSample &ps : profileSamples) {
         if (ps.count == 0) continue;
 
@@ -341,18 +791,30 @@ void ReportProfilerResults(FILE *dest) {
             if (ps.profilerState & (1ull << b)) {
                 if (s.size() > 0) {
                     // contribute to the parents...
-                    hierarchicalResults[s] += ps.count;
+                    (*hierarchicalResults)[s] += ps.count;
                     s += "/";
                 }
                 s += ProfNames[b];
             }
         }
-        hierarchicalResults[s] += ps.count;
+        (*hierarchicalResults)[s] += ps.count;
 
         int nameIndex = Log2Int(ps.profilerState);
         DCHECK_LT(nameIndex, NumProfCategories);
-        flatResults[ProfNames[nameIndex]] += ps.count;
+        (*flatResults)[ProfNames[nameIndex]] += ps.count;
     }
+    return overallCount;
+}
+
+void ReportProfilerResults(FILE *dest) {
+#ifdef PBRT_HAVE_ITIMER
+    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+
+    PBRT_CONSTEXPR int NumProfCategories = (int)Prof::NumProfCategories;
+    std::map<std::string, uint64_t> flatResults;
+    std::map<std::string, uint64_t> hierarchicalResults;
+    uint64_t overallCount =
+        GatherProfileResults(&hierarchicalResults, &flatResults);
 
     fprintf(dest, "  Profile\n");
     for (const auto &r : hierarchicalResults) {
@@ -387,8 +849,306 @@ void ReportProfilerResults(FILE *dest) {
                 std::max(0, int(67 - strlen(toPrint) - indent)), ' ', pct,
                 timeString(pct, now).c_str());
     }
+
+    // Report each thread's share of the samples along with the category
+    // it spent the most time in, so that poor load balance stands out.
+    fprintf(dest, "  Profile (per thread)\n");
+    for (int t = 0; t < profileMaxThreads; ++t) {
+        uint64_t threadCount = 0, maxCount = 0;
+        int maxCategory = 0;
+        for (int c = 0; c < NumProfCategories; ++c) {
+            uint64_t count = threadSamples[t][c];
+            threadCount += count;
+            if (count > maxCount) {
+                maxCount = count;
+                maxCategory = c;
+            }
+        }
+        if (threadCount == 0) continue;
+        float pct = (100.f * threadCount) / overallCount;
+        std::string name =
+            StringPrintf("Thread %d%s (", t,
+                         t == profileMaxThreads - 1 ? "+" : "") +
+            StringPrintf("%.1f", (100.f * maxCount) / threadCount) + "% " +
+            ProfNames[maxCategory] + ")";
+        fprintf(dest, "    %s%*c %5.2f%% (%s)\n", name.c_str(),
+                std::max(0, int(63 - name.size())), ' ', pct,
+                timeString(pct, now).c_str());
+    }
+
+#ifdef PBRT_HAVE_PERF_EVENT
+    if (HavePerfCounts()) {
+        // Report the hardware counters by innermost category, sorted by
+        // cycles, and then per thread. Cache and branch misses are given
+        // per thousand instructions.
+        std::vector<std::pair<int, std::array<uint64_t, NumPerfCounters>>>
+            categoryCounts;
+        std::vector<std::array<uint64_t, NumPerfCounters>> threadCounts(
+            profileMaxThreads);
+        for (int c = 0; c < NumProfCategories; ++c) {
+            std::array<uint64_t, NumPerfCounters> counts = {};
+            for (int t = 0; t < profileMaxThreads; ++t)
+                for (int i = 0; i < NumPerfCounters; ++i) {
+                    counts[i] += perfCounts[t][c][i];
+                    threadCounts[t][i] += perfCounts[t][c][i];
+                }
+            if (counts[PerfCycles] > 0 || counts[PerfInstructions] > 0)
+                categoryCounts.push_back(std::make_pair(c, counts));
+        }
+        std::sort(categoryCounts.begin(), categoryCounts.end(),
+                  [](const std::pair<int, std::array<uint64_t,
+                                                     NumPerfCounters>> &a,
+                     const std::pair<int, std::array<uint64_t,
+                                                     NumPerfCounters>> &b) {
+                      return a.second[PerfCycles] > b.second[PerfCycles];
+                  });
+
+        fprintf(dest, "  Profile (hardware counters)%*c %9s %6s %7s %7s\n",
+                13, ' ', "Gcycles", "IPC", "LLC/ki", "br/ki");
+        for (const auto &cc : categoryCounts)
+            ReportPerfCounts(dest, ProfNames[cc.first], cc.second);
+        for (int t = 0; t < profileMaxThreads; ++t)
+            if (threadCounts[t][PerfCycles] > 0 ||
+                threadCounts[t][PerfInstructions] > 0)
+                ReportPerfCounts(
+                    dest,
+                    StringPrintf("Thread %d%s", t,
+                                 t == profileMaxThreads - 1 ? "+" : ""),
+                    threadCounts[t]);
+    }
+#endif  // PBRT_HAVE_PERF_EVENT
+
+#ifdef PBRT_HAVE_BACKTRACE
+    if (stackSamples) {
+        // Report the functions that the most samples were taken in
+        // ("self") and the ones that were most often on the stack
+        // ("total"), counting recursive calls once per sample.
+        std::map<std::string, std::pair<uint64_t, uint64_t>> functions;
+        std::map<void *, std::string> names;
+        uint64_t stackCount = 0;
+        for (int i = 0; i < profileStackHashSize; ++i) {
+            const StackSample &ss = stackSamples[i];
+            if (!ss.ready) continue;
+            stackCount += ss.count;
+            std::set<std::string> seen;
+            for (int f = 0; f < ss.depth; ++f) {
+                const std::string &name = FrameName(ss.frames[f], &names);
+                if (f == 0) functions[name].first += ss.count;
+                if (seen.insert(name).second)
+                    functions[name].second += ss.count;
+            }
+        }
+        std::vector<std::pair<std::string, std::pair<uint64_t, uint64_t>>>
+            functionVec(functions.begin(), functions.end());
+        std::sort(functionVec.begin(), functionVec.end(),
+                  [](const std::pair<std::string,
+                                     std::pair<uint64_t, uint64_t>> &a,
+                     const std::pair<std::string,
+                                     std::pair<uint64_t, uint64_t>> &b) {
+                      return a.second.first > b.second.first;
+                  });
+        fprintf(dest, "  Profile (functions, self / total)\n");
+        const int maxFunctions = 30;
+        for (size_t i = 0;
+             i < std::min<size_t>(maxFunctions, functionVec.size()); ++i) {
+            std::string name = functionVec[i].first;
+            if (name.size() > 58) name = name.substr(0, 55) + "...";
+            fprintf(dest, "    %-58s %6.2f%% / %6.2f%%\n", name.c_str(),
+                    (100.f * functionVec[i].second.first) / stackCount,
+                    (100.f * functionVec[i].second.second) / stackCount);
+        }
+        if (droppedStackSamples > 0)
+            fprintf(dest, "    (%" PRIu64 " samples with too many distinct "
+                    "stacks to record)\n", droppedStackSamples.load());
+    }
+#endif  // PBRT_HAVE_BACKTRACE
     fprintf(dest, "\n");
 #endif
 }
 
+bool WriteStatsJSON(const std::string &filename) {
+    FILE *f = fopen(filename.c_str(), "w");
+    if (!f) {
+        Error("%s: unable to open statistics file", filename.c_str());
+        return false;
+    }
+    fprintf(f, "{\n  \"wallTime\": {");
+    const char *sep = "";
+    for (const auto &t : wallTimes) {
+        fprintf(f, "%s\n    %s: %.6f", sep, JSONString(t.first).c_str(),
+                t.second);
+        sep = ",";
+    }
+    fprintf(f, "\n  },\n");
+
+    // Report the process's CPU time and peak resident set size, both
+    // overall and as of the end of each timed phase.
+#ifndef PBRT_IS_WINDOWS
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        fprintf(f, "  \"cpuTime\": {\"user\": %.6f, \"system\": %.6f},\n",
+                usage.ru_utime.tv_sec + 1e-6 * usage.ru_utime.tv_usec,
+                usage.ru_stime.tv_sec + 1e-6 * usage.ru_stime.tv_usec);
+#endif  // !PBRT_IS_WINDOWS
+    int64_t peakBytes = PeakMemoryBytes();
+    if (peakBytes >= 0) {
+        fprintf(f, "  \"peakMemory\": %" PRId64 ",\n", peakBytes);
+        fprintf(f, "  \"phasePeakMemory\": {");
+        sep = "";
+        for (const auto &m : phasePeakMemory) {
+            fprintf(f, "%s\n    %s: %" PRId64, sep,
+                    JSONString(m.first).c_str(), m.second);
+            sep = ",";
+        }
+        fprintf(f, "\n  },\n");
+    }
+
+    statsAccumulator.PrintJSON(f);
+
+#ifdef PBRT_HAVE_ITIMER
+    // The profile gives the CPU time spent in each category, estimated
+    // from the number of samples taken in it, both nested as in the text
+    // report and by innermost category.
+    std::map<std::string, uint64_t> flatResults, hierarchicalResults;
+    uint64_t overallCount =
+        GatherProfileResults(&hierarchicalResults, &flatResults);
+    fprintf(f, ",\n  \"profile\": {\n    \"samples\": %" PRIu64
+            ",\n    \"sampleRate\": %d,\n    \"phases\": {",
+            overallCount, profileSamplingRate);
+    sep = "";
+    for (const auto &r : hierarchicalResults) {
+        fprintf(f, "%s\n      %s: {\"fraction\": %.6f, \"cpuSeconds\": %.2f}",
+                sep, JSONString(r.first).c_str(),
+                (double)r.second / overallCount,
+                (double)r.second / profileSamplingRate);
+        sep = ",";
+    }
+    fprintf(f, "\n    },\n    \"flat\": {");
+    sep = "";
+    for (const auto &r : flatResults) {
+        fprintf(f, "%s\n      %s: {\"fraction\": %.6f, \"cpuSeconds\": %.2f}",
+                sep, JSONString(r.first).c_str(),
+                (double)r.second / overallCount,
+                (double)r.second / profileSamplingRate);
+        sep = ",";
+    }
+    fprintf(f, "\n    }\n  },\n");
+
+    // Per-thread CPU time, broken down by innermost category, shows how
+    // well the work was balanced.
+    fprintf(f, "  \"threads\": [");
+    sep = "";
+    for (int t = 0; t < profileMaxThreads; ++t) {
+        uint64_t threadCount = 0;
+        for (const std::atomic<uint64_t> &count : threadSamples[t])
+            threadCount += count;
+        if (threadCount == 0) continue;
+        fprintf(f, "%s\n    {\"thread\": %d, \"cpuSeconds\": %.2f, "
+                "\"phases\": {", sep, t,
+                (double)threadCount / profileSamplingRate);
+        const char *phaseSep = "";
+        for (int c = 0; c < (int)Prof::NumProfCategories; ++c) {
+            if (threadSamples[t][c] == 0) continue;
+            fprintf(f, "%s%s: %.2f", phaseSep,
+                    JSONString(ProfNames[c]).c_str(),
+                    (double)threadSamples[t][c] / profileSamplingRate);
+            phaseSep = ", ";
+        }
+        fprintf(f, "}}");
+        sep = ",";
+    }
+    fprintf(f, "\n  ]");
+#endif  // PBRT_HAVE_ITIMER
+
+#ifdef PBRT_HAVE_PERF_EVENT
+    // Hardware counter totals, by thread and innermost category.
+    if (HavePerfCounts()) {
+        fprintf(f, ",\n  \"perfCounters\": [");
+        sep = "";
+        for (int t = 0; t < profileMaxThreads; ++t)
+            for (int c = 0; c < (int)Prof::NumProfCategories; ++c) {
+                const auto &counts = perfCounts[t][c];
+                if (std::all_of(counts.begin(), counts.end(),
+                                [](const std::atomic<uint64_t> &count) {
+                                    return count == 0;
+                                }))
+                    continue;
+                fprintf(f, "%s\n    {\"thread\": %d, \"phase\": %s", sep, t,
+                        JSONString(ProfNames[c]).c_str());
+                for (int i = 0; i < NumPerfCounters; ++i)
+                    fprintf(f, ", \"%s\": %" PRIu64, PerfCounters()[i].name,
+                            counts[i].load());
+                fprintf(f, "}");
+                sep = ",";
+            }
+        fprintf(f, "\n  ]");
+    }
+#endif  // PBRT_HAVE_PERF_EVENT
+    fprintf(f, "\n}\n");
+    fclose(f);
+    return true;
+}
+
+#ifdef PBRT_HAVE_BACKTRACE
+// Returns a readable name for the function containing the return address
+// _pc_: its demangled symbol if it has one, or else the address as an
+// offset into its module, which addr2line can resolve.
+static const std::string &FrameName(void *pc,
+                                    std::map<void *, std::string> *names) {
+    auto iter = names->find(pc);
+    if (iter != names->end()) return iter->second;
+    std::string name;
+    Dl_info info;
+    bool found = dladdr(pc, &info) != 0;
+    if (found && info.dli_sname) {
+        int status;
+        char *demangled =
+            abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        name = (status == 0 && demangled) ? demangled : info.dli_sname;
+        free(demangled);
+    } else if (found && info.dli_fname) {
+        const char *module = strrchr(info.dli_fname, '/');
+        module = module ? module + 1 : info.dli_fname;
+        // Back up into the call instruction so that the address is
+        // attributed to the right line.
+        name = StringPrintf("%s+0x%" PRIxPTR, module,
+                            (uintptr_t)pc - (uintptr_t)info.dli_fbase - 1);
+    } else
+        name = StringPrintf("0x%" PRIxPTR, (uintptr_t)pc);
+    // Semicolons separate frames in collapsed stacks.
+    std::replace(name.begin(), name.end(), ';', ':');
+    return (*names)[pc] = name;
+}
+#endif  // PBRT_HAVE_BACKTRACE
+
+bool WriteProfileStacks(const std::string &filename, bool append) {
+#ifdef PBRT_HAVE_BACKTRACE
+    if (!stackSamples) return false;
+    FILE *f = fopen(filename.c_str(), append ? "a" : "w");
+    if (!f) {
+        Error("%s: unable to open profile stacks file", filename.c_str());
+        return false;
+    }
+    // Write one line per distinct stack in the "collapsed" format used by
+    // flame graph tools: the frames from the outermost call inward,
+    // separated by semicolons, followed by the sample count.
+    std::map<void *, std::string> names;
+    for (int i = 0; i < profileStackHashSize; ++i) {
+        const StackSample &ss = stackSamples[i];
+        if (!ss.ready || ss.count == 0) continue;
+        std::string line;
+        for (int f = ss.depth - 1; f >= 0; --f) {
+            line += FrameName(ss.frames[f], &names);
+            if (f > 0) line += ';';
+        }
+        fprintf(f, "%s %" PRIu64 "\n", line.c_str(), ss.count.load());
+    }
+    fclose(f);
+    return true;
+#else
+    Warning("Call stacks can't be recorded on this system.");
+    return false;
+#endif  // PBRT_HAVE_BACKTRACE
+}
+
 }  // namespace pbrt
@@ -65,8 +65,14 @@ class StatRegisterer {
 };
 
 void PrintStats(FILE *dest);
+// Writes the statistics, the profile, and the times reported via
+// ReportWallTime() to the given file as a JSON object.
+bool WriteStatsJSON(const std::string &filename);
 void ClearStats();
 void ReportThreadStats();
+// Adds _seconds_ to the wall-clock time of the phase named _title_ and
+// records the process's peak memory use as of its end.
+void ReportWallTime(const std::string &title, double seconds);
 
 class StatsAccumulator {
   public:
@@ -117,6 +123,7 @@ class StatsAccumulator {
     }
 
     void Print(FILE *file);
+    void PrintJSON(FILE *file);
     void Clear();
 
   private:
@@ -270,8 +277,13 @@ class ProfilePhase {
 void InitProfiler();
 void SuspendProfiler();
 void ResumeProfiler();
-void ProfilerWorkerThreadInit();
+// Threads that don't do rendering work, like ProgressReporter's, pass
+// false for _countEvents_ so that they don't open performance counters.
+void ProfilerWorkerThreadInit(bool countEvents = true);
 void ReportProfilerResults(FILE *dest);
+// Writes the call stacks recorded when PbrtOptions.profileStacksFile is
+// set, in the collapsed format read by flame graph tools.
+bool WriteProfileStacks(const std::string &filename, bool append = false);
 void ClearProfiler();
 void CleanupProfiler();
 
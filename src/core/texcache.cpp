@@ -0,0 +1,296 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+
+// core/texcache.cpp*
+#include "texcache.h"
+#include "stats.h"
+#include <cerrno>
+#include <cstdio>
+#ifndef PBRT_IS_WINDOWS
+#include <fcntl.h>
+#include <unistd.h>
+#endif  // !PBRT_IS_WINDOWS
+
+namespace pbrt {
+
+STAT_PERCENT("Texture/Tile lookups served by per-thread caches",
+             nThreadTileHits, nTileLookups);
+STAT_PERCENT("Texture/Tile cache misses served by shared cache",
+             nSharedTileHits, nTileFetches);
+STAT_COUNTER("Texture/Tiles read from disk", nTileReads);
+STAT_COUNTER("Texture/Tiles evicted", nTileEvictions);
+STAT_MEMORY_COUNTER("Memory/Texture tile cache peak", tileCachePeakMemory);
+
+static const char tiledImageMagic[8] = {'P', 'B', 'R', 'T', 'M', 'I', 'P', '\0'};
+static const int32_t tiledImageVersion = 1;
+
+// TiledImageHeader Local Functions
+static bool SeekFile(FILE *f, int64_t offset) {
+#ifdef PBRT_IS_WINDOWS
+    return _fseeki64(f, offset, SEEK_SET) == 0;
+#else
+    return fseeko(f, offset, SEEK_SET) == 0;
+#endif
+}
+
+static size_t HeaderBytes(const TiledImageHeader &header) {
+    return sizeof(tiledImageMagic) + 5 * sizeof(int32_t) +
+           header.levels.size() * (2 * sizeof(int32_t) + sizeof(int64_t));
+}
+
+// TiledImageHeader Function Definitions
+bool ReadTiledImageHeader(const std::string &filename,
+                          TiledImageHeader *header) {
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (!f) {
+        Error("%s: unable to open tiled image file", filename.c_str());
+        return false;
+    }
+    char magic[sizeof(tiledImageMagic)];
+    int32_t fields[5];
+    bool ok = fread(magic, sizeof(magic), 1, f) == 1 &&
+              memcmp(magic, tiledImageMagic, sizeof(magic)) == 0 &&
+              fread(fields, sizeof(fields), 1, f) == 1;
+    if (!ok || fields[0] != tiledImageVersion) {
+        Error("%s: not a tiled image file, or unsupported version",
+              filename.c_str());
+        fclose(f);
+        return false;
+    }
+    int nLevels = fields[4];
+    header->nChannels = fields[1];
+    header->format = TexelFormat(fields[2]);
+    header->logTileSize = fields[3];
+    ok = (header->nChannels == 1 || header->nChannels == 3) &&
+         fields[2] >= 0 && fields[2] <= (int)TexelFormat::Byte &&
+         header->logTileSize >= 0 && header->logTileSize <= 7 &&
+         nLevels > 0 && nLevels < 32;
+    header->levels.resize(ok ? nLevels : 0);
+    for (TiledImageLevel &level : header->levels) {
+        int32_t res[2];
+        ok &= fread(res, sizeof(res), 1, f) == 1 &&
+              fread(&level.offset, sizeof(int64_t), 1, f) == 1 &&
+              res[0] > 0 && res[1] > 0;
+        level.resolution = Point2i(res[0], res[1]);
+        if (!ok) break;
+    }
+    fclose(f);
+    if (!ok) Error("%s: corrupt tiled image header", filename.c_str());
+    return ok;
+}
+
+bool WriteTiledImage(const std::string &filename, TiledImageHeader header,
+                     const std::vector<const uint8_t *> &levelTexels) {
+    CHECK_EQ(header.levels.size(), levelTexels.size());
+    FILE *f = fopen(filename.c_str(), "wb");
+    if (!f) {
+        Error("%s: unable to open tiled image file for writing",
+              filename.c_str());
+        return false;
+    }
+    // Assign file offsets to the levels, which follow the header
+    int64_t offset = HeaderBytes(header);
+    for (size_t i = 0; i < header.levels.size(); ++i) {
+        header.levels[i].offset = offset;
+        offset += header.LevelBytes(i);
+    }
+
+    int32_t fields[5] = {tiledImageVersion, header.nChannels,
+                         (int32_t)header.format, header.logTileSize,
+                         (int32_t)header.levels.size()};
+    bool ok = fwrite(tiledImageMagic, sizeof(tiledImageMagic), 1, f) == 1 &&
+              fwrite(fields, sizeof(fields), 1, f) == 1;
+    for (const TiledImageLevel &level : header.levels) {
+        int32_t res[2] = {level.resolution.x, level.resolution.y};
+        ok &= fwrite(res, sizeof(res), 1, f) == 1 &&
+              fwrite(&level.offset, sizeof(int64_t), 1, f) == 1;
+    }
+    for (size_t i = 0; i < header.levels.size(); ++i)
+        ok &= fwrite(levelTexels[i], header.LevelBytes(i), 1, f) == 1;
+    if (fclose(f) != 0) ok = false;
+    if (!ok) Error("%s: error writing tiled image file", filename.c_str());
+    return ok;
+}
+
+bool ReadTiledImageLevel(const std::string &filename,
+                         const TiledImageHeader &header, int level,
+                         uint8_t *texels) {
+    FILE *f = fopen(filename.c_str(), "rb");
+    bool ok = f && SeekFile(f, header.levels[level].offset) &&
+              fread(texels, header.LevelBytes(level), 1, f) == 1;
+    if (f) fclose(f);
+    if (!ok)
+        Error("%s: unable to read level %d of tiled image", filename.c_str(),
+              level);
+    return ok;
+}
+
+// TextureCache Method Definitions
+TextureCache::TextureCache(size_t maxBytes)
+    : maxBytes(maxBytes),
+      shards(new Shard[NumShards]),
+      threadCaches(MaxThreadIndex()) {}
+
+TextureCache::~TextureCache() {
+#ifndef PBRT_IS_WINDOWS
+    for (const TiledImageFile &file : files)
+        if (file.fd >= 0) close(file.fd);
+#endif  // !PBRT_IS_WINDOWS
+    for (const ThreadTileCache &tc : threadCaches) {
+        nThreadTileHits += tc.hits;
+        nTileLookups += tc.hits;
+    }
+    tileCachePeakMemory += peakBytesUsed;
+}
+
+int TextureCache::AddFile(const std::string &filename,
+                          const TiledImageHeader &header) {
+    auto iter = fileIds.find(filename);
+    if (iter != fileIds.end()) return iter->second;
+    // Make sure that tiles from this file can be identified by _TileKey()_
+    CHECK_LT(files.size(), (1 << 20) - 1);
+    CHECK_LE(header.levels.size(), 32);
+    Point2i nTiles = header.TileCount(0);
+    CHECK_LT((int64_t)nTiles.x * (int64_t)nTiles.y, 1ll << 39);
+
+    int fileId = files.size();
+    int fd = -1;
+#ifndef PBRT_IS_WINDOWS
+    // Keep the file open so that reading a tile takes a single pread()
+    // call; failures are reported when a tile is first read.
+    fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+#endif  // !PBRT_IS_WINDOWS
+    files.push_back({filename, header, fd});
+    fileIds[filename] = fileId;
+    return fileId;
+}
+
+std::shared_ptr<uint8_t> TextureCache::Fetch(int fileId, int level,
+                                             int tileIndex, uint64_t key) {
+    ++nTileLookups;
+    ++nTileFetches;
+    Shard &shard = shards[(MixBits(key) >> 32) % NumShards];
+    {
+        // Return the tile if it's already in the shared cache
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto iter = shard.tiles.find(key);
+        if (iter != shard.tiles.end()) {
+            ++nSharedTileHits;
+            shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+            return iter->second->texels;
+        }
+    }
+
+    // Read the tile from disk without holding the shard's lock
+    std::shared_ptr<uint8_t> texels = ReadTile(fileId, level, tileIndex);
+    size_t tileBytes = files[fileId].header.TileBytes();
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto iter = shard.tiles.find(key);
+    if (iter != shard.tiles.end())
+        // Another thread loaded the tile in the meantime
+        return iter->second->texels;
+    shard.lru.push_front({key, tileBytes, texels});
+    shard.tiles[key] = shard.lru.begin();
+    shard.bytes += tileBytes;
+    size_t used = (bytesUsed += tileBytes);
+
+    // Evict least recently used tiles to stay within the shard's budget.
+    // Tiles still referenced by per-thread caches are freed once those
+    // caches move on to other tiles.
+    while (shard.bytes > maxBytes / NumShards && shard.lru.size() > 1) {
+        const CachedTile &victim = shard.lru.back();
+        shard.bytes -= victim.bytes;
+        bytesUsed -= victim.bytes;
+        shard.tiles.erase(victim.key);
+        shard.lru.pop_back();
+        ++nTileEvictions;
+    }
+    size_t peak = peakBytesUsed;
+    while (used > peak && !peakBytesUsed.compare_exchange_weak(peak, used))
+        ;
+    return texels;
+}
+
+std::shared_ptr<uint8_t> TextureCache::ReadTile(int fileId, int level,
+                                                int tileIndex) {
+    ++nTileReads;
+    const TiledImageFile &file = files[fileId];
+    size_t tileBytes = file.header.TileBytes();
+    std::shared_ptr<uint8_t> texels(new uint8_t[tileBytes],
+                                    std::default_delete<uint8_t[]>());
+    int64_t offset = file.header.levels[level].offset +
+                     (int64_t)tileIndex * (int64_t)tileBytes;
+#ifndef PBRT_IS_WINDOWS
+    // pread() doesn't use the descriptor's file position, so threads can
+    // read tiles from the same file concurrently.
+    bool ok = file.fd >= 0;
+    for (size_t done = 0; ok && done < tileBytes;) {
+        ssize_t n = pread(file.fd, texels.get() + done, tileBytes - done,
+                          offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        ok = n > 0;
+        if (ok) done += n;
+    }
+#else
+    FILE *f = fopen(file.filename.c_str(), "rb");
+    bool ok = f && SeekFile(f, offset) &&
+              fread(texels.get(), tileBytes, 1, f) == 1;
+    if (f) fclose(f);
+#endif  // !PBRT_IS_WINDOWS
+    if (!ok) {
+        // Report the first failure and fill the tile with zero texels
+        static std::atomic<bool> reported{false};
+        if (!reported.exchange(true))
+            Error("%s: unable to read tile %d of level %d",
+                  file.filename.c_str(), tileIndex, level);
+        memset(texels.get(), 0, tileBytes);
+    }
+    return texels;
+}
+
+static std::unique_ptr<TextureCache> textureCache;
+
+TextureCache *GetTextureCache() {
+    if (!textureCache) {
+        size_t maxBytes = (size_t)PbrtOptions.textureCacheMB << 20;
+        LOG(INFO) << "Creating texture cache with a "
+                  << PbrtOptions.textureCacheMB << " MiB budget";
+        textureCache.reset(new TextureCache(maxBytes));
+    }
+    return textureCache.get();
+}
+
+void FreeTextureCache() { textureCache.reset(); }
+
+}  // namespace pbrt
@@ -0,0 +1,206 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_TEXCACHE_H
+#define PBRT_CORE_TEXCACHE_H
+
+// core/texcache.h*
+#include "pbrt.h"
+#include "geometry.h"
+#include "parallel.h"
+#include <list>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+namespace pbrt {
+
+// Texel storage formats, shared by in-memory MIP maps and tiled image files
+enum class TexelFormat { Float, Half, Byte };
+
+inline int TexelFormatBytes(TexelFormat format) {
+    switch (format) {
+    case TexelFormat::Half:
+        return sizeof(uint16_t);
+    case TexelFormat::Byte:
+        return sizeof(uint8_t);
+    default:
+        return sizeof(float);
+    }
+}
+
+inline const char *TexelFormatName(TexelFormat format) {
+    switch (format) {
+    case TexelFormat::Half:
+        return "half";
+    case TexelFormat::Byte:
+        return "8-bit";
+    default:
+        return "float";
+    }
+}
+
+// TiledImageHeader Declarations
+
+// A tiled image file (".mip") stores a complete MIP pyramid. After the
+// header, each level's tiles follow in scanline order; each tile holds
+// $2^\roman{logTileSize} \times 2^\roman{logTileSize}$ texels in the same
+// Morton-ordered layout that _TiledTexelArray_ uses in memory, so a tile
+// can be read from disk with a single seek and read.
+struct TiledImageLevel {
+    Point2i resolution;
+    int64_t offset;
+};
+
+struct TiledImageHeader {
+    int TileSize() const { return 1 << logTileSize; }
+    size_t TileBytes() const {
+        return (size_t)(nChannels * TexelFormatBytes(format))
+               << (2 * logTileSize);
+    }
+    Point2i TileCount(int level) const {
+        const Point2i &res = levels[level].resolution;
+        return Point2i((res.x + TileSize() - 1) >> logTileSize,
+                       (res.y + TileSize() - 1) >> logTileSize);
+    }
+    size_t LevelBytes(int level) const {
+        Point2i nTiles = TileCount(level);
+        return TileBytes() * nTiles.x * nTiles.y;
+    }
+    int nChannels = 3;
+    TexelFormat format = TexelFormat::Float;
+    int logTileSize = 5;
+    std::vector<TiledImageLevel> levels;
+};
+
+bool ReadTiledImageHeader(const std::string &filename,
+                          TiledImageHeader *header);
+bool WriteTiledImage(const std::string &filename, TiledImageHeader header,
+                     const std::vector<const uint8_t *> &levelTexels);
+bool ReadTiledImageLevel(const std::string &filename,
+                         const TiledImageHeader &header, int level,
+                         uint8_t *texels);
+
+// TextureCache Declarations
+
+// TextureCache keeps recently used tiles of tiled image files in memory,
+// loading them on demand and evicting the least recently used ones to stay
+// within a fixed memory budget. Tiles are distributed over independently
+// locked shards; each thread also keeps a small direct-mapped cache of the
+// tiles it has used most recently so that most lookups take no locks.
+class TextureCache {
+  public:
+    // TextureCache Public Methods
+    TextureCache(size_t maxBytes);
+    ~TextureCache();
+    int AddFile(const std::string &filename, const TiledImageHeader &header);
+    const uint8_t *GetTile(int fileId, int level, int tileIndex) {
+        uint64_t key = TileKey(fileId, level, tileIndex);
+        ThreadTileCache &tc = threadCaches[ThreadIndex];
+        ThreadTileCache::Entry &entry =
+            tc.entries[MixBits(key) & (ThreadTileCache::Size - 1)];
+        if (entry.key != key) {
+            entry.tile = Fetch(fileId, level, tileIndex, key);
+            entry.key = key;
+        } else
+            ++tc.hits;
+        return entry.tile.get();
+    }
+    size_t MaxBytes() const { return maxBytes; }
+
+  private:
+    // TextureCache Private Methods
+    static uint64_t TileKey(int fileId, int level, int tileIndex) {
+        return ((uint64_t)fileId << 44) | ((uint64_t)level << 39) |
+               (uint64_t)tileIndex;
+    }
+    static uint64_t MixBits(uint64_t v) {
+        v ^= (v >> 31);
+        v *= 0x7fb5d329728ea185;
+        v ^= (v >> 27);
+        v *= 0x81dadef4bc2dd44d;
+        v ^= (v >> 33);
+        return v;
+    }
+    std::shared_ptr<uint8_t> Fetch(int fileId, int level, int tileIndex,
+                                   uint64_t key);
+    std::shared_ptr<uint8_t> ReadTile(int fileId, int level, int tileIndex);
+
+    // TextureCache Private Data
+    struct TiledImageFile {
+        std::string filename;
+        TiledImageHeader header;
+        // Descriptor that tiles are read through, or -1 if the file
+        // couldn't be opened (or on Windows, where each read opens it).
+        int fd;
+    };
+    struct ThreadTileCache {
+        static PBRT_CONSTEXPR int Size = 64;
+        struct Entry {
+            uint64_t key = ~0ull;
+            std::shared_ptr<uint8_t> tile;
+        };
+        Entry entries[Size];
+        int64_t hits = 0;
+    };
+    struct CachedTile {
+        uint64_t key;
+        size_t bytes;
+        std::shared_ptr<uint8_t> texels;
+    };
+    struct Shard {
+        std::mutex mutex;
+        // Most recently used tiles are at the front of _lru_.
+        std::list<CachedTile> lru;
+        std::unordered_map<uint64_t, std::list<CachedTile>::iterator> tiles;
+        size_t bytes = 0;
+    };
+    static PBRT_CONSTEXPR int NumShards = 64;
+    const size_t maxBytes;
+    std::vector<TiledImageFile> files;
+    std::map<std::string, int> fileIds;
+    std::unique_ptr<Shard[]> shards;
+    std::vector<ThreadTileCache> threadCaches;
+    std::atomic<size_t> bytesUsed{0}, peakBytesUsed{0};
+};
+
+TextureCache *GetTextureCache();
+void FreeTextureCache();
+
+}  // namespace pbrt
+
+#endif  // PBRT_CORE_TEXCACHE_H
@@ -39,12 +39,58 @@
 #include "paramset.h"
 #include "progressreporter.h"
 #include "sampler.h"
+#include "samplers/random.h"
 #include "stats.h"
+#include <chrono>
 
 namespace pbrt {
 
 STAT_PERCENT("Integrator/Zero-radiance paths", zeroRadiancePaths, totalPaths);
 STAT_INT_DISTRIBUTION("Integrator/Path length", pathLength);
+STAT_FLOAT_DISTRIBUTION("Integrator/Tile render time (ms)", tileTime);
+STAT_MEMORY_COUNTER("Memory/BDPT light vertex cache", lightVertexCacheBytes);
+STAT_RATIO("Integrator/Cached light vertices per light subpath",
+           cachedLightVertices, cachedLightPaths);
+
+// Per-strategy statistics: each $(s,t)$ connection strategy up to
+// _strategyStatsMaxDepth_ reports how often it was evaluated, how many of
+// its evaluations traced a shadow ray, and the luminance of the MIS-weighted
+// contributions it made, so that the cost of each strategy can be weighed
+// against what it adds to the image.
+static const int strategyStatsMaxDepth = 8;
+struct StrategyStats {
+    int64_t evaluations, shadowRays, nonZero;
+    double contribution, maxContribution;
+};
+static PBRT_THREAD_LOCAL
+    StrategyStats strategyStats[(1 + strategyStatsMaxDepth) *
+                                (6 + strategyStatsMaxDepth) / 2];
+
+inline int BufferIndex(int s, int t);
+
+static void ReportStrategyStats(StatsAccumulator &accum) {
+    for (int depth = 0; depth <= strategyStatsMaxDepth; ++depth)
+        for (int s = 0; s <= depth + 2; ++s) {
+            int t = depth + 2 - s;
+            if (t == 0 || (s == 1 && t == 1)) continue;
+            StrategyStats &stats = strategyStats[BufferIndex(s, t)];
+            if (stats.evaluations == 0) continue;
+            std::string prefix =
+                StringPrintf("BDPT strategies/Depth %d, s=%d t=%d ", depth, s, t);
+            accum.ReportCounter(prefix + "evaluations", stats.evaluations);
+            accum.ReportPercentage(prefix + "shadow rays", stats.shadowRays,
+                                   stats.evaluations);
+            accum.ReportPercentage(prefix + "non-zero", stats.nonZero,
+                                   stats.evaluations);
+            accum.ReportFloatDistribution(prefix + "contribution",
+                                          stats.contribution,
+                                          stats.evaluations, 0,
+                                          stats.maxContribution);
+            stats = StrategyStats();
+        }
+}
+
+static StatRegisterer strategyStatsRegisterer(ReportStrategyStats);
 
 // BDPT Forward Declarations
 int RandomWalk(const Scene &scene, RayDifferential ray, Sampler &sampler,
@@ -228,12 +274,20 @@ Spectrum G(const Scene &scene, Sampler &sampler, const Vertex &v0,
 Float MISWeight(const Scene &scene, Vertex *lightVertices,
                 Vertex *cameraVertices, Vertex &sampled, int s, int t,
                 const Distribution1D &lightPdf,
-                const std::unordered_map<const Light *, size_t> &lightToIndex) {
+                const std::unordered_map<const Light *, size_t> &lightToIndex,
+                Float etaVM, bool merging) {
     if (s + t == 2) return 1;
     Float sumRi = 0;
     // Define helper function _remap0_ that deals with Dirac delta functions
     auto remap0 = [](Float f) -> Float { return f != 0 ? f : 1; };
 
+    // Define helper function _mergeable_ for vertex merging strategies,
+    // which are possible at non-specular surface vertices other than the
+    // path's endpoints
+    auto mergeable = [](const Vertex &v) -> bool {
+        return v.type == VertexType::Surface && !v.delta;
+    };
+
     // Temporarily update vertex properties for current strategy
 
     // Look up connection vertices and their predecessors
@@ -249,10 +303,12 @@ Float MISWeight(const Scene &scene, Vertex *lightVertices,
     else if (t == 1)
         a1 = {pt, sampled};
 
-    // Mark connection vertices as non-degenerate
+    // Mark connection vertices as non-degenerate; when merging, the light
+    // subpath's last vertex keeps its sampled scattering type, as it's
+    // part of the merged path
     ScopedAssignment<bool> a2, a3;
     if (pt) a2 = {&pt->delta, false};
-    if (qs) a3 = {&qs->delta, false};
+    if (qs && !merging) a3 = {&qs->delta, false};
 
     // Update reverse density of vertex $\pt{}_{t-1}$
     ScopedAssignment<Float> a4;
@@ -273,9 +329,14 @@ Float MISWeight(const Scene &scene, Vertex *lightVertices,
     ScopedAssignment<Float> a7;
     if (qsMinus) a7 = {&qsMinus->pdfRev, qs->Pdf(scene, pt, *qsMinus)};
 
-    // Consider hypothetical connection strategies along the camera subpath
+    // Consider hypothetical connection strategies along the camera subpath.
+    // A merge at a vertex has the density of the strategy that connects
+    // just past it, times the density of the other subpath reaching it and
+    // _etaVM_, the merging area times the number of light subpaths.
     Float ri = 1;
     for (int i = t - 1; i > 0; --i) {
+        if (etaVM > 0 && (s > 0 || i < t - 1) && mergeable(cameraVertices[i]))
+            sumRi += ri * remap0(cameraVertices[i].pdfRev) * etaVM;
         ri *=
             remap0(cameraVertices[i].pdfRev) / remap0(cameraVertices[i].pdfFwd);
         if (!cameraVertices[i].delta && !cameraVertices[i - 1].delta)
@@ -285,11 +346,19 @@ Float MISWeight(const Scene &scene, Vertex *lightVertices,
     // Consider hypothetical connection strategies along the light subpath
     ri = 1;
     for (int i = s - 1; i >= 0; --i) {
+        if (etaVM > 0 && i > 0 && mergeable(lightVertices[i]))
+            sumRi += ri * remap0(lightVertices[i].pdfRev) * etaVM;
         ri *= remap0(lightVertices[i].pdfRev) / remap0(lightVertices[i].pdfFwd);
         bool deltaLightvertex = i > 0 ? lightVertices[i - 1].delta
                                       : lightVertices[0].IsDeltaLight();
         if (!lightVertices[i].delta && !deltaLightvertex) sumRi += ri;
     }
+
+    // When merging at $\pt{}_{t-1}$, the $(s,t)$ connection is only a
+    // point of reference, and only a strategy itself if $\pq{}_{s-1}$ can
+    // be connected to
+    if (merging)
+        return remap0(pt->pdfRev) * etaVM / ((qs->delta ? 0 : 1) + sumRi);
     return 1 / (1 + sumRi);
 }
 
@@ -299,9 +368,26 @@ inline int BufferIndex(int s, int t) {
     return s + above * (5 + above) / 2;
 }
 
+// LightVertexCache Method Definitions
+LightVertexCache::LightVertexCache(int nPaths, int maxVertices)
+    : nPaths(nPaths),
+      maxVertices(maxVertices),
+      vertices(new Vertex[(size_t)nPaths * maxVertices]),
+      pathLengths(nPaths, 0) {}
+
+void LightVertexCache::BuildConnectionList() {
+    connectible.clear();
+    for (int i = 0; i < nPaths; ++i) {
+        const Vertex *path = &vertices[(size_t)i * maxVertices];
+        for (int s = 2; s <= pathLengths[i]; ++s)
+            if (path[s - 1].IsConnectible()) connectible.push_back({i, s});
+    }
+}
+
 void BDPTIntegrator::Render(const Scene &scene) {
     std::unique_ptr<LightDistribution> lightDistribution =
-        CreateLightSampleDistribution(lightSampleStrategy, scene);
+        CreateLightSampleDistribution(lightSampleStrategy, scene,
+                                      maxSparseLights, maxLightCacheBytes);
 
     // Compute a reverse mapping from light pointers to offsets into the
     // scene lights vector (and, equivalently, offsets into
@@ -342,9 +428,17 @@ void BDPTIntegrator::Render(const Scene &scene) {
     }
 
     // Render and write the output image to disk
-    if (scene.lights.size() > 0) {
+    if (scene.lights.size() > 0 && lightVertexCache) {
+        // Light subpaths are shared by all camera subpaths, so they're all
+        // started with the distribution at the camera's position
+        const Distribution1D *lightDistr = lightDistribution->Lookup(
+            camera->CameraToWorld(camera->shutterOpen, Point3f(0, 0, 0)));
+        RenderLightVertexCache(scene, *lightDistr, lightToIndex, weightFilms);
+    } else if (scene.lights.size() > 0) {
         ParallelFor2D([&](const Point2i tile) {
             // Render a single tile using BDPT
+            std::chrono::steady_clock::time_point tileStart =
+                std::chrono::steady_clock::now();
             MemoryArena arena;
             int seed = tile.y * nXTiles + tile.x;
             std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
@@ -426,6 +520,9 @@ void BDPTIntegrator::Render(const Scene &scene) {
                 } while (tileSampler->StartNextSample());
             }
             film->MergeFilmTile(std::move(filmTile));
+            std::chrono::duration<double, std::milli> tileDuration =
+                std::chrono::steady_clock::now() - tileStart;
+            ReportValue(tileTime, tileDuration.count());
             reporter.Update();
             LOG(INFO) << "Finished image tile " << tileBounds;
         }, Point2i(nXTiles, nYTiles));
@@ -441,12 +538,176 @@ void BDPTIntegrator::Render(const Scene &scene) {
     }
 }
 
+void BDPTIntegrator::RenderLightVertexCache(
+    const Scene &scene, const Distribution1D &lightDistr,
+    const std::unordered_map<const Light *, size_t> &lightToIndex,
+    std::vector<std::unique_ptr<Film>> &weightFilms) {
+    // Each iteration traces a pool of light subpaths, one per pixel as long
+    // as their vertices fit in _maxCacheBytes_, and then connects every
+    // camera subpath vertex to _cacheConnections_ vertices chosen uniformly
+    // from the whole pool. Scaling those connections by the pool's average
+    // number of connectible vertices per subpath gives an unbiased estimate
+    // of connecting to all the vertices of a single light subpath, as
+    // regular BDPT does, with fewer rays traced per connection.
+    Film *film = camera->film;
+    const int64_t nPixels = pixelBounds.Area();
+    const int maxVertices = maxDepth + 1;
+    const int nLightPaths = (int)std::max<int64_t>(
+        1, std::min<int64_t>(nPixels,
+                             maxCacheBytes / (maxVertices * sizeof(Vertex))));
+    if (nLightPaths < nPixels)
+        LOG(INFO) << StringPrintf("Light vertex cache limited to %d light "
+                                  "subpaths per iteration for %d pixels",
+                                  nLightPaths, (int)nPixels);
+    LightVertexCache cache(nLightPaths, maxVertices);
+    // The light subpaths' scattering functions are allocated in per-thread
+    // arenas that live until the iteration's camera pass is done
+    std::vector<MemoryArena> lightArenas(MaxThreadIndex());
+
+    // Partition the light subpaths into chunks and the image into tiles
+    const int lightChunkSize = 256;
+    const int64_t nLightChunks =
+        (nLightPaths + lightChunkSize - 1) / lightChunkSize;
+    const Bounds2i sampleBounds = film->GetSampleBounds();
+    const Vector2i sampleExtent = sampleBounds.Diagonal();
+    const int tileSize = 16;
+    const int nXTiles = (sampleExtent.x + tileSize - 1) / tileSize;
+    const int nYTiles = (sampleExtent.y + tileSize - 1) / tileSize;
+    const int64_t spp = sampler->samplesPerPixel;
+    ProgressReporter reporter(spp * (nLightChunks + nXTiles * nYTiles),
+                              "Rendering");
+
+    auto visualize = [&](int s, int t, const Point2f &pFilm,
+                         const Spectrum &Lpath, Float misWeight) {
+        if (!visualizeStrategies && !visualizeWeights) return;
+        Spectrum value;
+        if (visualizeStrategies) value = misWeight == 0 ? 0 : Lpath / misWeight;
+        if (visualizeWeights) value = Lpath;
+        weightFilms[BufferIndex(s, t)]->AddSplat(pFilm, value);
+    };
+
+    for (int64_t iteration = 0; iteration < spp; ++iteration) {
+        // Trace the light subpaths and execute their $t=1$ strategies. With
+        // fewer subpaths than pixels, each one's splats stand in for
+        // several pixels' worth of samples.
+        const Float splatScale = Float(nPixels) / nLightPaths;
+        ParallelFor([&](int64_t chunk) {
+            MemoryArena &arena = lightArenas[ThreadIndex];
+            RandomSampler lightSampler(1, iteration * nLightChunks + chunk);
+            lightSampler.StartPixel(Point2i(0, 0));
+            Vertex cameraVertex;
+            int start = chunk * lightChunkSize;
+            int end = std::min(start + lightChunkSize, nLightPaths);
+            for (int i = start; i < end; ++i) {
+                Float time = Lerp(lightSampler.Get1D(), camera->shutterOpen,
+                                  camera->shutterClose);
+                Vertex *lightVertices = cache.Path(i);
+                int nLight = GenerateLightSubpath(
+                    scene, lightSampler, arena, maxDepth + 1, time,
+                    lightDistr, lightToIndex, lightVertices);
+                cache.SetPathLength(i, nLight);
+                for (int s = 2; s <= nLight; ++s) {
+                    Point2f pFilm;
+                    Float misWeight = 0.f;
+                    Spectrum Lpath = ConnectBDPT(
+                        scene, lightVertices, &cameraVertex, s, 1, lightDistr,
+                        lightToIndex, *camera, lightSampler, &pFilm,
+                        &misWeight);
+                    visualize(s, 1, pFilm, Lpath, misWeight);
+                    film->AddSplat(pFilm, Lpath * splatScale);
+                }
+            }
+            reporter.Update();
+        }, nLightChunks);
+        cache.BuildConnectionList();
+        cachedLightVertices += cache.ConnectibleCount();
+        cachedLightPaths += nLightPaths;
+
+        // Trace the camera subpaths and connect them to the cached vertices
+        const int nConnectible = cache.ConnectibleCount();
+        const Float connectionScale =
+            Float(nConnectible) / (Float(nLightPaths) * cacheConnections);
+        ParallelFor2D([&](const Point2i tile) {
+            MemoryArena arena;
+            int seed = iteration * nXTiles * nYTiles + tile.y * nXTiles + tile.x;
+            std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
+            int x0 = sampleBounds.pMin.x + tile.x * tileSize;
+            int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
+            int y0 = sampleBounds.pMin.y + tile.y * tileSize;
+            int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
+            Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
+            std::unique_ptr<FilmTile> filmTile = film->GetFilmTile(tileBounds);
+            for (Point2i pPixel : tileBounds) {
+                tileSampler->StartPixel(pPixel);
+                if (!InsideExclusive(pPixel, pixelBounds) ||
+                    !tileSampler->SetSampleNumber(iteration))
+                    continue;
+                Point2f pFilm = (Point2f)pPixel + tileSampler->Get2D();
+                Vertex *cameraVertices = arena.Alloc<Vertex>(maxDepth + 2);
+                Vertex *lightVertices = arena.Alloc<Vertex>(maxDepth + 1);
+                int nCamera =
+                    GenerateCameraSubpath(scene, *tileSampler, arena,
+                                          maxDepth + 2, *camera, pFilm,
+                                          cameraVertices);
+                Spectrum L(0.f);
+                for (int t = 2; t <= nCamera; ++t) {
+                    // Execute the $s=0$ and $s=1$ strategies, which don't
+                    // use the light subpaths
+                    for (int s = 0; s <= 1 && s + t - 2 <= maxDepth; ++s) {
+                        Point2f pFilmNew = pFilm;
+                        Float misWeight = 0.f;
+                        Spectrum Lpath = ConnectBDPT(
+                            scene, lightVertices, cameraVertices, s, t,
+                            lightDistr, lightToIndex, *camera, *tileSampler,
+                            &pFilmNew, &misWeight);
+                        visualize(s, t, pFilmNew, Lpath, misWeight);
+                        L += Lpath;
+                    }
+
+                    // Connect $\pt{}_{t-1}$ to randomly chosen cached vertices
+                    for (int c = 0; c < cacheConnections && nConnectible > 0;
+                         ++c) {
+                        int index = std::min<int>(
+                            tileSampler->Get1D() * nConnectible,
+                            nConnectible - 1);
+                        int s;
+                        const Vertex *path = cache.ConnectibleVertex(index, &s);
+                        if (s + t - 2 > maxDepth) continue;
+                        // _MISWeight()_ temporarily modifies the vertices
+                        // next to the connection, so work on a copy of the
+                        // shared subpath
+                        std::copy(path, path + s, lightVertices);
+                        Point2f pFilmNew = pFilm;
+                        Float misWeight = 0.f;
+                        Spectrum Lpath =
+                            connectionScale *
+                            ConnectBDPT(scene, lightVertices, cameraVertices,
+                                        s, t, lightDistr, lightToIndex,
+                                        *camera, *tileSampler, &pFilmNew,
+                                        &misWeight);
+                        visualize(s, t, pFilmNew, Lpath, misWeight);
+                        L += Lpath;
+                    }
+                }
+                filmTile->AddSample(pFilm, L);
+                arena.Reset();
+            }
+            film->MergeFilmTile(std::move(filmTile));
+            reporter.Update();
+        }, Point2i(nXTiles, nYTiles));
+
+        for (MemoryArena &arena : lightArenas) arena.Reset();
+    }
+    reporter.Done();
+    lightVertexCacheBytes += cache.BytesUsed();
+}
+
 Spectrum ConnectBDPT(
     const Scene &scene, Vertex *lightVertices, Vertex *cameraVertices, int s,
     int t, const Distribution1D &lightDistr,
     const std::unordered_map<const Light *, size_t> &lightToIndex,
     const Camera &camera, Sampler &sampler, Point2f *pRaster,
-    Float *misWeightPtr) {
+    Float *misWeightPtr, Float etaVM) {
     ProfilePhase _(Prof::BDPTConnectSubpaths);
     Spectrum L(0.f);
     // Ignore invalid connections related to infinite area lights
@@ -455,6 +716,7 @@ Spectrum ConnectBDPT(
 
     // Perform connection and write contribution to _L_
     Vertex sampled;
+    bool shadowRay = false;
     if (s == 0) {
         // Interpret the camera subpath as a complete path
         const Vertex &pt = cameraVertices[t - 1];
@@ -477,7 +739,10 @@ Spectrum ConnectBDPT(
                 DCHECK(!L.HasNaNs());
                 // Only check visibility after we know that the path would
                 // make a non-zero contribution.
-                if (!L.IsBlack()) L *= vis.Tr(scene, sampler);
+                if (!L.IsBlack()) {
+                    L *= vis.Tr(scene, sampler);
+                    shadowRay = true;
+                }
             }
         }
     } else if (s == 1) {
@@ -502,7 +767,10 @@ Spectrum ConnectBDPT(
                 L = pt.beta * pt.f(sampled, TransportMode::Radiance) * sampled.beta;
                 if (pt.IsOnSurface()) L *= AbsDot(wi, pt.ns());
                 // Only check visibility if the path would carry radiance.
-                if (!L.IsBlack()) L *= vis.Tr(scene, sampler);
+                if (!L.IsBlack()) {
+                    L *= vis.Tr(scene, sampler);
+                    shadowRay = true;
+                }
             }
         }
     } else {
@@ -514,7 +782,10 @@ Spectrum ConnectBDPT(
                 " qs: " << qs << ", pt: " << pt << ", qs.f(pt): " << qs.f(pt, TransportMode::Importance) <<
                 ", pt.f(qs): " << pt.f(qs, TransportMode::Radiance) << ", G: " << G(scene, sampler, qs, pt) <<
                 ", dist^2: " << DistanceSquared(qs.p(), pt.p());
-            if (!L.IsBlack()) L *= G(scene, sampler, qs, pt);
+            if (!L.IsBlack()) {
+                L *= G(scene, sampler, qs, pt);
+                shadowRay = true;
+            }
         }
     }
 
@@ -525,12 +796,26 @@ Spectrum ConnectBDPT(
     // Compute MIS weight for connection strategy
     Float misWeight =
         L.IsBlack() ? 0.f : MISWeight(scene, lightVertices, cameraVertices,
-                                      sampled, s, t, lightDistr, lightToIndex);
+                                      sampled, s, t, lightDistr, lightToIndex,
+                                      etaVM);
     VLOG(2) << "MIS weight for (s,t) = (" << s << ", " << t << ") connection: "
             << misWeight;
     DCHECK(!std::isnan(misWeight));
     L *= misWeight;
     if (misWeightPtr) *misWeightPtr = misWeight;
+
+    // Update the statistics for the $(s,t)$ strategy
+    if (s + t - 2 <= strategyStatsMaxDepth) {
+        StrategyStats &stats = strategyStats[BufferIndex(s, t)];
+        ++stats.evaluations;
+        if (shadowRay) ++stats.shadowRays;
+        if (!L.IsBlack()) {
+            ++stats.nonZero;
+            stats.contribution += L.y();
+            stats.maxContribution = std::max<double>(stats.maxContribution,
+                                                     L.y());
+        }
+    }
     return L;
 }
 
@@ -562,10 +847,20 @@ BDPTIntegrator *CreateBDPTIntegrator(const ParamSet &params,
         }
     }
 
-    std::string lightStrategy = params.FindOneString("lightsamplestrategy",
-                                                     "power");
+    // "lightsampler" is accepted as a synonym for "lightsamplestrategy".
+    std::string lightStrategy = params.FindOneString(
+        "lightsampler", params.FindOneString("lightsamplestrategy", "power"));
+    bool lightVertexCache = params.FindOneBool("lightvertexcache", false);
+    int cacheConnections = params.FindOneInt("cacheconnections", 1);
+    size_t maxCacheBytes =
+        (size_t)params.FindOneInt("cachemaxmb", 256) * 1024 * 1024;
+    int sparseLights = params.FindOneInt("sparselights", 64);
+    int lightCacheMB = params.FindOneInt("lightcachemaxmb", 64);
     return new BDPTIntegrator(sampler, camera, maxDepth, visualizeStrategies,
-                              visualizeWeights, pixelBounds, lightStrategy);
+                              visualizeWeights, pixelBounds, lightStrategy,
+                              lightVertexCache, cacheConnections,
+                              maxCacheBytes, sparseLights,
+                              (size_t)std::max(1, lightCacheMB) << 20);
 }
 
 }  // namespace pbrt
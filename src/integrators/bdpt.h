@@ -131,17 +131,32 @@ class BDPTIntegrator : public Integrator {
                    std::shared_ptr<const Camera> camera, int maxDepth,
                    bool visualizeStrategies, bool visualizeWeights,
                    const Bounds2i &pixelBounds,
-                   const std::string &lightSampleStrategy = "power")
+                   const std::string &lightSampleStrategy = "power",
+                   bool lightVertexCache = false, int cacheConnections = 1,
+                   size_t maxCacheBytes = 256 * 1024 * 1024,
+                   int maxSparseLights = 64,
+                   size_t maxLightCacheBytes = 64 * 1024 * 1024)
         : sampler(sampler),
           camera(camera),
           maxDepth(maxDepth),
           visualizeStrategies(visualizeStrategies),
           visualizeWeights(visualizeWeights),
           pixelBounds(pixelBounds),
-          lightSampleStrategy(lightSampleStrategy) {}
+          lightSampleStrategy(lightSampleStrategy),
+          lightVertexCache(lightVertexCache),
+          cacheConnections(std::max(1, cacheConnections)),
+          maxCacheBytes(maxCacheBytes),
+          maxSparseLights(maxSparseLights),
+          maxLightCacheBytes(maxLightCacheBytes) {}
     void Render(const Scene &scene);
 
   private:
+    // BDPTIntegrator Private Methods
+    void RenderLightVertexCache(
+        const Scene &scene, const Distribution1D &lightDistr,
+        const std::unordered_map<const Light *, size_t> &lightToIndex,
+        std::vector<std::unique_ptr<Film>> &weightFilms);
+
     // BDPTIntegrator Private Data
     std::shared_ptr<Sampler> sampler;
     std::shared_ptr<const Camera> camera;
@@ -150,6 +165,11 @@ class BDPTIntegrator : public Integrator {
     const bool visualizeWeights;
     const Bounds2i pixelBounds;
     const std::string lightSampleStrategy;
+    const bool lightVertexCache;
+    const int cacheConnections;
+    const size_t maxCacheBytes;
+    const int maxSparseLights;
+    const size_t maxLightCacheBytes;
 };
 
 struct Vertex {
@@ -423,6 +443,44 @@ struct Vertex {
     }
 };
 
+// LightVertexCache Declarations
+class LightVertexCache {
+  public:
+    // LightVertexCache Public Methods
+    LightVertexCache(int nPaths, int maxVertices);
+    int PathCount() const { return nPaths; }
+    Vertex *Path(int i) { return &vertices[(size_t)i * maxVertices]; }
+    int PathLength(int i) const { return pathLengths[i]; }
+    void SetPathLength(int i, int length) { pathLengths[i] = length; }
+    // Collects the connectible vertices of the stored paths that are past
+    // their light endpoint; it must be called after all of the paths for
+    // an iteration have been generated.
+    void BuildConnectionList();
+    int ConnectibleCount() const { return connectible.size(); }
+    // Returns the subpath that the _i_th connectible vertex belongs to
+    // and sets _*s_ to the number of subpath vertices up to and including
+    // it.
+    const Vertex *ConnectibleVertex(int i, int *s) const {
+        *s = connectible[i].s;
+        return &vertices[(size_t)connectible[i].path * maxVertices];
+    }
+    size_t BytesUsed() const {
+        return (size_t)nPaths * maxVertices * sizeof(Vertex) +
+               pathLengths.capacity() * sizeof(int) +
+               connectible.capacity() * sizeof(VertexRef);
+    }
+
+  private:
+    // LightVertexCache Private Data
+    struct VertexRef {
+        int path, s;
+    };
+    const int nPaths, maxVertices;
+    std::unique_ptr<Vertex[]> vertices;
+    std::vector<int> pathLengths;
+    std::vector<VertexRef> connectible;
+};
+
 extern int GenerateCameraSubpath(const Scene &scene, Sampler &sampler,
                                  MemoryArena &arena, int maxDepth,
                                  const Camera &camera, const Point2f &pFilm,
@@ -438,7 +496,17 @@ Spectrum ConnectBDPT(
     int t, const Distribution1D &lightDistr,
     const std::unordered_map<const Light *, size_t> &lightToIndex,
     const Camera &camera, Sampler &sampler, Point2f *pRaster,
-    Float *misWeight = nullptr);
+    Float *misWeight = nullptr, Float etaVM = 0);
+// Returns the MIS weight of the $(s,t)$ connection strategy. With _etaVM_
+// greater than zero, vertex merging strategies are accounted for as well,
+// where _etaVM_ is the merging area times the number of light subpaths;
+// with _merging_ set, the weight of merging the light subpath's next
+// vertex at $\pt{}_{t-1}$ is returned instead.
+Float MISWeight(const Scene &scene, Vertex *lightVertices,
+                Vertex *cameraVertices, Vertex &sampled, int s, int t,
+                const Distribution1D &lightPdf,
+                const std::unordered_map<const Light *, size_t> &lightToIndex,
+                Float etaVM = 0, bool merging = false);
 BDPTIntegrator *CreateBDPTIntegrator(const ParamSet &params,
                                      std::shared_ptr<Sampler> sampler,
                                      std::shared_ptr<const Camera> camera);
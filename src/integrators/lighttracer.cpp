@@ -0,0 +1,174 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// integrators/lighttracer.cpp*
+#include "integrators/lighttracer.h"
+#include "integrators/bdpt.h"
+#include "camera.h"
+#include "film.h"
+#include "light.h"
+#include "lightdistrib.h"
+#include "paramset.h"
+#include "progressreporter.h"
+#include "sampler.h"
+#include "samplers/random.h"
+#include "scene.h"
+#include "stats.h"
+
+namespace pbrt {
+
+STAT_COUNTER("Integrator/Light paths traced", lightPathsTraced);
+STAT_PERCENT("Integrator/Unoccluded camera connections", visibleConnections,
+             totalConnections);
+
+// LightTracer Utility Functions
+static Spectrum ConnectToCamera(const Scene &scene, const Vertex &qs,
+                                const Camera &camera, Sampler &sampler,
+                                Point2f *pRaster) {
+    // Only area lights can be seen directly by the camera
+    if (!qs.IsConnectible() || (qs.type == VertexType::Light &&
+                                !(qs.ei.light->flags & (int)LightFlags::Area)))
+        return Spectrum(0.f);
+    VisibilityTester vis;
+    Vector3f wi;
+    Float pdf;
+    Spectrum Wi = camera.Sample_Wi(qs.GetInteraction(), sampler.Get2D(), &wi,
+                                   &pdf, pRaster, &vis);
+    if (pdf == 0 || Wi.IsBlack()) return Spectrum(0.f);
+
+    // Compute the contribution of the connection before testing visibility
+    Spectrum L;
+    if (qs.type == VertexType::Light) {
+        // The light vertex's _beta_ holds the radiance emitted along the
+        // sampled ray, so evaluate it toward the camera instead
+        const AreaLight *light = static_cast<const AreaLight *>(qs.ei.light);
+        L = light->L(qs.ei, wi) * AbsDot(wi, qs.ng()) * Wi / (qs.pdfFwd * pdf);
+    } else {
+        Vertex sampled = Vertex::CreateCamera(&camera, vis.P1(), Wi / pdf);
+        L = qs.beta * qs.f(sampled, TransportMode::Importance) * sampled.beta;
+        if (qs.IsOnSurface()) L *= AbsDot(wi, qs.ns());
+    }
+    if (L.IsBlack()) return L;
+    ++totalConnections;
+    L *= vis.Tr(scene, sampler);
+    if (!L.IsBlack()) ++visibleConnections;
+    return L;
+}
+
+// LightTracerIntegrator Method Definitions
+void LightTracerIntegrator::Render(const Scene &scene) {
+    ProfilePhase p(Prof::IntegratorRender);
+    Film *film = camera->film;
+    if (scene.lights.empty()) {
+        film->WriteImage(1.0f / pathsPerPixel);
+        return;
+    }
+
+    // Light subpaths all start with the distribution at the camera's
+    // position, since that's where all of them end
+    std::unique_ptr<LightDistribution> lightDistribution =
+        CreateLightSampleDistribution(lightSampleStrategy, scene,
+                                      maxSparseLights, maxLightCacheBytes);
+    const Distribution1D &lightDistr = *lightDistribution->Lookup(
+        camera->CameraToWorld(camera->shutterOpen, Point3f(0, 0, 0)));
+    std::unordered_map<const Light *, size_t> lightToIndex;
+    for (size_t i = 0; i < scene.lights.size(); ++i)
+        lightToIndex[scene.lights[i].get()] = i;
+
+    // Trace _pathsPerPixel_ light subpaths per pixel in batches
+    const int64_t nPaths =
+        (int64_t)pathsPerPixel * film->GetSampleBounds().Area();
+    const int batchSize = 4096;
+    const int64_t nBatches = (nPaths + batchSize - 1) / batchSize;
+    std::vector<MemoryArena> threadArenas(MaxThreadIndex());
+    // Each thread accumulates its splats in an XYZ image of its own, which
+    // is added to the film once all paths have been traced, so that
+    // threads don't contend over the film's pixels
+    std::vector<std::vector<Float>> threadSplats(MaxThreadIndex());
+    const size_t splatImageSize = 3 * (size_t)film->croppedPixelBounds.Area();
+    ProgressReporter reporter(nBatches, "Rendering");
+    ParallelFor([&](int64_t batch) {
+        MemoryArena &arena = threadArenas[ThreadIndex];
+        std::vector<Float> &splats = threadSplats[ThreadIndex];
+        if (splats.empty()) splats.resize(splatImageSize, 0.f);
+        RandomSampler sampler(1, batch);
+        sampler.StartPixel(Point2i(0, 0));
+        int64_t end = std::min(nPaths, (batch + 1) * batchSize);
+        for (int64_t i = batch * batchSize; i < end; ++i) {
+            // Trace a light subpath and connect each of its vertices to the
+            // camera
+            Vertex *lightVertices = arena.Alloc<Vertex>(maxDepth + 1);
+            Float time = Lerp(sampler.Get1D(), camera->shutterOpen,
+                              camera->shutterClose);
+            int nLight =
+                GenerateLightSubpath(scene, sampler, arena, maxDepth + 1, time,
+                                     lightDistr, lightToIndex, lightVertices);
+            for (int s = 1; s <= nLight; ++s) {
+                Point2f pRaster;
+                Spectrum L = ConnectToCamera(scene, lightVertices[s - 1],
+                                             *camera, sampler, &pRaster);
+                int offset;
+                Float xyz[3];
+                if (!L.IsBlack() && film->SplatValue(pRaster, L, &offset, xyz))
+                    for (int c = 0; c < 3; ++c) splats[3 * offset + c] += xyz[c];
+            }
+            ++lightPathsTraced;
+            arena.Reset();
+        }
+        reporter.Update();
+    }, nBatches);
+    reporter.Done();
+    for (const std::vector<Float> &splats : threadSplats)
+        if (!splats.empty()) film->AddSplats(splats);
+
+    // Each pixel received the splats of _pathsPerPixel_ light subpaths
+    film->WriteImage(1.0f / pathsPerPixel);
+}
+
+LightTracerIntegrator *CreateLightTracerIntegrator(
+    const ParamSet &params, std::shared_ptr<Sampler> sampler,
+    std::shared_ptr<const Camera> camera) {
+    int maxDepth = params.FindOneInt("maxdepth", 5);
+    std::string lightStrategy = params.FindOneString(
+        "lightsampler", params.FindOneString("lightsamplestrategy", "power"));
+    // The sampler only sets the number of light subpaths per pixel; they
+    // aren't associated with pixels, so each batch uses its own
+    // _RandomSampler_
+    int pathsPerPixel = (int)sampler->samplesPerPixel;
+    int sparseLights = params.FindOneInt("sparselights", 64);
+    int lightCacheMB = params.FindOneInt("lightcachemaxmb", 64);
+    return new LightTracerIntegrator(camera, maxDepth, pathsPerPixel,
+                                     lightStrategy, sparseLights,
+                                     (size_t)std::max(1, lightCacheMB) << 20);
+}
+
+}  // namespace pbrt
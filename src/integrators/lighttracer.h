@@ -0,0 +1,86 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_INTEGRATORS_LIGHTTRACER_H
+#define PBRT_INTEGRATORS_LIGHTTRACER_H
+
+// integrators/lighttracer.h*
+#include "pbrt.h"
+#include "integrator.h"
+
+namespace pbrt {
+
+// LightTracerIntegrator Declarations
+
+// The light tracer follows paths from the light sources and connects every
+// vertex to the camera, splatting the result to the film; it's BDPT's
+// $t=1$ strategy on its own. Caustics seen on diffuse surfaces converge
+// quickly, while surfaces seen through specular interfaces, point lights
+// and infinite lights seen directly by the camera aren't rendered at all.
+class LightTracerIntegrator : public Integrator {
+  public:
+    // LightTracerIntegrator Public Methods
+    LightTracerIntegrator(std::shared_ptr<const Camera> camera, int maxDepth,
+                          int pathsPerPixel,
+                          const std::string &lightSampleStrategy = "power",
+                          int maxSparseLights = 64,
+                          size_t maxLightCacheBytes = 64 * 1024 * 1024)
+        : camera(camera),
+          maxDepth(maxDepth),
+          pathsPerPixel(pathsPerPixel),
+          lightSampleStrategy(lightSampleStrategy),
+          maxSparseLights(maxSparseLights),
+          maxLightCacheBytes(maxLightCacheBytes) {}
+    void Render(const Scene &scene);
+
+  private:
+    // LightTracerIntegrator Private Data
+    std::shared_ptr<const Camera> camera;
+    const int maxDepth;
+    const int pathsPerPixel;
+    const std::string lightSampleStrategy;
+    const int maxSparseLights;
+    const size_t maxLightCacheBytes;
+};
+
+LightTracerIntegrator *CreateLightTracerIntegrator(
+    const ParamSet &params, std::shared_ptr<Sampler> sampler,
+    std::shared_ptr<const Camera> camera);
+
+}  // namespace pbrt
+
+#endif  // PBRT_INTEGRATORS_LIGHTTRACER_H
@@ -44,10 +44,14 @@
 #include "paramset.h"
 #include "sampling.h"
 #include "progressreporter.h"
+#include "parallel.h"
 
 namespace pbrt {
 
 STAT_PERCENT("Integrator/Acceptance rate", acceptedMutations, totalMutations);
+STAT_PERCENT("Integrator/Replica exchange acceptance rate", acceptedSwaps,
+             totalSwaps);
+STAT_COUNTER("Integrator/MLT chains restarted", chainsRestarted);
 
 // MLTSampler Constants
 static const int cameraStreamIndex = 0;
@@ -162,6 +166,59 @@ Spectrum MLTIntegrator::L(const Scene &scene, MemoryArena &arena,
            nStrategies;
 }
 
+// MLTChain Declarations
+struct MLTReplica {
+    std::unique_ptr<MLTSampler> sampler;
+    Point2f pCurrent;
+    Spectrum LCurrent;
+};
+
+struct MLTChain {
+    // MLTChain Public Data
+    int depth = -1;
+    RNG rng;
+    std::vector<MLTReplica> replicas;
+    // Large step proposals are independent uniform samples of the chain's
+    // depth, so their luminance refines the estimate of its contribution
+    Float largeStepSum = 0;
+    int64_t nLargeSteps = 0;
+};
+
+// MLT Utility Functions
+static std::vector<int> AllocateChains(const std::vector<Float> &depthB,
+                                       int nChains) {
+    // Give each depth that contributes at least one chain and distribute
+    // the rest in proportion to the depths' contributions
+    int nDepths = depthB.size(), nNonzero = 0;
+    Float b = 0;
+    for (Float bd : depthB)
+        if (bd > 0) {
+            b += bd;
+            ++nNonzero;
+        }
+    std::vector<int> nDepthChains(nDepths, 0);
+    if (nNonzero == 0) return nDepthChains;
+    int nRemaining = std::max(0, nChains - nNonzero), nAllocated = 0;
+    std::vector<std::pair<Float, int>> remainders;
+    for (int d = 0; d < nDepths; ++d) {
+        if (depthB[d] == 0) continue;
+        Float share = nRemaining * depthB[d] / b;
+        nDepthChains[d] = 1 + (int)share;
+        nAllocated += nDepthChains[d];
+        remainders.push_back({share - (int)share, d});
+    }
+
+    // Hand out the chains lost to rounding by largest remainder
+    std::sort(remainders.begin(), remainders.end(),
+              [](const std::pair<Float, int> &a,
+                 const std::pair<Float, int> &b) { return a.first > b.first; });
+    for (size_t i = 0; i < remainders.size() && nAllocated < nChains; ++i) {
+        ++nDepthChains[remainders[i].second];
+        ++nAllocated;
+    }
+    return nDepthChains;
+}
+
 void MLTIntegrator::Render(const Scene &scene) {
     std::unique_ptr<Distribution1D> lightDistr =
         ComputeLightPowerDistribution(scene);
@@ -175,18 +232,19 @@ void MLTIntegrator::Render(const Scene &scene) {
         lightToIndex[scene.lights[i].get()] = i;
 
     // Generate bootstrap samples and compute normalization constant $b$
-    int nBootstrapSamples = nBootstrap * (maxDepth + 1);
+    const int nDepths = maxDepth + 1;
+    int nBootstrapSamples = nBootstrap * nDepths;
     std::vector<Float> bootstrapWeights(nBootstrapSamples, 0);
     if (scene.lights.size() > 0) {
         ProgressReporter progress(nBootstrap / 256,
                                   "Generating bootstrap paths");
         std::vector<MemoryArena> bootstrapThreadArenas(MaxThreadIndex());
-        int chunkSize = Clamp(nBootstrap / 128, 1, 8192);
+        int chunkSize = Clamp(nBootstrap / (32 * MaxThreadIndex()), 1, 8192);
         ParallelFor([&](int i) {
             // Generate _i_th bootstrap sample
             MemoryArena &arena = bootstrapThreadArenas[ThreadIndex];
             for (int depth = 0; depth <= maxDepth; ++depth) {
-                int rngIndex = i * (maxDepth + 1) + depth;
+                int rngIndex = i * nDepths + depth;
                 MLTSampler sampler(mutationsPerPixel, rngIndex, sigma,
                                    largeStepProbability, nSampleStreams);
                 Point2f pRaster;
@@ -198,88 +256,223 @@ void MLTIntegrator::Render(const Scene &scene) {
         }, nBootstrap, chunkSize);
         progress.Done();
     }
-    Distribution1D bootstrap(&bootstrapWeights[0], nBootstrapSamples);
-    Float b = bootstrap.funcInt * (maxDepth + 1);
 
-    // Run _nChains_ Markov chains in parallel
+    // Split the bootstrap samples by depth; each depth's normalization
+    // constant $b_d$ is the average of its samples, and $b=\sum_d b_d$
+    std::vector<std::unique_ptr<Distribution1D>> depthBootstrap;
+    std::vector<Float> bootstrapSum(nDepths, 0);
+    std::vector<Float> depthWeights(nBootstrap);
+    for (int depth = 0; depth < nDepths; ++depth) {
+        for (int i = 0; i < nBootstrap; ++i) {
+            depthWeights[i] = bootstrapWeights[i * nDepths + depth];
+            bootstrapSum[depth] += depthWeights[i];
+        }
+        depthBootstrap.push_back(std::unique_ptr<Distribution1D>(
+            new Distribution1D(&depthWeights[0], nBootstrap)));
+    }
+
+    // Compute inverse temperatures of the replicas, from one for the replica
+    // that renders down to $1/\roman{maxTemperature}$
+    std::vector<Float> beta(nReplicas, 1);
+    for (int k = 1; k < nReplicas; ++k)
+        beta[k] = std::pow(maxTemperature, -Float(k) / (nReplicas - 1));
+
+    // Run _nChains_ Markov chains in parallel over _nRounds_ rounds
     Film &film = *camera->film;
-    int64_t nTotalMutations =
-        (int64_t)mutationsPerPixel * (int64_t)film.GetSampleBounds().Area();
+    int64_t nPixels = film.GetSampleBounds().Area();
+    int64_t nTotalMutations = (int64_t)mutationsPerPixel * nPixels;
+    const int nChainsUsed = std::max(nChains, nDepths);
+    std::vector<MLTChain> chains(nChainsUsed);
+    for (int i = 0; i < nChainsUsed; ++i) chains[i].rng.SetSequence(i);
+    std::vector<Float> largeStepSum(nDepths, 0);
+    std::vector<int64_t> nLargeSteps(nDepths, 0);
     if (scene.lights.size() > 0) {
-        const int progressFrequency = 32768;
-        ProgressReporter progress(nTotalMutations / progressFrequency,
-                                  "Rendering");
-        ParallelFor([&](int i) {
-            int64_t nChainMutations =
-                std::min((i + 1) * nTotalMutations / nChains, nTotalMutations) -
-                i * nTotalMutations / nChains;
-            // Follow {i}th Markov chain for _nChainMutations_
-            MemoryArena arena;
-
-            // Select initial state from the set of bootstrap samples
-            RNG rng(i);
-            int bootstrapIndex = bootstrap.SampleDiscrete(rng.UniformFloat());
-            int depth = bootstrapIndex % (maxDepth + 1);
-
-            // Initialize local variables for selected state
-            MLTSampler sampler(mutationsPerPixel, bootstrapIndex, sigma,
-                               largeStepProbability, nSampleStreams);
-            Point2f pCurrent;
-            Spectrum LCurrent =
-                L(scene, arena, lightDistr, lightToIndex, sampler, depth, &pCurrent);
-
-            // Run the Markov chain for _nChainMutations_ steps
-            for (int64_t j = 0; j < nChainMutations; ++j) {
-                sampler.StartIteration();
-                Point2f pProposed;
-                Spectrum LProposed =
-                    L(scene, arena, lightDistr, lightToIndex, sampler, depth, &pProposed);
-                // Compute acceptance probability for proposed sample
-                Float accept = std::min((Float)1, LProposed.y() / LCurrent.y());
-
-                // Splat both current and proposed samples to _film_
-                if (accept > 0)
-                    film.AddSplat(pProposed,
-                                  LProposed * accept / LProposed.y());
-                film.AddSplat(pCurrent, LCurrent * (1 - accept) / LCurrent.y());
-
-                // Accept or reject the proposal
-                if (rng.UniformFloat() < accept) {
-                    pCurrent = pProposed;
-                    LCurrent = LProposed;
-                    sampler.Accept();
-                    ++acceptedMutations;
-                } else
-                    sampler.Reject();
-                ++totalMutations;
-                if ((i * nTotalMutations / nChains + j) % progressFrequency ==
-                    0)
-                    progress.Update();
-                arena.Reset();
+        ProgressReporter progress(nTotalMutations, "Rendering");
+        std::vector<MemoryArena> threadArenas(MaxThreadIndex());
+        for (int round = 0; round < nRounds; ++round) {
+            // Rebalance the chains across depths using the current $b_d$
+            // estimates, keeping the state of chains whose depth is unchanged
+            std::vector<Float> depthB(nDepths);
+            for (int d = 0; d < nDepths; ++d)
+                depthB[d] = (bootstrapSum[d] + largeStepSum[d]) /
+                            (nBootstrap + nLargeSteps[d]);
+            std::vector<int> nOpen = AllocateChains(depthB, nChainsUsed);
+            std::vector<int> released;
+            for (int i = 0; i < nChainsUsed; ++i) {
+                int d = chains[i].depth;
+                if (d >= 0 && nOpen[d] > 0)
+                    --nOpen[d];
+                else
+                    released.push_back(i);
+            }
+            int depth = 0;
+            for (int i : released) {
+                while (depth < nDepths && nOpen[depth] == 0) ++depth;
+                chains[i].depth = depth < nDepths ? depth : -1;
+                chains[i].replicas.clear();
+                if (depth < nDepths) {
+                    --nOpen[depth];
+                    ++chainsRestarted;
+                }
             }
-        }, nChains);
+
+            // Divide this round's mutations among the chains and compute the
+            // splat scale that gives each depth a total weight of $b_d$
+            int64_t roundStart = round * nTotalMutations / nRounds;
+            int64_t nRoundMutations =
+                (round + 1) * nTotalMutations / nRounds - roundStart;
+            auto chainMutations = [&](int i) {
+                return (i + 1) * nRoundMutations / nChainsUsed -
+                       i * nRoundMutations / nChainsUsed;
+            };
+            std::vector<int64_t> nDepthMutations(nDepths, 0);
+            for (int i = 0; i < nChainsUsed; ++i)
+                if (chains[i].depth >= 0)
+                    nDepthMutations[chains[i].depth] += chainMutations(i);
+            std::vector<Float> splatScale(nDepths, 0);
+            for (int d = 0; d < nDepths; ++d)
+                if (nDepthMutations[d] > 0)
+                    splatScale[d] = depthB[d] * nPixels /
+                                    (nRounds * (Float)nDepthMutations[d]);
+
+            ParallelFor([&](int i) {
+                MLTChain &chain = chains[i];
+                if (chain.depth < 0) return;
+                int64_t nChainMutations = chainMutations(i);
+                MemoryArena &arena = threadArenas[ThreadIndex];
+
+                // Select initial replica states from the set of bootstrap
+                // samples at the chain's depth if it was just assigned one
+                if (chain.replicas.empty()) {
+                    chain.replicas.resize(nReplicas);
+                    for (MLTReplica &replica : chain.replicas) {
+                        int bootstrapIndex =
+                            depthBootstrap[chain.depth]->SampleDiscrete(
+                                chain.rng.UniformFloat());
+                        replica.sampler.reset(new MLTSampler(
+                            mutationsPerPixel,
+                            bootstrapIndex * nDepths + chain.depth, sigma,
+                            largeStepProbability, nSampleStreams));
+                        replica.LCurrent =
+                            L(scene, arena, lightDistr, lightToIndex,
+                              *replica.sampler, chain.depth,
+                              &replica.pCurrent);
+                        arena.Reset();
+                    }
+                }
+
+                // Run the Markov chain for _nChainMutations_ steps
+                Float scale = splatScale[chain.depth];
+                for (int64_t j = 0; j < nChainMutations; ++j) {
+                    for (int k = 0; k < nReplicas; ++k) {
+                        MLTReplica &replica = chain.replicas[k];
+                        MLTSampler &sampler = *replica.sampler;
+                        sampler.StartIteration();
+                        Point2f pProposed;
+                        Spectrum LProposed =
+                            L(scene, arena, lightDistr, lightToIndex, sampler,
+                              chain.depth, &pProposed);
+                        if (sampler.LargeStep()) {
+                            chain.largeStepSum += LProposed.y();
+                            ++chain.nLargeSteps;
+                        }
+
+                        // Compute acceptance probability for proposed sample
+                        Float accept = std::min(
+                            (Float)1, LProposed.y() / replica.LCurrent.y());
+                        if (beta[k] != 1) accept = std::pow(accept, beta[k]);
+
+                        // Splat both current and proposed samples to _film_
+                        if (k == 0) {
+                            if (accept > 0)
+                                film.AddSplat(pProposed,
+                                              LProposed *
+                                                  (accept * scale / LProposed.y()));
+                            film.AddSplat(replica.pCurrent,
+                                          replica.LCurrent *
+                                              ((1 - accept) * scale /
+                                               replica.LCurrent.y()));
+                            ++totalMutations;
+                        }
+
+                        // Accept or reject the proposal
+                        if (chain.rng.UniformFloat() < accept) {
+                            replica.pCurrent = pProposed;
+                            replica.LCurrent = LProposed;
+                            sampler.Accept();
+                            if (k == 0) ++acceptedMutations;
+                        } else
+                            sampler.Reject();
+                        arena.Reset();
+                    }
+
+                    // Propose exchanging the states of a random pair of
+                    // replicas at adjacent temperatures
+                    if (nReplicas > 1) {
+                        int k = std::min(
+                            (int)(chain.rng.UniformFloat() * (nReplicas - 1)),
+                            nReplicas - 2);
+                        MLTReplica &cold = chain.replicas[k];
+                        MLTReplica &hot = chain.replicas[k + 1];
+                        Float accept = std::min(
+                            (Float)1, std::pow(hot.LCurrent.y() /
+                                                   cold.LCurrent.y(),
+                                               beta[k] - beta[k + 1]));
+                        if (chain.rng.UniformFloat() < accept) {
+                            std::swap(cold, hot);
+                            ++acceptedSwaps;
+                        }
+                        ++totalSwaps;
+                    }
+                }
+                progress.Update(nChainMutations);
+            }, nChainsUsed);
+
+            // Fold the chains' large step samples into the $b_d$ estimates
+            for (MLTChain &chain : chains) {
+                if (chain.depth < 0) continue;
+                largeStepSum[chain.depth] += chain.largeStepSum;
+                nLargeSteps[chain.depth] += chain.nLargeSteps;
+                chain.largeStepSum = 0;
+                chain.nLargeSteps = 0;
+            }
+        }
         progress.Done();
     }
 
     // Store final image computed with MLT
-    camera->film->WriteImage(b / mutationsPerPixel);
+    camera->film->WriteImage(1);
 }
 
 MLTIntegrator *CreateMLTIntegrator(const ParamSet &params,
                                    std::shared_ptr<const Camera> camera) {
     int maxDepth = params.FindOneInt("maxdepth", 5);
     int nBootstrap = params.FindOneInt("bootstrapsamples", 100000);
-    int64_t nChains = params.FindOneInt("chains", 1000);
+    // By default, use enough chains that each thread has plenty of them to
+    // balance the load
+    int nChains = params.FindOneInt("chains", 0);
+    if (nChains <= 0) nChains = std::max(1000, 64 * MaxThreadIndex());
     int mutationsPerPixel = params.FindOneInt("mutationsperpixel", 100);
     Float largeStepProbability =
         params.FindOneFloat("largestepprobability", 0.3f);
     Float sigma = params.FindOneFloat("sigma", .01f);
+    int nRounds = params.FindOneInt("rounds", 4);
+    int nReplicas = params.FindOneInt("replicas", 1);
+    Float maxTemperature = params.FindOneFloat("maxtemperature", 8.f);
+    if (nRounds < 1 || nReplicas < 1 || maxTemperature < 1) {
+        Error("\"rounds\" and \"replicas\" must be at least one and "
+              "\"maxtemperature\" can't be less than one.");
+        nRounds = std::max(nRounds, 1);
+        nReplicas = std::max(nReplicas, 1);
+        maxTemperature = std::max(maxTemperature, (Float)1);
+    }
     if (PbrtOptions.quickRender) {
         mutationsPerPixel = std::max(1, mutationsPerPixel / 16);
         nBootstrap = std::max(1, nBootstrap / 16);
     }
     return new MLTIntegrator(camera, maxDepth, nBootstrap, nChains,
-                             mutationsPerPixel, sigma, largeStepProbability);
+                             mutationsPerPixel, sigma, largeStepProbability,
+                             nRounds, nReplicas, maxTemperature);
 }
 
 }  // namespace pbrt
@@ -68,6 +68,7 @@ class MLTSampler : public Sampler {
     void Reject();
     void StartStream(int index);
     int GetNextIndex() { return streamIndex + streamCount * sampleIndex++; }
+    bool LargeStep() const { return largeStep; }
 
   protected:
     // MLTSampler Private Declarations
@@ -109,14 +110,18 @@ class MLTIntegrator : public Integrator {
     // MLTIntegrator Public Methods
     MLTIntegrator(std::shared_ptr<const Camera> camera, int maxDepth,
                   int nBootstrap, int nChains, int mutationsPerPixel,
-                  Float sigma, Float largeStepProbability)
+                  Float sigma, Float largeStepProbability, int nRounds = 1,
+                  int nReplicas = 1, Float maxTemperature = 1)
         : camera(camera),
           maxDepth(maxDepth),
           nBootstrap(nBootstrap),
           nChains(nChains),
           mutationsPerPixel(mutationsPerPixel),
           sigma(sigma),
-          largeStepProbability(largeStepProbability) {}
+          largeStepProbability(largeStepProbability),
+          nRounds(nRounds),
+          nReplicas(nReplicas),
+          maxTemperature(maxTemperature) {}
     void Render(const Scene &scene);
     Spectrum L(const Scene &scene, MemoryArena &arena,
                const std::unique_ptr<Distribution1D> &lightDistr,
@@ -131,6 +136,12 @@ class MLTIntegrator : public Integrator {
     const int nChains;
     const int mutationsPerPixel;
     const Float sigma, largeStepProbability;
+    // Chains are reassigned to path depths between each of the _nRounds_
+    // rounds; each chain runs _nReplicas_ tempered replicas, of which only
+    // the first, at temperature one, contributes to the image
+    const int nRounds;
+    const int nReplicas;
+    const Float maxTemperature;
 };
 
 MLTIntegrator *CreateMLTIntegrator(const ParamSet &params,
@@ -44,31 +44,202 @@ namespace pbrt {
 
 STAT_PERCENT("Integrator/Zero-radiance paths", zeroRadiancePaths, totalPaths);
 STAT_INT_DISTRIBUTION("Integrator/Path length", pathLength);
+STAT_COUNTER("Integrator/Guiding training passes", guidingPasses);
+STAT_COUNTER("Integrator/Guiding spatial leaves", guidingLeaves);
+STAT_MEMORY_COUNTER("Memory/Guiding SD-tree", guidingBytes);
+STAT_PERCENT("Integrator/ADRRS paths terminated", adrrsTerminated,
+             adrrsVertices);
+STAT_INT_DISTRIBUTION("Integrator/ADRRS splitting factor", adrrsSplits);
+
+// Probability of sampling the BSDF rather than the SD-tree at guided
+// vertices
+static PBRT_CONSTEXPR Float guidingBSDFFraction = .5f;
+
+// ADRRS weight window: paths expected to contribute less than
+// _adrrsLow_ times their pixel's estimated value undergo Russian roulette
+// and ones above _adrrsHigh_ times it are split, following Vorba and
+// Krivanek, "Adjoint-Driven Russian Roulette and Splitting in Light
+// Transport Simulation" (2016). A camera ray is split into at most
+// _adrrsMaxSplits_ paths.
+static PBRT_CONSTEXPR Float adrrsLow = 1.f / 3.f, adrrsHigh = 5.f / 3.f;
+static PBRT_CONSTEXPR int adrrsMaxSplits = 8;
+
+// A vertex whose sampled direction is recorded into the SD-tree once the
+// radiance arriving along it is known
+struct GuidingVertex {
+    DTreeWrapper *dTree;
+    Vector3f wi;
+    // Path throughput up to and including the vertex's own scattering
+    Spectrum beta;
+    // Radiance arriving at the vertex along _wi_
+    Spectrum L;
+    Float pdf;
+    // The vertex's scattering weight, $f \cos\theta / p$
+    Spectrum weight;
+};
 
 // PathIntegrator Method Definitions
 PathIntegrator::PathIntegrator(int maxDepth,
                                std::shared_ptr<const Camera> camera,
                                std::shared_ptr<Sampler> sampler,
                                const Bounds2i &pixelBounds, Float rrThreshold,
-                               const std::string &lightSampleStrategy)
+                               const std::string &lightSampleStrategy,
+                               bool guiding, Float guidingTrainingFraction,
+                               size_t maxGuidingBytes, bool adrrs,
+                               int maxSparseLights, size_t maxLightCacheBytes)
     : SamplerIntegrator(camera, sampler, pixelBounds),
       maxDepth(maxDepth),
       rrThreshold(rrThreshold),
-      lightSampleStrategy(lightSampleStrategy) {}
+      lightSampleStrategy(lightSampleStrategy),
+      maxSparseLights(maxSparseLights),
+      maxLightCacheBytes(maxLightCacheBytes),
+      guiding(guiding),
+      guidingTrainingFraction(guidingTrainingFraction),
+      maxGuidingBytes(maxGuidingBytes),
+      adrrs(adrrs) {}
 
 void PathIntegrator::Preprocess(const Scene &scene, Sampler &sampler) {
-    lightDistribution =
-        CreateLightSampleDistribution(lightSampleStrategy, scene);
+    lightDistribution = CreateLightSampleDistribution(
+        lightSampleStrategy, scene, maxSparseLights, maxLightCacheBytes);
+    if (guiding || adrrs) sdTree.reset(new SDTree(scene.WorldBound()));
+    if (adrrs) {
+        estimateBounds = camera->film->GetSampleBounds();
+        pixelLuminance.reset(new AtomicFloat[estimateBounds.Area()]);
+    }
+}
+
+void PathIntegrator::Render(const Scene &scene) {
+    if (!guiding && !adrrs) {
+        SamplerIntegrator::Render(scene);
+        return;
+    }
+    Preprocess(scene, *sampler);
+
+    // Train the SD-tree with passes of 1, 2, 4, ... samples per pixel, as
+    // long as they fit in the training share of the sample budget. Each
+    // pass samples from the tree learned by the previous ones. Without
+    // guiding, the training paths are ordinary path-traced samples and go
+    // to the film as well.
+    int64_t spp = sampler->samplesPerPixel;
+    int64_t trainingSamples = std::min<int64_t>(
+        spp - 1, (int64_t)(std::max<Float>(0, guidingTrainingFraction) * spp));
+    int64_t firstSample = 0;
+    int iteration = 0;
+    for (int64_t passSamples = 1; firstSample + passSamples <= trainingSamples;
+         passSamples *= 2, ++iteration) {
+        guideRecording = true;
+        guideSampling = guiding && iteration > 0;
+        RenderSamples(scene, firstSample, firstSample + passSamples, !guiding,
+                      StringPrintf("Training guiding (pass %d)", iteration + 1));
+        sdTree->Refine(iteration, maxGuidingBytes);
+        firstSample += passSamples;
+        ++guidingPasses;
+    }
+    LOG(INFO) << StringPrintf("Trained SD-tree with %d passes: %d spatial "
+                              "leaves, %d bytes", iteration,
+                              sdTree->NumLeaves(), (int)sdTree->BytesUsed());
+    guidingLeaves = sdTree->NumLeaves();
+    guidingBytes = sdTree->BytesUsed();
+
+    // Turn the training passes' pixel sums into mean luminances, averaged
+    // over a small neighborhood to reduce their noise
+    if (adrrs && firstSample > 0) {
+        const int radius = 2;
+        std::vector<Float> sums(estimateBounds.Area());
+        for (int i = 0; i < estimateBounds.Area(); ++i)
+            sums[i] = pixelLuminance[i];
+        for (Point2i p : estimateBounds) {
+            Bounds2i filterBounds =
+                Intersect(Bounds2i(p - Vector2i(radius, radius),
+                                   p + Vector2i(radius + 1, radius + 1)),
+                          estimateBounds);
+            Float sum = 0;
+            for (Point2i pf : filterBounds) sum += sums[PixelIndex(pf)];
+            pixelLuminance[PixelIndex(p)] =
+                sum / (firstSample * filterBounds.Area());
+        }
+        adrrsActive = true;
+    }
+
+    // Render the remaining samples with the trained guiding distributions
+    guideRecording = false;
+    guideSampling = guiding && iteration > 0;
+    RenderSamples(scene, firstSample, spp, true, "Rendering");
+    LOG(INFO) << "Rendering finished";
+    camera->film->WriteImage();
+}
+
+Spectrum PathIntegrator::SampleGuided(const SurfaceInteraction &isect,
+                                      const DTreeWrapper &dTree,
+                                      const Vector3f &wo, Vector3f *wi,
+                                      Float *pdf, BxDFType *sampledType,
+                                      Sampler &sampler) const {
+    // Pick the BSDF or the SD-tree with one-sample MIS; the returned pdf
+    // is that of the mixture
+    const BSDF &bsdf = *isect.bsdf;
+    Float uChoice = sampler.Get1D();
+    Point2f u = sampler.Get2D();
+    Spectrum f;
+    Float bsdfPdf;
+    if (uChoice < guidingBSDFFraction) {
+        f = bsdf.Sample_f(wo, wi, u, &bsdfPdf, BSDF_ALL, sampledType);
+        if (f.IsBlack() || bsdfPdf == 0) {
+            *pdf = 0;
+            return Spectrum(0.f);
+        }
+    } else {
+        *wi = dTree.Sample(u);
+        f = bsdf.f(wo, *wi);
+        bsdfPdf = bsdf.Pdf(wo, *wi);
+        bool reflect = Dot(*wi, isect.n) * Dot(wo, isect.n) > 0;
+        *sampledType = BxDFType(BSDF_GLOSSY | (reflect ? BSDF_REFLECTION
+                                                       : BSDF_TRANSMISSION));
+    }
+    *pdf = guidingBSDFFraction * bsdfPdf +
+           (1 - guidingBSDFFraction) * dTree.Pdf(*wi);
+    return f;
+}
+
+Float PathIntegrator::ContributionRatio(const SurfaceInteraction &isect,
+                                        const Spectrum &beta,
+                                        const Point2i &pixel) const {
+    // Returns the expected contribution of the path's remaining vertices
+    // relative to its pixel's estimated value, or -1 if there's no
+    // estimate for the pixel
+
+    // The SD-tree caches the scattered radiance found by the training
+    // passes' paths after light sampling at non-specular vertices only
+    if (isect.bsdf->NumComponents(BSDF_SPECULAR) > 0) return -1;
+    Float Lo = sdTree->Lookup(isect.p)->outgoingRadiance;
+    Float pixelL = pixelLuminance[PixelIndex(pixel)];
+    if (pixelL <= 0) return -1;
+    return beta.y() * Lo / pixelL;
 }
 
 Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
                             Sampler &sampler, MemoryArena &arena,
                             int depth) const {
     ProfilePhase p(Prof::SamplerIntegratorLi);
-    Spectrum L(0.f), beta(1.f);
-    RayDifferential ray(r);
-    bool specularBounce = false;
-    int bounces;
+    Spectrum L = TracePath(r, Spectrum(1.f), 0, false, 1, 1, scene, sampler,
+                           arena);
+
+    // Accumulate the training passes' estimates of the pixel values
+    if (adrrs && guideRecording) {
+        pixelLuminance[PixelIndex(sampler.CurrentPixel())].Add(L.y());
+    }
+    return L;
+}
+
+// Follows a path from _ray_ given the throughput and state of the path up
+// to its origin; paths split by ADRRS continue through recursive calls.
+// _splitFactor_ is the number of paths that the camera ray has already
+// been split into along the way to this one.
+Spectrum PathIntegrator::TracePath(RayDifferential ray, Spectrum beta,
+                                   int bounces, bool specularBounce,
+                                   Float etaScale, int splitFactor,
+                                   const Scene &scene, Sampler &sampler,
+                                   MemoryArena &arena) const {
+    Spectrum L(0.f);
     // Added after book publication: etaScale tracks the accumulated effect
     // of radiance scaling due to rays passing through refractive
     // boundaries (see the derivation on p. 527 of the third edition). We
@@ -76,9 +247,23 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
     // Russian roulette; this is worthwhile, since it lets us sometimes
     // avoid terminating refracted rays that are about to be refracted back
     // out of a medium and thus have their beta value increased.
-    Float etaScale = 1;
+    // Lobe spreads are scaled like the camera ray differentials, since the
+    // pixel's samples jointly cover the lobe.
+    Float spreadScale = 1 / std::sqrt((Float)sampler.samplesPerPixel);
+    // When training the SD-tree, every contribution to _L_ is also
+    // radiance arriving at the guided vertices found before it
+    GuidingVertex *vertices =
+        guideRecording ? arena.Alloc<GuidingVertex>(maxDepth + 1) : nullptr;
+    int nVertices = 0;
+    auto addRadiance = [&](const Spectrum &contrib) {
+        L += contrib;
+        for (int i = 0; i < nVertices; ++i)
+            for (int c = 0; c < Spectrum::nSamples; ++c)
+                if (vertices[i].beta[c] > 0)
+                    vertices[i].L[c] += contrib[c] / vertices[i].beta[c];
+    };
 
-    for (bounces = 0;; ++bounces) {
+    for (;; ++bounces) {
         // Find next path vertex and accumulate contribution
         VLOG(2) << "Path tracer bounce " << bounces << ", current L = " << L
                 << ", beta = " << beta;
@@ -91,11 +276,11 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
         if (bounces == 0 || specularBounce) {
             // Add emitted light at path vertex or from the environment
             if (foundIntersection) {
-                L += beta * isect.Le(-ray.d);
+                addRadiance(beta * isect.Le(-ray.d));
                 VLOG(2) << "Added Le -> L = " << L;
             } else {
                 for (const auto &light : scene.infiniteLights)
-                    L += beta * light->Le(ray);
+                    addRadiance(beta * light->Le(ray));
                 VLOG(2) << "Added infinite area lights -> L = " << L;
             }
         }
@@ -107,35 +292,104 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
         isect.ComputeScatteringFunctions(ray, arena, true);
         if (!isect.bsdf) {
             VLOG(2) << "Skipping intersection due to null bsdf";
-            ray = isect.SpawnRay(ray.d);
+            ray = isect.SpawnRayCone(ray, ray.d, 0);
             bounces--;
             continue;
         }
 
-        const Distribution1D *distrib = lightDistribution->Lookup(isect.p);
-
         // Sample illumination from lights to find path contribution.
         // (But skip this for perfectly specular BSDFs.)
         if (isect.bsdf->NumComponents(BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) >
             0) {
             ++totalPaths;
-            Spectrum Ld = beta * UniformSampleOneLight(isect, scene, arena,
-                                                       sampler, false, distrib);
+            Spectrum Ld =
+                beta * UniformSampleOneLight(isect, scene, arena, sampler,
+                                             false, *lightDistribution);
             VLOG(2) << "Sampled direct lighting Ld = " << Ld;
             if (Ld.IsBlack()) ++zeroRadiancePaths;
             CHECK_GE(Ld.y(), 0.f);
-            L += Ld;
+            addRadiance(Ld);
         }
 
+        // Play Russian roulette or split the path according to its
+        // expected contribution
+        int nSplits = 1;
+        bool adrrsVertex = false;
+        if (adrrsActive && !guideRecording) {
+            Float ratio =
+                ContributionRatio(isect, beta, sampler.CurrentPixel());
+            if (ratio >= 0) {
+                adrrsVertex = true;
+                ++adrrsVertices;
+                if (ratio < adrrsLow) {
+                    Float pSurvive = std::max((Float).05, ratio / adrrsLow);
+                    if (sampler.Get1D() >= pSurvive) {
+                        ++adrrsTerminated;
+                        break;
+                    }
+                    beta /= pSurvive;
+                } else if (ratio > adrrsHigh && !isect.bssrdf)
+                    // Limit the total number of paths per camera ray
+                    nSplits = std::max(
+                        1, std::min((int)std::round(ratio),
+                                    adrrsMaxSplits / splitFactor));
+                ReportValue(adrrsSplits, nSplits);
+            }
+        }
+
+        // Find the SD-tree leaf for vertices with no specular components
+        DTreeWrapper *dTree = nullptr;
+        if (sdTree && (guideSampling || guideRecording) &&
+            isect.bsdf->NumComponents(BSDF_SPECULAR) == 0 &&
+            isect.bsdf->NumComponents(BSDF_ALL) > 0)
+            dTree = sdTree->Lookup(isect.p);
+
         // Sample BSDF to get new path direction
         Vector3f wo = -ray.d, wi;
         Float pdf;
         BxDFType flags;
-        Spectrum f = isect.bsdf->Sample_f(wo, &wi, sampler.Get2D(), &pdf,
-                                          BSDF_ALL, &flags);
+        auto sampleDirection = [&](Vector3f *wi, Float *pdf, BxDFType *flags) {
+            if (dTree && guideSampling)
+                return SampleGuided(isect, *dTree, wo, wi, pdf, flags, sampler);
+            return isect.bsdf->Sample_f(wo, wi, sampler.Get2D(), pdf, BSDF_ALL,
+                                        flags);
+        };
+        if (nSplits > 1) {
+            // Trace the additional split paths, each of which carries an
+            // equal share of the throughput
+            beta /= nSplits;
+            for (int i = 1; i < nSplits; ++i) {
+                Vector3f wiSplit;
+                Float pdfSplit;
+                BxDFType flagsSplit;
+                Spectrum fSplit = sampleDirection(&wiSplit, &pdfSplit,
+                                                  &flagsSplit);
+                if (fSplit.IsBlack() || pdfSplit == 0) continue;
+                bool specularSplit = (flagsSplit & BSDF_SPECULAR) != 0;
+                Float etaScaleSplit = etaScale;
+                if (specularSplit && (flagsSplit & BSDF_TRANSMISSION)) {
+                    Float eta = isect.bsdf->eta;
+                    etaScaleSplit *= (Dot(wo, isect.n) > 0) ? (eta * eta)
+                                                            : 1 / (eta * eta);
+                }
+                Float spread =
+                    specularSplit ? 0 : LobeSpreadAngle(pdfSplit) * spreadScale;
+                L += TracePath(
+                    isect.SpawnRayCone(ray, wiSplit, spread),
+                    beta * fSplit * AbsDot(wiSplit, isect.shading.n) / pdfSplit,
+                    bounces + 1, specularSplit, etaScaleSplit,
+                    splitFactor * nSplits, scene, sampler, arena);
+            }
+            splitFactor *= nSplits;
+        }
+        Spectrum f = sampleDirection(&wi, &pdf, &flags);
         VLOG(2) << "Sampled BSDF, f = " << f << ", pdf = " << pdf;
         if (f.IsBlack() || pdf == 0.f) break;
-        beta *= f * AbsDot(wi, isect.shading.n) / pdf;
+        Spectrum weight = f * AbsDot(wi, isect.shading.n) / pdf;
+        beta *= weight;
+        if (dTree && guideRecording)
+            vertices[nVertices++] = {dTree, wi, beta, Spectrum(0.f), pdf,
+                                     weight};
         VLOG(2) << "Updated beta = " << beta;
         CHECK_GE(beta.y(), 0.f);
         DCHECK(!std::isinf(beta.y()));
@@ -147,7 +401,10 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
             // medium.
             etaScale *= (Dot(wo, isect.n) > 0) ? (eta * eta) : 1 / (eta * eta);
         }
-        ray = isect.SpawnRay(wi);
+        // Widen the ray cone at non-specular bounces so that indirect texture
+        // lookups filter over the region the path represents
+        Float spread = specularBounce ? 0 : LobeSpreadAngle(pdf) * spreadScale;
+        ray = isect.SpawnRayCone(ray, wi, spread);
 
         // Account for subsurface scattering, if applicable
         if (isect.bssrdf && (flags & BSDF_TRANSMISSION)) {
@@ -160,8 +417,9 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
             beta *= S / pdf;
 
             // Account for the direct subsurface scattering component
-            L += beta * UniformSampleOneLight(pi, scene, arena, sampler, false,
-                                              lightDistribution->Lookup(pi.p));
+            addRadiance(beta * UniformSampleOneLight(pi, scene, arena, sampler,
+                                                     false,
+                                                     *lightDistribution));
 
             // Account for the indirect subsurface scattering component
             Spectrum f = pi.bsdf->Sample_f(pi.wo, &wi, sampler.Get2D(), &pdf,
@@ -176,7 +434,8 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
         // Possibly terminate the path with Russian roulette.
         // Factor out radiance scaling due to refraction in rrBeta.
         Spectrum rrBeta = beta * etaScale;
-        if (rrBeta.MaxComponentValue() < rrThreshold && bounces > 3) {
+        if (!adrrsVertex && rrBeta.MaxComponentValue() < rrThreshold &&
+            bounces > 3) {
             Float q = std::max((Float).05, 1 - rrBeta.MaxComponentValue());
             if (sampler.Get1D() < q) break;
             beta /= 1 - q;
@@ -184,6 +443,13 @@ Spectrum PathIntegrator::Li(const RayDifferential &r, const Scene &scene,
         }
     }
     ReportValue(pathLength, bounces);
+
+    // Record the radiance found along the guided directions
+    for (int i = 0; i < nVertices; ++i) {
+        const GuidingVertex &v = vertices[i];
+        v.dTree->Record(v.wi, v.L.y() / v.pdf);
+        v.dTree->RecordOutgoing(Spectrum(v.weight * v.L).y());
+    }
     return L;
 }
 
@@ -206,10 +472,22 @@ PathIntegrator *CreatePathIntegrator(const ParamSet &params,
         }
     }
     Float rrThreshold = params.FindOneFloat("rrthreshold", 1.);
-    std::string lightStrategy =
-        params.FindOneString("lightsamplestrategy", "spatial");
+    // "lightsampler" is accepted as a synonym for "lightsamplestrategy".
+    std::string lightStrategy = params.FindOneString(
+        "lightsampler", params.FindOneString("lightsamplestrategy", "spatial"));
+    bool guiding = params.FindOneBool("guiding", false);
+    Float trainingFraction =
+        params.FindOneFloat("guidingtrainingfraction", .5f);
+    int maxGuidingMB = params.FindOneInt("guidingmaxmb", 256);
+    bool adrrs = params.FindOneBool("adrrs", false);
+    int sparseLights = params.FindOneInt("sparselights", 64);
+    int lightCacheMB = params.FindOneInt("lightcachemaxmb", 64);
     return new PathIntegrator(maxDepth, camera, sampler, pixelBounds,
-                              rrThreshold, lightStrategy);
+                              rrThreshold, lightStrategy, guiding,
+                              trainingFraction,
+                              (size_t)std::max(1, maxGuidingMB) << 20, adrrs,
+                              sparseLights,
+                              (size_t)std::max(1, lightCacheMB) << 20);
 }
 
 }  // namespace pbrt
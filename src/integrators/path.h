@@ -42,6 +42,7 @@
 #include "pbrt.h"
 #include "integrator.h"
 #include "lightdistrib.h"
+#include "sdtree.h"
 
 namespace pbrt {
 
@@ -52,18 +53,56 @@ class PathIntegrator : public SamplerIntegrator {
     PathIntegrator(int maxDepth, std::shared_ptr<const Camera> camera,
                    std::shared_ptr<Sampler> sampler,
                    const Bounds2i &pixelBounds, Float rrThreshold = 1,
-                   const std::string &lightSampleStrategy = "spatial");
+                   const std::string &lightSampleStrategy = "spatial",
+                   bool guiding = false, Float guidingTrainingFraction = .5f,
+                   size_t maxGuidingBytes = 256 * 1024 * 1024,
+                   bool adrrs = false, int maxSparseLights = 64,
+                   size_t maxLightCacheBytes = 64 * 1024 * 1024);
 
     void Preprocess(const Scene &scene, Sampler &sampler);
+    void Render(const Scene &scene);
     Spectrum Li(const RayDifferential &ray, const Scene &scene,
                 Sampler &sampler, MemoryArena &arena, int depth) const;
 
   private:
+    // PathIntegrator Private Methods
+    Spectrum TracePath(RayDifferential ray, Spectrum beta, int bounces,
+                       bool specularBounce, Float etaScale, int splitFactor,
+                       const Scene &scene, Sampler &sampler,
+                       MemoryArena &arena) const;
+    int PixelIndex(const Point2i &p) const {
+        return (p.y - estimateBounds.pMin.y) *
+                   (estimateBounds.pMax.x - estimateBounds.pMin.x) +
+               p.x - estimateBounds.pMin.x;
+    }
+    Float ContributionRatio(const SurfaceInteraction &isect,
+                            const Spectrum &beta, const Point2i &pixel) const;
+    Spectrum SampleGuided(const SurfaceInteraction &isect,
+                          const DTreeWrapper &dTree, const Vector3f &wo,
+                          Vector3f *wi, Float *pdf, BxDFType *sampledType,
+                          Sampler &sampler) const;
+
     // PathIntegrator Private Data
     const int maxDepth;
     const Float rrThreshold;
     const std::string lightSampleStrategy;
+    const int maxSparseLights;
+    const size_t maxLightCacheBytes;
     std::unique_ptr<LightDistribution> lightDistribution;
+    // Path guiding: the first passes over the image train _sdTree_; only
+    // the last one is added to the film.
+    const bool guiding;
+    const Float guidingTrainingFraction;
+    const size_t maxGuidingBytes;
+    std::unique_ptr<SDTree> sdTree;
+    bool guideSampling = false, guideRecording = false;
+    // Adjoint-driven Russian roulette and splitting (ADRRS) compares each
+    // path's expected contribution, estimated with the SD-tree, to a
+    // coarse estimate of its pixel's value from the training passes.
+    const bool adrrs;
+    bool adrrsActive = false;
+    Bounds2i estimateBounds;
+    std::unique_ptr<AtomicFloat[]> pixelLuminance;
 };
 
 PathIntegrator *CreatePathIntegrator(const ParamSet &params,
@@ -43,7 +43,9 @@
 #include "interaction.h"
 #include "sampling.h"
 #include "samplers/halton.h"
+#include "hashgrid.h"
 #include "stats.h"
+#include <chrono>
 
 namespace pbrt {
 
@@ -53,10 +55,11 @@ STAT_RATIO(
     visiblePointsChecked, totalPhotonSurfaceInteractions);
 STAT_COUNTER("Stochastic Progressive Photon Mapping/Photon paths followed",
              photonPaths);
-STAT_INT_DISTRIBUTION(
-    "Stochastic Progressive Photon Mapping/Grid cells per visible point",
-    gridCellsPerVisiblePoint);
+STAT_FLOAT_DISTRIBUTION(
+    "Stochastic Progressive Photon Mapping/Photon pass throughput (M/s)",
+    photonsPerSecond);
 STAT_MEMORY_COUNTER("Memory/SPPM Pixels", pixelMemoryBytes);
+STAT_MEMORY_COUNTER("Memory/SPPM visible point grid", gridMemoryBytes);
 STAT_FLOAT_DISTRIBUTION("Memory/SPPM BSDF and Grid Memory", memoryArenaMB);
 
 // SPPM Local Definitions
@@ -84,29 +87,6 @@ struct SPPMPixel {
     Spectrum tau;
 };
 
-struct SPPMPixelListNode {
-    SPPMPixel *pixel;
-    SPPMPixelListNode *next;
-};
-
-static bool ToGrid(const Point3f &p, const Bounds3f &bounds,
-                   const int gridRes[3], Point3i *pi) {
-    bool inBounds = true;
-    Vector3f pg = bounds.Offset(p);
-    for (int i = 0; i < 3; ++i) {
-        (*pi)[i] = (int)(gridRes[i] * pg[i]);
-        inBounds &= ((*pi)[i] >= 0 && (*pi)[i] < gridRes[i]);
-        (*pi)[i] = Clamp((*pi)[i], 0, gridRes[i] - 1);
-    }
-    return inBounds;
-}
-
-inline unsigned int hash(const Point3i &p, int hashSize) {
-    return (unsigned int)((p.x * 73856093) ^ (p.y * 19349663) ^
-                          (p.z * 83492791)) %
-           hashSize;
-}
-
 // SPPM Method Definitions
 void SPPMIntegrator::Render(const Scene &scene) {
     ProfilePhase p(Prof::IntegratorRender);
@@ -123,6 +103,7 @@ void SPPMIntegrator::Render(const Scene &scene) {
 
     // Perform _nIterations_ of SPPM integration
     HaltonSampler sampler(nIterations, pixelBounds);
+    HashGrid grid;
 
     // Compute number of tiles to use for SPPM camera pass
     Vector2i pixelExtent = pixelBounds.Diagonal();
@@ -237,70 +218,28 @@ void SPPMIntegrator::Render(const Scene &scene) {
         progress.Update();
 
         // Create grid of all SPPM visible points
-        int gridRes[3];
-        Bounds3f gridBounds;
-        // Allocate grid for SPPM visible points
-        const int hashSize = nPixels;
-        std::vector<std::atomic<SPPMPixelListNode *>> grid(hashSize);
         {
             ProfilePhase _(Prof::SPPMGridConstruction);
-
-            // Compute grid bounds for SPPM visible points
+            // Use cells about the size of the largest search radius
             Float maxRadius = 0.;
-            for (int i = 0; i < nPixels; ++i) {
-                const SPPMPixel &pixel = pixels[i];
-                if (pixel.vp.beta.IsBlack()) continue;
-                Bounds3f vpBound = Expand(Bounds3f(pixel.vp.p), pixel.radius);
-                gridBounds = Union(gridBounds, vpBound);
-                maxRadius = std::max(maxRadius, pixel.radius);
-            }
-
-            // Compute resolution of SPPM grid in each dimension
-            Vector3f diag = gridBounds.Diagonal();
-            Float maxDiag = MaxComponent(diag);
-            int baseGridRes = (int)(maxDiag / maxRadius);
-            CHECK_GT(baseGridRes, 0);
-            for (int i = 0; i < 3; ++i)
-                gridRes[i] = std::max((int)(baseGridRes * diag[i] / maxDiag), 1);
-
-            // Add visible points to SPPM grid
-            ParallelFor([&](int pixelIndex) {
-                MemoryArena &arena = perThreadArenas[ThreadIndex];
-                SPPMPixel &pixel = pixels[pixelIndex];
-                if (!pixel.vp.beta.IsBlack()) {
-                    // Add pixel's visible point to applicable grid cells
-                    Float radius = pixel.radius;
-                    Point3i pMin, pMax;
-                    ToGrid(pixel.vp.p - Vector3f(radius, radius, radius),
-                           gridBounds, gridRes, &pMin);
-                    ToGrid(pixel.vp.p + Vector3f(radius, radius, radius),
-                           gridBounds, gridRes, &pMax);
-                    for (int z = pMin.z; z <= pMax.z; ++z)
-                        for (int y = pMin.y; y <= pMax.y; ++y)
-                            for (int x = pMin.x; x <= pMax.x; ++x) {
-                                // Add visible point to grid cell $(x, y, z)$
-                                int h = hash(Point3i(x, y, z), hashSize);
-                                SPPMPixelListNode *node =
-                                    arena.Alloc<SPPMPixelListNode>();
-                                node->pixel = &pixel;
-
-                                // Atomically add _node_ to the start of
-                                // _grid[h]_'s linked list
-                                node->next = grid[h];
-                                while (grid[h].compare_exchange_weak(
-                                           node->next, node) == false)
-                                    ;
-                            }
-                    ReportValue(gridCellsPerVisiblePoint,
-                                (1 + pMax.x - pMin.x) * (1 + pMax.y - pMin.y) *
-                                    (1 + pMax.z - pMin.z));
-                }
-            }, nPixels, 4096);
+            for (int i = 0; i < nPixels; ++i)
+                if (!pixels[i].vp.beta.IsBlack())
+                    maxRadius = std::max(maxRadius, pixels[i].radius);
+            grid.Build(nPixels,
+                       [&](int i) {
+                           const SPPMPixel &pixel = pixels[i];
+                           if (pixel.vp.beta.IsBlack()) return Bounds3f();
+                           return Expand(Bounds3f(pixel.vp.p), pixel.radius);
+                       },
+                       maxRadius);
+            gridMemoryBytes = std::max<int64_t>(gridMemoryBytes,
+                                                grid.BytesUsed());
         }
 
         // Trace photons and accumulate contributions
         {
             ProfilePhase _(Prof::SPPMPhotonPass);
+            auto startTime = std::chrono::steady_clock::now();
             std::vector<MemoryArena> photonShootArenas(MaxThreadIndex());
             ParallelFor([&](int photonIndex) {
                 MemoryArena &arena = photonShootArenas[ThreadIndex];
@@ -346,31 +285,21 @@ void SPPMIntegrator::Render(const Scene &scene) {
                     ++totalPhotonSurfaceInteractions;
                     if (depth > 0) {
                         // Add photon contribution to nearby visible points
-                        Point3i photonGridIndex;
-                        if (ToGrid(isect.p, gridBounds, gridRes,
-                                   &photonGridIndex)) {
-                            int h = hash(photonGridIndex, hashSize);
-                            // Add photon contribution to visible points in
-                            // _grid[h]_
-                            for (SPPMPixelListNode *node =
-                                     grid[h].load(std::memory_order_relaxed);
-                                 node != nullptr; node = node->next) {
-                                ++visiblePointsChecked;
-                                SPPMPixel &pixel = *node->pixel;
-                                Float radius = pixel.radius;
-                                if (DistanceSquared(pixel.vp.p, isect.p) >
-                                    radius * radius)
-                                    continue;
-                                // Update _pixel_ $\Phi$ and $M$ for nearby
-                                // photon
-                                Vector3f wi = -photonRay.d;
-                                Spectrum Phi =
-                                    beta * pixel.vp.bsdf->f(pixel.vp.wo, wi);
-                                for (int i = 0; i < Spectrum::nSamples; ++i)
-                                    pixel.Phi[i].Add(Phi[i]);
-                                ++pixel.M;
-                            }
-                        }
+                        grid.ForEachCandidate(isect.p, [&](int pixelIndex) {
+                            ++visiblePointsChecked;
+                            SPPMPixel &pixel = pixels[pixelIndex];
+                            Float radius = pixel.radius;
+                            if (DistanceSquared(pixel.vp.p, isect.p) >
+                                radius * radius)
+                                return;
+                            // Update _pixel_ $\Phi$ and $M$ for nearby photon
+                            Vector3f wi = -photonRay.d;
+                            Spectrum Phi =
+                                beta * pixel.vp.bsdf->f(pixel.vp.wo, wi);
+                            for (int i = 0; i < Spectrum::nSamples; ++i)
+                                pixel.Phi[i].Add(Phi[i]);
+                            ++pixel.M;
+                        });
                     }
                     // Sample new photon ray direction
 
@@ -410,6 +339,10 @@ void SPPMIntegrator::Render(const Scene &scene) {
             }, photonsPerIteration, 8192);
             progress.Update();
             photonPaths += photonsPerIteration;
+            std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - startTime;
+            ReportValue(photonsPerSecond,
+                        photonsPerIteration / (1e6 * elapsed.count()));
         }
 
         // Update pixel values from this pass's photons
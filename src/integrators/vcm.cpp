@@ -0,0 +1,278 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// integrators/vcm.cpp*
+#include "integrators/vcm.h"
+#include "integrators/bdpt.h"
+#include "film.h"
+#include "hashgrid.h"
+#include "lightdistrib.h"
+#include "paramset.h"
+#include "progressreporter.h"
+#include "sampler.h"
+#include "samplers/random.h"
+#include "stats.h"
+
+namespace pbrt {
+
+STAT_PERCENT("Integrator/VCM merge candidates within radius", photonsMerged,
+             photonCandidates);
+STAT_MEMORY_COUNTER("Memory/VCM light vertex cache and grid", vcmBytes);
+
+// VCMIntegrator Method Definitions
+void VCMIntegrator::Render(const Scene &scene) {
+    ProfilePhase p(Prof::IntegratorRender);
+    Film *film = camera->film;
+    const int64_t spp = sampler->samplesPerPixel;
+    if (scene.lights.empty()) {
+        film->WriteImage(1.0f / spp);
+        return;
+    }
+
+    // Light subpaths are shared by camera subpaths, so they're all started
+    // with the distribution at the camera's position
+    std::unique_ptr<LightDistribution> lightDistribution =
+        CreateLightSampleDistribution(lightSampleStrategy, scene,
+                                      maxSparseLights, maxLightCacheBytes);
+    const Distribution1D &lightDistr = *lightDistribution->Lookup(
+        camera->CameraToWorld(camera->shutterOpen, Point3f(0, 0, 0)));
+    std::unordered_map<const Light *, size_t> lightToIndex;
+    for (size_t i = 0; i < scene.lights.size(); ++i)
+        lightToIndex[scene.lights[i].get()] = i;
+
+    // Allocate the light vertex cache, with one light subpath per pixel as
+    // long as they fit in _maxCacheBytes_
+    const int64_t nPixels = pixelBounds.Area();
+    const int maxVertices = maxDepth + 1;
+    const int nLightPaths = (int)std::max<int64_t>(
+        1, std::min<int64_t>(nPixels,
+                             maxCacheBytes / (maxVertices * sizeof(Vertex))));
+    LightVertexCache cache(nLightPaths, maxVertices);
+    std::vector<MemoryArena> lightArenas(MaxThreadIndex());
+    HashGrid grid;
+
+    // Compute the initial merging radius, by default a small fraction of
+    // the scene's extent
+    Float radius0 = initialRadius;
+    if (radius0 <= 0) {
+        Point3f worldCenter;
+        Float worldRadius;
+        scene.WorldBound().BoundingSphere(&worldCenter, &worldRadius);
+        radius0 = .005f * worldRadius;
+    }
+
+    // Partition the light subpaths into chunks and the image into tiles
+    const int lightChunkSize = 256;
+    const int64_t nLightChunks =
+        (nLightPaths + lightChunkSize - 1) / lightChunkSize;
+    const Bounds2i sampleBounds = film->GetSampleBounds();
+    const Vector2i sampleExtent = sampleBounds.Diagonal();
+    const int tileSize = 16;
+    const int nXTiles = (sampleExtent.x + tileSize - 1) / tileSize;
+    const int nYTiles = (sampleExtent.y + tileSize - 1) / tileSize;
+    ProgressReporter reporter(spp * (nLightChunks + nXTiles * nYTiles),
+                              "Rendering");
+    for (int64_t iteration = 0; iteration < spp; ++iteration) {
+        // Shrink the merging radius as in progressive photon mapping
+        const Float radius =
+            radius0 * std::pow(Float(iteration + 1), (radiusAlpha - 1) / 2);
+        const Float etaVM = Pi * radius * radius * nLightPaths;
+
+        // Trace the light subpaths and execute their $t=1$ strategies. With
+        // fewer subpaths than pixels, each one's splats stand in for
+        // several pixels' worth of samples.
+        const Float splatScale = Float(nPixels) / nLightPaths;
+        ParallelFor([&](int64_t chunk) {
+            MemoryArena &arena = lightArenas[ThreadIndex];
+            RandomSampler lightSampler(1, iteration * nLightChunks + chunk);
+            lightSampler.StartPixel(Point2i(0, 0));
+            Vertex cameraVertex;
+            int start = chunk * lightChunkSize;
+            int end = std::min(start + lightChunkSize, nLightPaths);
+            for (int i = start; i < end; ++i) {
+                Float time = Lerp(lightSampler.Get1D(), camera->shutterOpen,
+                                  camera->shutterClose);
+                Vertex *lightVertices = cache.Path(i);
+                int nLight = GenerateLightSubpath(
+                    scene, lightSampler, arena, maxDepth + 1, time,
+                    lightDistr, lightToIndex, lightVertices);
+                cache.SetPathLength(i, nLight);
+                for (int s = 2; s <= nLight; ++s) {
+                    Point2f pFilm;
+                    Spectrum Lpath = ConnectBDPT(
+                        scene, lightVertices, &cameraVertex, s, 1, lightDistr,
+                        lightToIndex, *camera, lightSampler, &pFilm, nullptr,
+                        etaVM);
+                    film->AddSplat(pFilm, Lpath * splatScale);
+                }
+            }
+            reporter.Update();
+        }, nLightChunks);
+
+        // Build the hash grid over the light subpaths' surface vertices,
+        // which are merged with camera subpath vertices within _radius_
+        cache.BuildConnectionList();
+        grid.Build(cache.ConnectibleCount(),
+                   [&](int i) {
+                       int s;
+                       const Vertex &v = cache.ConnectibleVertex(i, &s)[s - 1];
+                       if (v.type != VertexType::Surface) return Bounds3f();
+                       return Bounds3f(v.p() - Vector3f(radius, radius, radius),
+                                       v.p() + Vector3f(radius, radius, radius));
+                   },
+                   2 * radius);
+
+        // Trace the camera subpaths, connecting each one to the light
+        // subpath it's paired with and merging at each of its vertices
+        ParallelFor2D([&](const Point2i tile) {
+            MemoryArena arena;
+            int seed = iteration * nXTiles * nYTiles + tile.y * nXTiles + tile.x;
+            std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
+            int x0 = sampleBounds.pMin.x + tile.x * tileSize;
+            int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
+            int y0 = sampleBounds.pMin.y + tile.y * tileSize;
+            int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
+            Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
+            std::unique_ptr<FilmTile> filmTile = film->GetFilmTile(tileBounds);
+            for (Point2i pPixel : tileBounds) {
+                tileSampler->StartPixel(pPixel);
+                if (!InsideExclusive(pPixel, pixelBounds) ||
+                    !tileSampler->SetSampleNumber(iteration))
+                    continue;
+                Point2f pFilm = (Point2f)pPixel + tileSampler->Get2D();
+                Vertex *cameraVertices = arena.Alloc<Vertex>(maxDepth + 2);
+                Vertex *lightVertices = arena.Alloc<Vertex>(maxDepth + 1);
+                Vertex *mergeVertices = arena.Alloc<Vertex>(maxDepth + 1);
+                int nCamera =
+                    GenerateCameraSubpath(scene, *tileSampler, arena,
+                                          maxDepth + 2, *camera, pFilm,
+                                          cameraVertices);
+
+                // Copy the paired light subpath, since _MISWeight()_
+                // temporarily modifies the vertices it's given
+                int pixelIndex =
+                    (pPixel.y - pixelBounds.pMin.y) *
+                        (pixelBounds.pMax.x - pixelBounds.pMin.x) +
+                    (pPixel.x - pixelBounds.pMin.x);
+                int lightPath = pixelIndex % nLightPaths;
+                int nLight = cache.PathLength(lightPath);
+                std::copy(cache.Path(lightPath),
+                          cache.Path(lightPath) + nLight, lightVertices);
+
+                Spectrum L(0.f);
+                for (int t = 2; t <= nCamera; ++t) {
+                    // Execute the connection strategies that end at
+                    // $\pt{}_{t-1}$
+                    for (int s = 0; s <= nLight && s + t - 2 <= maxDepth; ++s) {
+                        Point2f pFilmNew = pFilm;
+                        L += ConnectBDPT(scene, lightVertices, cameraVertices,
+                                         s, t, lightDistr, lightToIndex,
+                                         *camera, *tileSampler, &pFilmNew,
+                                         nullptr, etaVM);
+                    }
+
+                    // Merge light subpath vertices near $\pt{}_{t-1}$
+                    const Vertex &pt = cameraVertices[t - 1];
+                    if (t - 1 > maxDepth || pt.type != VertexType::Surface ||
+                        !pt.IsConnectible())
+                        continue;
+                    Spectrum Lmerge(0.f);
+                    grid.ForEachCandidate(pt.p(), [&](int i) {
+                        ++photonCandidates;
+                        int s;
+                        const Vertex *path = cache.ConnectibleVertex(i, &s);
+                        const Vertex &q = path[s - 1];
+                        if (s + t - 3 > maxDepth ||
+                            DistanceSquared(q.p(), pt.p()) > radius * radius)
+                            return;
+                        ++photonsMerged;
+                        Spectrum f = pt.si.bsdf->f(pt.si.wo, q.si.wo);
+                        if (f.IsBlack()) return;
+                        // The merged path is the light subpath up to
+                        // $\pq{}_{s-2}$ followed by the camera subpath up
+                        // to $\pt{}_{t-1}$
+                        std::copy(path, path + s - 1, mergeVertices);
+                        Vertex sampled = mergeVertices[0];
+                        Float misWeight = MISWeight(
+                            scene, mergeVertices, cameraVertices, sampled,
+                            s - 1, t, lightDistr, lightToIndex, etaVM, true);
+                        Lmerge += misWeight * q.beta * f;
+                    });
+                    L += pt.beta * Lmerge / (Pi * radius * radius * nLightPaths);
+                }
+                filmTile->AddSample(pFilm, L);
+                arena.Reset();
+            }
+            film->MergeFilmTile(std::move(filmTile));
+            reporter.Update();
+        }, Point2i(nXTiles, nYTiles));
+
+        for (MemoryArena &arena : lightArenas) arena.Reset();
+    }
+    reporter.Done();
+    vcmBytes += cache.BytesUsed() + grid.BytesUsed();
+    film->WriteImage(1.0f / spp);
+}
+
+VCMIntegrator *CreateVCMIntegrator(const ParamSet &params,
+                                   std::shared_ptr<Sampler> sampler,
+                                   std::shared_ptr<const Camera> camera) {
+    int maxDepth = params.FindOneInt("maxdepth", 5);
+    int np;
+    const int *pb = params.FindInt("pixelbounds", &np);
+    Bounds2i pixelBounds = camera->film->GetSampleBounds();
+    if (pb) {
+        if (np != 4)
+            Error("Expected four values for \"pixelbounds\" parameter. Got %d.",
+                  np);
+        else {
+            pixelBounds = Intersect(pixelBounds,
+                                    Bounds2i{{pb[0], pb[2]}, {pb[1], pb[3]}});
+            if (pixelBounds.Area() == 0)
+                Error("Degenerate \"pixelbounds\" specified.");
+        }
+    }
+    Float radius = params.FindOneFloat("radius", 0.f);
+    Float radiusAlpha = params.FindOneFloat("radiusalpha", .75f);
+    std::string lightStrategy = params.FindOneString(
+        "lightsampler", params.FindOneString("lightsamplestrategy", "power"));
+    size_t maxCacheBytes =
+        (size_t)params.FindOneInt("cachemaxmb", 256) * 1024 * 1024;
+    int sparseLights = params.FindOneInt("sparselights", 64);
+    int lightCacheMB = params.FindOneInt("lightcachemaxmb", 64);
+    return new VCMIntegrator(sampler, camera, maxDepth, pixelBounds, radius,
+                             Clamp(radiusAlpha, 0, 1), lightStrategy,
+                             maxCacheBytes, sparseLights,
+                             (size_t)std::max(1, lightCacheMB) << 20);
+}
+
+}  // namespace pbrt
@@ -48,8 +48,8 @@ STAT_COUNTER("Integrator/Surface interactions", surfaceInteractions);
 
 // VolPathIntegrator Method Definitions
 void VolPathIntegrator::Preprocess(const Scene &scene, Sampler &sampler) {
-    lightDistribution =
-        CreateLightSampleDistribution(lightSampleStrategy, scene);
+    lightDistribution = CreateLightSampleDistribution(
+        lightSampleStrategy, scene, maxSparseLights, maxLightCacheBytes);
 }
 
 Spectrum VolPathIntegrator::Li(const RayDifferential &r, const Scene &scene,
@@ -68,6 +68,9 @@ Spectrum VolPathIntegrator::Li(const RayDifferential &r, const Scene &scene,
     // avoid terminating refracted rays that are about to be refracted back
     // out of a medium and thus have their beta value increased.
     Float etaScale = 1;
+    // Lobe spreads are scaled like the camera ray differentials, since the
+    // pixel's samples jointly cover the lobe.
+    Float spreadScale = 1 / std::sqrt((Float)sampler.samplesPerPixel);
 
     for (bounces = 0;; ++bounces) {
         // Intersect _ray_ with scene and store intersection in _isect_
@@ -86,10 +89,8 @@ Spectrum VolPathIntegrator::Li(const RayDifferential &r, const Scene &scene,
 
             ++volumeInteractions;
             // Handle scattering at point in medium for volumetric path tracer
-            const Distribution1D *lightDistrib =
-                lightDistribution->Lookup(mi.p);
             L += beta * UniformSampleOneLight(mi, scene, arena, sampler, true,
-                                              lightDistrib);
+                                              *lightDistribution);
 
             Vector3f wo = -ray.d, wi;
             mi.phase->Sample_p(wo, &wi, sampler.Get2D());
@@ -115,17 +116,15 @@ Spectrum VolPathIntegrator::Li(const RayDifferential &r, const Scene &scene,
             // Compute scattering functions and skip over medium boundaries
             isect.ComputeScatteringFunctions(ray, arena, true);
             if (!isect.bsdf) {
-                ray = isect.SpawnRay(ray.d);
+                ray = isect.SpawnRayCone(ray, ray.d, 0);
                 bounces--;
                 continue;
             }
 
             // Sample illumination from lights to find attenuated path
             // contribution
-            const Distribution1D *lightDistrib =
-                lightDistribution->Lookup(isect.p);
             L += beta * UniformSampleOneLight(isect, scene, arena, sampler,
-                                              true, lightDistrib);
+                                              true, *lightDistribution);
 
             // Sample BSDF to get new path direction
             Vector3f wo = -ray.d, wi;
@@ -145,7 +144,11 @@ Spectrum VolPathIntegrator::Li(const RayDifferential &r, const Scene &scene,
                 etaScale *=
                     (Dot(wo, isect.n) > 0) ? (eta * eta) : 1 / (eta * eta);
             }
-            ray = isect.SpawnRay(wi);
+            // Widen the ray cone at non-specular bounces so that indirect
+            // texture lookups filter over the region the path represents
+            Float spread =
+                specularBounce ? 0 : LobeSpreadAngle(pdf) * spreadScale;
+            ray = isect.SpawnRayCone(ray, wi, spread);
 
             // Account for attenuated subsurface scattering, if applicable
             if (isect.bssrdf && (flags & BSDF_TRANSMISSION)) {
@@ -161,7 +164,7 @@ Spectrum VolPathIntegrator::Li(const RayDifferential &r, const Scene &scene,
                 // component
                 L += beta *
                      UniformSampleOneLight(pi, scene, arena, sampler, true,
-                                           lightDistribution->Lookup(pi.p));
+                                           *lightDistribution);
 
                 // Account for the indirect subsurface scattering component
                 Spectrum f = pi.bsdf->Sample_f(pi.wo, &wi, sampler.Get2D(),
@@ -207,10 +210,14 @@ VolPathIntegrator *CreateVolPathIntegrator(
         }
     }
     Float rrThreshold = params.FindOneFloat("rrthreshold", 1.);
-    std::string lightStrategy =
-        params.FindOneString("lightsamplestrategy", "spatial");
+    // "lightsampler" is accepted as a synonym for "lightsamplestrategy".
+    std::string lightStrategy = params.FindOneString(
+        "lightsampler", params.FindOneString("lightsamplestrategy", "spatial"));
+    int sparseLights = params.FindOneInt("sparselights", 64);
+    int lightCacheMB = params.FindOneInt("lightcachemaxmb", 64);
     return new VolPathIntegrator(maxDepth, camera, sampler, pixelBounds,
-                                 rrThreshold, lightStrategy);
+                                 rrThreshold, lightStrategy, sparseLights,
+                                 (size_t)std::max(1, lightCacheMB) << 20);
 }
 
 }  // namespace pbrt
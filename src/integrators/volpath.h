@@ -52,11 +52,15 @@ class VolPathIntegrator : public SamplerIntegrator {
     VolPathIntegrator(int maxDepth, std::shared_ptr<const Camera> camera,
                       std::shared_ptr<Sampler> sampler,
                       const Bounds2i &pixelBounds, Float rrThreshold = 1,
-                      const std::string &lightSampleStrategy = "spatial")
+                      const std::string &lightSampleStrategy = "spatial",
+                      int maxSparseLights = 64,
+                      size_t maxLightCacheBytes = 64 * 1024 * 1024)
         : SamplerIntegrator(camera, sampler, pixelBounds),
           maxDepth(maxDepth),
           rrThreshold(rrThreshold),
-          lightSampleStrategy(lightSampleStrategy) { }
+          lightSampleStrategy(lightSampleStrategy),
+          maxSparseLights(maxSparseLights),
+          maxLightCacheBytes(maxLightCacheBytes) { }
     void Preprocess(const Scene &scene, Sampler &sampler);
     Spectrum Li(const RayDifferential &ray, const Scene &scene,
                 Sampler &sampler, MemoryArena &arena, int depth) const;
@@ -66,6 +70,8 @@ class VolPathIntegrator : public SamplerIntegrator {
     const int maxDepth;
     const Float rrThreshold;
     const std::string lightSampleStrategy;
+    const int maxSparseLights;
+    const size_t maxLightCacheBytes;
     std::unique_ptr<LightDistribution> lightDistribution;
 };
 
@@ -0,0 +1,349 @@
+
+/*
+    pbrt source code is Copyright(c) 1998-2016
+                        Matt Pharr, Greg Humphreys, and Wenzel Jakob.
+
+    This file is part of pbrt.
+
+    Redistribution and use in source and binary forms, with or without
+    modification, are permitted provided that the following conditions are
+    met:
+
+    - Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+
+    - Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS
+    IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+    TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+    PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+    HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+    SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+    LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+    DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+    THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+    (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+    OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+ */
+
+// integrators/wavefront.cpp*
+#include "integrators/wavefront.h"
+#include "bssrdf.h"
+#include "camera.h"
+#include "film.h"
+#include "interaction.h"
+#include "paramset.h"
+#include "progressreporter.h"
+#include "scene.h"
+#include "stats.h"
+#include <algorithm>
+
+namespace pbrt {
+
+STAT_COUNTER("Integrator/Camera rays traced", nCameraRays);
+STAT_INT_DISTRIBUTION("Integrator/Path length", pathLength);
+STAT_RATIO("Integrator/Active paths per wavefront bounce", activePaths,
+           wavefrontBounces);
+STAT_RATIO("Integrator/Material switches per shading stage",
+           materialSwitches, shadingStages);
+
+// WavefrontPath Declarations
+struct WavefrontPath {
+    CameraSample cameraSample;
+    RayDifferential ray;
+    Float rayWeight;
+    Spectrum L, beta;
+    Float etaScale;
+    bool specularBounce;
+    int bounces;
+};
+
+// WavefrontPathIntegrator Method Definitions
+WavefrontPathIntegrator::WavefrontPathIntegrator(
+    int maxDepth, std::shared_ptr<const Camera> camera,
+    std::shared_ptr<Sampler> sampler, const Bounds2i &pixelBounds,
+    Float rrThreshold, const std::string &lightSampleStrategy, int tileSize,
+    bool sortByMaterial, int maxSparseLights, size_t maxLightCacheBytes)
+    : camera(camera),
+      sampler(sampler),
+      pixelBounds(pixelBounds),
+      maxDepth(maxDepth),
+      rrThreshold(rrThreshold),
+      lightSampleStrategy(lightSampleStrategy),
+      tileSize(tileSize),
+      sortByMaterial(sortByMaterial),
+      maxSparseLights(maxSparseLights),
+      maxLightCacheBytes(maxLightCacheBytes) {}
+
+void WavefrontPathIntegrator::Render(const Scene &scene) {
+    lightDistribution = CreateLightSampleDistribution(
+        lightSampleStrategy, scene, maxSparseLights, maxLightCacheBytes);
+
+    // Compute number of tiles, _nTiles_, to use for parallel rendering
+    Bounds2i sampleBounds = camera->film->GetSampleBounds();
+    Vector2i sampleExtent = sampleBounds.Diagonal();
+    Point2i nTiles((sampleExtent.x + tileSize - 1) / tileSize,
+                   (sampleExtent.y + tileSize - 1) / tileSize);
+    ProgressReporter reporter(nTiles.x * nTiles.y, "Rendering");
+    ParallelFor2D([&](Point2i tile) {
+        // Compute sample bounds for tile
+        int x0 = sampleBounds.pMin.x + tile.x * tileSize;
+        int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
+        int y0 = sampleBounds.pMin.y + tile.y * tileSize;
+        int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
+        Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
+        std::unique_ptr<FilmTile> filmTile =
+            camera->film->GetFilmTile(tileBounds);
+
+        // Allocate a sampler for each pixel, since all of the tile's paths
+        // are in flight at once
+        std::vector<Point2i> pixels;
+        std::vector<std::unique_ptr<Sampler>> samplers;
+        int seed = (tile.y * nTiles.x + tile.x) * tileSize * tileSize;
+        for (Point2i pixel : tileBounds) {
+            std::unique_ptr<Sampler> pixelSampler = sampler->Clone(seed++);
+            {
+                ProfilePhase pp(Prof::StartPixel);
+                pixelSampler->StartPixel(pixel);
+            }
+            if (!InsideExclusive(pixel, pixelBounds)) continue;
+            pixels.push_back(pixel);
+            samplers.push_back(std::move(pixelSampler));
+        }
+
+        MemoryArena arena;
+        const int nPaths = pixels.size();
+        std::vector<WavefrontPath> paths(nPaths);
+        std::vector<SurfaceInteraction> isects(nPaths);
+        std::vector<int> active, shade, next;
+        std::vector<std::pair<const Material *, int>> materialOrder;
+        bool moreSamples = nPaths > 0;
+        while (moreSamples) {
+            // Generate a camera ray for the current sample of each pixel
+            active.clear();
+            for (int i = 0; i < nPaths; ++i) {
+                WavefrontPath &path = paths[i];
+                path.cameraSample = samplers[i]->GetCameraSample(pixels[i]);
+                path.rayWeight = camera->GenerateRayDifferential(
+                    path.cameraSample, &path.ray);
+                path.ray.ScaleDifferentials(
+                    1 / std::sqrt((Float)sampler->samplesPerPixel));
+                ++nCameraRays;
+                path.L = Spectrum(0.f);
+                path.beta = Spectrum(1.f);
+                path.etaScale = 1;
+                path.specularBounce = false;
+                path.bounces = 0;
+                if (path.rayWeight > 0) active.push_back(i);
+            }
+
+            // Advance all active paths by one bounce per iteration
+            ProfilePhase pp(Prof::SamplerIntegratorLi);
+            Float spreadScale =
+                1 / std::sqrt((Float)sampler->samplesPerPixel);
+            while (!active.empty()) {
+                ++wavefrontBounces;
+                activePaths += active.size();
+
+                // Find the next vertex of each path; add emitted light and
+                // terminate paths that escaped or reached _maxDepth_
+                shade.clear();
+                for (int i : active) {
+                    WavefrontPath &path = paths[i];
+                    SurfaceInteraction &isect = isects[i];
+                    bool foundIntersection = scene.Intersect(path.ray, &isect);
+                    if (path.bounces == 0 || path.specularBounce) {
+                        if (foundIntersection)
+                            path.L += path.beta * isect.Le(-path.ray.d);
+                        else
+                            for (const auto &light : scene.infiniteLights)
+                                path.L += path.beta * light->Le(path.ray);
+                    }
+                    if (!foundIntersection || path.bounces >= maxDepth)
+                        ReportValue(pathLength, path.bounces);
+                    else
+                        shade.push_back(i);
+                }
+
+                // Sort the hit points by material
+                if (sortByMaterial) {
+                    ++shadingStages;
+                    materialOrder.clear();
+                    for (int i : shade)
+                        materialOrder.push_back(
+                            {isects[i].primitive->GetMaterial(), i});
+                    std::sort(materialOrder.begin(), materialOrder.end());
+                    for (size_t j = 0; j < shade.size(); ++j) {
+                        shade[j] = materialOrder[j].second;
+                        if (j > 0 &&
+                            materialOrder[j].first != materialOrder[j - 1].first)
+                            ++materialSwitches;
+                    }
+                }
+
+                // Compute scattering functions at all hit points
+                for (int i : shade)
+                    isects[i].ComputeScatteringFunctions(paths[i].ray, arena,
+                                                         true);
+
+                // Sample illumination from lights at non-specular vertices
+                for (int i : shade) {
+                    const SurfaceInteraction &isect = isects[i];
+                    if (isect.bsdf &&
+                        isect.bsdf->NumComponents(
+                            BxDFType(BSDF_ALL & ~BSDF_SPECULAR)) > 0)
+                        paths[i].L +=
+                            paths[i].beta *
+                            UniformSampleOneLight(isect, scene, arena,
+                                                  *samplers[i], false,
+                                                  *lightDistribution);
+                }
+
+                // Sample BSDFs to find the paths' continuation rays
+                next.clear();
+                for (int i : shade) {
+                    WavefrontPath &path = paths[i];
+                    SurfaceInteraction &isect = isects[i];
+                    Sampler &pixelSampler = *samplers[i];
+                    if (!isect.bsdf) {
+                        // Skip over medium boundaries
+                        path.ray = isect.SpawnRayCone(path.ray, path.ray.d, 0);
+                        next.push_back(i);
+                        continue;
+                    }
+                    Vector3f wo = -path.ray.d, wi;
+                    Float pdf;
+                    BxDFType flags;
+                    Spectrum f = isect.bsdf->Sample_f(
+                        wo, &wi, pixelSampler.Get2D(), &pdf, BSDF_ALL, &flags);
+                    if (f.IsBlack() || pdf == 0.f) {
+                        ReportValue(pathLength, path.bounces);
+                        continue;
+                    }
+                    path.beta *= f * AbsDot(wi, isect.shading.n) / pdf;
+                    path.specularBounce = (flags & BSDF_SPECULAR) != 0;
+                    if ((flags & BSDF_SPECULAR) &&
+                        (flags & BSDF_TRANSMISSION)) {
+                        Float eta = isect.bsdf->eta;
+                        path.etaScale *= (Dot(wo, isect.n) > 0)
+                                             ? (eta * eta)
+                                             : 1 / (eta * eta);
+                    }
+                    Float spread = path.specularBounce
+                                       ? 0
+                                       : LobeSpreadAngle(pdf) * spreadScale;
+                    path.ray = isect.SpawnRayCone(path.ray, wi, spread);
+
+                    // Account for subsurface scattering, if applicable
+                    if (isect.bssrdf && (flags & BSDF_TRANSMISSION)) {
+                        SurfaceInteraction pi;
+                        Spectrum S = isect.bssrdf->Sample_S(
+                            scene, pixelSampler.Get1D(), pixelSampler.Get2D(),
+                            arena, &pi, &pdf);
+                        if (S.IsBlack() || pdf == 0) {
+                            ReportValue(pathLength, path.bounces);
+                            continue;
+                        }
+                        path.beta *= S / pdf;
+                        path.L += path.beta *
+                                  UniformSampleOneLight(pi, scene, arena,
+                                                        pixelSampler, false,
+                                                        *lightDistribution);
+                        Spectrum f = pi.bsdf->Sample_f(pi.wo, &wi,
+                                                       pixelSampler.Get2D(),
+                                                       &pdf, BSDF_ALL, &flags);
+                        if (f.IsBlack() || pdf == 0) {
+                            ReportValue(pathLength, path.bounces);
+                            continue;
+                        }
+                        path.beta *= f * AbsDot(wi, pi.shading.n) / pdf;
+                        path.specularBounce = (flags & BSDF_SPECULAR) != 0;
+                        path.ray = pi.SpawnRay(wi);
+                    }
+
+                    // Possibly terminate the path with Russian roulette
+                    Spectrum rrBeta = path.beta * path.etaScale;
+                    if (rrBeta.MaxComponentValue() < rrThreshold &&
+                        path.bounces > 3) {
+                        Float q =
+                            std::max((Float).05, 1 - rrBeta.MaxComponentValue());
+                        if (pixelSampler.Get1D() < q) {
+                            ReportValue(pathLength, path.bounces);
+                            continue;
+                        }
+                        path.beta /= 1 - q;
+                    }
+                    ++path.bounces;
+                    next.push_back(i);
+                }
+                // All of the bounce's BSDFs have been sampled
+                arena.Reset();
+                std::swap(active, next);
+            }
+
+            // Add the finished paths' radiance to the image
+            for (int i = 0; i < nPaths; ++i) {
+                const WavefrontPath &path = paths[i];
+                Spectrum L = path.L;
+                if (L.HasNaNs() || L.y() < -1e-5 || std::isinf(L.y())) {
+                    LOG(ERROR) << StringPrintf(
+                        "Invalid radiance value returned for pixel (%d, %d), "
+                        "sample %d. Setting to black.",
+                        pixels[i].x, pixels[i].y,
+                        (int)samplers[i]->CurrentSampleNumber());
+                    L = Spectrum(0.f);
+                }
+                filmTile->AddSample(path.cameraSample.pFilm, L,
+                                    path.rayWeight);
+            }
+            for (int i = 0; i < nPaths; ++i)
+                moreSamples = samplers[i]->StartNextSample();
+        }
+
+        // Merge image tile into _Film_
+        camera->film->MergeFilmTile(std::move(filmTile));
+        reporter.Update();
+    }, nTiles);
+    reporter.Done();
+    LOG(INFO) << "Rendering finished";
+
+    // Save final image after rendering
+    camera->film->WriteImage();
+}
+
+WavefrontPathIntegrator *CreateWavefrontPathIntegrator(
+    const ParamSet &params, std::shared_ptr<Sampler> sampler,
+    std::shared_ptr<const Camera> camera) {
+    int maxDepth = params.FindOneInt("maxdepth", 5);
+    int np;
+    const int *pb = params.FindInt("pixelbounds", &np);
+    Bounds2i pixelBounds = camera->film->GetSampleBounds();
+    if (pb) {
+        if (np != 4)
+            Error("Expected four values for \"pixelbounds\" parameter. Got %d.",
+                  np);
+        else {
+            pixelBounds = Intersect(pixelBounds,
+                                    Bounds2i{{pb[0], pb[2]}, {pb[1], pb[3]}});
+            if (pixelBounds.Area() == 0)
+                Error("Degenerate \"pixelbounds\" specified.");
+        }
+    }
+    Float rrThreshold = params.FindOneFloat("rrthreshold", 1.);
+    std::string lightStrategy = params.FindOneString(
+        "lightsampler", params.FindOneString("lightsamplestrategy", "spatial"));
+    int tileSize = std::max(1, params.FindOneInt("tilesize", 64));
+    bool sortByMaterial = params.FindOneBool("sortbymaterial", true);
+    int sparseLights = params.FindOneInt("sparselights", 64);
+    int lightCacheMB = params.FindOneInt("lightcachemaxmb", 64);
+    return new WavefrontPathIntegrator(
+        maxDepth, camera, sampler, pixelBounds, rrThreshold, lightStrategy,
+        tileSize, sortByMaterial, sparseLights,
+        (size_t)std::max(1, lightCacheMB) << 20);
+}
+
+}  // namespace pbrt
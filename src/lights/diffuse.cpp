@@ -65,6 +65,17 @@ Spectrum DiffuseAreaLight::Power() const {
     return (twoSided ? 2 : 1) * Lemit * area * Pi;
 }
 
+bool DiffuseAreaLight::Bounds(LightBounds *lb) const {
+    Vector3f w(0, 0, 1);
+    Float cosTheta_o;
+    if (!shape->NormalBounds(&w, &cosTheta_o)) cosTheta_o = -1;
+    // Emission falls off with the cosine to the surface normal, so it
+    // extends a further $\pi/2$ beyond the normal cone.
+    *lb = LightBounds(shape->WorldBound(), w, Lemit.MaxComponentValue() * area,
+                      cosTheta_o, 0, twoSided);
+    return true;
+}
+
 Spectrum DiffuseAreaLight::Sample_Li(const Interaction &ref, const Point2f &u,
                                      Vector3f *wi, Float *pdf,
                                      VisibilityTester *vis) const {
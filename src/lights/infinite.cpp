@@ -39,12 +39,16 @@
 
 namespace pbrt {
 
+STAT_MEMORY_COUNTER("Memory/Environment map sampling", samplingBytes);
+
 // InfiniteAreaLight Method Definitions
 InfiniteAreaLight::InfiniteAreaLight(const Transform &LightToWorld,
                                      const Spectrum &L, int nSamples,
-                                     const std::string &texmap)
+                                     const std::string &texmap,
+                                     EnvironmentSampling sampling)
     : Light((int)LightFlags::Infinite, LightToWorld, MediumInterface(),
-            nSamples) {
+            nSamples),
+      sampling(sampling) {
     // Read texel data from _texmap_ and initialize _Lmap_
     Point2i resolution;
     std::unique_ptr<RGBSpectrum[]> texels(nullptr);
@@ -79,8 +83,45 @@ InfiniteAreaLight::InfiniteAreaLight(const Transform &LightToWorld,
         },
         height, 32);
 
-    // Compute sampling distributions for rows and columns of image
-    distribution.reset(new Distribution2D(img.get(), width, height));
+    // Compute the sampling distribution for the image
+    switch (sampling) {
+    case EnvironmentSampling::CDF:
+        distribution.reset(new Distribution2D(img.get(), width, height));
+        samplingBytes += (size_t)(2 * width + 1) * height * sizeof(Float);
+        break;
+    case EnvironmentSampling::Hierarchical:
+        hierarchical.reset(
+            new HierarchicalDistribution2D(img.get(), width, height));
+        samplingBytes += hierarchical->BytesUsed();
+        break;
+    case EnvironmentSampling::Alias:
+        alias.reset(new AliasDistribution2D(img.get(), width, height));
+        samplingBytes += (size_t)(width + 1) * height *
+                         (2 * sizeof(Float) + sizeof(int));
+        break;
+    }
+}
+
+Point2f InfiniteAreaLight::SampleMap(const Point2f &u, Float *mapPdf) const {
+    switch (sampling) {
+    case EnvironmentSampling::CDF:
+        return distribution->SampleContinuous(u, mapPdf);
+    case EnvironmentSampling::Hierarchical:
+        return hierarchical->SampleContinuous(u, mapPdf);
+    default:
+        return alias->SampleContinuous(u, mapPdf);
+    }
+}
+
+Float InfiniteAreaLight::MapPdf(const Point2f &uv) const {
+    switch (sampling) {
+    case EnvironmentSampling::CDF:
+        return distribution->Pdf(uv);
+    case EnvironmentSampling::Hierarchical:
+        return hierarchical->Pdf(uv);
+    default:
+        return alias->Pdf(uv);
+    }
 }
 
 Spectrum InfiniteAreaLight::Power() const {
@@ -101,7 +142,7 @@ Spectrum InfiniteAreaLight::Sample_Li(const Interaction &ref, const Point2f &u,
     ProfilePhase _(Prof::LightSample);
     // Find $(u,v)$ sample coordinates in infinite light texture
     Float mapPdf;
-    Point2f uv = distribution->SampleContinuous(u, &mapPdf);
+    Point2f uv = SampleMap(u, &mapPdf);
     if (mapPdf == 0) return Spectrum(0.f);
 
     // Convert infinite light sample point to direction
@@ -127,7 +168,7 @@ Float InfiniteAreaLight::Pdf_Li(const Interaction &, const Vector3f &w) const {
     Float theta = SphericalTheta(wi), phi = SphericalPhi(wi);
     Float sinTheta = std::sin(theta);
     if (sinTheta == 0) return 0;
-    return distribution->Pdf(Point2f(phi * Inv2Pi, theta * InvPi)) /
+    return MapPdf(Point2f(phi * Inv2Pi, theta * InvPi)) /
            (2 * Pi * Pi * sinTheta);
 }
 
@@ -140,7 +181,7 @@ Spectrum InfiniteAreaLight::Sample_Le(const Point2f &u1, const Point2f &u2,
 
     // Find $(u,v)$ sample coordinates in infinite light texture
     Float mapPdf;
-    Point2f uv = distribution->SampleContinuous(u, &mapPdf);
+    Point2f uv = SampleMap(u, &mapPdf);
     if (mapPdf == 0) return Spectrum(0.f);
     Float theta = uv[1] * Pi, phi = uv[0] * 2.f * Pi;
     Float cosTheta = std::cos(theta), sinTheta = std::sin(theta);
@@ -168,7 +209,7 @@ void InfiniteAreaLight::Pdf_Le(const Ray &ray, const Normal3f &, Float *pdfPos,
     Vector3f d = -WorldToLight(ray.d);
     Float theta = SphericalTheta(d), phi = SphericalPhi(d);
     Point2f uv(phi * Inv2Pi, theta * InvPi);
-    Float mapPdf = distribution->Pdf(uv);
+    Float mapPdf = MapPdf(uv);
     *pdfDir = mapPdf / (2 * Pi * Pi * std::sin(theta));
     *pdfPos = 1 / (Pi * worldRadius * worldRadius);
 }
@@ -181,8 +222,19 @@ std::shared_ptr<InfiniteAreaLight> CreateInfiniteLight(
     int nSamples = paramSet.FindOneInt("samples",
                                        paramSet.FindOneInt("nsamples", 1));
     if (PbrtOptions.quickRender) nSamples = std::max(1, nSamples / 4);
+    std::string samplingName =
+        paramSet.FindOneString("sampling", "hierarchical");
+    EnvironmentSampling sampling = EnvironmentSampling::Hierarchical;
+    if (samplingName == "cdf")
+        sampling = EnvironmentSampling::CDF;
+    else if (samplingName == "alias")
+        sampling = EnvironmentSampling::Alias;
+    else if (samplingName != "hierarchical")
+        Warning("Environment map sampling \"%s\" unknown. Using "
+                "\"hierarchical\".",
+                samplingName.c_str());
     return std::make_shared<InfiniteAreaLight>(light2world, L * sc, nSamples,
-                                               texmap);
+                                               texmap, sampling);
 }
 
 }  // namespace pbrt
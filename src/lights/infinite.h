@@ -49,11 +49,15 @@
 namespace pbrt {
 
 // InfiniteAreaLight Declarations
+enum class EnvironmentSampling { CDF, Hierarchical, Alias };
+
 class InfiniteAreaLight : public Light {
   public:
     // InfiniteAreaLight Public Methods
     InfiniteAreaLight(const Transform &LightToWorld, const Spectrum &power,
-                      int nSamples, const std::string &texmap);
+                      int nSamples, const std::string &texmap,
+                      EnvironmentSampling sampling =
+                          EnvironmentSampling::Hierarchical);
     void Preprocess(const Scene &scene) {
         scene.WorldBound().BoundingSphere(&worldCenter, &worldRadius);
     }
@@ -69,11 +73,18 @@ class InfiniteAreaLight : public Light {
                 Float *pdfDir) const;
 
   private:
+    // InfiniteAreaLight Private Methods
+    Point2f SampleMap(const Point2f &u, Float *mapPdf) const;
+    Float MapPdf(const Point2f &uv) const;
+
     // InfiniteAreaLight Private Data
     std::unique_ptr<MIPMap<RGBSpectrum>> Lmap;
     Point3f worldCenter;
     Float worldRadius;
+    EnvironmentSampling sampling;
     std::unique_ptr<Distribution2D> distribution;
+    std::unique_ptr<HierarchicalDistribution2D> hierarchical;
+    std::unique_ptr<AliasDistribution2D> alias;
 };
 
 std::shared_ptr<InfiniteAreaLight> CreateInfiniteLight(
@@ -76,6 +76,13 @@ Spectrum SpotLight::Power() const {
     return I * 2 * Pi * (1 - .5f * (cosFalloffStart + cosTotalWidth));
 }
 
+bool SpotLight::Bounds(LightBounds *lb) const {
+    Vector3f w = LightToWorld(Vector3f(0, 0, 1));
+    *lb = LightBounds(Bounds3f(pLight), w, I.MaxComponentValue(), 1,
+                      cosTotalWidth, false);
+    return true;
+}
+
 Float SpotLight::Pdf_Li(const Interaction &, const Vector3f &) const {
     return 0.f;
 }
@@ -48,11 +48,26 @@ static void usage(const char *msg = nullptr) {
 Rendering options:
   --cropwindow <x0,x1,y0,y1> Specify an image crop window.
   --help               Print this help text.
+  --mipcachedir <dir>  Save MIP maps generated for image textures in the
+                       given directory and reuse them in later runs.
   --nthreads <num>     Use specified number of threads for rendering.
   --outfile <filename> Write the final image to the given filename.
+  --perfcounters       Count cycles, instructions, cache misses and branch
+                       misses in each profiling category using the CPU's
+                       hardware counters (Linux only).
+  --profilestacks <filename>
+                       Record call stacks while profiling and write them to
+                       the given file in the collapsed format used by flame
+                       graph tools.
   --quick              Automatically reduce a number of quality settings to
                        render more quickly.
   --quiet              Suppress all text output other than error messages.
+  --stats-json <filename>
+                       Write statistics, timings and the profile to the
+                       given file in JSON format.
+  --texcachemb <num>   Limit memory used for tiles of on-demand (.mip) image
+                       textures to the given number of megabytes.
+                       Default: 512.
 
 Logging options:
   --logdir <dir>       Specify directory that log files should be written to.
@@ -113,10 +128,41 @@ int main(int argc, char *argv[]) {
             FLAGS_minloglevel = atoi(argv[++i]);
         } else if (!strncmp(argv[i], "--minloglevel=", 14)) {
             FLAGS_minloglevel = atoi(&argv[i][14]);
+        } else if (!strcmp(argv[i], "--mipcachedir") ||
+                   !strcmp(argv[i], "-mipcachedir")) {
+            if (i + 1 == argc)
+                usage("missing value after --mipcachedir argument");
+            options.mipCacheDir = argv[++i];
+        } else if (!strncmp(argv[i], "--mipcachedir=", 14)) {
+            options.mipCacheDir = &argv[i][14];
+        } else if (!strcmp(argv[i], "--texcachemb") ||
+                   !strcmp(argv[i], "-texcachemb")) {
+            if (i + 1 == argc)
+                usage("missing value after --texcachemb argument");
+            options.textureCacheMB = atoi(argv[++i]);
+        } else if (!strncmp(argv[i], "--texcachemb=", 13)) {
+            options.textureCacheMB = atoi(&argv[i][13]);
+        } else if (!strcmp(argv[i], "--profilestacks") ||
+                   !strcmp(argv[i], "-profilestacks")) {
+            if (i + 1 == argc)
+                usage("missing value after --profilestacks argument");
+            options.profileStacksFile = argv[++i];
+        } else if (!strncmp(argv[i], "--profilestacks=", 16)) {
+            options.profileStacksFile = &argv[i][16];
+        } else if (!strcmp(argv[i], "--perfcounters") ||
+                   !strcmp(argv[i], "-perfcounters")) {
+            options.perfCounters = true;
         } else if (!strcmp(argv[i], "--quick") || !strcmp(argv[i], "-quick")) {
             options.quickRender = true;
         } else if (!strcmp(argv[i], "--quiet") || !strcmp(argv[i], "-quiet")) {
             options.quiet = true;
+        } else if (!strcmp(argv[i], "--stats-json") ||
+                   !strcmp(argv[i], "-stats-json")) {
+            if (i + 1 == argc)
+                usage("missing value after --stats-json argument");
+            options.statsJSONFile = argv[++i];
+        } else if (!strncmp(argv[i], "--stats-json=", 13)) {
+            options.statsJSONFile = &argv[i][13];
         } else if (!strcmp(argv[i], "--cat") || !strcmp(argv[i], "-cat")) {
             options.cat = true;
         } else if (!strcmp(argv[i], "--toply") || !strcmp(argv[i], "-toply")) {
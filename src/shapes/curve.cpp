@@ -41,6 +41,8 @@ namespace pbrt {
 STAT_MEMORY_COUNTER("Memory/Curves", curveBytes);
 STAT_PERCENT("Intersections/Ray-curve intersection tests", nHits, nTests);
 STAT_INT_DISTRIBUTION("Intersections/Curve refinement level", refinementLevel);
+STAT_PERCENT("Intersections/Ray-curve oriented bounds misses",
+             nOrientedBoundsMisses, nOrientedBoundsTests);
 STAT_COUNTER("Scene/Curves", nCurves);
 STAT_COUNTER("Scene/Split curves", nSplitCurves);
 
@@ -52,16 +54,6 @@ static Point3f BlossomBezier(const Point3f p[4], Float u0, Float u1, Float u2) {
     return Lerp(u2, b[0], b[1]);
 }
 
-inline void SubdivideBezier(const Point3f cp[4], Point3f cpSplit[7]) {
-    cpSplit[0] = cp[0];
-    cpSplit[1] = (cp[0] + cp[1]) / 2;
-    cpSplit[2] = (cp[0] + 2 * cp[1] + cp[2]) / 4;
-    cpSplit[3] = (cp[0] + 3 * cp[1] + 3 * cp[2] + cp[3]) / 8;
-    cpSplit[4] = (cp[1] + 2 * cp[2] + cp[3]) / 4;
-    cpSplit[5] = (cp[2] + cp[3]) / 2;
-    cpSplit[6] = cp[3];
-}
-
 static Point3f EvalBezier(const Point3f cp[4], Float u,
                           Vector3f *deriv = nullptr) {
     Point3f cp1[3] = {Lerp(u, cp[0], cp[1]), Lerp(u, cp[1], cp[2]),
@@ -107,6 +99,18 @@ std::vector<std::shared_ptr<Shape>> CreateCurve(
     std::vector<std::shared_ptr<Shape>> segments;
     std::shared_ptr<CurveCommon> common =
         std::make_shared<CurveCommon>(c, w0, w1, type, norm);
+    if (splitDepth < 0) {
+        // Split long, thin curves just enough to keep the axis-aligned
+        // bounds that the BVH sees reasonably tight; the segments' oriented
+        // bounds make further splitting unnecessary
+        Float length = Distance(c[0], c[1]) + Distance(c[1], c[2]) +
+                       Distance(c[2], c[3]);
+        Float width = std::max(w0, w1);
+        splitDepth = 3;
+        if (width > 0 && length > 0)
+            splitDepth = Clamp(
+                (int)std::ceil(Log2(length / (16 * width))), 0, 3);
+    }
     const int nSegments = 1 << splitDepth;
     segments.reserve(nSegments);
     for (int i = 0; i < nSegments; ++i) {
@@ -120,13 +124,63 @@ std::vector<std::shared_ptr<Shape>> CreateCurve(
     return segments;
 }
 
-Bounds3f Curve::ObjectBound() const {
-    // Compute object-space control points for curve segment, _cpObj_
+Curve::Curve(const Transform *ObjectToWorld, const Transform *WorldToObject,
+             bool reverseOrientation,
+             const std::shared_ptr<CurveCommon> &common, Float uMin,
+             Float uMax)
+    : Shape(ObjectToWorld, WorldToObject, reverseOrientation),
+      common(common),
+      uMin(uMin),
+      uMax(uMax) {
+    // Compute the axes of the segment's oriented bounding box; the first
+    // follows the chord and the second the bulge of the inner control
+    // points away from it, which keeps the box tight around thin curves
     Point3f cpObj[4];
+    SegmentControlPoints(cpObj);
+    Vector3f axis[3];
+    axis[0] = cpObj[3] - cpObj[0];
+    if (axis[0].LengthSquared() == 0) axis[0] = cpObj[1] - cpObj[0];
+    if (axis[0].LengthSquared() == 0) axis[0] = cpObj[2] - cpObj[0];
+    axis[0] = axis[0].LengthSquared() > 0 ? Normalize(axis[0])
+                                          : Vector3f(1, 0, 0);
+    Vector3f bulge = (cpObj[1] - cpObj[0]) + (cpObj[2] - cpObj[3]);
+    bulge -= Dot(bulge, axis[0]) * axis[0];
+    if (bulge.LengthSquared() > 1e-8f * (cpObj[3] - cpObj[0]).LengthSquared() &&
+        bulge.LengthSquared() > 0) {
+        axis[1] = Normalize(bulge);
+        axis[2] = Cross(axis[0], axis[1]);
+    } else
+        CoordinateSystem(axis[0], &axis[1], &axis[2]);
+    obbAxis[0] = axis[0];
+    obbAxis[1] = axis[1];
+
+    // Compute the extent of the control points along each axis, padded by
+    // the curve's half width
+    Float maxWidth = std::max(Lerp(uMin, common->width[0], common->width[1]),
+                              Lerp(uMax, common->width[0], common->width[1]));
+    for (int i = 0; i < 3; ++i) {
+        obbMin[i] = obbMax[i] = Dot(Vector3f(cpObj[0]), axis[i]);
+        for (int j = 1; j < 4; ++j) {
+            Float d = Dot(Vector3f(cpObj[j]), axis[i]);
+            obbMin[i] = std::min(obbMin[i], d);
+            obbMax[i] = std::max(obbMax[i], d);
+        }
+        obbMin[i] -= 0.5f * maxWidth;
+        obbMax[i] += 0.5f * maxWidth;
+    }
+}
+
+void Curve::SegmentControlPoints(Point3f cpObj[4]) const {
     cpObj[0] = BlossomBezier(common->cpObj, uMin, uMin, uMin);
     cpObj[1] = BlossomBezier(common->cpObj, uMin, uMin, uMax);
     cpObj[2] = BlossomBezier(common->cpObj, uMin, uMax, uMax);
     cpObj[3] = BlossomBezier(common->cpObj, uMax, uMax, uMax);
+}
+
+Bounds3f Curve::ObjectBound() const {
+    // Compute object-space control points for curve segment, _cpObj_
+    Point3f cpObj[4];
+    SegmentControlPoints(cpObj);
     Bounds3f b =
         Union(Bounds3f(cpObj[0], cpObj[1]), Bounds3f(cpObj[2], cpObj[3]));
     Float width[2] = {Lerp(uMin, common->width[0], common->width[1]),
@@ -134,6 +188,44 @@ Bounds3f Curve::ObjectBound() const {
     return Expand(b, std::max(width[0], width[1]) * 0.5f);
 }
 
+bool Curve::IntersectOrientedBounds(const Ray &ray) const {
+    // Clip the ray's parametric range against each pair of slabs
+    Vector3f axis[3] = {obbAxis[0], obbAxis[1], Cross(obbAxis[0], obbAxis[1])};
+    Float t0 = 0, t1 = ray.tMax;
+    for (int i = 0; i < 3; ++i) {
+        Float o = Dot(Vector3f(ray.o), axis[i]);
+        Float invD = 1 / Dot(ray.d, axis[i]);
+        Float tNear = (obbMin[i] - o) * invD;
+        Float tFar = (obbMax[i] - o) * invD;
+        if (tNear > tFar) std::swap(tNear, tFar);
+        // Be conservative about round-off, as in _Bounds3::IntersectP()_
+        tFar *= 1 + 2 * gamma(3);
+        t0 = tNear > t0 ? tNear : t0;
+        t1 = tFar < t1 ? tFar : t1;
+        if (t0 > t1) return false;
+    }
+    return true;
+}
+
+// Returns the rigid transformation that maps the ray's origin to
+// $(0,0,0)$, its direction to $+z$ and _up_ to the $yz$ plane; this is
+// _LookAt()_'s transformation, computed without a general matrix inverse.
+static Transform RayCoordinateSystem(const Ray &ray, const Vector3f &up) {
+    Vector3f dir = Normalize(ray.d);
+    Vector3f right = Normalize(Cross(Normalize(up), dir));
+    Vector3f newUp = Cross(dir, right);
+    Vector3f o(ray.o);
+    Matrix4x4 rayToObject(right.x, newUp.x, dir.x, o.x,
+                          right.y, newUp.y, dir.y, o.y,
+                          right.z, newUp.z, dir.z, o.z,
+                          0, 0, 0, 1);
+    Matrix4x4 objectToRay(right.x, right.y, right.z, -Dot(right, o),
+                          newUp.x, newUp.y, newUp.z, -Dot(newUp, o),
+                          dir.x, dir.y, dir.z, -Dot(dir, o),
+                          0, 0, 0, 1);
+    return Transform(objectToRay, rayToObject);
+}
+
 bool Curve::Intersect(const Ray &r, Float *tHit, SurfaceInteraction *isect,
                       bool testAlphaTexture) const {
     ProfilePhase p(isect ? Prof::CurveIntersect : Prof::CurveIntersectP);
@@ -142,12 +234,17 @@ bool Curve::Intersect(const Ray &r, Float *tHit, SurfaceInteraction *isect,
     Vector3f oErr, dErr;
     Ray ray = (*WorldToObject)(r, &oErr, &dErr);
 
+    // Reject the ray if it misses the segment's oriented bounding box; the
+    // BVH only tests the much looser axis-aligned bounds of diagonal hairs
+    ++nOrientedBoundsTests;
+    if (!IntersectOrientedBounds(ray)) {
+        ++nOrientedBoundsMisses;
+        return false;
+    }
+
     // Compute object-space control points for curve segment, _cpObj_
     Point3f cpObj[4];
-    cpObj[0] = BlossomBezier(common->cpObj, uMin, uMin, uMin);
-    cpObj[1] = BlossomBezier(common->cpObj, uMin, uMin, uMax);
-    cpObj[2] = BlossomBezier(common->cpObj, uMin, uMax, uMax);
-    cpObj[3] = BlossomBezier(common->cpObj, uMax, uMax, uMax);
+    SegmentControlPoints(cpObj);
 
     // Project curve control points to plane perpendicular to ray
 
@@ -158,7 +255,7 @@ bool Curve::Intersect(const Ray &r, Float *tHit, SurfaceInteraction *isect,
     //
     // In turn (especially for curves that are approaching stright lines),
     // we get curve bounds with minimal extent in y, which in turn lets us
-    // early out more quickly in recursiveIntersect().
+    // early out more quickly below.
     Vector3f dx = Cross(ray.d, cpObj[3] - cpObj[0]);
     if (dx.LengthSquared() == 0) {
         // If the ray and the vector between the first and last control
@@ -169,7 +266,7 @@ bool Curve::Intersect(const Ray &r, Float *tHit, SurfaceInteraction *isect,
         CoordinateSystem(ray.d, &dx, &dy);
     }
 
-    Transform objectToRay = LookAt(ray.o, ray.o + ray.d, dx);
+    Transform objectToRay = RayCoordinateSystem(ray, dx);
     Point3f cp[4] = {objectToRay(cpObj[0]), objectToRay(cpObj[1]),
                      objectToRay(cpObj[2]), objectToRay(cpObj[3])};
 
@@ -225,161 +322,163 @@ bool Curve::Intersect(const Ray &r, Float *tHit, SurfaceInteraction *isect,
     int maxDepth = Clamp(r0, 0, 10);
     ReportValue(refinementLevel, maxDepth);
 
-    return recursiveIntersect(ray, tHit, isect, cp, Inverse(objectToRay), uMin,
-                              uMax, maxDepth);
+    // The refinement depth that subdivision would need also bounds how
+    // finely the closest-approach function has to be sampled to bracket its
+    // roots
+    return closestApproachIntersect(ray, tHit, isect, cp, Inverse(objectToRay),
+                                    4 << std::min(maxDepth, 4));
 }
 
-bool Curve::recursiveIntersect(const Ray &ray, Float *tHit,
-                               SurfaceInteraction *isect, const Point3f cp[4],
-                               const Transform &rayToObject, Float u0, Float u1,
-                               int depth) const {
-    Float rayLength = ray.d.Length();
+// Returns the root of the quintic with coefficients _f_ in $[a,b]$, where
+// $f(a) \le 0 < f(b)$, using Newton's method safeguarded by bisection.
+static Float BracketedQuinticRoot(const Float f[6], Float a, Float b) {
+    Float w = 0.5f * (a + b);
+    for (int i = 0; i < 20; ++i) {
+        Float fw = f[0] + w * (f[1] + w * (f[2] + w * (f[3] + w * (f[4] +
+                                                                   w * f[5]))));
+        Float dfw = f[1] + w * (2 * f[2] + w * (3 * f[3] + w * (4 * f[4] +
+                                                                w * 5 * f[5])));
+        if (fw <= 0)
+            a = w;
+        else
+            b = w;
+        Float wNext = w - fw / dfw;
+        if (!(wNext > a && wNext < b)) wNext = 0.5f * (a + b);
+        if (std::abs(wNext - w) < 1e-6f) return wNext;
+        w = wNext;
+    }
+    return w;
+}
 
-    if (depth > 0) {
-        // Split curve segment into sub-segments and test for intersection
-        Point3f cpSplit[7];
-        SubdivideBezier(cp, cpSplit);
-
-        // For each of the two segments, see if the ray's bounding box
-        // overlaps the segment before recursively checking for
-        // intersection with it.
-        bool hit = false;
-        Float u[3] = {u0, (u0 + u1) / 2.f, u1};
-        // Pointer to the 4 control poitns for the current segment.
-        const Point3f *cps = cpSplit;
-        for (int seg = 0; seg < 2; ++seg, cps += 3) {
-            Float maxWidth =
-                std::max(Lerp(u[seg], common->width[0], common->width[1]),
-                         Lerp(u[seg + 1], common->width[0], common->width[1]));
-
-            // As above, check y first, since it most commonly lets us exit
-            // out early.
-            if (std::max(std::max(cps[0].y, cps[1].y),
-                         std::max(cps[2].y, cps[3].y)) +
-                        0.5 * maxWidth < 0 ||
-                std::min(std::min(cps[0].y, cps[1].y),
-                         std::min(cps[2].y, cps[3].y)) -
-                        0.5 * maxWidth > 0)
-                continue;
-
-            if (std::max(std::max(cps[0].x, cps[1].x),
-                         std::max(cps[2].x, cps[3].x)) +
-                        0.5 * maxWidth < 0 ||
-                std::min(std::min(cps[0].x, cps[1].x),
-                         std::min(cps[2].x, cps[3].x)) -
-                        0.5 * maxWidth > 0)
-                continue;
-
-            Float zMax = rayLength * ray.tMax;
-            if (std::max(std::max(cps[0].z, cps[1].z),
-                         std::max(cps[2].z, cps[3].z)) +
-                        0.5 * maxWidth < 0 ||
-                std::min(std::min(cps[0].z, cps[1].z),
-                         std::min(cps[2].z, cps[3].z)) -
-                        0.5 * maxWidth > zMax)
-                continue;
-
-            hit |= recursiveIntersect(ray, tHit, isect, cps, rayToObject,
-                                      u[seg], u[seg + 1], depth - 1);
-            // If we found an intersection and this is a shadow ray,
-            // we can exit out immediately.
-            if (hit && !tHit) return true;
-        }
-        return hit;
-    } else {
-        // Intersect ray with curve segment
-
-        // Test ray against segment endpoint boundaries
-
-        // Test sample point against tangent perpendicular at curve start
-        Float edge =
-            (cp[1].y - cp[0].y) * -cp[0].y + cp[0].x * (cp[0].x - cp[1].x);
-        if (edge < 0) return false;
-
-        // Test sample point against tangent perpendicular at curve end
-        edge = (cp[2].y - cp[3].y) * -cp[3].y + cp[3].x * (cp[3].x - cp[2].x);
-        if (edge < 0) return false;
-
-        // Compute line $w$ that gives minimum distance to sample point
-        Vector2f segmentDirection = Point2f(cp[3]) - Point2f(cp[0]);
-        Float denom = segmentDirection.LengthSquared();
-        if (denom == 0) return false;
-        Float w = Dot(-Vector2f(cp[0]), segmentDirection) / denom;
-
-        // Compute $u$ coordinate of curve intersection point and _hitWidth_
-        Float u = Clamp(Lerp(w, u0, u1), u0, u1);
-        Float hitWidth = Lerp(u, common->width[0], common->width[1]);
-        Normal3f nHit;
-        if (common->type == CurveType::Ribbon) {
-            // Scale _hitWidth_ based on ribbon orientation
-            Float sin0 = std::sin((1 - u) * common->normalAngle) *
-                         common->invSinNormalAngle;
-            Float sin1 =
-                std::sin(u * common->normalAngle) * common->invSinNormalAngle;
-            nHit = sin0 * common->n[0] + sin1 * common->n[1];
-            hitWidth *= AbsDot(nHit, ray.d) / rayLength;
-        }
+bool Curve::closestApproachIntersect(const Ray &ray, Float *tHit,
+                                     SurfaceInteraction *isect,
+                                     const Point3f cp[4],
+                                     const Transform &rayToObject,
+                                     int nIntervals) const {
+    // Compute power basis coefficients of the curve's projection onto the
+    // plane perpendicular to the ray, $(x(w), y(w))$
+    Float c[2][4];
+    for (int i = 0; i < 2; ++i) {
+        c[i][0] = cp[0][i];
+        c[i][1] = 3 * (cp[1][i] - cp[0][i]);
+        c[i][2] = 3 * (cp[2][i] - 2 * cp[1][i] + cp[0][i]);
+        c[i][3] = cp[3][i] - 3 * cp[2][i] + 3 * cp[1][i] - cp[0][i];
+    }
+
+    // Compute the coefficients of $f(w) = x x' + y y'$; the ray passes
+    // closest to the curve where $f$ crosses zero from below
+    Float f[6] = {0, 0, 0, 0, 0, 0};
+    for (int i = 0; i < 2; ++i) {
+        const Float *a = c[i];
+        f[0] += a[0] * a[1];
+        f[1] += 2 * a[0] * a[2] + a[1] * a[1];
+        f[2] += 3 * a[0] * a[3] + 3 * a[1] * a[2];
+        f[3] += 4 * a[1] * a[3] + 2 * a[2] * a[2];
+        f[4] += 5 * a[2] * a[3];
+        f[5] += 3 * a[3] * a[3];
+    }
+    auto F = [&f](Float w) {
+        return f[0] + w * (f[1] + w * (f[2] + w * (f[3] + w * (f[4] +
+                                                               w * f[5]))));
+    };
+
+    // Find the closest hit among the local minima of the ray's distance
+    // to the curve
+    Float rayLength = ray.d.Length();
+    Float zMax = rayLength * ray.tMax;
+    bool hit = false;
+    Float uHit = 0, hitWidthHit = 0;
+    Point3f pcHit;
+    Vector3f dpcdwHit;
+    Normal3f nHit;
+    Float wPrev = 0, fPrev = F(0);
+    for (int i = 1; i <= nIntervals; ++i) {
+        Float w1 = Float(i) / Float(nIntervals), f1 = F(w1);
+        if (fPrev <= 0 && f1 > 0) {
+            Float w = BracketedQuinticRoot(f, wPrev, w1);
+
+            // Compute $u$ coordinate of curve intersection point and
+            // _hitWidth_
+            Float u = Clamp(Lerp(w, uMin, uMax), uMin, uMax);
+            Float hitWidth = Lerp(u, common->width[0], common->width[1]);
+            Normal3f n;
+            if (common->type == CurveType::Ribbon) {
+                // Scale _hitWidth_ based on ribbon orientation
+                Float sin0 = std::sin((1 - u) * common->normalAngle) *
+                             common->invSinNormalAngle;
+                Float sin1 = std::sin(u * common->normalAngle) *
+                             common->invSinNormalAngle;
+                n = sin0 * common->n[0] + sin1 * common->n[1];
+                hitWidth *= AbsDot(n, ray.d) / rayLength;
+            }
 
-        // Test intersection point against curve width
-        Vector3f dpcdw;
-        Point3f pc = EvalBezier(cp, Clamp(w, 0, 1), &dpcdw);
-        Float ptCurveDist2 = pc.x * pc.x + pc.y * pc.y;
-        if (ptCurveDist2 > hitWidth * hitWidth * .25) return false;
-        Float zMax = rayLength * ray.tMax;
-        if (pc.z < 0 || pc.z > zMax) return false;
-
-        // Compute $v$ coordinate of curve intersection point
-        Float ptCurveDist = std::sqrt(ptCurveDist2);
-        Float edgeFunc = dpcdw.x * -pc.y + pc.x * dpcdw.y;
-        Float v = (edgeFunc > 0) ? 0.5f + ptCurveDist / hitWidth
-                                 : 0.5f - ptCurveDist / hitWidth;
-
-        // Compute hit _t_ and partial derivatives for curve intersection
-        if (tHit != nullptr) {
-            // FIXME: this tHit isn't quite right for ribbons...
-            *tHit = pc.z / rayLength;
-            // Compute error bounds for curve intersection
-            Vector3f pError(2 * hitWidth, 2 * hitWidth, 2 * hitWidth);
-
-            // Compute $\dpdu$ and $\dpdv$ for curve intersection
-            Vector3f dpdu, dpdv;
-            EvalBezier(common->cpObj, u, &dpdu);
-            CHECK_NE(Vector3f(0, 0, 0), dpdu) << "u = " << u << ", cp = " <<
-                common->cpObj[0] << ", " << common->cpObj[1] << ", " <<
-                common->cpObj[2] << ", " << common->cpObj[3];
-
-            if (common->type == CurveType::Ribbon)
-                dpdv = Normalize(Cross(nHit, dpdu)) * hitWidth;
-            else {
-                // Compute curve $\dpdv$ for flat and cylinder curves
-                Vector3f dpduPlane = (Inverse(rayToObject))(dpdu);
-                Vector3f dpdvPlane =
-                    Normalize(Vector3f(-dpduPlane.y, dpduPlane.x, 0)) *
-                    hitWidth;
-                if (common->type == CurveType::Cylinder) {
-                    // Rotate _dpdvPlane_ to give cylindrical appearance
-                    Float theta = Lerp(v, -90., 90.);
-                    Transform rot = Rotate(-theta, dpduPlane);
-                    dpdvPlane = rot(dpdvPlane);
-                }
-                dpdv = rayToObject(dpdvPlane);
+            // Test intersection point against curve width
+            Vector3f dpcdw;
+            Point3f pc = EvalBezier(cp, w, &dpcdw);
+            Float ptCurveDist2 = pc.x * pc.x + pc.y * pc.y;
+            if (ptCurveDist2 <= hitWidth * hitWidth * .25f && pc.z >= 0 &&
+                pc.z <= zMax && (!hit || pc.z < pcHit.z)) {
+                hit = true;
+                // Shadow rays can stop at the first hit
+                if (!tHit) break;
+                uHit = u;
+                hitWidthHit = hitWidth;
+                pcHit = pc;
+                dpcdwHit = dpcdw;
+                nHit = n;
             }
-            *isect = (*ObjectToWorld)(SurfaceInteraction(
-                ray(pc.z), pError, Point2f(u, v), -ray.d, dpdu, dpdv,
-                Normal3f(0, 0, 0), Normal3f(0, 0, 0), ray.time, this));
         }
-        ++nHits;
-        return true;
+        wPrev = w1;
+        fPrev = f1;
+    }
+    if (!hit) return false;
+    ++nHits;
+    if (!tHit) return true;
+
+    // Compute $v$ coordinate of curve intersection point
+    Float ptCurveDist = std::sqrt(pcHit.x * pcHit.x + pcHit.y * pcHit.y);
+    Float edgeFunc = dpcdwHit.x * -pcHit.y + pcHit.x * dpcdwHit.y;
+    Float v = (edgeFunc > 0) ? 0.5f + ptCurveDist / hitWidthHit
+                             : 0.5f - ptCurveDist / hitWidthHit;
+
+    // Compute hit _t_ and partial derivatives for curve intersection
+    // FIXME: this tHit isn't quite right for ribbons...
+    *tHit = pcHit.z / rayLength;
+    // Compute error bounds for curve intersection
+    Vector3f pError(2 * hitWidthHit, 2 * hitWidthHit, 2 * hitWidthHit);
+
+    // Compute $\dpdu$ and $\dpdv$ for curve intersection
+    Vector3f dpdu, dpdv;
+    EvalBezier(common->cpObj, uHit, &dpdu);
+    CHECK_NE(Vector3f(0, 0, 0), dpdu) << "u = " << uHit << ", cp = " <<
+        common->cpObj[0] << ", " << common->cpObj[1] << ", " <<
+        common->cpObj[2] << ", " << common->cpObj[3];
+
+    if (common->type == CurveType::Ribbon)
+        dpdv = Normalize(Cross(nHit, dpdu)) * hitWidthHit;
+    else {
+        // Compute curve $\dpdv$ for flat and cylinder curves
+        Vector3f dpduPlane = (Inverse(rayToObject))(dpdu);
+        Vector3f dpdvPlane =
+            Normalize(Vector3f(-dpduPlane.y, dpduPlane.x, 0)) * hitWidthHit;
+        if (common->type == CurveType::Cylinder) {
+            // Rotate _dpdvPlane_ to give cylindrical appearance
+            Float theta = Lerp(v, -90., 90.);
+            Transform rot = Rotate(-theta, dpduPlane);
+            dpdvPlane = rot(dpdvPlane);
+        }
+        dpdv = rayToObject(dpdvPlane);
     }
+    *isect = (*ObjectToWorld)(SurfaceInteraction(
+        ray(pcHit.z), pError, Point2f(uHit, v), -ray.d, dpdu, dpdv,
+        Normal3f(0, 0, 0), Normal3f(0, 0, 0), ray.time, this));
+    return true;
 }
 
 Float Curve::Area() const {
     // Compute object-space control points for curve segment, _cpObj_
     Point3f cpObj[4];
-    cpObj[0] = BlossomBezier(common->cpObj, uMin, uMin, uMin);
-    cpObj[1] = BlossomBezier(common->cpObj, uMin, uMin, uMax);
-    cpObj[2] = BlossomBezier(common->cpObj, uMin, uMax, uMax);
-    cpObj[3] = BlossomBezier(common->cpObj, uMax, uMax, uMax);
+    SegmentControlPoints(cpObj);
     Float width0 = Lerp(uMin, common->width[0], common->width[1]);
     Float width1 = Lerp(uMax, common->width[0], common->width[1]);
     Float avgWidth = (width0 + width1) * 0.5f;
@@ -473,7 +572,7 @@ std::vector<std::shared_ptr<Shape>> CreateCurveShape(const Transform *o2w,
     }
 
     int sd = params.FindOneInt("splitdepth",
-                               int(params.FindOneFloat("splitdepth", 3)));
+                               int(params.FindOneFloat("splitdepth", -1)));
 
     std::vector<std::shared_ptr<Shape>> curves;
     // Pointer to the first control point for the current segment. This is
@@ -64,11 +64,7 @@ class Curve : public Shape {
     // Curve Public Methods
     Curve(const Transform *ObjectToWorld, const Transform *WorldToObject,
           bool reverseOrientation, const std::shared_ptr<CurveCommon> &common,
-          Float uMin, Float uMax)
-        : Shape(ObjectToWorld, WorldToObject, reverseOrientation),
-          common(common),
-          uMin(uMin),
-          uMax(uMax) {}
+          Float uMin, Float uMax);
     Bounds3f ObjectBound() const;
     bool Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
                    bool testAlphaTexture) const;
@@ -77,14 +73,22 @@ class Curve : public Shape {
 
   private:
     // Curve Private Methods
-    bool recursiveIntersect(const Ray &r, Float *tHit,
-                            SurfaceInteraction *isect, const Point3f cp[4],
-                            const Transform &rayToObject, Float u0, Float u1,
-                            int depth) const;
+    void SegmentControlPoints(Point3f cpObj[4]) const;
+    bool IntersectOrientedBounds(const Ray &ray) const;
+    bool closestApproachIntersect(const Ray &r, Float *tHit,
+                                  SurfaceInteraction *isect,
+                                  const Point3f cp[4],
+                                  const Transform &rayToObject,
+                                  int nIntervals) const;
 
     // Curve Private Data
     const std::shared_ptr<CurveCommon> common;
     const Float uMin, uMax;
+    // Object-space oriented bounding box of the segment, with its first
+    // axis along the segment's chord; the third axis is the cross product
+    // of the first two
+    Vector3f obbAxis[2];
+    Float obbMin[3], obbMax[3];
 };
 
 std::vector<std::shared_ptr<Shape>> CreateCurveShape(const Transform *o2w,
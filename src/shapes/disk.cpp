@@ -137,6 +137,14 @@ Interaction Disk::Sample(const Point2f &u, Float *pdf) const {
     return it;
 }
 
+bool Disk::NormalBounds(Vector3f *w, Float *cosTheta) const {
+    Normal3f n = Normalize((*ObjectToWorld)(Normal3f(0, 0, 1)));
+    if (reverseOrientation) n *= -1;
+    *w = Vector3f(n);
+    *cosTheta = 1;
+    return true;
+}
+
 std::shared_ptr<Disk> CreateDiskShape(const Transform *o2w,
                                       const Transform *w2o,
                                       bool reverseOrientation,
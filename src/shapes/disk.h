@@ -61,6 +61,7 @@ class Disk : public Shape {
     bool IntersectP(const Ray &ray, bool testAlphaTexture) const;
     Float Area() const;
     Interaction Sample(const Point2f &u, Float *pdf) const;
+    bool NormalBounds(Vector3f *w, Float *cosTheta) const;
 
   private:
     // Disk Private Data
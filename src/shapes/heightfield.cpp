@@ -30,15 +30,345 @@
 
  */
 
-
 // shapes/heightfield.cpp*
 #include "shapes/heightfield.h"
-#include "shapes/triangle.h"
+#include "interaction.h"
 #include "paramset.h"
+#include "stats.h"
 
 namespace pbrt {
 
-// Heightfield Definitions
+STAT_MEMORY_COUNTER("Memory/Heightfields", heightfieldBytes);
+STAT_INT_DISTRIBUTION("Intersections/Heightfield nodes visited per ray",
+                      nodesVisited);
+
+// Heightfield Local Definitions
+
+// The ray coordinate space of the watertight ray--triangle test, set up
+// once per ray and shared by all of the triangles it is tested against
+struct TriangleRaySpace {
+    TriangleRaySpace(const Ray &ray) : o(ray.o) {
+        kz = MaxDimension(Abs(ray.d));
+        kx = kz + 1;
+        if (kx == 3) kx = 0;
+        ky = kx + 1;
+        if (ky == 3) ky = 0;
+        Vector3f d = Permute(ray.d, kx, ky, kz);
+        Sx = -d.x / d.z;
+        Sy = -d.y / d.z;
+        Sz = 1.f / d.z;
+    }
+    Point3f o;
+    int kx, ky, kz;
+    Float Sx, Sy, Sz;
+};
+
+static bool IntersectTriangle(const TriangleRaySpace &rs, const Point3f p[3],
+                              Float tMax, Float *tHit, Float b[3]) {
+    // Transform triangle vertices to ray coordinate space
+    Point3f pt[3];
+    for (int i = 0; i < 3; ++i) {
+        pt[i] = Permute(p[i] - Vector3f(rs.o), rs.kx, rs.ky, rs.kz);
+        pt[i].x += rs.Sx * pt[i].z;
+        pt[i].y += rs.Sy * pt[i].z;
+    }
+
+    // Compute edge function coefficients _e0_, _e1_, and _e2_
+    Float e0 = pt[1].x * pt[2].y - pt[1].y * pt[2].x;
+    Float e1 = pt[2].x * pt[0].y - pt[2].y * pt[0].x;
+    Float e2 = pt[0].x * pt[1].y - pt[0].y * pt[1].x;
+
+    // Fall back to double precision test at triangle edges
+    if (sizeof(Float) == sizeof(float) &&
+        (e0 == 0.0f || e1 == 0.0f || e2 == 0.0f)) {
+        e0 = (float)((double)pt[2].y * (double)pt[1].x -
+                     (double)pt[2].x * (double)pt[1].y);
+        e1 = (float)((double)pt[0].y * (double)pt[2].x -
+                     (double)pt[0].x * (double)pt[2].y);
+        e2 = (float)((double)pt[1].y * (double)pt[0].x -
+                     (double)pt[1].x * (double)pt[0].y);
+    }
+
+    // Perform triangle edge and determinant tests
+    if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+        return false;
+    Float det = e0 + e1 + e2;
+    if (det == 0) return false;
+
+    // Compute scaled hit distance to triangle and test against ray $t$ range
+    for (int i = 0; i < 3; ++i) pt[i].z *= rs.Sz;
+    Float tScaled = e0 * pt[0].z + e1 * pt[1].z + e2 * pt[2].z;
+    if (det < 0 && (tScaled >= 0 || tScaled < tMax * det))
+        return false;
+    else if (det > 0 && (tScaled <= 0 || tScaled > tMax * det))
+        return false;
+
+    // Compute barycentric coordinates and $t$ value for triangle intersection
+    Float invDet = 1 / det;
+    Float t = tScaled * invDet;
+
+    // Ensure that computed triangle $t$ is conservatively greater than zero
+    Float maxZt = MaxComponent(Abs(Vector3f(pt[0].z, pt[1].z, pt[2].z)));
+    Float deltaZ = gamma(3) * maxZt;
+    Float maxXt = MaxComponent(Abs(Vector3f(pt[0].x, pt[1].x, pt[2].x)));
+    Float maxYt = MaxComponent(Abs(Vector3f(pt[0].y, pt[1].y, pt[2].y)));
+    Float deltaX = gamma(5) * (maxXt + maxZt);
+    Float deltaY = gamma(5) * (maxYt + maxZt);
+    Float deltaE =
+        2 * (gamma(2) * maxXt * maxYt + deltaY * maxXt + deltaX * maxYt);
+    Float maxE = MaxComponent(Abs(Vector3f(e0, e1, e2)));
+    Float deltaT = 3 *
+                   (gamma(3) * maxE * maxZt + deltaE * maxZt + deltaZ * maxE) *
+                   std::abs(invDet);
+    if (t <= deltaT) return false;
+    *tHit = t;
+    b[0] = e0 * invDet;
+    b[1] = e1 * invDet;
+    b[2] = e2 * invDet;
+    return true;
+}
+
+struct Heightfield::CellHit {
+    Float t;
+    int x, y, tri;
+    Float b[3];
+};
+
+// Heightfield Method Definitions
+Heightfield::Heightfield(const Transform *ObjectToWorld,
+                         const Transform *WorldToObject,
+                         bool reverseOrientation, int nx, int ny,
+                         const Float *zs)
+    : Shape(ObjectToWorld, WorldToObject, reverseOrientation),
+      nx(nx),
+      ny(ny),
+      z(new Float[nx * ny]) {
+    std::copy(zs, zs + nx * ny, z.get());
+
+    // Build the min-max pyramid, starting from the cells' height ranges
+    Point2i res(nx - 1, ny - 1);
+    std::vector<HeightRange> cells(res.x * res.y);
+    for (int y = 0; y < res.y; ++y)
+        for (int x = 0; x < res.x; ++x) {
+            Float z00 = z[y * nx + x], z10 = z[y * nx + x + 1];
+            Float z01 = z[(y + 1) * nx + x], z11 = z[(y + 1) * nx + x + 1];
+            cells[y * res.x + x] = {std::min({z00, z10, z01, z11}),
+                                    std::max({z00, z10, z01, z11})};
+        }
+    pyramid.push_back(std::move(cells));
+    pyramidRes.push_back(res);
+    while (res.x > 1 || res.y > 1) {
+        const std::vector<HeightRange> &fine = pyramid.back();
+        Point2i fineRes = res;
+        res = Point2i((res.x + 1) / 2, (res.y + 1) / 2);
+        std::vector<HeightRange> coarse(res.x * res.y, {Infinity, -Infinity});
+        for (int y = 0; y < fineRes.y; ++y)
+            for (int x = 0; x < fineRes.x; ++x) {
+                HeightRange &c = coarse[(y / 2) * res.x + x / 2];
+                const HeightRange &f = fine[y * fineRes.x + x];
+                c.zMin = std::min(c.zMin, f.zMin);
+                c.zMax = std::max(c.zMax, f.zMax);
+            }
+        pyramid.push_back(std::move(coarse));
+        pyramidRes.push_back(res);
+    }
+
+    // Compute the surface area of the heightfield's triangles
+    area = 0;
+    for (int y = 0; y < ny - 1; ++y)
+        for (int x = 0; x < nx - 1; ++x)
+            for (int tri = 0; tri < 2; ++tri) {
+                Point3f p[3];
+                CellTriangle(x, y, tri, p);
+                for (int i = 0; i < 3; ++i) p[i] = (*ObjectToWorld)(p[i]);
+                area += 0.5f * Cross(p[1] - p[0], p[2] - p[0]).Length();
+            }
+
+    heightfieldBytes += sizeof(*this) + nx * ny * sizeof(Float);
+    for (const std::vector<HeightRange> &level : pyramid)
+        heightfieldBytes += level.size() * sizeof(HeightRange);
+}
+
+Bounds3f Heightfield::ObjectBound() const {
+    const HeightRange &root = pyramid.back()[0];
+    return Bounds3f(Point3f(0, 0, root.zMin), Point3f(1, 1, root.zMax));
+}
+
+void Heightfield::CellTriangle(int x, int y, int tri, Point3f p[3]) const {
+    // Split the cell along its $(x,y)$--$(x+1,y+1)$ diagonal
+    p[0] = Vertex(x, y);
+    p[1] = tri == 0 ? Vertex(x + 1, y) : Vertex(x + 1, y + 1);
+    p[2] = tri == 0 ? Vertex(x + 1, y + 1) : Vertex(x, y + 1);
+}
+
+void Heightfield::Derivatives(int x, int y, int tri, Vector3f *dpdu,
+                              Vector3f *dpdv) const {
+    // $(u,v)$ is the object-space $(x,y)$ position, so the derivatives
+    // are given by the slopes of the triangle's plane
+    Float z00 = z[y * nx + x], z10 = z[y * nx + x + 1];
+    Float z01 = z[(y + 1) * nx + x], z11 = z[(y + 1) * nx + x + 1];
+    Float dzdx = (tri == 0 ? z10 - z00 : z11 - z01) * (nx - 1);
+    Float dzdy = (tri == 0 ? z11 - z10 : z01 - z00) * (ny - 1);
+    *dpdu = Vector3f(1, 0, dzdx);
+    *dpdv = Vector3f(0, 1, dzdy);
+}
+
+bool Heightfield::IntersectGrid(const Ray &r, CellHit *hit) const {
+    // Traverse the min-max pyramid depth first, visiting each node's
+    // children nearest to the ray origin first and shortening the ray as
+    // hits are found
+    Ray ray = r;
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    TriangleRaySpace rs(ray);
+    struct Node {
+        int level, x, y;
+    };
+    Node nodes[128];
+    int nNodes = 0, nVisited = 0;
+    bool hitSomething = false;
+    nodes[nNodes++] = {(int)pyramid.size() - 1, 0, 0};
+    while (nNodes > 0) {
+        Node node = nodes[--nNodes];
+        ++nVisited;
+        // Test the ray against the node's bounds
+        const HeightRange &range =
+            pyramid[node.level][node.y * pyramidRes[node.level].x + node.x];
+        int x0 = node.x << node.level, y0 = node.y << node.level;
+        int x1 = std::min((node.x + 1) << node.level, nx - 1);
+        int y1 = std::min((node.y + 1) << node.level, ny - 1);
+        Bounds3f bounds(Point3f((Float)x0 / (Float)(nx - 1),
+                                (Float)y0 / (Float)(ny - 1), range.zMin),
+                        Point3f((Float)x1 / (Float)(nx - 1),
+                                (Float)y1 / (Float)(ny - 1), range.zMax));
+        if (!bounds.IntersectP(ray, invDir, dirIsNeg)) continue;
+
+        if (node.level == 0) {
+            // Intersect the ray with the cell's two triangles
+            for (int tri = 0; tri < 2; ++tri) {
+                Point3f p[3];
+                CellTriangle(node.x, node.y, tri, p);
+                Float t, b[3];
+                if (!IntersectTriangle(rs, p, ray.tMax, &t, b)) continue;
+                hitSomething = true;
+                if (!hit) {
+                    ReportValue(nodesVisited, nVisited);
+                    return true;
+                }
+                *hit = {t, node.x, node.y, tri, {b[0], b[1], b[2]}};
+                ray.tMax = t;
+            }
+        } else {
+            // Push the node's children, farthest first
+            int level = node.level - 1;
+            for (int i = 3; i >= 0; --i) {
+                int x = 2 * node.x + ((i & 1) ^ dirIsNeg[0]);
+                int y = 2 * node.y + ((i >> 1) ^ dirIsNeg[1]);
+                if (x < pyramidRes[level].x && y < pyramidRes[level].y)
+                    nodes[nNodes++] = {level, x, y};
+            }
+        }
+    }
+    ReportValue(nodesVisited, nVisited);
+    return hitSomething;
+}
+
+bool Heightfield::Intersect(const Ray &r, Float *tHit,
+                            SurfaceInteraction *isect,
+                            bool testAlphaTexture) const {
+    ProfilePhase p(Prof::ShapeIntersect);
+    // Transform _Ray_ to object space
+    Vector3f oErr, dErr;
+    Ray ray = (*WorldToObject)(r, &oErr, &dErr);
+    CellHit hit;
+    if (!IntersectGrid(ray, &hit)) return false;
+
+    // Compute the hit point and its error bounds as for a triangle
+    Point3f pt[3];
+    CellTriangle(hit.x, hit.y, hit.tri, pt);
+    const Float *b = hit.b;
+    Point3f pHit = b[0] * pt[0] + b[1] * pt[1] + b[2] * pt[2];
+    Vector3f pError = gamma(7) * (Abs(b[0] * Vector3f(pt[0])) +
+                                  Abs(b[1] * Vector3f(pt[1])) +
+                                  Abs(b[2] * Vector3f(pt[2])));
+    Vector3f dpdu, dpdv;
+    Derivatives(hit.x, hit.y, hit.tri, &dpdu, &dpdv);
+
+    // Fill in _SurfaceInteraction_ and orient its normal the way the
+    // heightfield's triangulation would be
+    *isect = (*ObjectToWorld)(SurfaceInteraction(
+        pHit, pError, Point2f(pHit.x, pHit.y), -ray.d, dpdu, dpdv,
+        Normal3f(0, 0, 0), Normal3f(0, 0, 0), ray.time, this));
+    isect->n = isect->shading.n = Normal3f(Normalize(Cross(isect->dpdu,
+                                                           isect->dpdv)));
+    if (reverseOrientation ^ transformSwapsHandedness)
+        isect->n = isect->shading.n = -isect->n;
+    *tHit = hit.t;
+    return true;
+}
+
+bool Heightfield::IntersectP(const Ray &r, bool testAlphaTexture) const {
+    ProfilePhase p(Prof::ShapeIntersectP);
+    Vector3f oErr, dErr;
+    Ray ray = (*WorldToObject)(r, &oErr, &dErr);
+    return IntersectGrid(ray, nullptr);
+}
+
+Float Heightfield::AreaPdf(const Point3f &pObj) const {
+    // Find the triangle under _pObj_ and account for its slope
+    Float fx = Clamp(pObj.x, 0, 1) * (nx - 1);
+    Float fy = Clamp(pObj.y, 0, 1) * (ny - 1);
+    int x = std::min((int)fx, nx - 2), y = std::min((int)fy, ny - 2);
+    Vector3f dpdu, dpdv;
+    Derivatives(x, y, fx - x >= fy - y ? 0 : 1, &dpdu, &dpdv);
+    return 1 / Cross((*ObjectToWorld)(dpdu), (*ObjectToWorld)(dpdv)).Length();
+}
+
+Interaction Heightfield::Sample(const Point2f &u, Float *pdf) const {
+    // Sample a point uniformly over the heightfield's $(x,y)$ domain
+    Float fx = u[0] * (nx - 1), fy = u[1] * (ny - 1);
+    int x = std::min((int)fx, nx - 2), y = std::min((int)fy, ny - 2);
+    Float s = fx - x, t = fy - y;
+    int tri = s >= t ? 0 : 1;
+    Point3f p[3];
+    CellTriangle(x, y, tri, p);
+    Float b[3] = {tri == 0 ? 1 - s : 1 - t, tri == 0 ? s - t : s,
+                  tri == 0 ? t : t - s};
+    Point3f pObj = b[0] * p[0] + b[1] * p[1] + b[2] * p[2];
+    Vector3f pObjError = gamma(6) * (Abs(b[0] * Vector3f(p[0])) +
+                                     Abs(b[1] * Vector3f(p[1])) +
+                                     Abs(b[2] * Vector3f(p[2])));
+    Vector3f dpdu, dpdv;
+    Derivatives(x, y, tri, &dpdu, &dpdv);
+    Vector3f ng = Cross((*ObjectToWorld)(dpdu), (*ObjectToWorld)(dpdv));
+
+    Interaction it;
+    it.p = (*ObjectToWorld)(pObj, pObjError, &it.pError);
+    it.n = Normal3f(Normalize(ng));
+    if (reverseOrientation ^ transformSwapsHandedness) it.n *= -1;
+    *pdf = 1 / ng.Length();
+    return it;
+}
+
+Float Heightfield::Pdf(const Interaction &it) const {
+    return AreaPdf((*WorldToObject)(it.p));
+}
+
+Float Heightfield::Pdf(const Interaction &ref, const Vector3f &wi) const {
+    // Intersect sample ray with area light geometry
+    Ray ray = ref.SpawnRay(wi);
+    Float tHit;
+    SurfaceInteraction isectLight;
+    if (!Intersect(ray, &tHit, &isectLight, false)) return 0;
+
+    // Convert light sample weight to solid angle measure
+    Float pdf = AreaPdf(Point3f(isectLight.uv[0], isectLight.uv[1], 0)) *
+                DistanceSquared(ref.p, isectLight.p) /
+                AbsDot(isectLight.n, -wi);
+    if (std::isinf(pdf)) pdf = 0.f;
+    return pdf;
+}
+
 std::vector<std::shared_ptr<Shape>> CreateHeightfield(
     const Transform *ObjectToWorld, const Transform *WorldToObject,
     bool reverseOrientation, const ParamSet &params) {
@@ -46,44 +376,20 @@ std::vector<std::shared_ptr<Shape>> CreateHeightfield(
     int ny = params.FindOneInt("nv", -1);
     int nitems;
     const Float *z = params.FindFloat("Pz", &nitems);
-    CHECK_EQ(nitems, nx * ny);
-    CHECK(nx != -1 && ny != -1 && z != nullptr);
-
-    int ntris = 2 * (nx - 1) * (ny - 1);
-    std::unique_ptr<int[]> indices(new int[3 * ntris]);
-    std::unique_ptr<Point3f[]> P(new Point3f[nx * ny]);
-    std::unique_ptr<Point2f[]> uvs(new Point2f[nx * ny]);
-    int nverts = nx * ny;
-    // Compute heightfield vertex positions
-    int pos = 0;
-    for (int y = 0; y < ny; ++y) {
-        for (int x = 0; x < nx; ++x) {
-            P[pos].x = uvs[pos].x = (float)x / (float)(nx - 1);
-            P[pos].y = uvs[pos].y = (float)y / (float)(ny - 1);
-            P[pos].z = z[pos];
-            ++pos;
-        }
+    if (nx < 2 || ny < 2) {
+        Error("Heightfield needs at least 2x2 heights (\"nu\" %d, \"nv\" %d).",
+              nx, ny);
+        return std::vector<std::shared_ptr<Shape>>();
     }
-
-    // Fill in heightfield vertex offset array
-    int *vp = indices.get();
-    for (int y = 0; y < ny - 1; ++y) {
-        for (int x = 0; x < nx - 1; ++x) {
-#define VERT(x, y) ((x) + (y)*nx)
-            *vp++ = VERT(x, y);
-            *vp++ = VERT(x + 1, y);
-            *vp++ = VERT(x + 1, y + 1);
-
-            *vp++ = VERT(x, y);
-            *vp++ = VERT(x + 1, y + 1);
-            *vp++ = VERT(x, y + 1);
-        }
-#undef VERT
+    if (!z || nitems != nx * ny) {
+        Error("Heightfield needs %d \"Pz\" values; %d were given.", nx * ny,
+              z ? nitems : 0);
+        return std::vector<std::shared_ptr<Shape>>();
     }
-
-    return CreateTriangleMesh(ObjectToWorld, WorldToObject, reverseOrientation,
-                              ntris, indices.get(), nverts, P.get(), nullptr,
-                              nullptr, uvs.get(), nullptr, nullptr);
+    std::vector<std::shared_ptr<Shape>> shapes;
+    shapes.push_back(std::make_shared<Heightfield>(
+        ObjectToWorld, WorldToObject, reverseOrientation, nx, ny, z));
+    return shapes;
 }
 
 }  // namespace pbrt
@@ -44,6 +44,49 @@
 namespace pbrt {
 
 // Heightfield Declarations
+class Heightfield : public Shape {
+  public:
+    // Heightfield Public Methods
+    Heightfield(const Transform *ObjectToWorld, const Transform *WorldToObject,
+                bool reverseOrientation, int nx, int ny, const Float *z);
+    Bounds3f ObjectBound() const;
+    bool Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
+                   bool testAlphaTexture) const;
+    bool IntersectP(const Ray &ray, bool testAlphaTexture) const;
+    Float Area() const { return area; }
+    Interaction Sample(const Point2f &u, Float *pdf) const;
+    Float Pdf(const Interaction &it) const;
+    Float Pdf(const Interaction &ref, const Vector3f &wi) const;
+
+  private:
+    // Heightfield Private Declarations
+    struct CellHit;
+    struct HeightRange {
+        Float zMin, zMax;
+    };
+
+    // Heightfield Private Methods
+    Point3f Vertex(int x, int y) const {
+        return Point3f((Float)x / (Float)(nx - 1), (Float)y / (Float)(ny - 1),
+                       z[y * nx + x]);
+    }
+    void CellTriangle(int x, int y, int tri, Point3f p[3]) const;
+    void Derivatives(int x, int y, int tri, Vector3f *dpdu,
+                     Vector3f *dpdv) const;
+    bool IntersectGrid(const Ray &ray, CellHit *hit) const;
+    Float AreaPdf(const Point3f &pObj) const;
+
+    // Heightfield Private Data
+    const int nx, ny;
+    std::unique_ptr<Float[]> z;
+    // Min-max height pyramid over the grid cells: level 0 holds the height
+    // range of each cell and each coarser level that of 2x2 blocks of the
+    // level below, up to a single root node
+    std::vector<std::vector<HeightRange>> pyramid;
+    std::vector<Point2i> pyramidRes;
+    Float area;
+};
+
 std::vector<std::shared_ptr<Shape>> CreateHeightfield(const Transform *o2w,
                                                       const Transform *w2o,
                                                       bool ro,
@@ -30,110 +30,67 @@
 
  */
 
-
 // shapes/loopsubdiv.cpp*
 #include "shapes/loopsubdiv.h"
 #include "shapes/triangle.h"
 #include "paramset.h"
-#include <set>
-#include <map>
+#include "parallel.h"
+#include "stats.h"
+#include <algorithm>
+#include <numeric>
 
 namespace pbrt {
 
-struct SDFace;
-struct SDVertex;
+STAT_MEMORY_COUNTER("Memory/Loop subdivision", subdivBytes);
+STAT_COUNTER("Scene/Loop subdivision triangles", nSubdivTriangles);
+STAT_INT_DISTRIBUTION("Scene/Loop subdivision patch level", patchLevel);
 
 // LoopSubdiv Macros
 #define NEXT(i) (((i) + 1) % 3)
 #define PREV(i) (((i) + 2) % 3)
 
-// LoopSubdiv Local Structures
-struct SDVertex {
-    // SDVertex Constructor
-    SDVertex(const Point3f &p = Point3f(0, 0, 0)) : p(p) {}
-
-    // SDVertex Methods
-    int valence();
-    void oneRing(Point3f *p);
-    Point3f p;
-    SDFace *startFace = nullptr;
-    SDVertex *child = nullptr;
-    bool regular = false, boundary = false;
-};
+// LoopSubdiv Constants
 
-struct SDFace {
-    // SDFace Constructor
-    SDFace() {
-        for (int i = 0; i < 3; ++i) {
-            v[i] = nullptr;
-            f[i] = nullptr;
-        }
-        for (int i = 0; i < 4; ++i) children[i] = nullptr;
-    }
+// Face neighbors across boundary edges, and across edges whose neighbor was
+// not refined to the current level of the sparse subdivision
+static const int Boundary = -1, Missing = -2;
 
-    // SDFace Methods
-    int vnum(SDVertex *vert) const {
+// LoopSubdiv Local Structures
+struct SubdivLevel {
+    // SubdivLevel Methods
+    int nFaces() const { return (int)v.size() / 3; }
+    int nVertices() const { return (int)p.size(); }
+    int vnum(int face, int vert) const {
         for (int i = 0; i < 3; ++i)
-            if (v[i] == vert) return i;
-        LOG(FATAL) << "Basic logic error in SDFace::vnum()";
+            if (v[3 * face + i] == vert) return i;
+        LOG(FATAL) << "Basic logic error in SubdivLevel::vnum()";
         return -1;
     }
-    SDFace *nextFace(SDVertex *vert) { return f[vnum(vert)]; }
-    SDFace *prevFace(SDVertex *vert) { return f[PREV(vnum(vert))]; }
-    SDVertex *nextVert(SDVertex *vert) { return v[NEXT(vnum(vert))]; }
-    SDVertex *prevVert(SDVertex *vert) { return v[PREV(vnum(vert))]; }
-    SDVertex *otherVert(SDVertex *v0, SDVertex *v1) {
-        for (int i = 0; i < 3; ++i)
-            if (v[i] != v0 && v[i] != v1) return v[i];
-        LOG(FATAL) << "Basic logic error in SDVertex::otherVert()";
-        return nullptr;
+    int OneRing(int vert, std::vector<int> *ring, bool *boundary) const;
+    size_t BytesUsed() const {
+        return p.capacity() * sizeof(Point3f) +
+               (origin.capacity() + startFace.capacity() + v.capacity() +
+                f.capacity() + patch.capacity()) *
+                   sizeof(int) +
+               inTree.capacity();
     }
-    SDVertex *v[3];
-    SDFace *f[3];
-    SDFace *children[4];
-};
 
-struct SDEdge {
-    // SDEdge Constructor
-    SDEdge(SDVertex *v0 = nullptr, SDVertex *v1 = nullptr) {
-        v[0] = std::min(v0, v1);
-        v[1] = std::max(v0, v1);
-        f[0] = f[1] = nullptr;
-        f0edgeNum = -1;
-    }
+    // SubdivLevel Data
 
-    // SDEdge Comparison Function
-    bool operator<(const SDEdge &e2) const {
-        if (v[0] == e2.v[0]) return v[1] < e2.v[1];
-        return v[0] < e2.v[0];
-    }
-    SDVertex *v[2];
-    SDFace *f[2];
-    int f0edgeNum;
-};
+    // Per-vertex data; _origin_ identifies a vertex across levels, since an
+    // even vertex has the same limit position as its parent
+    std::vector<Point3f> p;
+    std::vector<int> origin, startFace;
 
-// LoopSubdiv Local Declarations
-static Point3f weightOneRing(SDVertex *vert, Float beta);
-static Point3f weightBoundary(SDVertex *vert, Float beta);
+    // Per-face data: the vertices, the neighbor across each edge (v[i],
+    // v[NEXT(i)]), the control face (patch) the face descends from, and
+    // whether its parent was refined for its own patch's sake, which makes
+    // the face part of the tessellation rather than just support for it
+    std::vector<int> v, f, patch;
+    std::vector<char> inTree;
+};
 
 // LoopSubdiv Inline Functions
-inline int SDVertex::valence() {
-    SDFace *f = startFace;
-    if (!boundary) {
-        // Compute valence of interior vertex
-        int nf = 1;
-        while ((f = f->nextFace(this)) != startFace) ++nf;
-        return nf;
-    } else {
-        // Compute valence of boundary vertex
-        int nf = 1;
-        while ((f = f->nextFace(this)) != nullptr) ++nf;
-        f = startFace;
-        while ((f = f->prevFace(this)) != nullptr) ++nf;
-        return nf + 1;
-    }
-}
-
 inline Float beta(int valence) {
     if (valence == 3)
         return 3.f / 16.f;
@@ -146,265 +103,391 @@ inline Float loopGamma(int valence) {
 }
 
 // LoopSubdiv Function Definitions
-static std::vector<std::shared_ptr<Shape>> LoopSubdivide(
-    const Transform *ObjectToWorld, const Transform *WorldToObject,
-    bool reverseOrientation, int nLevels, int nIndices,
-    const int *vertexIndices, int nVertices, const Point3f *p) {
-    std::vector<SDVertex *> vertices;
-    std::vector<SDFace *> faces;
-    // Allocate _LoopSubdiv_ vertices and faces
-    std::unique_ptr<SDVertex[]> verts(new SDVertex[nVertices]);
-    for (int i = 0; i < nVertices; ++i) {
-        verts[i] = SDVertex(p[i]);
-        vertices.push_back(&verts[i]);
-    }
-    int nFaces = nIndices / 3;
-    std::unique_ptr<SDFace[]> fs(new SDFace[nFaces]);
-    for (int i = 0; i < nFaces; ++i) faces.push_back(&fs[i]);
-
-    // Set face to vertex pointers
-    const int *vp = vertexIndices;
-    for (int i = 0; i < nFaces; ++i, vp += 3) {
-        SDFace *f = faces[i];
-        for (int j = 0; j < 3; ++j) {
-            SDVertex *v = vertices[vp[j]];
-            f->v[j] = v;
-            v->startFace = f;
+int SubdivLevel::OneRing(int vert, std::vector<int> *ring,
+                         bool *boundary) const {
+    // Find the last face around _vert_ in the next-face direction
+    ring->clear();
+    int start = startFace[vert], face = start;
+    *boundary = false;
+    while (true) {
+        int next = f[3 * face + vnum(face, vert)];
+        if (next == Missing) return 0;
+        if (next == Boundary) {
+            *boundary = true;
+            break;
         }
+        if ((face = next) == start) break;
     }
 
-    // Set neighbor pointers in _faces_
-    std::set<SDEdge> edges;
-    for (int i = 0; i < nFaces; ++i) {
-        SDFace *f = faces[i];
-        for (int edgeNum = 0; edgeNum < 3; ++edgeNum) {
-            // Update neighbor pointer for _edgeNum_
-            int v0 = edgeNum, v1 = NEXT(edgeNum);
-            SDEdge e(f->v[v0], f->v[v1]);
-            if (edges.find(e) == edges.end()) {
-                // Handle new edge
-                e.f[0] = f;
-                e.f0edgeNum = edgeNum;
-                edges.insert(e);
-            } else {
-                // Handle previously seen edge
-                e = *edges.find(e);
-                e.f[0]->f[e.f0edgeNum] = f;
-                f->f[edgeNum] = e.f[0];
-                edges.erase(e);
-            }
+    if (!*boundary) {
+        // Get one-ring vertices for interior vertex
+        do {
+            int i = vnum(face, vert);
+            ring->push_back(v[3 * face + NEXT(i)]);
+            face = f[3 * face + i];
+        } while (face != start);
+    } else {
+        // Get one-ring vertices for boundary vertex
+        ring->push_back(v[3 * face + NEXT(vnum(face, vert))]);
+        while (true) {
+            int i = vnum(face, vert);
+            ring->push_back(v[3 * face + PREV(i)]);
+            int prev = f[3 * face + PREV(i)];
+            if (prev == Missing) return 0;
+            if (prev == Boundary) break;
+            face = prev;
         }
     }
+    return (int)ring->size();
+}
 
-    // Finish vertex initialization
-    for (int i = 0; i < nVertices; ++i) {
-        SDVertex *v = vertices[i];
-        SDFace *f = v->startFace;
-        do {
-            f = f->nextFace(v);
-        } while (f && f != v->startFace);
-        v->boundary = (f == nullptr);
-        if (!v->boundary && v->valence() == 6)
-            v->regular = true;
-        else if (v->boundary && v->valence() == 4)
-            v->regular = true;
-        else
-            v->regular = false;
-    }
+static Point3f WeightOneRing(const SubdivLevel &level, int vert,
+                             const std::vector<int> &ring, Float beta) {
+    Point3f p = (1 - ring.size() * beta) * level.p[vert];
+    for (int r : ring) p += beta * level.p[r];
+    return p;
+}
+
+static Point3f WeightBoundary(const SubdivLevel &level, int vert,
+                              const std::vector<int> &ring, Float beta) {
+    Point3f p = (1 - 2 * beta) * level.p[vert];
+    p += beta * level.p[ring.front()];
+    p += beta * level.p[ring.back()];
+    return p;
+}
 
-    // Refine _LoopSubdiv_ into triangles
-    std::vector<SDFace *> f = faces;
-    std::vector<SDVertex *> v = vertices;
-    MemoryArena arena;
-    for (int i = 0; i < nLevels; ++i) {
-        // Update _f_ and _v_ for next level of subdivision
-        std::vector<SDFace *> newFaces;
-        std::vector<SDVertex *> newVertices;
-
-        // Allocate next level of children in mesh tree
-        for (SDVertex *vertex : v) {
-            vertex->child = arena.Alloc<SDVertex>();
-            vertex->child->regular = vertex->regular;
-            vertex->child->boundary = vertex->boundary;
-            newVertices.push_back(vertex->child);
+static Normal3f LimitNormal(const SubdivLevel &level, int vert,
+                            const std::vector<int> &ring, bool boundary) {
+    // Compute vertex tangents on limit surface
+    int valence = ring.size();
+    auto pRing = [&](int j) { return level.p[ring[j]]; };
+    const Point3f &p = level.p[vert];
+    Vector3f S(0, 0, 0), T(0, 0, 0);
+    if (!boundary) {
+        // Compute tangents of interior face
+        for (int j = 0; j < valence; ++j) {
+            S += std::cos(2 * Pi * j / valence) * Vector3f(pRing(j));
+            T += std::sin(2 * Pi * j / valence) * Vector3f(pRing(j));
         }
-        for (SDFace *face : f) {
-            for (int k = 0; k < 4; ++k) {
-                face->children[k] = arena.Alloc<SDFace>();
-                newFaces.push_back(face->children[k]);
+    } else {
+        // Compute tangents of boundary face
+        S = pRing(valence - 1) - pRing(0);
+        if (valence == 2)
+            T = Vector3f(pRing(0) + pRing(1) - 2 * p);
+        else if (valence == 3)
+            T = pRing(1) - p;
+        else if (valence == 4)  // regular
+            T = Vector3f(-1 * pRing(0) + 2 * pRing(1) + 2 * pRing(2) +
+                         -1 * pRing(3) + -2 * p);
+        else {
+            Float theta = Pi / float(valence - 1);
+            T = Vector3f(std::sin(theta) * (pRing(0) + pRing(valence - 1)));
+            for (int k = 1; k < valence - 1; ++k) {
+                Float wt = (2 * std::cos(theta) - 2) * std::sin((k)*theta);
+                T += Vector3f(wt * pRing(k));
             }
+            T = -T;
         }
+    }
+    return Normal3f(Cross(S, T));
+}
 
-        // Update vertex positions and create new edge vertices
+// Runs _func_ over [0, count) in parallel, a chunk of indices at a time
+static void ParallelForChunks(int count,
+                              const std::function<void(int, int)> &func) {
+    const int chunkSize = 1024;
+    ParallelFor([&](int64_t chunk) {
+        int begin = chunk * chunkSize;
+        func(begin, std::min(begin + chunkSize, count));
+    }, (count + chunkSize - 1) / chunkSize);
+}
 
-        // Update vertex positions for even vertices
-        for (SDVertex *vertex : v) {
-            if (!vertex->boundary) {
-                // Apply one-ring rule for even vertex
-                if (vertex->regular)
-                    vertex->child->p = weightOneRing(vertex, 1.f / 16.f);
-                else
-                    vertex->child->p =
-                        weightOneRing(vertex, beta(vertex->valence()));
-            } else {
-                // Apply boundary rule for even vertex
-                vertex->child->p = weightBoundary(vertex, 1.f / 8.f);
-            }
+static void EmitTriangles(const int c[3], const int m[3],
+                          std::vector<int> *indices) {
+    auto tri = [&](int v0, int v1, int v2) {
+        indices->push_back(v0);
+        indices->push_back(v1);
+        indices->push_back(v2);
+    };
+    // Triangulate the face with corners _c_, splitting each edge _e_ at
+    // _m[e]_ if a finer neighbor has a vertex there
+    int nSplit = (m[0] >= 0) + (m[1] >= 0) + (m[2] >= 0);
+    if (nSplit == 0)
+        tri(c[0], c[1], c[2]);
+    else if (nSplit == 1) {
+        int e = m[0] >= 0 ? 0 : (m[1] >= 0 ? 1 : 2);
+        tri(c[e], m[e], c[PREV(e)]);
+        tri(m[e], c[NEXT(e)], c[PREV(e)]);
+    } else if (nSplit == 2) {
+        int e = NEXT(m[0] < 0 ? 0 : (m[1] < 0 ? 1 : 2));
+        tri(m[e], c[NEXT(e)], m[NEXT(e)]);
+        tri(c[e], m[e], m[NEXT(e)]);
+        tri(c[e], m[NEXT(e)], c[PREV(e)]);
+    } else {
+        tri(c[0], m[0], m[2]);
+        tri(m[0], c[1], m[1]);
+        tri(m[2], m[1], c[2]);
+        tri(m[0], m[1], m[2]);
+    }
+}
+
+void LoopTessellate(int nIndices, const int *vertexIndices, int nVertices,
+                    const Point3f *p, std::vector<int> patchLevels,
+                    std::vector<int> *indices, std::vector<Point3f> *P,
+                    std::vector<Normal3f> *N) {
+    // Initialize the control mesh
+    int nFaces = nIndices / 3;
+    CHECK_EQ(nFaces, (int)patchLevels.size());
+    SubdivLevel level;
+    level.p.assign(p, p + nVertices);
+    level.origin.resize(nVertices);
+    std::iota(level.origin.begin(), level.origin.end(), 0);
+    level.startFace.assign(nVertices, -1);
+    level.v.assign(vertexIndices, vertexIndices + 3 * nFaces);
+    level.f.assign(3 * nFaces, Boundary);
+    level.patch.resize(nFaces);
+    std::iota(level.patch.begin(), level.patch.end(), 0);
+    level.inTree.assign(nFaces, 1);
+    for (int i = 0; i < 3 * nFaces; ++i) level.startFace[level.v[i]] = i / 3;
+
+    // Set face neighbors by sorting the edges by their endpoints
+    std::vector<std::pair<uint64_t, int>> edges(3 * nFaces);
+    for (int i = 0; i < 3 * nFaces; ++i) {
+        uint64_t v0 = level.v[i], v1 = level.v[3 * (i / 3) + NEXT(i % 3)];
+        edges[i] = std::make_pair(std::min(v0, v1) << 32 | std::max(v0, v1),
+                                  i);
+    }
+    std::sort(edges.begin(), edges.end());
+    for (size_t i = 0; i + 1 < edges.size(); ++i)
+        if (edges[i].first == edges[i + 1].first) {
+            level.f[edges[i].second] = edges[i + 1].second / 3;
+            level.f[edges[i + 1].second] = edges[i].second / 3;
+            ++i;
         }
 
-        // Compute new odd edge vertices
-        std::map<SDEdge, SDVertex *> edgeVerts;
-        for (SDFace *face : f) {
-            for (int k = 0; k < 3; ++k) {
-                // Compute odd vertex on _k_th edge
-                SDEdge edge(face->v[k], face->v[NEXT(k)]);
-                SDVertex *vert = edgeVerts[edge];
-                if (!vert) {
-                    // Create and initialize new odd vertex
-                    vert = arena.Alloc<SDVertex>();
-                    newVertices.push_back(vert);
-                    vert->regular = true;
-                    vert->boundary = (face->f[k] == nullptr);
-                    vert->startFace = face->children[3];
-
-                    // Apply edge rules to compute new vertex position
-                    if (vert->boundary) {
-                        vert->p = 0.5f * edge.v[0]->p;
-                        vert->p += 0.5f * edge.v[1]->p;
-                    } else {
-                        vert->p = 3.f / 8.f * edge.v[0]->p;
-                        vert->p += 3.f / 8.f * edge.v[1]->p;
-                        vert->p += 1.f / 8.f *
-                                   face->otherVert(edge.v[0], edge.v[1])->p;
-                        vert->p +=
-                            1.f / 8.f *
-                            face->f[k]->otherVert(edge.v[0], edge.v[1])->p;
-                    }
-                    edgeVerts[edge] = vert;
+    // Limit neighboring patches' levels to differ by at most one
+    int maxLevel = 0;
+    for (int &l : patchLevels) maxLevel = std::max(maxLevel, l = std::max(l, 0));
+    std::vector<std::vector<int>> patchesAtLevel(maxLevel + 1);
+    for (int i = 0; i < nFaces; ++i) patchesAtLevel[patchLevels[i]].push_back(i);
+    for (int l = maxLevel; l > 1; --l)
+        for (int face : patchesAtLevel[l])
+            for (int j = 0; j < 3; ++j) {
+                int g = level.f[3 * face + j];
+                if (g >= 0 && patchLevels[g] < l - 1) {
+                    patchLevels[g] = l - 1;
+                    patchesAtLevel[l - 1].push_back(g);
                 }
             }
+    for (int l : patchLevels) ReportValue(patchLevel, l);
+
+    // Refine the patches, emitting triangles once they reach their level
+    indices->clear();
+    P->clear();
+    N->clear();
+    std::vector<int> outputIndex(nVertices, -1);
+    std::vector<char> placed;
+    int nOrigins = nVertices;
+    size_t peakBytes = 0;
+    for (int depth = 0;; ++depth) {
+        // Select the faces to refine at this depth: those of patches below
+        // their level, plus the faces around them that their stencils use
+        int nf = level.nFaces(), nv = level.nVertices();
+        std::vector<char> selected(nf), refine(nf), touched(nv, 0);
+        for (int face = 0; face < nf; ++face) {
+            selected[face] = level.inTree[face] &&
+                             depth < patchLevels[level.patch[face]];
+            if (selected[face])
+                for (int j = 0; j < 3; ++j) touched[level.v[3 * face + j]] = 1;
         }
-
-        // Update new mesh topology
-
-        // Update even vertex face pointers
-        for (SDVertex *vertex : v) {
-            int vertNum = vertex->startFace->vnum(vertex);
-            vertex->child->startFace = vertex->startFace->children[vertNum];
-        }
-
-        // Update face neighbor pointers
-        for (SDFace *face : f) {
+        for (int face = 0; face < nf; ++face)
+            refine[face] = selected[face] || touched[level.v[3 * face]] ||
+                           touched[level.v[3 * face + 1]] ||
+                           touched[level.v[3 * face + 2]];
+
+        // Number the children of the refined faces, their even vertices, and
+        // the odd vertices on their edges
+        SubdivLevel next;
+        std::vector<int> childFace(nf, -1), evenChild(nv, -1),
+            edgeVert(3 * nf, -1), evenParent, oddEdge;
+        int nChildFaces = 0;
+        for (int face = 0; face < nf; ++face) {
+            if (!refine[face]) continue;
+            childFace[face] = nChildFaces;
+            nChildFaces += 4;
             for (int j = 0; j < 3; ++j) {
-                // Update children _f_ pointers for siblings
-                face->children[3]->f[j] = face->children[NEXT(j)];
-                face->children[j]->f[NEXT(j)] = face->children[3];
-
-                // Update children _f_ pointers for neighbor children
-                SDFace *f2 = face->f[j];
-                face->children[j]->f[j] =
-                    f2 ? f2->children[f2->vnum(face->v[j])] : nullptr;
-                f2 = face->f[PREV(j)];
-                face->children[j]->f[PREV(j)] =
-                    f2 ? f2->children[f2->vnum(face->v[j])] : nullptr;
+                int vert = level.v[3 * face + j];
+                if (evenChild[vert] >= 0) continue;
+                evenChild[vert] = evenParent.size();
+                evenParent.push_back(vert);
+                next.origin.push_back(level.origin[vert]);
+                next.startFace.push_back(childFace[face] + j);
             }
         }
-
-        // Update face vertex pointers
-        for (SDFace *face : f) {
+        int nEven = evenParent.size();
+        for (int face = 0; face < nf; ++face) {
+            if (!refine[face]) continue;
+            for (int e = 0; e < 3; ++e) {
+                int g = level.f[3 * face + e];
+                if (g < 0 || !refine[g] || face < g) {
+                    // Create the odd vertex for an edge seen the first time
+                    edgeVert[3 * face + e] = nEven + oddEdge.size();
+                    oddEdge.push_back(3 * face + e);
+                    next.origin.push_back(nOrigins++);
+                    next.startFace.push_back(childFace[face] + 3);
+                } else {
+                    // Reuse the odd vertex of the neighbor's matching edge
+                    int v0 = level.v[3 * face + e];
+                    int ge = level.vnum(g, level.v[3 * face + NEXT(e)]);
+                    if (level.v[3 * g + NEXT(ge)] != v0) ge = level.vnum(g, v0);
+                    edgeVert[3 * face + e] = edgeVert[3 * g + ge];
+                }
+            }
+        }
+        int nOdd = oddEdge.size();
+        outputIndex.resize(nOrigins, -1);
+
+        // Emit the faces of patches that have reached their level, splitting
+        // edges shared with faces of patches refined one level further
+        std::vector<std::pair<int, int>> newVerts;
+        auto outputVertex = [&](int origin) {
+            if (outputIndex[origin] < 0) {
+                outputIndex[origin] = placed.size();
+                placed.push_back(0);
+            }
+            return outputIndex[origin];
+        };
+        for (int face = 0; face < nf; ++face) {
+            if (!level.inTree[face] || selected[face]) continue;
+            int c[3], m[3];
             for (int j = 0; j < 3; ++j) {
-                // Update child vertex pointer to new even vertex
-                face->children[j]->v[j] = face->v[j]->child;
-
-                // Update child vertex pointer to new odd vertex
-                SDVertex *vert =
-                    edgeVerts[SDEdge(face->v[j], face->v[NEXT(j)])];
-                face->children[j]->v[NEXT(j)] = vert;
-                face->children[NEXT(j)]->v[j] = vert;
-                face->children[3]->v[j] = vert;
+                int vert = level.v[3 * face + j];
+                c[j] = outputVertex(level.origin[vert]);
+                if (!placed[c[j]]) {
+                    placed[c[j]] = 1;
+                    newVerts.push_back(std::make_pair(vert, c[j]));
+                }
+                int g = level.f[3 * face + j];
+                m[j] = (g >= 0 && level.inTree[g] && selected[g])
+                           ? outputVertex(next.origin[edgeVert[3 * face + j]])
+                           : -1;
             }
+            EmitTriangles(c, m, indices);
         }
 
-        // Prepare for next level of subdivision
-        f = newFaces;
-        v = newVertices;
-    }
+        // Push the newly emitted vertices to the limit surface
+        P->resize(placed.size());
+        N->resize(placed.size());
+        ParallelForChunks(newVerts.size(), [&](int begin, int end) {
+            std::vector<int> ring;
+            for (int i = begin; i < end; ++i) {
+                int vert = newVerts[i].first, out = newVerts[i].second;
+                bool boundary;
+                int valence = level.OneRing(vert, &ring, &boundary);
+                CHECK_GT(valence, 0);
+                (*P)[out] = boundary
+                                ? WeightBoundary(level, vert, ring, 1.f / 5.f)
+                                : WeightOneRing(level, vert, ring,
+                                                loopGamma(valence));
+                (*N)[out] = LimitNormal(level, vert, ring, boundary);
+            }
+        });
+        if (nChildFaces == 0) break;
 
-    // Push vertices to limit surface
-    std::unique_ptr<Point3f[]> pLimit(new Point3f[v.size()]);
-    for (size_t i = 0; i < v.size(); ++i) {
-        if (v[i]->boundary)
-            pLimit[i] = weightBoundary(v[i], 1.f / 5.f);
-        else
-            pLimit[i] = weightOneRing(v[i], loopGamma(v[i]->valence()));
-    }
-    for (size_t i = 0; i < v.size(); ++i) v[i]->p = pLimit[i];
+        // Update vertex positions for even vertices
+        next.p.resize(nEven + nOdd);
+        ParallelForChunks(nEven, [&](int begin, int end) {
+            std::vector<int> ring;
+            for (int i = begin; i < end; ++i) {
+                int vert = evenParent[i];
+                bool boundary;
+                int valence = level.OneRing(vert, &ring, &boundary);
+                if (valence == 0)
+                    // Only the outermost supporting faces use this vertex,
+                    // and they are never refined or emitted
+                    next.p[i] = level.p[vert];
+                else if (boundary)
+                    next.p[i] = WeightBoundary(level, vert, ring, 1.f / 8.f);
+                else
+                    next.p[i] = WeightOneRing(level, vert, ring, beta(valence));
+            }
+        });
 
-    // Compute vertex tangents on limit surface
-    std::vector<Normal3f> Ns;
-    Ns.reserve(v.size());
-    std::vector<Point3f> pRing(16, Point3f());
-    for (SDVertex *vertex : v) {
-        Vector3f S(0, 0, 0), T(0, 0, 0);
-        int valence = vertex->valence();
-        if (valence > (int)pRing.size()) pRing.resize(valence);
-        vertex->oneRing(&pRing[0]);
-        if (!vertex->boundary) {
-            // Compute tangents of interior face
-            for (int j = 0; j < valence; ++j) {
-                S += std::cos(2 * Pi * j / valence) * Vector3f(pRing[j]);
-                T += std::sin(2 * Pi * j / valence) * Vector3f(pRing[j]);
+        // Compute new odd edge vertices
+        ParallelForChunks(nOdd, [&](int begin, int end) {
+            for (int i = begin; i < end; ++i) {
+                int face = oddEdge[i] / 3, e = oddEdge[i] % 3;
+                int v0 = level.v[3 * face + e], v1 = level.v[3 * face + NEXT(e)];
+                int g = level.f[3 * face + e];
+                Point3f &p = next.p[nEven + i];
+                p = .5f * level.p[v0] + .5f * level.p[v1];
+                if (g < 0) continue;
+                int other = level.v[3 * g];
+                for (int j = 1; j < 3 && (other == v0 || other == v1); ++j)
+                    other = level.v[3 * g + j];
+                p = 3.f / 8.f * level.p[v0];
+                p += 3.f / 8.f * level.p[v1];
+                p += 1.f / 8.f * level.p[level.v[3 * face + PREV(e)]];
+                p += 1.f / 8.f * level.p[other];
             }
-        } else {
-            // Compute tangents of boundary face
-            S = pRing[valence - 1] - pRing[0];
-            if (valence == 2)
-                T = Vector3f(pRing[0] + pRing[1] - 2 * vertex->p);
-            else if (valence == 3)
-                T = pRing[1] - vertex->p;
-            else if (valence == 4)  // regular
-                T = Vector3f(-1 * pRing[0] + 2 * pRing[1] + 2 * pRing[2] +
-                             -1 * pRing[3] + -2 * vertex->p);
-            else {
-                Float theta = Pi / float(valence - 1);
-                T = Vector3f(std::sin(theta) * (pRing[0] + pRing[valence - 1]));
-                for (int k = 1; k < valence - 1; ++k) {
-                    Float wt = (2 * std::cos(theta) - 2) * std::sin((k)*theta);
-                    T += Vector3f(wt * pRing[k]);
+        });
+
+        // Update new mesh topology
+        next.v.resize(3 * nChildFaces);
+        next.f.resize(3 * nChildFaces);
+        next.patch.resize(nChildFaces);
+        next.inTree.resize(nChildFaces);
+        ParallelForChunks(nf, [&](int begin, int end) {
+            auto childAt = [&](int g, int vert) {
+                if (g < 0) return g;
+                return refine[g] ? childFace[g] + level.vnum(g, vert) : Missing;
+            };
+            for (int face = begin; face < end; ++face) {
+                if (!refine[face]) continue;
+                int c = childFace[face];
+                for (int j = 0; j < 3; ++j) {
+                    // Update children vertices
+                    int vert = level.v[3 * face + j], odd = edgeVert[3 * face + j];
+                    next.v[3 * (c + j) + j] = evenChild[vert];
+                    next.v[3 * (c + j) + NEXT(j)] = odd;
+                    next.v[3 * (c + NEXT(j)) + j] = odd;
+                    next.v[3 * (c + 3) + j] = odd;
+
+                    // Update children neighbors for siblings and for neighbor
+                    // children
+                    next.f[3 * (c + 3) + j] = c + NEXT(j);
+                    next.f[3 * (c + j) + NEXT(j)] = c + 3;
+                    next.f[3 * (c + j) + j] = childAt(level.f[3 * face + j], vert);
+                    next.f[3 * (c + j) + PREV(j)] =
+                        childAt(level.f[3 * face + PREV(j)], vert);
+                }
+                for (int k = 0; k < 4; ++k) {
+                    next.patch[c + k] = level.patch[face];
+                    next.inTree[c + k] = selected[face];
                 }
-                T = -T;
             }
-        }
-        Ns.push_back(Normal3f(Cross(S, T)));
-    }
+        });
 
-    // Create triangle mesh from subdivision mesh
-    {
-        size_t ntris = f.size();
-        std::unique_ptr<int[]> verts(new int[3 * ntris]);
-        int *vp = verts.get();
-        size_t totVerts = v.size();
-        std::map<SDVertex *, int> usedVerts;
-        for (size_t i = 0; i < totVerts; ++i) usedVerts[v[i]] = i;
-        for (size_t i = 0; i < ntris; ++i) {
-            for (int j = 0; j < 3; ++j) {
-                *vp = usedVerts[f[i]->v[j]];
-                ++vp;
-            }
-        }
-        return CreateTriangleMesh(ObjectToWorld, WorldToObject,
-                                  reverseOrientation, ntris, verts.get(),
-                                  totVerts, pLimit.get(), nullptr, &Ns[0],
-                                  nullptr, nullptr, nullptr);
+        // Prepare for next level of subdivision
+        size_t tempBytes = (2 * nf + nv) * sizeof(char) +
+                           (nf + nv + 3 * nf + nEven + nOdd) * sizeof(int);
+        peakBytes = std::max(
+            peakBytes, level.BytesUsed() + next.BytesUsed() + tempBytes);
+        level = std::move(next);
     }
+    subdivBytes += peakBytes + indices->capacity() * sizeof(int) +
+                   P->capacity() * sizeof(Point3f) +
+                   N->capacity() * sizeof(Normal3f);
+    nSubdivTriangles += indices->size() / 3;
 }
 
-std::vector<std::shared_ptr<Shape>> CreateLoopSubdiv(const Transform *o2w,
-                                                     const Transform *w2o,
-                                                     bool reverseOrientation,
-                                                     const ParamSet &params) {
+std::vector<std::shared_ptr<Shape>> CreateLoopSubdiv(
+    const Transform *o2w, const Transform *w2o, bool reverseOrientation,
+    const ParamSet &params, const SubdivisionCamera *camera) {
     int nLevels = params.FindOneInt("levels",
                                     params.FindOneInt("nlevels", 3));
+    // Target length of the tessellation's edges on screen, in pixels
+    Float edgeLength = params.FindOneFloat("edgelength", 1.f);
     int nps, nIndices;
     const int *vertexIndices = params.FindInt("indices", &nIndices);
     const Point3f *P = params.FindPoint3f("P", &nps);
@@ -416,52 +499,46 @@ std::vector<std::shared_ptr<Shape>> CreateLoopSubdiv(const Transform *o2w,
         Error("Vertex positions \"P\" not provided for LoopSubdiv shape.");
         return std::vector<std::shared_ptr<Shape>>();
     }
+    for (int i = 0; i < nIndices; ++i)
+        if (vertexIndices[i] < 0 || vertexIndices[i] >= nps) {
+            Error("LoopSubdiv has out-of-bounds vertex index %d (%d \"P\" "
+                  "values were given).", vertexIndices[i], nps);
+            return std::vector<std::shared_ptr<Shape>>();
+        }
 
     // don't actually use this for now...
     std::string scheme = params.FindOneString("scheme", "loop");
-    return LoopSubdivide(o2w, w2o, reverseOrientation, nLevels, nIndices,
-                         vertexIndices, nps, P);
-}
-
-static Point3f weightOneRing(SDVertex *vert, Float beta) {
-    // Put _vert_ one-ring in _pRing_
-    int valence = vert->valence();
-    Point3f *pRing = ALLOCA(Point3f, valence);
-    vert->oneRing(pRing);
-    Point3f p = (1 - valence * beta) * vert->p;
-    for (int i = 0; i < valence; ++i) p += beta * pRing[i];
-    return p;
-}
 
-void SDVertex::oneRing(Point3f *p) {
-    if (!boundary) {
-        // Get one-ring vertices for interior vertex
-        SDFace *face = startFace;
-        do {
-            *p++ = face->nextVert(this)->p;
-            face = face->nextFace(this);
-        } while (face != startFace);
-    } else {
-        // Get one-ring vertices for boundary vertex
-        SDFace *face = startFace, *f2;
-        while ((f2 = face->nextFace(this)) != nullptr) face = f2;
-        *p++ = face->nextVert(this)->p;
-        do {
-            *p++ = face->prevVert(this)->p;
-            face = face->prevFace(this);
-        } while (face != nullptr);
+    // Choose each patch's level so that its edges end up about _edgeLength_
+    // pixels long, up to _nLevels_
+    int nFaces = nIndices / 3;
+    std::vector<int> patchLevels(nFaces, std::max(nLevels, 0));
+    if (camera && edgeLength > 0) {
+        std::vector<Point3f> pWorld(nps);
+        for (int i = 0; i < nps; ++i) pWorld[i] = (*o2w)(P[i]);
+        for (int face = 0; face < nFaces; ++face) {
+            Float pixels = 0;
+            for (int j = 0; j < 3; ++j) {
+                const Point3f &p0 = pWorld[vertexIndices[3 * face + j]];
+                const Point3f &p1 = pWorld[vertexIndices[3 * face + NEXT(j)]];
+                Float dist = Distance(camera->p, (p0 + p1) / 2);
+                pixels = std::max(pixels, camera->pixelsPerRadian *
+                                              Distance(p0, p1) /
+                                              std::max(dist, (Float)1e-6));
+            }
+            patchLevels[face] = Clamp(std::ceil(Log2(pixels / edgeLength)), 0,
+                                      patchLevels[face]);
+        }
     }
-}
 
-static Point3f weightBoundary(SDVertex *vert, Float beta) {
-    // Put _vert_ one-ring in _pRing_
-    int valence = vert->valence();
-    Point3f *pRing = ALLOCA(Point3f, valence);
-    vert->oneRing(pRing);
-    Point3f p = (1 - 2 * beta) * vert->p;
-    p += beta * pRing[0];
-    p += beta * pRing[valence - 1];
-    return p;
+    std::vector<int> indices;
+    std::vector<Point3f> pLimit;
+    std::vector<Normal3f> Ns;
+    LoopTessellate(nIndices, vertexIndices, nps, P, std::move(patchLevels),
+                   &indices, &pLimit, &Ns);
+    return CreateTriangleMesh(o2w, w2o, reverseOrientation, indices.size() / 3,
+                              indices.data(), pLimit.size(), pLimit.data(),
+                              nullptr, Ns.data(), nullptr, nullptr, nullptr);
 }
 
 }  // namespace pbrt
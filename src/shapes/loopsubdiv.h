@@ -44,10 +44,28 @@
 namespace pbrt {
 
 // LoopSubdiv Declarations
-std::vector<std::shared_ptr<Shape>> CreateLoopSubdiv(const Transform *o2w,
-                                                     const Transform *w2o,
-                                                     bool reverseOrientation,
-                                                     const ParamSet &params);
+
+// The viewpoint that screen-space adaptive subdivision refines against:
+// a world-space camera position and the number of image pixels spanned by
+// one radian of its field of view. It's only given for shapes whose
+// object-to-world transformation is final, i.e. not in object definitions.
+struct SubdivisionCamera {
+    Point3f p;
+    Float pixelsPerRadian;
+};
+
+// Tessellates the limit surface of the Loop subdivision mesh given by
+// _vertexIndices_ and _p_. Each control face (patch) _f_ is refined
+// _patchLevels[f]_ times; levels are first raised where needed so that
+// neighboring patches differ by at most one, which lets the transitions
+// between them be closed without cracks.
+void LoopTessellate(int nIndices, const int *vertexIndices, int nVertices,
+                    const Point3f *p, std::vector<int> patchLevels,
+                    std::vector<int> *indices, std::vector<Point3f> *P,
+                    std::vector<Normal3f> *N);
+std::vector<std::shared_ptr<Shape>> CreateLoopSubdiv(
+    const Transform *o2w, const Transform *w2o, bool reverseOrientation,
+    const ParamSet &params, const SubdivisionCamera *camera = nullptr);
 
 }  // namespace pbrt
 
@@ -607,6 +607,27 @@ Interaction Triangle::Sample(const Point2f &u, Float *pdf) const {
     return it;
 }
 
+bool Triangle::NormalBounds(Vector3f *w, Float *cosTheta) const {
+    const Point3f &p0 = mesh->p[v[0]];
+    const Point3f &p1 = mesh->p[v[1]];
+    const Point3f &p2 = mesh->p[v[2]];
+    Normal3f n = Normalize(Normal3f(Cross(p1 - p0, p2 - p0)));
+    if (mesh->n) {
+        // The geometric normal is flipped towards the interpolated shading
+        // normal, so it's only constant if all vertex normals agree
+        Float d0 = Dot(n, mesh->n[v[0]]), d1 = Dot(n, mesh->n[v[1]]),
+              d2 = Dot(n, mesh->n[v[2]]);
+        if (d0 < 0 && d1 < 0 && d2 < 0)
+            n *= -1;
+        else if (d0 <= 0 || d1 <= 0 || d2 <= 0)
+            return false;
+    } else if (reverseOrientation ^ transformSwapsHandedness)
+        n *= -1;
+    *w = Vector3f(n);
+    *cosTheta = 1;
+    return true;
+}
+
 Float Triangle::SolidAngle(const Point3f &p, int nSamples) const {
     // Project the vertices into the unit sphere around p.
     std::array<Vector3f, 3> pSphere = {
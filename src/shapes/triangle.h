@@ -92,6 +92,7 @@ class Triangle : public Shape {
     // Returns the solid angle subtended by the triangle w.r.t. the given
     // reference point p.
     Float SolidAngle(const Point3f &p, int nSamples = 0) const;
+    bool NormalBounds(Vector3f *w, Float *cosTheta) const;
 
   private:
     // Triangle Private Methods
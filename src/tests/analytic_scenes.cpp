@@ -12,9 +12,12 @@
 #include "imageio.h"
 #include "integrators/bdpt.h"
 #include "integrators/directlighting.h"
+#include "integrators/lighttracer.h"
 #include "integrators/mlt.h"
 #include "integrators/path.h"
+#include "integrators/vcm.h"
 #include "integrators/volpath.h"
+#include "integrators/wavefront.h"
 #include "lights/diffuse.h"
 #include "lights/point.h"
 #include "materials/matte.h"
@@ -373,6 +376,33 @@ std::vector<TestIntegrator> GetIntegrators() {
                                        scene.description,
                                    scene});
         }
+
+        // BDPT with a light vertex cache, with a memory limit that allows
+        // fewer light subpaths than pixels
+        for (size_t maxCacheBytes : {size_t(256 * 1024 * 1024), size_t(32768)}) {
+            Bounds2i sampleBounds(Point2i(0, 0), resolution);
+            std::shared_ptr<Sampler> sampler =
+                std::make_shared<HaltonSampler>(256, sampleBounds);
+            std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
+            Film *film =
+                new Film(resolution, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                         std::move(filter), 1., inTestDir("test.exr"), 1.);
+            std::shared_ptr<Camera> camera =
+                std::make_shared<PerspectiveCamera>(
+                    identity, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 1.,
+                    0., 10., 45, film, nullptr);
+
+            Integrator *integrator = new BDPTIntegrator(
+                sampler, camera, 6, false, false, film->croppedPixelBounds,
+                "power", true /* lightVertexCache */, 2, maxCacheBytes);
+            integrators.push_back(
+                {integrator, film,
+                 StringPrintf("BDPT, depth 8, Perspective, Halton 256, light "
+                              "vertex cache (%d bytes), ",
+                              (int)maxCacheBytes) +
+                     scene.description,
+                 scene});
+        }
 #if 0
     // Ortho camera not currently supported with BDPT.
     for (auto sampler : GetSamplers(Bounds2i(Point2i(0,0), resolution))) {
@@ -391,6 +421,158 @@ std::vector<TestIntegrator> GetIntegrators() {
     }
 #endif
 
+        // VCM, with and without enough memory for a light subpath per pixel
+        for (size_t maxCacheBytes : {size_t(256 * 1024 * 1024), size_t(32768)}) {
+            Bounds2i sampleBounds(Point2i(0, 0), resolution);
+            std::shared_ptr<Sampler> sampler =
+                std::make_shared<HaltonSampler>(256, sampleBounds);
+            std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
+            Film *film =
+                new Film(resolution, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                         std::move(filter), 1., inTestDir("test.exr"), 1.);
+            std::shared_ptr<Camera> camera =
+                std::make_shared<PerspectiveCamera>(
+                    identity, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 1.,
+                    0., 10., 45, film, nullptr);
+
+            Integrator *integrator = new VCMIntegrator(
+                sampler, camera, 6, film->croppedPixelBounds, 0, .75f, "power",
+                maxCacheBytes);
+            integrators.push_back(
+                {integrator, film,
+                 StringPrintf("VCM, depth 8, Perspective, Halton 256 (%d "
+                              "bytes), ",
+                              (int)maxCacheBytes) +
+                     scene.description,
+                 scene});
+        }
+
+        // Light BVH sampling, with each integrator that supports it
+        for (int i = 0; i < 3; ++i) {
+            Bounds2i sampleBounds(Point2i(0, 0), resolution);
+            std::shared_ptr<Sampler> sampler =
+                std::make_shared<HaltonSampler>(256, sampleBounds);
+            std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
+            Film *film =
+                new Film(resolution, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                         std::move(filter), 1., inTestDir("test.exr"), 1.);
+            std::shared_ptr<Camera> camera =
+                std::make_shared<PerspectiveCamera>(
+                    identity, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 1.,
+                    0., 10., 45, film, nullptr);
+
+            Integrator *integrator;
+            std::string name;
+            if (i == 0) {
+                integrator = new PathIntegrator(
+                    8, camera, sampler, film->croppedPixelBounds, 1, "bvh");
+                name = "Path";
+            } else if (i == 1) {
+                integrator = new VolPathIntegrator(
+                    8, camera, sampler, film->croppedPixelBounds, 1, "bvh");
+                name = "VolPath";
+            } else {
+                integrator = new BDPTIntegrator(sampler, camera, 6, false,
+                                                false,
+                                                film->croppedPixelBounds, "bvh");
+                name = "BDPT";
+            }
+            integrators.push_back({integrator, film,
+                                   name + ", depth 8, Perspective, Halton 256, "
+                                          "light BVH, " + scene.description,
+                                   scene});
+        }
+
+        // Path guiding, with training passes over the first half of the
+        // samples
+        {
+            Bounds2i sampleBounds(Point2i(0, 0), resolution);
+            std::shared_ptr<Sampler> sampler =
+                std::make_shared<HaltonSampler>(256, sampleBounds);
+            std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
+            Film *film =
+                new Film(resolution, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                         std::move(filter), 1., inTestDir("test.exr"), 1.);
+            std::shared_ptr<Camera> camera =
+                std::make_shared<PerspectiveCamera>(
+                    identity, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 1.,
+                    0., 10., 45, film, nullptr);
+
+            Integrator *integrator =
+                new PathIntegrator(8, camera, sampler, film->croppedPixelBounds,
+                                   1, "spatial", true /* guiding */);
+            integrators.push_back({integrator, film,
+                                   "Path, depth 8, Perspective, Halton 256, "
+                                   "guided, " + scene.description,
+                                   scene});
+        }
+
+        // Adjoint-driven Russian roulette and splitting, which trains on
+        // the first half of the samples as well
+        {
+            Bounds2i sampleBounds(Point2i(0, 0), resolution);
+            std::shared_ptr<Sampler> sampler =
+                std::make_shared<HaltonSampler>(256, sampleBounds);
+            std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
+            Film *film =
+                new Film(resolution, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                         std::move(filter), 1., inTestDir("test.exr"), 1.);
+            std::shared_ptr<Camera> camera =
+                std::make_shared<PerspectiveCamera>(
+                    identity, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 1.,
+                    0., 10., 45, film, nullptr);
+
+            Integrator *integrator = new PathIntegrator(
+                8, camera, sampler, film->croppedPixelBounds, 1, "spatial",
+                false, .5f, 256 * 1024 * 1024, true /* adrrs */);
+            integrators.push_back({integrator, film,
+                                   "Path, depth 8, Perspective, Halton 256, "
+                                   "ADRRS, " + scene.description,
+                                   scene});
+        }
+
+        // Wavefront path tracing, with small tiles so that some are
+        // partially covered by the image
+        for (auto sampler : GetSamplers(Bounds2i(Point2i(0, 0), resolution))) {
+            std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
+            Film *film =
+                new Film(resolution, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                         std::move(filter), 1., inTestDir("test.exr"), 1.);
+            std::shared_ptr<Camera> camera =
+                std::make_shared<PerspectiveCamera>(
+                    identity, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 1.,
+                    0., 10., 45, film, nullptr);
+
+            Integrator *integrator = new WavefrontPathIntegrator(
+                8, camera, sampler.first, film->croppedPixelBounds, 1,
+                "spatial", 4);
+            integrators.push_back({integrator, film,
+                                   "Wavefront, depth 8, Perspective, " +
+                                       sampler.second + ", " +
+                                       scene.description,
+                                   scene});
+        }
+
+        // Light tracing; it can't render specular surfaces seen by the
+        // camera, so skip the scene with a specular sphere
+        if (scene.description.find("Kr") == std::string::npos) {
+            std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
+            Film *film =
+                new Film(resolution, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                         std::move(filter), 1., inTestDir("test.exr"), 1.);
+            std::shared_ptr<Camera> camera =
+                std::make_shared<PerspectiveCamera>(
+                    identity, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 1.,
+                    0., 10., 45, film, nullptr);
+
+            Integrator *integrator =
+                new LightTracerIntegrator(camera, 8, 4096);
+            integrators.push_back({integrator, film,
+                                   "Light tracer, depth 8, Perspective, " +
+                                       scene.description,
+                                   scene});
+        }
+
         // MLT
         {
             std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
@@ -410,6 +592,29 @@ std::vector<TestIntegrator> GetIntegrators() {
                 {integrator, film,
                  "MLT, depth 8, Perspective, " + scene.description, scene});
         }
+
+        // MLT, rebalanced rounds with replica exchange
+        {
+            std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
+            Film *film =
+                new Film(resolution, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                         std::move(filter), 1., inTestDir("test.exr"), 1.);
+            std::shared_ptr<Camera> camera =
+                std::make_shared<PerspectiveCamera>(
+                    identity, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 1.,
+                    0., 10., 45, film, nullptr);
+
+            Integrator *integrator = new MLTIntegrator(
+                camera, 8 /* depth */, 100000 /* n bootstrap */,
+                1000 /* nchains */, 1024 /* mutations per pixel */,
+                0.01 /* sigma */, 0.3 /* large step prob */, 4 /* rounds */,
+                2 /* replicas */, 8 /* max temperature */);
+            integrators.push_back({integrator, film,
+                                   "MLT, depth 8, Perspective, 4 rounds, 2 "
+                                   "replicas, " +
+                                       scene.description,
+                                   scene});
+        }
     }
 
     return integrators;
@@ -0,0 +1,48 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "hashgrid.h"
+#include "parallel.h"
+#include "rng.h"
+
+using namespace pbrt;
+
+TEST(HashGrid, FindsOverlappingItems) {
+    ParallelInit();
+
+    // Random boxes of varying sizes, some of them empty
+    RNG rng;
+    const int nItems = 10000;
+    std::vector<Bounds3f> items(nItems);
+    for (Bounds3f &b : items) {
+        if (rng.UniformFloat() < .05f) continue;
+        Point3f p(rng.UniformFloat(), rng.UniformFloat(), rng.UniformFloat());
+        Float r = .05f * rng.UniformFloat();
+        b = Bounds3f(p - Vector3f(r, r, r), p + Vector3f(r, r, r));
+    }
+    HashGrid grid;
+    grid.Build(nItems, [&](int i) { return items[i]; }, .05f);
+
+    for (int i = 0; i < 1000; ++i) {
+        Point3f p(1.2f * rng.UniformFloat() - .1f,
+                  1.2f * rng.UniformFloat() - .1f,
+                  1.2f * rng.UniformFloat() - .1f);
+        std::vector<int> candidates;
+        grid.ForEachCandidate(p, [&](int item) { candidates.push_back(item); });
+        std::sort(candidates.begin(), candidates.end());
+        EXPECT_TRUE(std::adjacent_find(candidates.begin(), candidates.end()) ==
+                    candidates.end());
+        for (int j = 0; j < nItems; ++j)
+            if (Inside(p, items[j]))
+                EXPECT_TRUE(std::binary_search(candidates.begin(),
+                                               candidates.end(), j))
+                    << "Point " << p << " in item " << j;
+    }
+
+    // An empty grid has no candidates
+    grid.Build(0, [&](int i) { return items[i]; }, .05f);
+    int nCandidates = 0;
+    grid.ForEachCandidate(Point3f(.5, .5, .5), [&](int) { ++nCandidates; });
+    EXPECT_EQ(0, nCandidates);
+
+    ParallelCleanup();
+}
@@ -0,0 +1,49 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "interaction.h"
+
+using namespace pbrt;
+
+// Returns an interaction on the plane $z=z_0$, parameterized by $(x,y)$.
+static SurfaceInteraction PlaneInteraction(const Point3f &p,
+                                           const Vector3f &wo) {
+    return SurfaceInteraction(p, Vector3f(0, 0, 0), Point2f(p.x, p.y), wo,
+                              Vector3f(1, 0, 0), Vector3f(0, 1, 0),
+                              Normal3f(0, 0, 0), Normal3f(0, 0, 0), 0, nullptr);
+}
+
+TEST(SurfaceInteraction, RayCone) {
+    // A ray with a small footprint hits the plane $z=0$ head-on.
+    RayDifferential ray(Point3f(0, 0, 1), Vector3f(0, 0, -1));
+    ray.hasDifferentials = true;
+    ray.rxOrigin = ray.ryOrigin = ray.o;
+    ray.rxDirection = Vector3f(.01f, 0, -1);
+    ray.ryDirection = Vector3f(0, .01f, -1);
+    SurfaceInteraction isect =
+        PlaneInteraction(Point3f(0, 0, 0), Vector3f(0, 0, 1));
+    isect.ComputeDifferentials(ray);
+    EXPECT_NEAR(.01f, isect.dudx, 1e-5);
+    EXPECT_NEAR(.01f, isect.dvdy, 1e-5);
+
+    // Rays without differentials don't get any.
+    RayDifferential plain(ray.o, ray.d);
+    EXPECT_FALSE(
+        isect.SpawnRayCone(plain, Vector3f(0, 0, 1), 1).hasDifferentials);
+
+    // Without a lobe spread, the cone keeps its angle after the bounce, so
+    // its footprint on the plane $z=1$ grows by the same amount again.
+    RayDifferential rd = isect.SpawnRayCone(ray, Vector3f(0, 0, 1), 0);
+    ASSERT_TRUE(rd.hasDifferentials);
+    SurfaceInteraction next =
+        PlaneInteraction(Point3f(0, 0, 1), Vector3f(0, 0, -1));
+    next.ComputeDifferentials(rd);
+    Float width = std::max(next.dpdx.Length(), next.dpdy.Length());
+    EXPECT_NEAR(.02f, width, 1e-3);
+
+    // A diffuse bounce widens the footprint well beyond the specular one.
+    Float spread = LobeSpreadAngle(InvPi);
+    EXPECT_GT(spread, .5f);
+    rd = isect.SpawnRayCone(ray, Vector3f(0, 0, 1), spread);
+    next.ComputeDifferentials(rd);
+    EXPECT_GT(std::max(next.dpdx.Length(), next.dpdy.Length()), 10 * width);
+}
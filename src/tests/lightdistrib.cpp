@@ -0,0 +1,298 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "accelerators/bvh.h"
+#include "lightdistrib.h"
+#include "lights/diffuse.h"
+#include "lights/distant.h"
+#include "lights/point.h"
+#include "lights/spot.h"
+#include "parallel.h"
+#include "rng.h"
+#include "scene.h"
+#include "shapes/disk.h"
+#include "shapes/sphere.h"
+#include <set>
+
+using namespace pbrt;
+
+static Vector3f RandomDirection(RNG &rng) {
+    return UniformSampleSphere(Point2f(rng.UniformFloat(), rng.UniformFloat()));
+}
+
+static Point3f RandomPoint(RNG &rng, Float extent) {
+    return Point3f(extent * (2 * rng.UniformFloat() - 1),
+                   extent * (2 * rng.UniformFloat() - 1),
+                   extent * (2 * rng.UniformFloat() - 1));
+}
+
+TEST(LightBounds, Importance) {
+    // A one-sided emitter facing +z doesn't light points below it.
+    LightBounds lb(Bounds3f(Point3f(-1, -1, 0), Point3f(1, 1, 0)),
+                   Vector3f(0, 0, 1), 1, 1, 0, false);
+    EXPECT_GT(lb.Importance(Point3f(0, 0, 2), Normal3f(0, 0, 0)), 0);
+    EXPECT_GT(lb.Importance(Point3f(5, 0, .1), Normal3f(0, 0, 0)), 0);
+    EXPECT_EQ(0, lb.Importance(Point3f(0, 0, -2), Normal3f(0, 0, 0)));
+    EXPECT_EQ(0, lb.Importance(Point3f(5, 0, -3), Normal3f(0, 0, 0)));
+    lb.twoSided = true;
+    EXPECT_GT(lb.Importance(Point3f(0, 0, -2), Normal3f(0, 0, 0)), 0);
+
+    // Importance falls off with distance.
+    EXPECT_GT(lb.Importance(Point3f(0, 0, 2), Normal3f(0, 0, 0)),
+              lb.Importance(Point3f(0, 0, 20), Normal3f(0, 0, 0)));
+
+    // The union must conservatively bound both of its inputs.
+    RNG rng;
+    for (int i = 0; i < 100; ++i) {
+        LightBounds a(Bounds3f(RandomPoint(rng, 10)), RandomDirection(rng), 1,
+                      std::cos(rng.UniformFloat()), 0, false);
+        LightBounds b(Bounds3f(RandomPoint(rng, 10)), RandomDirection(rng), 1,
+                      std::cos(rng.UniformFloat()), 0, false);
+        LightBounds ab = Union(a, b);
+        for (int j = 0; j < 20; ++j) {
+            Point3f p = RandomPoint(rng, 20);
+            Normal3f n(RandomDirection(rng));
+            if (a.Importance(p, n) > 0 || b.Importance(p, n) > 0)
+                EXPECT_GT(ab.Importance(p, n), 0);
+        }
+    }
+}
+
+// Returns a scene with a mix of point, spot, area, and distant lights.
+static std::unique_ptr<Scene> ManyLightScene(int nLights) {
+    static Transform identity;
+    std::vector<std::shared_ptr<Primitive>> prims;
+    prims.push_back(std::make_shared<GeometricPrimitive>(
+        std::make_shared<Sphere>(&identity, &identity, false, 10, -10, 10,
+                                 360),
+        nullptr, nullptr, MediumInterface()));
+    std::shared_ptr<BVHAccel> bvh = std::make_shared<BVHAccel>(prims);
+
+    // The disks' transformations must outlive the scene.
+    static std::vector<std::unique_ptr<Transform>> transforms;
+    RNG rng;
+    std::vector<std::shared_ptr<Light>> lights;
+    for (int i = 0; i < nLights; ++i) {
+        Transform lightToWorld =
+            Translate(Vector3f(RandomPoint(rng, 8))) *
+            Rotate(360 * rng.UniformFloat(), RandomDirection(rng));
+        Spectrum I(.1f + rng.UniformFloat());
+        if (i % 4 == 0)
+            lights.push_back(
+                std::make_shared<PointLight>(lightToWorld, nullptr, I));
+        else if (i % 4 == 1)
+            lights.push_back(std::make_shared<SpotLight>(
+                lightToWorld, nullptr, I, 30, 20));
+        else {
+            transforms.push_back(
+                std::unique_ptr<Transform>(new Transform(lightToWorld)));
+            transforms.push_back(std::unique_ptr<Transform>(
+                new Transform(Inverse(lightToWorld))));
+            std::shared_ptr<Shape> disk = std::make_shared<Disk>(
+                transforms[transforms.size() - 2].get(),
+                transforms.back().get(), false, 0, .1f, 0, 360);
+            lights.push_back(std::make_shared<DiffuseAreaLight>(
+                Transform(), nullptr, I, 1, disk, i % 4 == 3));
+        }
+    }
+    lights.push_back(std::make_shared<DistantLight>(
+        Transform(), Spectrum(1), Vector3f(0, 0, 1)));
+    return std::unique_ptr<Scene>(new Scene(bvh, lights));
+}
+
+TEST(BVHLightDistribution, SampleMatchesPmf) {
+    ParallelInit();
+
+    std::unique_ptr<Scene> scene = ManyLightScene(200);
+    const std::vector<std::shared_ptr<Light>> &lights = scene->lights;
+    RNG rng;
+    BVHLightDistribution distrib(*scene);
+    for (int i = 0; i < 100; ++i) {
+        Point3f p = RandomPoint(rng, 10);
+        Normal3f n = (i & 1) ? Normal3f(RandomDirection(rng)) : Normal3f();
+
+        // Traversal may reach nodes where neither child can contribute,
+        // so the probabilities of all lights sum to at most one; the
+        // remainder is the probability that Sample() fails.
+        Float sum = 0;
+        for (size_t j = 0; j < lights.size(); ++j)
+            sum += distrib.Pmf(p, n, j);
+        EXPECT_LE(sum, 1 + 1e-4);
+        EXPECT_GT(sum, .5f);
+        EXPECT_NEAR(.5f, distrib.Pmf(p, n, lights.size() - 1), 1e-6);
+
+        const int nSamples = 1000;
+        int nFailed = 0;
+        for (int j = 0; j < nSamples; ++j) {
+            Float pmf;
+            Float u = (j + rng.UniformFloat()) / nSamples;
+            int light = distrib.Sample(p, n, u, &pmf);
+            if (light == -1) {
+                ++nFailed;
+                continue;
+            }
+            EXPECT_GT(pmf, 0);
+            EXPECT_NEAR(pmf, distrib.Pmf(p, n, light), 1e-4 * pmf);
+        }
+        EXPECT_NEAR(1 - sum, Float(nFailed) / nSamples, .02f);
+    }
+
+    // Lookup() distributions must give every light a nonzero probability.
+    const Distribution1D *lookup = distrib.Lookup(Point3f(1, 2, 3));
+    ASSERT_EQ(lights.size(), lookup->Count());
+    for (size_t j = 0; j < lights.size(); ++j)
+        EXPECT_GT(lookup->DiscretePDF(j), 0);
+    EXPECT_EQ(lookup, distrib.Lookup(Point3f(1, 2, 3)));
+
+    ParallelCleanup();
+}
+
+TEST(SpatialLightDistribution, SparseDistributions) {
+    ParallelInit();
+
+    std::unique_ptr<Scene> scene = ManyLightScene(100);
+    size_t nLights = scene->lights.size();
+    // Use a budget too small for any full distribution and a tiny cache,
+    // so that sparse distributions are evicted and recomputed.
+    SpatialLightDistribution distrib(*scene, 8, 8, 1024);
+    SpatialLightDistribution fullDistrib(*scene, 8);
+
+    RNG rng;
+    for (int i = 0; i < 200; ++i) {
+        Point3f p = RandomPoint(rng, 10);
+        const Distribution1D *full = fullDistrib.Lookup(p);
+
+        // The stored lights get the same probabilities as in the full
+        // distribution and the others share the remainder.
+        Float sum = 0;
+        int nMatching = 0;
+        for (size_t j = 0; j < nLights; ++j) {
+            Float pmf = distrib.Pmf(p, Normal3f(), j);
+            EXPECT_GT(pmf, 0);
+            if (std::abs(pmf - full->DiscretePDF(j)) < 1e-5f) ++nMatching;
+            sum += pmf;
+        }
+        EXPECT_NEAR(1, sum, 1e-4);
+        EXPECT_GE(nMatching, 8);
+
+        for (int j = 0; j < 20; ++j) {
+            Float pmf;
+            int light =
+                distrib.Sample(p, Normal3f(), rng.UniformFloat(), &pmf);
+            ASSERT_GE(light, 0);
+            ASSERT_LT(light, nLights);
+            EXPECT_NEAR(distrib.Pmf(p, Normal3f(), light), pmf, 1e-6);
+        }
+    }
+
+    ParallelCleanup();
+}
+
+TEST(SpatialLightDistribution, FullDistributionsWithinBudget) {
+    ParallelInit();
+
+    std::unique_ptr<Scene> scene = ManyLightScene(100);
+    size_t nLights = scene->lights.size();
+    // Room for the full distributions of a few voxels only; the ones
+    // sampled first get them and the rest are sampled sparsely.
+    const int nFull = 5;
+    size_t distributionBytes =
+        sizeof(Distribution1D) + (2 * nLights + 1) * sizeof(Float);
+    SpatialLightDistribution distrib(*scene, 8, 8,
+                                     nFull * distributionBytes * 4 / 3 + 1);
+    SpatialLightDistribution fullDistrib(*scene, 8);
+
+    RNG rng;
+    int nMatchingVoxels = 0;
+    for (int i = 0; i < 50; ++i) {
+        Point3f p = RandomPoint(rng, 10);
+        Float pmf;
+        int light = distrib.Sample(p, Normal3f(), rng.UniformFloat(), &pmf);
+        ASSERT_GE(light, 0);
+        EXPECT_EQ(pmf, distrib.Pmf(p, Normal3f(), light));
+
+        const Distribution1D *full = fullDistrib.Lookup(p);
+        bool matches = true;
+        for (size_t j = 0; j < nLights; ++j)
+            matches &= distrib.Pmf(p, Normal3f(), j) == full->DiscretePDF(j);
+        nMatchingVoxels += matches;
+    }
+    EXPECT_GE(nMatchingVoxels, nFull);
+    EXPECT_LT(nMatchingVoxels, 50);
+
+    ParallelCleanup();
+}
+
+TEST(SpatialLightDistribution, LookupWithinBudget) {
+    ParallelInit();
+
+    std::unique_ptr<Scene> scene = ManyLightScene(100);
+    size_t nLights = scene->lights.size();
+    const int nFull = 5;
+    size_t distributionBytes =
+        sizeof(Distribution1D) + (2 * nLights + 1) * sizeof(Float);
+    SpatialLightDistribution distrib(*scene, 8, 8,
+                                     nFull * distributionBytes * 4 / 3 + 1);
+    PowerLightDistribution powerDistrib(*scene);
+
+    // Once the budget is used up, voxels share the power distribution,
+    // including ones that Sample() and Pmf() already sample sparsely.
+    RNG rng;
+    std::vector<Point3f> points;
+    for (int i = 0; i < 50; ++i) {
+        points.push_back(RandomPoint(rng, 10));
+        Float pmf;
+        if (i % 2 == 0)
+            distrib.Sample(points.back(), Normal3f(), rng.UniformFloat(),
+                           &pmf);
+    }
+    std::set<const Distribution1D *> fullDistribs;
+    const Distribution1D *power = nullptr;
+    for (const Point3f &p : points) {
+        const Distribution1D *lookup = distrib.Lookup(p);
+        ASSERT_EQ(nLights, lookup->Count());
+        EXPECT_EQ(lookup, distrib.Lookup(p));
+        bool isPower = true;
+        for (size_t j = 0; j < nLights; ++j)
+            isPower &= std::abs(lookup->DiscretePDF(j) -
+                                powerDistrib.Pmf(p, Normal3f(), j)) < 1e-6f;
+        if (isPower) {
+            if (!power) power = lookup;
+            EXPECT_EQ(power, lookup);
+        } else
+            fullDistribs.insert(lookup);
+    }
+    EXPECT_EQ((size_t)nFull, fullDistribs.size());
+    EXPECT_NE(nullptr, power);
+
+    ParallelCleanup();
+}
+
+TEST(PowerLightDistribution, AliasTable) {
+    ParallelInit();
+
+    std::unique_ptr<Scene> scene = ManyLightScene(50);
+    size_t nLights = scene->lights.size();
+    PowerLightDistribution cdf(*scene), alias(*scene, true);
+    for (size_t j = 0; j < nLights; ++j)
+        EXPECT_NEAR(cdf.Pmf(Point3f(), Normal3f(), j),
+                    alias.Pmf(Point3f(), Normal3f(), j), 1e-6);
+
+    // Stratified samples should choose each light in proportion to its
+    // probability.
+    const int nSamples = 100000;
+    std::vector<int> counts(nLights, 0);
+    for (int i = 0; i < nSamples; ++i) {
+        Float pmf;
+        int light =
+            alias.Sample(Point3f(), Normal3f(), (i + .5f) / nSamples, &pmf);
+        ASSERT_GE(light, 0);
+        ASSERT_LT(light, nLights);
+        EXPECT_EQ(alias.Pmf(Point3f(), Normal3f(), light), pmf);
+        ++counts[light];
+    }
+    for (size_t j = 0; j < nLights; ++j)
+        EXPECT_NEAR(cdf.Pmf(Point3f(), Normal3f(), j),
+                    Float(counts[j]) / nSamples, 1e-3);
+
+    ParallelCleanup();
+}
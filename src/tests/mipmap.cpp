@@ -0,0 +1,240 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "mipmap.h"
+#include "parallel.h"
+#include "rng.h"
+#include "fileutil.h"
+#include "texcache.h"
+
+using namespace pbrt;
+
+TEST(Half, RoundTrip) {
+    // Every finite half value should survive a trip through float.
+    for (int i = 0; i < 65536; ++i) {
+        uint16_t h = i;
+        float f = HalfToFloat(h);
+        if (std::isnan(f)) continue;
+        EXPECT_EQ(h, FloatToHalf(f)) << i << " -> " << f;
+    }
+
+    EXPECT_EQ(1.f, HalfToFloat(FloatToHalf(1.f)));
+    EXPECT_EQ(-2.5f, HalfToFloat(FloatToHalf(-2.5f)));
+    EXPECT_EQ(65504.f, HalfToFloat(FloatToHalf(65504.f)));
+    EXPECT_TRUE(std::isinf(HalfToFloat(FloatToHalf(1e6f))));
+    EXPECT_TRUE(std::isnan(HalfToFloat(FloatToHalf(std::nanf("")))));
+
+    RNG rng;
+    for (int i = 0; i < 1000; ++i) {
+        float f = 1000.f * (rng.UniformFloat() - .5f);
+        float err = std::abs(HalfToFloat(FloatToHalf(f)) - f);
+        EXPECT_LE(err, std::abs(f) / 1024.f);
+    }
+}
+
+TEST(TiledTexelArray, Formats) {
+    const int res = 37;
+    std::vector<RGBSpectrum> texels(res * res);
+    RNG rng;
+    for (RGBSpectrum &t : texels) {
+        Float rgb[3] = {rng.UniformFloat(), rng.UniformFloat(),
+                        rng.UniformFloat()};
+        t = RGBSpectrum::FromRGB(rgb);
+    }
+
+    for (int logTileSize : {0, 2, 3, 5}) {
+        for (TexelFormat format :
+             {TexelFormat::Float, TexelFormat::Half, TexelFormat::Byte}) {
+            TiledTexelArray<RGBSpectrum> array(res, res, logTileSize, format);
+            for (int t = 0; t < res; ++t)
+                for (int s = 0; s < res; ++s)
+                    array.Set(s, t, texels[t * res + s]);
+
+            Float tolerance = format == TexelFormat::Float
+                                  ? 0
+                                  : (format == TexelFormat::Half ? 1e-3 : 2e-2);
+            for (int t = 0; t < res; ++t)
+                for (int s = 0; s < res; ++s) {
+                    RGBSpectrum v = array.Get(s, t);
+                    for (int c = 0; c < 3; ++c)
+                        EXPECT_NEAR(texels[t * res + s][c], v[c], tolerance);
+                }
+        }
+    }
+}
+
+TEST(MIPMap, CompactFormats) {
+    ParallelInit();
+
+    const int res = 64;
+    std::vector<Float> texels(res * res);
+    for (int t = 0; t < res; ++t)
+        for (int s = 0; s < res; ++s)
+            texels[t * res + s] = Float((s + 2 * t) % 17) / 16.f;
+
+    MIPMap<Float> full(Point2i(res, res), texels.data());
+    MIPMap<Float> half(Point2i(res, res), texels.data(), false, 8.f,
+                       ImageWrap::Repeat, TexelFormat::Half);
+    MIPMap<Float> byte(Point2i(res, res), texels.data(), false, 8.f,
+                       ImageWrap::Repeat, TexelFormat::Byte, 16);
+    EXPECT_EQ(TexelFormat::Byte, byte.Format());
+    EXPECT_EQ(full.Levels(), byte.Levels());
+    EXPECT_EQ(full.BytesUsed(), 2 * half.BytesUsed());
+    EXPECT_LT(byte.BytesUsed(), half.BytesUsed());
+
+    RNG rng;
+    for (int i = 0; i < 1000; ++i) {
+        Point2f st(rng.UniformFloat(), rng.UniformFloat());
+        Vector2f dst0(.02f * rng.UniformFloat(), .02f * rng.UniformFloat());
+        Vector2f dst1(-dst0.y, dst0.x);
+        Float ref = full.Lookup(st, dst0, dst1);
+        EXPECT_NEAR(ref, half.Lookup(st, dst0, dst1), 1e-3);
+        EXPECT_NEAR(ref, byte.Lookup(st, dst0, dst1), 2e-2);
+    }
+
+    // Values outside [0,1] can't be stored as 8-bit sRGB texels.
+    texels[0] = 4.f;
+    MIPMap<Float> hdr(Point2i(res, res), texels.data(), false, 8.f,
+                      ImageWrap::Repeat, TexelFormat::Byte);
+    EXPECT_EQ(TexelFormat::Half, hdr.Format());
+    EXPECT_EQ(4.f, hdr.Texel(0, 0, 0));
+
+    ParallelCleanup();
+}
+
+TEST(MIPMap, TiledFileCache) {
+    ParallelInit();
+
+    const int res = 100;
+    std::vector<RGBSpectrum> texels(res * res);
+    for (int t = 0; t < res; ++t)
+        for (int s = 0; s < res; ++s) {
+            Float rgb[3] = {Float(s) / res, Float(t) / res,
+                            Float((s * t) % 7) / 7.f};
+            texels[t * res + s] = RGBSpectrum::FromRGB(rgb);
+        }
+    MIPMap<RGBSpectrum> mem(Point2i(res, res), texels.data(), false, 8.f,
+                            ImageWrap::Repeat, TexelFormat::Half, 8);
+
+    std::string filename = "test_tiled.mip";
+    ASSERT_TRUE(mem.WriteTiled(filename));
+    TiledImageHeader header;
+    ASSERT_TRUE(ReadTiledImageHeader(filename, &header));
+    EXPECT_EQ(mem.Levels(), header.levels.size());
+    EXPECT_EQ(3, header.logTileSize);
+
+    {
+        // Use a cache much smaller than the image so that tiles are evicted
+        // and re-read during the lookups.
+        TextureCache cache(64 * header.TileBytes());
+        int fileId = cache.AddFile(filename, header);
+        EXPECT_EQ(fileId, cache.AddFile(filename, header));
+        MIPMap<RGBSpectrum> tiled(&cache, fileId, header);
+        MIPMap<Float> tiledFloat(&cache, fileId, header);
+        ASSERT_EQ(mem.Levels(), tiled.Levels());
+
+        RNG rng;
+        for (int i = 0; i < 1000; ++i) {
+            Point2f st(rng.UniformFloat(), rng.UniformFloat());
+            Vector2f dst0(.05f * rng.UniformFloat(), .05f * rng.UniformFloat());
+            Vector2f dst1(-dst0.y, dst0.x);
+            RGBSpectrum ref = mem.Lookup(st, dst0, dst1);
+            RGBSpectrum v = tiled.Lookup(st, dst0, dst1);
+            for (int c = 0; c < 3; ++c) EXPECT_EQ(ref[c], v[c]);
+            EXPECT_NEAR(ref.y(), tiledFloat.Lookup(st, dst0, dst1), 1e-5);
+        }
+    }
+
+    EXPECT_EQ(0, remove(filename.c_str()));
+    ParallelCleanup();
+}
+
+TEST(MIPMap, ReadTiled) {
+    ParallelInit();
+
+    const int res = 50;
+    std::vector<Float> texels(res * res);
+    RNG rng;
+    for (Float &t : texels) t = rng.UniformFloat();
+    MIPMap<Float> mipmap(Point2i(res, res), texels.data(), false, 8.f,
+                         ImageWrap::Clamp, TexelFormat::Byte, 16);
+
+    std::string filename = "test_readtiled.mip";
+    ASSERT_TRUE(mipmap.WriteTiled(filename));
+    uint64_t hash0, hash1;
+    EXPECT_TRUE(HashFile(filename, &hash0));
+    std::unique_ptr<MIPMap<Float>> read(MIPMap<Float>::ReadTiled(
+        filename, false, 8.f, ImageWrap::Clamp));
+    // Spectral MIP maps can't be read from single-channel files.
+    std::unique_ptr<MIPMap<RGBSpectrum>> readRGB(
+        MIPMap<RGBSpectrum>::ReadTiled(filename));
+    EXPECT_TRUE(readRGB.get() == nullptr);
+
+    ASSERT_TRUE(read.get() != nullptr);
+    EXPECT_EQ(TexelFormat::Byte, read->Format());
+    EXPECT_EQ(mipmap.BytesUsed(), read->BytesUsed());
+    ASSERT_EQ(mipmap.Levels(), read->Levels());
+    for (int level = 0; level < mipmap.Levels(); ++level)
+        for (int t = 0; t < res; ++t)
+            for (int s = 0; s < res; ++s)
+                EXPECT_EQ(mipmap.Texel(level, s, t), read->Texel(level, s, t));
+
+    // Rewriting the same pyramid must give a file with the same hash.
+    ASSERT_TRUE(read->WriteTiled(filename));
+    EXPECT_TRUE(HashFile(filename, &hash1));
+    EXPECT_EQ(hash0, hash1);
+
+    EXPECT_EQ(0, remove(filename.c_str()));
+    ParallelCleanup();
+}
+
+TEST(MIPMap, VectorizedEWA) {
+    ParallelInit();
+
+    const int res = 45;
+    std::vector<RGBSpectrum> texels(res * res);
+    RNG rng;
+    for (RGBSpectrum &t : texels) {
+        Float rgb[3] = {rng.UniformFloat(), rng.UniformFloat(),
+                        rng.UniformFloat()};
+        t = RGBSpectrum::FromRGB(rgb);
+    }
+
+    // The SSE EWA kernel filters the same texels as the scalar one; only
+    // the order of summation and the rounding of the filter's radii differ.
+    for (TexelFormat format :
+         {TexelFormat::Float, TexelFormat::Half, TexelFormat::Byte})
+        for (ImageWrap wrap :
+             {ImageWrap::Repeat, ImageWrap::Black, ImageWrap::Clamp}) {
+            MIPMap<RGBSpectrum> mipmap(Point2i(res, res), texels.data(),
+                                       false, 8.f, wrap, format);
+            for (int i = 0; i < 1000; ++i) {
+                Point2f st(1.2f * rng.UniformFloat() - .1f,
+                           1.2f * rng.UniformFloat() - .1f);
+                Float scale = (i % 3 == 0) ? .001f : (i % 3 == 1 ? .02f : .2f);
+                Vector2f dst0(scale * (rng.UniformFloat() - .5f),
+                              scale * (rng.UniformFloat() - .5f));
+                Vector2f dst1(scale * (rng.UniformFloat() - .5f),
+                              scale * (rng.UniformFloat() - .5f));
+                RGBSpectrum ref = mipmap.Lookup(st, dst0, dst1, false);
+                RGBSpectrum v = mipmap.Lookup(st, dst0, dst1);
+                for (int c = 0; c < 3; ++c) EXPECT_NEAR(ref[c], v[c], 1e-3f);
+            }
+        }
+
+    // Single-channel textures
+    std::vector<Float> values(res * res);
+    for (Float &v : values) v = rng.UniformFloat();
+    MIPMap<Float> mipmap(Point2i(res, res), values.data(), false, 8.f,
+                         ImageWrap::Repeat, TexelFormat::Byte);
+    for (int i = 0; i < 1000; ++i) {
+        Point2f st(rng.UniformFloat(), rng.UniformFloat());
+        Vector2f dst0(.05f * (rng.UniformFloat() - .5f),
+                      .05f * (rng.UniformFloat() - .5f));
+        Vector2f dst1(.05f * (rng.UniformFloat() - .5f),
+                      .05f * (rng.UniformFloat() - .5f));
+        EXPECT_NEAR(mipmap.Lookup(st, dst0, dst1, false),
+                    mipmap.Lookup(st, dst0, dst1), 1e-3f);
+    }
+
+    ParallelCleanup();
+}
@@ -6,6 +6,7 @@
 #include "rng.h"
 #include "sampling.h"
 #include "lowdiscrepancy.h"
+#include "parallel.h"
 #include "samplers/maxmin.h"
 #include "samplers/sobol.h"
 #include "samplers/zerotwosequence.h"
@@ -301,3 +302,97 @@ TEST(Distribution1D, Continuous) {
     EXPECT_FLOAT_EQ(0., dist.SampleContinuous(0., &pdf));
     EXPECT_FLOAT_EQ(1., dist.SampleContinuous(1., &pdf));
 }
+
+TEST(AliasDistribution1D, MatchesDistribution1D) {
+    Float func[] = {1, 0, 2, 4, 8, 0.5, 0, 3};
+    int n = sizeof(func) / sizeof(func[0]);
+    Distribution1D cdf(func, n);
+    AliasDistribution1D alias(func, n);
+    EXPECT_EQ(n, alias.Count());
+    EXPECT_FLOAT_EQ(cdf.funcInt, alias.funcInt);
+    for (int i = 0; i < n; ++i)
+        EXPECT_FLOAT_EQ(cdf.DiscretePDF(i), alias.DiscretePDF(i));
+
+    // Stratified samples should hit each entry in proportion to its value,
+    // and the remapped samples should stay uniform within each entry.
+    const int nSamples = 1 << 16;
+    std::vector<int> counts(n, 0);
+    std::vector<double> uSum(n, 0);
+    for (int i = 0; i < nSamples; ++i) {
+        Float pdf, uRemapped;
+        int offset = alias.SampleDiscrete((i + .5f) / nSamples, &pdf,
+                                          &uRemapped);
+        ASSERT_GT(func[offset], 0);
+        EXPECT_FLOAT_EQ(alias.DiscretePDF(offset), pdf);
+        EXPECT_GE(uRemapped, 0);
+        EXPECT_LT(uRemapped, 1);
+        ++counts[offset];
+        uSum[offset] += uRemapped;
+    }
+    for (int i = 0; i < n; ++i) {
+        EXPECT_NEAR(cdf.DiscretePDF(i), Float(counts[i]) / nSamples, 1e-3);
+        if (counts[i] > 0) EXPECT_NEAR(.5, uSum[i] / counts[i], 1e-2);
+    }
+
+    Float pdf;
+    int offset;
+    Float x = alias.SampleContinuous(OneMinusEpsilon, &pdf, &offset);
+    EXPECT_LT(x, 1);
+    EXPECT_FLOAT_EQ(func[offset] / alias.funcInt, pdf);
+}
+
+TEST(HierarchicalDistribution2D, MatchesFunction) {
+    ParallelInit();
+
+    // Use odd resolutions so that the pyramid has partially empty nodes.
+    const int nu = 37, nv = 13;
+    std::vector<Float> func(nu * nv);
+    RNG rng;
+    for (Float &f : func) f = rng.UniformFloat() < .2f ? 0 : rng.UniformFloat();
+    HierarchicalDistribution2D dist(func.data(), nu, nv);
+    Distribution2D cdf(func.data(), nu, nv);
+
+    const int nSamples = 1 << 20;
+    std::vector<int> counts(nu * nv, 0);
+    for (int i = 0; i < nSamples; ++i) {
+        Point2f u(rng.UniformFloat(), rng.UniformFloat());
+        Float pdf;
+        Point2f p = dist.SampleContinuous(u, &pdf);
+        ASSERT_GE(p[0], 0);
+        ASSERT_LT(p[0], 1);
+        ASSERT_GE(p[1], 0);
+        ASSERT_LT(p[1], 1);
+        int iu = int(p[0] * nu), iv = int(p[1] * nv);
+        ASSERT_GT(func[iv * nu + iu], 0);
+        EXPECT_NEAR(cdf.Pdf(p), pdf, 1e-3f * pdf);
+        EXPECT_EQ(dist.Pdf(p), pdf);
+        ++counts[iv * nu + iu];
+    }
+
+    // Texels should be chosen in proportion to the function's values.
+    for (int i = 0; i < nu * nv; ++i) {
+        Float expected = Float(nSamples) * cdf.Pdf(Point2f(
+            (i % nu + .5f) / nu, (i / nu + .5f) / nv)) / (nu * nv);
+        EXPECT_NEAR(expected, counts[i], 5 * std::sqrt(expected) + 1) << i;
+    }
+
+    ParallelCleanup();
+}
+
+TEST(AliasDistribution2D, MatchesDistribution2D) {
+    const int nu = 29, nv = 11;
+    std::vector<Float> func(nu * nv);
+    RNG rng;
+    for (Float &f : func) f = rng.UniformFloat() < .2f ? 0 : rng.UniformFloat();
+    AliasDistribution2D alias(func.data(), nu, nv);
+    Distribution2D cdf(func.data(), nu, nv);
+
+    for (int i = 0; i < 10000; ++i) {
+        Point2f u(rng.UniformFloat(), rng.UniformFloat());
+        Float pdf;
+        Point2f p = alias.SampleContinuous(u, &pdf);
+        ASSERT_GT(func[int(p[1] * nv) * nu + int(p[0] * nu)], 0);
+        EXPECT_NEAR(cdf.Pdf(p), pdf, 1e-3f * pdf);
+        EXPECT_NEAR(alias.Pdf(p), pdf, 1e-3f * pdf);
+    }
+}
@@ -0,0 +1,81 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "rng.h"
+#include "sampling.h"
+#include "sdtree.h"
+
+using namespace pbrt;
+
+TEST(DTree, PdfMatchesSamples) {
+    // Train a quadtree on radiance concentrated around one direction.
+    Vector3f wPeak = Normalize(Vector3f(1, 2, 3));
+    DTree recorded;
+    RNG rng;
+    for (int iteration = 0; iteration < 4; ++iteration) {
+        DTree tree;
+        tree.Refine(recorded, .01f, 20);
+        for (int i = 0; i < 20000; ++i) {
+            Vector3f w = UniformSampleSphere(
+                Point2f(rng.UniformFloat(), rng.UniformFloat()));
+            tree.Record(w, Dot(w, wPeak) > .9f ? 10.f : .1f);
+        }
+        recorded = tree;
+    }
+    EXPECT_GT(recorded.NumNodes(), 1);
+    EXPECT_LE(recorded.Depth(), 20);
+    EXPECT_GT(recorded.Pdf(wPeak), 4 * Inv4Pi);
+    EXPECT_LT(recorded.Pdf(-wPeak), Inv4Pi);
+
+    // The pdf integrates to one over the sphere.
+    const int n = 200000;
+    Float integral = 0;
+    for (int i = 0; i < n; ++i) {
+        Vector3f w = UniformSampleSphere(
+            Point2f(rng.UniformFloat(), rng.UniformFloat()));
+        integral += recorded.Pdf(w) / UniformSpherePdf();
+    }
+    EXPECT_NEAR(1, integral / n, .02);
+
+    // Sampled directions follow the pdf: estimate the probability of the
+    // cone around the peak both ways.
+    Float pCone = 0, pConeFromSamples = 0;
+    for (int i = 0; i < n; ++i) {
+        Vector3f w = UniformSampleSphere(
+            Point2f(rng.UniformFloat(), rng.UniformFloat()));
+        if (Dot(w, wPeak) > .9f)
+            pCone += recorded.Pdf(w) / UniformSpherePdf();
+        Vector3f ws =
+            recorded.Sample(Point2f(rng.UniformFloat(), rng.UniformFloat()));
+        EXPECT_NEAR(1, ws.Length(), 1e-3);
+        EXPECT_GT(recorded.Pdf(ws), 0);
+        if (Dot(ws, wPeak) > .9f) ++pConeFromSamples;
+    }
+    EXPECT_NEAR(pCone / n, pConeFromSamples / n, .01);
+}
+
+TEST(SDTree, SplitsAndMemoryLimit) {
+    Bounds3f bounds(Point3f(-1, -1, -1), Point3f(1, 1, 1));
+    RNG rng;
+    for (size_t maxBytes : {(size_t)1 << 30, (size_t)16384}) {
+        SDTree tree(bounds);
+        for (int iteration = 0; iteration < 3; ++iteration) {
+            for (int i = 0; i < 100000; ++i) {
+                Point3f p = bounds.Lerp(Point3f(rng.UniformFloat(),
+                                                rng.UniformFloat(),
+                                                rng.UniformFloat()));
+                Vector3f w = UniformSampleSphere(
+                    Point2f(rng.UniformFloat(), rng.UniformFloat()));
+                tree.Lookup(p)->Record(w, w.z > 0 ? 1.f : .01f);
+            }
+            tree.Refine(iteration, maxBytes);
+        }
+        if (maxBytes > 16384) {
+            EXPECT_GT(tree.NumLeaves(), 4);
+            // Every leaf learned that light arrives from above.
+            DTreeWrapper *dTree = tree.Lookup(Point3f(.5, -.5, .2));
+            EXPECT_GT(dTree->Pdf(Vector3f(0, 0, 1)),
+                      10 * dTree->Pdf(Vector3f(0, 0, -1)));
+        } else
+            EXPECT_LE(tree.BytesUsed(), maxBytes);
+    }
+}
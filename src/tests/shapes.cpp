@@ -2,14 +2,21 @@
 #include "tests/gtest/gtest.h"
 #include <cmath>
 #include <functional>
+#include <map>
+#include <set>
 #include "pbrt.h"
+#include "paramset.h"
+#include "parallel.h"
 #include "rng.h"
 #include "shape.h"
 #include "lowdiscrepancy.h"
 #include "sampling.h"
 #include "shapes/cone.h"
+#include "shapes/curve.h"
 #include "shapes/cylinder.h"
 #include "shapes/disk.h"
+#include "shapes/heightfield.h"
+#include "shapes/loopsubdiv.h"
 #include "shapes/paraboloid.h"
 #include "shapes/sphere.h"
 #include "shapes/triangle.h"
@@ -557,3 +564,348 @@ TEST(Triangle, BadCases) {
     SurfaceInteraction isect;
     EXPECT_FALSE(mesh[0]->Intersect(ray, &thit, &isect));
 }
+
+TEST(Curve, ClosestApproach) {
+    // Check flat curve intersections against a brute-force search for the
+    // point where the ray passes closest to the curve.
+    RNG rng(4711);
+    Transform identity;
+    auto bezier = [](const Point3f cp[4], Float u) {
+        Point3f a[3] = {Lerp(u, cp[0], cp[1]), Lerp(u, cp[1], cp[2]),
+                        Lerp(u, cp[2], cp[3])};
+        return Lerp(u, Lerp(u, a[0], a[1]), Lerp(u, a[1], a[2]));
+    };
+    int nHitsExpected = 0, nMissesExpected = 0;
+    for (int i = 0; i < 100; ++i) {
+        Point3f cp[4];
+        for (int j = 0; j < 4; ++j)
+            cp[j] = Point3f(pUnif(rng, 1), pUnif(rng, 1), pUnif(rng, 1));
+        Float width = .02f + .1f * rng.UniformFloat();
+        std::shared_ptr<CurveCommon> common = std::make_shared<CurveCommon>(
+            cp, width, width, CurveType::Flat, nullptr);
+        Curve curve(&identity, &identity, false, common, 0, 1);
+
+        for (int j = 0; j < 100; ++j) {
+            // Aim a ray from far away at a point near the curve
+            Point3f pTarget = bezier(cp, rng.UniformFloat()) +
+                              Vector3f(pUnif(rng, width), pUnif(rng, width),
+                                       pUnif(rng, width));
+            Vector3f d = UniformSampleSphere(
+                Point2f(rng.UniformFloat(), rng.UniformFloat()));
+            Ray ray(pTarget - 10 * d, d);
+
+            // Find the point on the curve closest to the ray's line
+            const int nSteps = 5000;
+            Float minDist = Infinity, minU = 0;
+            for (int k = 0; k <= nSteps; ++k) {
+                Float u = Float(k) / nSteps;
+                Vector3f v = bezier(cp, u) - ray.o;
+                Float dist = (v - Dot(v, d) * d).Length();
+                if (dist < minDist) {
+                    minDist = dist;
+                    minU = u;
+                }
+            }
+            // Closest points at the curve's ends aren't hits
+            if (minU < .01f || minU > .99f) continue;
+
+            Float tHit;
+            SurfaceInteraction isect;
+            bool hit = curve.Intersect(ray, &tHit, &isect, false);
+            EXPECT_EQ(hit, curve.IntersectP(ray, false));
+            if (minDist < .45f * width) {
+                ++nHitsExpected;
+                EXPECT_TRUE(hit) << "distance " << minDist << ", width "
+                                 << width;
+            } else if (minDist > .55f * width) {
+                ++nMissesExpected;
+                EXPECT_FALSE(hit) << "distance " << minDist << ", width "
+                                  << width;
+            }
+            if (hit)
+                EXPECT_LT(std::abs(tHit - Dot(bezier(cp, isect.uv[0]) - ray.o,
+                                               d)),
+                          width);
+        }
+    }
+    EXPECT_GT(nHitsExpected, 1000);
+    EXPECT_GT(nMissesExpected, 1000);
+}
+
+// Control mesh of a regular icosahedron
+static void Icosahedron(std::vector<Point3f> *p, std::vector<int> *indices) {
+    const Float t = (1 + std::sqrt(Float(5))) / 2;
+    *p = {Point3f(-1, t, 0),  Point3f(1, t, 0),  Point3f(-1, -t, 0),
+          Point3f(1, -t, 0),  Point3f(0, -1, t), Point3f(0, 1, t),
+          Point3f(0, -1, -t), Point3f(0, 1, -t), Point3f(t, 0, -1),
+          Point3f(t, 0, 1),   Point3f(-t, 0, -1), Point3f(-t, 0, 1)};
+    *indices = {0, 11, 5, 0, 5,  1,  0,  1, 7, 0,  7,  10, 0, 10, 11,
+                1, 5,  9, 5, 11, 4,  11, 10, 2, 10, 7, 6,  7, 1,  8,
+                3, 9,  4, 3, 4,  2,  3,  2, 6, 3,  6,  8,  3, 8,  9,
+                4, 9,  5, 2, 4,  11, 6,  2, 10, 8, 6,  7,  9, 8,  1};
+}
+
+TEST(LoopSubdiv, AdaptiveIsWatertight) {
+    ParallelInit();
+    std::vector<Point3f> p;
+    std::vector<int> idx;
+    Icosahedron(&p, &idx);
+    int nFaces = idx.size() / 3;
+
+    std::vector<int> uIndices;
+    std::vector<Point3f> uP;
+    std::vector<Normal3f> uN;
+    LoopTessellate(idx.size(), idx.data(), p.size(), p.data(),
+                   std::vector<int>(nFaces, 4), &uIndices, &uP, &uN);
+    EXPECT_EQ(3 * 256 * nFaces, uIndices.size());
+    EXPECT_EQ(2 + 128 * nFaces, uP.size());
+
+    RNG rng;
+    for (int trial = 0; trial < 10; ++trial) {
+        std::vector<int> levels(nFaces);
+        for (int &l : levels) l = rng.UniformUInt32(5);
+        std::vector<int> indices;
+        std::vector<Point3f> P;
+        std::vector<Normal3f> N;
+        LoopTessellate(idx.size(), idx.data(), p.size(), p.data(), levels,
+                       &indices, &P, &N);
+        EXPECT_LE(indices.size(), uIndices.size());
+
+        // Every edge of the closed surface's tessellation must be shared by
+        // exactly two triangles, in opposite directions.
+        std::map<std::pair<int, int>, int> edges;
+        for (size_t i = 0; i < indices.size(); i += 3)
+            for (int j = 0; j < 3; ++j)
+                ++edges[std::make_pair(indices[i + j],
+                                       indices[i + (j + 1) % 3])];
+        for (const auto &e : edges) {
+            EXPECT_EQ(1, e.second);
+            auto twin = edges.find(std::make_pair(e.first.second,
+                                                  e.first.first));
+            EXPECT_TRUE(twin != edges.end() && twin->second == 1);
+        }
+
+        // Each vertex is a point of the finest uniform tessellation, since
+        // limit positions don't depend on the level they're computed at.
+        for (size_t i = 0; i < P.size(); ++i) {
+            Float minDist = Infinity;
+            for (const Point3f &up : uP)
+                minDist = std::min(minDist, Distance(P[i], up));
+            EXPECT_LT(minDist, 1e-5f);
+            EXPECT_GT(N[i].LengthSquared(), 0);
+        }
+    }
+    ParallelCleanup();
+}
+
+TEST(LoopSubdiv, AdaptiveOpenMeshIsWatertight) {
+    ParallelInit();
+    // A bumpy 5x5 grid of control vertices, so that the mesh has a boundary
+    // and boundary vertices of several valences
+    const int n = 5;
+    RNG rng;
+    std::vector<Point3f> p;
+    std::vector<int> idx;
+    for (int y = 0; y < n; ++y)
+        for (int x = 0; x < n; ++x)
+            p.push_back(Point3f(x, y, .5f * rng.UniformFloat()));
+    for (int y = 0; y < n - 1; ++y)
+        for (int x = 0; x < n - 1; ++x) {
+            int v = y * n + x;
+            if ((x + y) & 1)
+                for (int i : {v, v + 1, v + n, v + 1, v + n + 1, v + n})
+                    idx.push_back(i);
+            else
+                for (int i : {v, v + 1, v + n + 1, v, v + n + 1, v + n})
+                    idx.push_back(i);
+        }
+    int nFaces = idx.size() / 3;
+
+    std::vector<int> uIndices;
+    std::vector<Point3f> uP;
+    std::vector<Normal3f> uN;
+    LoopTessellate(idx.size(), idx.data(), p.size(), p.data(),
+                   std::vector<int>(nFaces, 4), &uIndices, &uP, &uN);
+
+    for (int trial = 0; trial < 10; ++trial) {
+        std::vector<int> levels(nFaces);
+        for (int &l : levels) l = rng.UniformUInt32(5);
+        std::vector<int> indices;
+        std::vector<Point3f> P;
+        std::vector<Normal3f> N;
+        LoopTessellate(idx.size(), idx.data(), p.size(), p.data(), levels,
+                       &indices, &P, &N);
+        EXPECT_LE(indices.size(), uIndices.size());
+
+        // Interior edges must be shared by two triangles in opposite
+        // directions; the remaining, boundary, edges must form a single
+        // loop, as a crack between patches would add another one.
+        std::map<std::pair<int, int>, int> edges;
+        for (size_t i = 0; i < indices.size(); i += 3)
+            for (int j = 0; j < 3; ++j)
+                ++edges[std::make_pair(indices[i + j],
+                                       indices[i + (j + 1) % 3])];
+        std::map<int, int> boundaryNext;
+        for (const auto &e : edges) {
+            EXPECT_EQ(1, e.second);
+            if (edges.find(std::make_pair(e.first.second, e.first.first)) ==
+                edges.end()) {
+                EXPECT_EQ(0, boundaryNext.count(e.first.first));
+                boundaryNext[e.first.first] = e.first.second;
+            }
+        }
+        ASSERT_FALSE(boundaryNext.empty());
+        size_t loopLength = 0;
+        int v = boundaryNext.begin()->first;
+        do {
+            ASSERT_EQ(1, boundaryNext.count(v));
+            v = boundaryNext[v];
+            ++loopLength;
+        } while (v != boundaryNext.begin()->first &&
+                 loopLength <= boundaryNext.size());
+        EXPECT_EQ(boundaryNext.size(), loopLength);
+
+        // The boundary limit rule is only approximate, so unlike for closed
+        // meshes, vertices near the boundary move slightly with the level
+        // they're computed at; each one is still placed just once.
+        EXPECT_EQ(P.size(),
+                  std::set<int>(indices.begin(), indices.end()).size());
+        for (size_t i = 0; i < P.size(); ++i)
+            EXPECT_GT(N[i].LengthSquared(), 0);
+    }
+    ParallelCleanup();
+}
+
+TEST(LoopSubdiv, ScreenSpaceLevels) {
+    ParallelInit();
+    std::vector<Point3f> p;
+    std::vector<int> idx;
+    Icosahedron(&p, &idx);
+    ParamSet params;
+    std::unique_ptr<int[]> indices(new int[idx.size()]);
+    std::copy(idx.begin(), idx.end(), indices.get());
+    params.AddInt("indices", std::move(indices), idx.size());
+    std::unique_ptr<Point3f[]> P(new Point3f[p.size()]);
+    std::copy(p.begin(), p.end(), P.get());
+    params.AddPoint3f("P", std::move(P), p.size());
+    std::unique_ptr<int[]> levels(new int[1]);
+    levels[0] = 4;
+    params.AddInt("levels", std::move(levels), 1);
+
+    // Without a camera, every patch is refined to the maximum level; the
+    // farther away the camera, the fewer triangles are needed.
+    Transform identity;
+    size_t nUniform =
+        CreateLoopSubdiv(&identity, &identity, false, params).size();
+    EXPECT_EQ(256 * idx.size() / 3, nUniform);
+    SubdivisionCamera camera{Point3f(0, 0, 4), 500};
+    size_t nNear =
+        CreateLoopSubdiv(&identity, &identity, false, params, &camera).size();
+    camera.p = Point3f(0, 0, 300);
+    size_t nFar =
+        CreateLoopSubdiv(&identity, &identity, false, params, &camera).size();
+    camera.p = Point3f(0, 0, 1e5);
+    size_t nDistant =
+        CreateLoopSubdiv(&identity, &identity, false, params, &camera).size();
+    EXPECT_LE(nNear, nUniform);
+    EXPECT_LT(nFar, nNear);
+    EXPECT_EQ(idx.size() / 3, nDistant);
+    ParallelCleanup();
+}
+
+TEST(Heightfield, MatchesTriangulation) {
+    // The heightfield must give the same hits as the mesh of two triangles
+    // per cell that it replaced.
+    RNG rng(1234);
+    const int nx = 37, ny = 21;
+    std::vector<Float> z(nx * ny);
+    for (Float &h : z) h = .3f * rng.UniformFloat();
+    std::vector<Point3f> P;
+    std::vector<Point2f> uv;
+    std::vector<int> indices;
+    for (int y = 0; y < ny; ++y)
+        for (int x = 0; x < nx; ++x) {
+            P.push_back(Point3f((Float)x / (Float)(nx - 1),
+                                (Float)y / (Float)(ny - 1), z[y * nx + x]));
+            uv.push_back(Point2f(P.back().x, P.back().y));
+        }
+    for (int y = 0; y < ny - 1; ++y)
+        for (int x = 0; x < nx - 1; ++x) {
+            int v = y * nx + x;
+            for (int i : {v, v + 1, v + nx + 1, v, v + nx + 1, v + nx})
+                indices.push_back(i);
+        }
+
+    Transform o2w = Translate(Vector3f(1, -2, .5)) *
+                    Rotate(30, Vector3f(1, 1, 0)) * Scale(4, 3, 2);
+    Transform w2o = Inverse(o2w);
+    std::vector<std::shared_ptr<Shape>> tris = CreateTriangleMesh(
+        &o2w, &w2o, false, indices.size() / 3, indices.data(), P.size(),
+        P.data(), nullptr, nullptr, uv.data(), nullptr, nullptr);
+    Heightfield hf(&o2w, &w2o, false, nx, ny, z.data());
+
+    Float triArea = 0;
+    for (const auto &tri : tris) triArea += tri->Area();
+    EXPECT_NEAR(triArea, hf.Area(), 1e-4 * triArea);
+
+    int nHits = 0, nMismatches = 0;
+    Bounds3f bounds = hf.WorldBound();
+    for (int i = 0; i < 20000; ++i) {
+        Point3f pTarget = bounds.Lerp(Point3f(
+            rng.UniformFloat(), rng.UniformFloat(), rng.UniformFloat()));
+        Vector3f d = UniformSampleSphere(
+            Point2f(rng.UniformFloat(), rng.UniformFloat()));
+        Ray ray(pTarget - 10 * d, d);
+
+        // Find the closest triangle hit by brute force
+        Float tTri = Infinity;
+        SurfaceInteraction isectTri;
+        for (const auto &tri : tris) {
+            Float t;
+            SurfaceInteraction isect;
+            if (tri->Intersect(ray, &t, &isect) && t < tTri) {
+                tTri = t;
+                isectTri = isect;
+            }
+        }
+
+        Float tHf;
+        SurfaceInteraction isectHf;
+        bool hit = hf.Intersect(ray, &tHf, &isectHf, false);
+        EXPECT_EQ(hit, hf.IntersectP(ray, false));
+        if (hit != (tTri < Infinity)) {
+            ++nMismatches;
+            continue;
+        }
+        if (!hit) continue;
+        ++nHits;
+        EXPECT_NEAR(tTri, tHf, 1e-4f * tTri);
+        EXPECT_GT(Dot(isectTri.n, isectHf.n), .9999f);
+        EXPECT_LT(Distance(isectTri.p, isectHf.p), 1e-3f);
+        EXPECT_NEAR(isectTri.uv[0], isectHf.uv[0], 1e-3f);
+        EXPECT_NEAR(isectTri.uv[1], isectHf.uv[1], 1e-3f);
+    }
+    EXPECT_GT(nHits, 5000);
+    // Rays grazing the shared edges of triangles may disagree.
+    EXPECT_LT(nMismatches, 5);
+
+    // Sampled points must lie on the surface with consistent densities,
+    // and the reciprocal densities must integrate to the area.
+    Float areaEstimate = 0;
+    const int nSamples = 10000;
+    for (int i = 0; i < nSamples; ++i) {
+        Point2f u(rng.UniformFloat(), rng.UniformFloat());
+        Float pdf;
+        Interaction it = hf.Sample(u, &pdf);
+        ASSERT_GT(pdf, 0);
+        EXPECT_NEAR(pdf, hf.Pdf(it), 1e-3f * pdf);
+        Ray ray(it.p + 1e-4f * Vector3f(it.n), -Vector3f(it.n));
+        Float tHit;
+        SurfaceInteraction isect;
+        ASSERT_TRUE(hf.Intersect(ray, &tHit, &isect, false));
+        EXPECT_LT(Distance(isect.p, it.p), 1e-3f);
+        EXPECT_GT(Dot(it.n, o2w(Vector3f(0, 0, 1))), 0);
+        areaEstimate += 1 / (pdf * nSamples);
+    }
+    EXPECT_NEAR(hf.Area(), areaEstimate, 1e-2f * hf.Area());
+}
@@ -0,0 +1,209 @@
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "parallel.h"
+#include "stats.h"
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+using namespace pbrt;
+
+#if defined(PBRT_HAVE_ITIMER) && defined(PBRT_HAVE_BACKTRACE)
+// Keeps the CPU busy for about the given number of seconds in _category_,
+// so that the profiler has a chance to take samples.
+static Float Spin(double seconds, Prof category = Prof::IntegratorRender) {
+    ProfilePhase _(category);
+    std::clock_t start = std::clock();
+    Float sum = 0;
+    while (std::clock() - start < seconds * CLOCKS_PER_SEC)
+        for (int i = 0; i < 10000; ++i) sum += std::sqrt(Float(i));
+    return sum;
+}
+
+TEST(Profiler, CallStacks) {
+    PbrtOptions.profileStacksFile = "test_stacks.txt";
+    ParallelInit();
+    InitProfiler();
+    EXPECT_GT(Spin(.5), 0);
+    CleanupProfiler();
+    ASSERT_TRUE(WriteProfileStacks(PbrtOptions.profileStacksFile));
+
+    // Each line has semicolon-separated frames followed by a sample count.
+    std::ifstream in(PbrtOptions.profileStacksFile);
+    std::string line;
+    uint64_t total = 0;
+    while (std::getline(in, line)) {
+        size_t space = line.find_last_of(' ');
+        ASSERT_NE(std::string::npos, space) << line;
+        EXPECT_GT(space, 0) << line;
+        uint64_t count = std::stoull(line.substr(space + 1));
+        EXPECT_GT(count, 0) << line;
+        total += count;
+    }
+    // The timer fires at 100 Hz of CPU time.
+    EXPECT_GT(total, 10);
+
+    ClearProfiler();
+    ParallelCleanup();
+    EXPECT_EQ(0, remove(PbrtOptions.profileStacksFile.c_str()));
+    PbrtOptions.profileStacksFile.clear();
+}
+
+static std::string ReadFile(const std::string &filename) {
+    std::ifstream in(filename);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+TEST(Profiler, PerfCounters) {
+    // Hardware counters may not be available (e.g. in a virtual machine
+    // or with a restrictive perf_event_paranoid setting), in which case
+    // rendering must carry on without them.
+    PbrtOptions.perfCounters = true;
+    ParallelInit();
+    InitProfiler();
+    EXPECT_GT(Spin(.5), 0);
+    CleanupProfiler();
+
+    std::string reportFile = "test_perfcounters.txt";
+    FILE *f = fopen(reportFile.c_str(), "w");
+    ASSERT_TRUE(f != nullptr);
+    ReportProfilerResults(f);
+    fclose(f);
+    std::string jsonFile = "test_perfcounters.json";
+    ASSERT_TRUE(WriteStatsJSON(jsonFile));
+    std::string report = ReadFile(reportFile), json = ReadFile(jsonFile);
+
+    // The counters are reported in both formats or in neither, and the
+    // spinning is charged to the category it ran in.
+    bool haveCounters =
+        report.find("Profile (hardware counters)") != std::string::npos;
+    EXPECT_EQ(haveCounters,
+              json.find("\"perfCounters\"") != std::string::npos);
+    if (haveCounters)
+        EXPECT_NE(std::string::npos,
+                  json.find("\"phase\": \"Integrator::Render()\", "
+                            "\"cycles\": "));
+
+    ClearProfiler();
+    ParallelCleanup();
+    PbrtOptions.perfCounters = false;
+    EXPECT_EQ(0, remove(reportFile.c_str()));
+    EXPECT_EQ(0, remove(jsonFile.c_str()));
+}
+
+// Returns the sum over threads of _counter_'s count in _phase_, from the
+// "perfCounters" entries of the stats JSON, which are one per line.
+static uint64_t PerfCount(const std::string &json, const std::string &phase,
+                          const std::string &counter) {
+    std::istringstream in(json);
+    std::string line, key = "\"" + counter + "\": ";
+    uint64_t sum = 0;
+    while (std::getline(in, line)) {
+        if (line.find("\"phase\": \"" + phase + "\"") == std::string::npos)
+            continue;
+        size_t pos = line.find(key);
+        if (pos != std::string::npos)
+            sum += std::stoull(line.substr(pos + key.size()));
+    }
+    return sum;
+}
+
+TEST(Profiler, SoftwarePerfCounters) {
+    // The kernel's clocks are available without a PMU, so this checks
+    // that events are charged to the category that they happened in.
+    PbrtOptions.perfCounters = PbrtOptions.perfCountersSoftware = true;
+    ParallelInit();
+    InitProfiler();
+    EXPECT_GT(Spin(.4), 0);
+    EXPECT_GT(Spin(.2, Prof::DirectLighting), 0);
+    CleanupProfiler();
+
+    std::string jsonFile = "test_softwareperfcounters.json";
+    ASSERT_TRUE(WriteStatsJSON(jsonFile));
+    std::string json = ReadFile(jsonFile);
+    ASSERT_NE(std::string::npos, json.find("\"perfCounters\""));
+
+    // Each counter measures the thread's CPU time in nanoseconds, so
+    // they roughly agree with each other and with the time spent in each
+    // category. Counts are only taken at overflows, some of which may be
+    // lost while a counter is re-armed, so they may come up short.
+    const char *counters[] = {"taskClock", "cpuClock", "taskClock4ms",
+                              "cpuClock4ms"};
+    for (const char *counter : counters) {
+        double render =
+            1e-9 * PerfCount(json, "Integrator::Render()", counter);
+        double direct = 1e-9 * PerfCount(json, "Direct lighting", counter);
+        EXPECT_GT(render, .2) << counter;
+        EXPECT_LT(render, .5) << counter;
+        EXPECT_GT(direct, .1) << counter;
+        EXPECT_LT(direct, .25) << counter;
+        EXPECT_NEAR(2, render / direct, .8) << counter;
+    }
+    EXPECT_EQ(0, PerfCount(json, "BSDF::f()", "taskClock"));
+
+    ClearProfiler();
+    ParallelCleanup();
+    PbrtOptions.perfCounters = PbrtOptions.perfCountersSoftware = false;
+    EXPECT_EQ(0, remove(jsonFile.c_str()));
+}
+#endif  // PBRT_HAVE_ITIMER && PBRT_HAVE_BACKTRACE
+
+STAT_COUNTER("Test/JSON counter", nJSONCounter);
+STAT_INT_DISTRIBUTION("Test/JSON distribution", jsonDistribution);
+
+TEST(Stats, JSON) {
+    ClearStats();
+    nJSONCounter += 5;
+    ReportValue(jsonDistribution, 2);
+    ReportValue(jsonDistribution, 4);
+    ReportThreadStats();
+    ReportWallTime("Rendering", 1.5);
+    ReportWallTime("Rendering", .5);
+
+    std::string filename = "test_stats.json";
+    ASSERT_TRUE(WriteStatsJSON(filename));
+    std::ifstream in(filename);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    std::string json = ss.str();
+    EXPECT_NE(std::string::npos, json.find("\"Test/JSON counter\": 5"));
+    EXPECT_NE(std::string::npos,
+              json.find("\"Test/JSON distribution\": {\"count\": 2, "
+                        "\"mean\": 3, \"min\": 2, \"max\": 4}"));
+    EXPECT_NE(std::string::npos, json.find("\"Rendering\": 2.000000"));
+#ifndef PBRT_IS_WINDOWS
+    // Each timed phase also records the peak memory use at its end.
+    size_t phaseMemory = json.find("\"phasePeakMemory\"");
+    ASSERT_NE(std::string::npos, phaseMemory);
+    EXPECT_NE(std::string::npos, json.find("\"Rendering\": ", phaseMemory));
+#endif  // !PBRT_IS_WINDOWS
+
+    // The braces and brackets outside of strings must balance.
+    std::vector<char> open;
+    bool inString = false;
+    for (size_t i = 0; i < json.size(); ++i) {
+        char c = json[i];
+        if (inString) {
+            if (c == '\\')
+                ++i;
+            else if (c == '"')
+                inString = false;
+        } else if (c == '"')
+            inString = true;
+        else if (c == '{' || c == '[')
+            open.push_back(c);
+        else if (c == '}' || c == ']') {
+            ASSERT_FALSE(open.empty());
+            EXPECT_EQ(c == '}' ? '{' : '[', open.back());
+            open.pop_back();
+        }
+    }
+    EXPECT_TRUE(open.empty());
+    EXPECT_FALSE(inString);
+
+    ClearStats();
+    EXPECT_EQ(0, remove(filename.c_str()));
+}
@@ -34,37 +34,169 @@
 // textures/imagemap.cpp*
 #include "textures/imagemap.h"
 #include "imageio.h"
+#include "fileutil.h"
+#include "parallel.h"
 #include "stats.h"
+#include <atomic>
+#ifdef PBRT_IS_WINDOWS
+#include <process.h>
+#else
+#include <unistd.h>
+#endif  // PBRT_IS_WINDOWS
 
 namespace pbrt {
 
+STAT_INT_DISTRIBUTION("Texture/MIP map kB per image texture", mipMapKBPerTexture);
+STAT_PERCENT("Texture/MIP maps loaded from MIP cache directory",
+             nMIPCacheHits, nMIPCacheLookups);
+
+// ImageTexture Local Functions
+static bool IsTiledImage(const std::string &filename) {
+    return HasExtension(filename, ".mip");
+}
+
+// Returns a name for a temporary file next to _filename_ that no other
+// process, or other call in this one, will use at the same time.
+static std::string TemporaryFilename(const std::string &filename) {
+    static std::atomic<int> counter{0};
+#ifdef PBRT_IS_WINDOWS
+    int pid = _getpid();
+#else
+    int pid = getpid();
+#endif  // PBRT_IS_WINDOWS
+    return filename + StringPrintf(".%d.%d.tmp", pid, counter++);
+}
+
+static TexelFormat GetTexelFormat(const TextureParams &tp,
+                                  const std::string &filename, bool gamma) {
+    std::string format = tp.FindString("texelformat", "float");
+    if (format == "float")
+        return TexelFormat::Float;
+    else if (format == "half")
+        return TexelFormat::Half;
+    else if (format == "8bit")
+        return TexelFormat::Byte;
+    else if (format == "auto")
+        // 8-bit images are stored as 8-bit sRGB texels; MIPMap construction
+        // falls back to half if scaling takes them out of the $[0,1]$ range.
+        return (gamma && (HasExtension(filename, ".tga") ||
+                          HasExtension(filename, ".png")))
+                   ? TexelFormat::Byte
+                   : TexelFormat::Half;
+    Error("Texel format \"%s\" unknown. Using \"float\".", format.c_str());
+    return TexelFormat::Float;
+}
+
+static int GetTexelTileSize(const TextureParams &tp) {
+    int tileSize = tp.FindInt("tilesize", 4);
+    if (tileSize < 1 || tileSize > 128 || !IsPowerOf2(tileSize)) {
+        Error("\"tilesize\" %d must be a power of two between 1 and 128. "
+              "Using 4.", tileSize);
+        return 4;
+    }
+    return tileSize;
+}
+
+static std::string MIPCacheFilename(const std::string &filename,
+                                    int nChannels, ImageWrap wrap, Float scale,
+                                    bool gamma, TexelFormat format,
+                                    int tileSize) {
+    // Cached MIP maps are identified by the contents of the source image
+    // and by every option that affects the stored texels
+    if (PbrtOptions.mipCacheDir.empty()) return "";
+    uint64_t fileHash;
+    if (!HashFile(filename, &fileHash)) return "";
+    static const int cacheVersion = 1;
+    uint64_t optionsHash = 0xcbf29ce484222325ull;
+    for (uint64_t v :
+         {(uint64_t)cacheVersion, (uint64_t)nChannels, (uint64_t)wrap,
+          (uint64_t)FloatToBits((float)scale), (uint64_t)gamma,
+          (uint64_t)format, (uint64_t)tileSize})
+        optionsHash = (optionsHash ^ v) * 0x100000001b3ull;
+    std::string dir = PbrtOptions.mipCacheDir;
+    if (dir.back() != '/' && dir.back() != '\\') dir += '/';
+    return dir + StringPrintf("%016llx-%016llx.mip",
+                              (unsigned long long)fileHash,
+                              (unsigned long long)optionsHash);
+}
+
 // ImageTexture Method Definitions
 template <typename Tmemory, typename Treturn>
 ImageTexture<Tmemory, Treturn>::ImageTexture(
     std::unique_ptr<TextureMapping2D> mapping, const std::string &filename,
     bool doTrilinear, Float maxAniso, ImageWrap wrapMode, Float scale,
-    bool gamma)
-    : mapping(std::move(mapping)) {
-    mipmap =
-        GetTexture(filename, doTrilinear, maxAniso, wrapMode, scale, gamma);
+    bool gamma, TexelFormat format, int tileSize)
+    : mapping(std::move(mapping)),
+      texelScale(IsTiledImage(filename) ? scale : 1) {
+    mipmap = GetTexture(filename, doTrilinear, maxAniso, wrapMode, scale,
+                        gamma, format, tileSize);
 }
 
 template <typename Tmemory, typename Treturn>
 MIPMap<Tmemory> *ImageTexture<Tmemory, Treturn>::GetTexture(
     const std::string &filename, bool doTrilinear, Float maxAniso,
-    ImageWrap wrap, Float scale, bool gamma) {
+    ImageWrap wrap, Float scale, bool gamma, TexelFormat format,
+    int tileSize) {
     // Return _MIPMap_ from texture cache if present
-    TexInfo texInfo(filename, doTrilinear, maxAniso, wrap, scale, gamma);
+    TexInfo texInfo(filename, doTrilinear, maxAniso, wrap, scale, gamma,
+                    format, tileSize);
     if (textures.find(texInfo) != textures.end())
         return textures[texInfo].get();
 
     // Create _MIPMap_ for _filename_
     ProfilePhase _(Prof::TextureLoading);
+    if (IsTiledImage(filename)) {
+        // Load tiles of pre-tiled image on demand through the texture cache
+        TiledImageHeader header;
+        if (ReadTiledImageHeader(filename, &header)) {
+            TextureCache *cache = GetTextureCache();
+            int fileId = cache->AddFile(filename, header);
+            MIPMap<Tmemory> *mipmap = new MIPMap<Tmemory>(
+                cache, fileId, header, doTrilinear, maxAniso, wrap);
+            LOG(INFO) << StringPrintf(
+                "Texture \"%s\": %d MIP levels, %s texels, loaded on demand",
+                filename.c_str(), mipmap->Levels(),
+                TexelFormatName(mipmap->Format()));
+            textures[texInfo].reset(mipmap);
+            return mipmap;
+        }
+        Warning("Creating a constant grey texture to replace \"%s\".",
+                filename.c_str());
+        Tmemory grey = 0.5f;
+        MIPMap<Tmemory> *mipmap = new MIPMap<Tmemory>(Point2i(1, 1), &grey);
+        textures[texInfo].reset(mipmap);
+        return mipmap;
+    }
+
+    // Look for a previously generated _MIPMap_ in the MIP cache directory
+    std::string cacheFile =
+        MIPCacheFilename(filename, TexelChannels<Tmemory>::N, wrap, scale,
+                         gamma, format, tileSize);
+    if (!cacheFile.empty()) {
+        ++nMIPCacheLookups;
+        FILE *f = fopen(cacheFile.c_str(), "rb");
+        if (f) {
+            fclose(f);
+            MIPMap<Tmemory> *mipmap = MIPMap<Tmemory>::ReadTiled(
+                cacheFile, doTrilinear, maxAniso, wrap);
+            if (mipmap) {
+                ++nMIPCacheHits;
+                LOG(INFO) << StringPrintf(
+                    "Texture \"%s\": read %d MIP levels from \"%s\"",
+                    filename.c_str(), mipmap->Levels(), cacheFile.c_str());
+                ReportValue(mipMapKBPerTexture, mipmap->BytesUsed() / 1024);
+                textures[texInfo].reset(mipmap);
+                return mipmap;
+            }
+        }
+    }
+
     Point2i resolution;
     std::unique_ptr<RGBSpectrum[]> texels = ReadImage(filename, &resolution);
     if (!texels) {
         Warning("Creating a constant grey texture to replace \"%s\".",
                 filename.c_str());
+        cacheFile.clear();
         resolution.x = resolution.y = 1;
         RGBSpectrum *rgb = new RGBSpectrum[1];
         *rgb = RGBSpectrum(0.5f);
@@ -73,27 +205,48 @@ MIPMap<Tmemory> *ImageTexture<Tmemory, Treturn>::GetTexture(
 
     // Flip image in y; texture coordinate space has (0,0) at the lower
     // left corner.
-    for (int y = 0; y < resolution.y / 2; ++y)
+    ParallelFor([&](int y) {
         for (int x = 0; x < resolution.x; ++x) {
             int o1 = y * resolution.x + x;
             int o2 = (resolution.y - 1 - y) * resolution.x + x;
             std::swap(texels[o1], texels[o2]);
         }
+    }, resolution.y / 2, 32);
 
     MIPMap<Tmemory> *mipmap = nullptr;
     if (texels) {
         // Convert texels to type _Tmemory_ and create _MIPMap_
         std::unique_ptr<Tmemory[]> convertedTexels(
             new Tmemory[resolution.x * resolution.y]);
-        for (int i = 0; i < resolution.x * resolution.y; ++i)
-            convertIn(texels[i], &convertedTexels[i], scale, gamma);
+        ParallelFor([&](int y) {
+            for (int i = y * resolution.x; i < (y + 1) * resolution.x; ++i)
+                convertIn(texels[i], &convertedTexels[i], scale, gamma);
+        }, resolution.y, 32);
         mipmap = new MIPMap<Tmemory>(resolution, convertedTexels.get(),
-                                     doTrilinear, maxAniso, wrap);
+                                     doTrilinear, maxAniso, wrap, format,
+                                     tileSize);
+
+        // Save the new _MIPMap_ for later runs; it's written to a temporary
+        // file first so that concurrent runs never read a partial file
+        if (!cacheFile.empty()) {
+            std::string tmpFile = TemporaryFilename(cacheFile);
+            if (!mipmap->WriteTiled(tmpFile) ||
+                rename(tmpFile.c_str(), cacheFile.c_str()) != 0) {
+                Warning("%s: unable to write MIP cache file",
+                        cacheFile.c_str());
+                remove(tmpFile.c_str());
+            }
+        }
     } else {
         // Create one-valued _MIPMap_
         Tmemory oneVal = scale;
         mipmap = new MIPMap<Tmemory>(Point2i(1, 1), &oneVal);
     }
+    LOG(INFO) << StringPrintf("Texture \"%s\": %d MIP levels, %s texels, "
+                              "%.2f MiB", filename.c_str(), mipmap->Levels(),
+                              TexelFormatName(mipmap->Format()),
+                              mipmap->BytesUsed() / (1024. * 1024.));
+    ReportValue(mipMapKBPerTexture, mipmap->BytesUsed() / 1024);
     textures[texInfo].reset(mipmap);
     return mipmap;
 }
@@ -139,8 +292,11 @@ ImageTexture<Float, Float> *CreateImageFloatTexture(const Transform &tex2world,
     std::string filename = tp.FindFilename("filename");
     bool gamma = tp.FindBool("gamma", HasExtension(filename, ".tga") ||
                                           HasExtension(filename, ".png"));
+    TexelFormat format = GetTexelFormat(tp, filename, gamma);
+    int tileSize = GetTexelTileSize(tp);
     return new ImageTexture<Float, Float>(std::move(map), filename, trilerp,
-                                          maxAniso, wrapMode, scale, gamma);
+                                          maxAniso, wrapMode, scale, gamma,
+                                          format, tileSize);
 }
 
 ImageTexture<RGBSpectrum, Spectrum> *CreateImageSpectrumTexture(
@@ -181,8 +337,11 @@ ImageTexture<RGBSpectrum, Spectrum> *CreateImageSpectrumTexture(
     std::string filename = tp.FindFilename("filename");
     bool gamma = tp.FindBool("gamma", HasExtension(filename, ".tga") ||
                                           HasExtension(filename, ".png"));
+    TexelFormat format = GetTexelFormat(tp, filename, gamma);
+    int tileSize = GetTexelTileSize(tp);
     return new ImageTexture<RGBSpectrum, Spectrum>(
-        std::move(map), filename, trilerp, maxAniso, wrapMode, scale, gamma);
+        std::move(map), filename, trilerp, maxAniso, wrapMode, scale, gamma,
+        format, tileSize);
 }
 
 template class ImageTexture<Float, Float>;
@@ -50,25 +50,31 @@ namespace pbrt {
 // TexInfo Declarations
 struct TexInfo {
     TexInfo(const std::string &f, bool dt, Float ma, ImageWrap wm, Float sc,
-            bool gamma)
+            bool gamma, TexelFormat format, int tileSize)
         : filename(f),
           doTrilinear(dt),
           maxAniso(ma),
           wrapMode(wm),
           scale(sc),
-          gamma(gamma) {}
+          gamma(gamma),
+          format(format),
+          tileSize(tileSize) {}
     std::string filename;
     bool doTrilinear;
     Float maxAniso;
     ImageWrap wrapMode;
     Float scale;
     bool gamma;
+    TexelFormat format;
+    int tileSize;
     bool operator<(const TexInfo &t2) const {
         if (filename != t2.filename) return filename < t2.filename;
         if (doTrilinear != t2.doTrilinear) return doTrilinear < t2.doTrilinear;
         if (maxAniso != t2.maxAniso) return maxAniso < t2.maxAniso;
         if (scale != t2.scale) return scale < t2.scale;
         if (gamma != t2.gamma) return !gamma;
+        if (format != t2.format) return format < t2.format;
+        if (tileSize != t2.tileSize) return tileSize < t2.tileSize;
         return wrapMode < t2.wrapMode;
     }
 };
@@ -80,7 +86,8 @@ class ImageTexture : public Texture<Treturn> {
     // ImageTexture Public Methods
     ImageTexture(std::unique_ptr<TextureMapping2D> m,
                  const std::string &filename, bool doTri, Float maxAniso,
-                 ImageWrap wm, Float scale, bool gamma);
+                 ImageWrap wm, Float scale, bool gamma,
+                 TexelFormat format = TexelFormat::Float, int tileSize = 4);
     static void ClearCache() {
         textures.erase(textures.begin(), textures.end());
     }
@@ -88,6 +95,7 @@ class ImageTexture : public Texture<Treturn> {
         Vector2f dstdx, dstdy;
         Point2f st = mapping->Map(si, &dstdx, &dstdy);
         Tmemory mem = mipmap->Lookup(st, dstdx, dstdy);
+        if (texelScale != 1) mem *= texelScale;
         Treturn ret;
         convertOut(mem, &ret);
         return ret;
@@ -97,7 +105,8 @@ class ImageTexture : public Texture<Treturn> {
     // ImageTexture Private Methods
     static MIPMap<Tmemory> *GetTexture(const std::string &filename,
                                        bool doTrilinear, Float maxAniso,
-                                       ImageWrap wm, Float scale, bool gamma);
+                                       ImageWrap wm, Float scale, bool gamma,
+                                       TexelFormat format, int tileSize);
     static void convertIn(const RGBSpectrum &from, RGBSpectrum *to, Float scale,
                           bool gamma) {
         for (int i = 0; i < RGBSpectrum::nSamples; ++i)
@@ -117,6 +126,9 @@ class ImageTexture : public Texture<Treturn> {
     // ImageTexture Private Data
     std::unique_ptr<TextureMapping2D> mapping;
     MIPMap<Tmemory> *mipmap;
+    // Texels from tiled image files are stored unscaled, so the texture's
+    // scale is applied after filtering
+    Float texelScale;
     static std::map<TexInfo, std::unique_ptr<MIPMap<Tmemory>>> textures;
 };
 
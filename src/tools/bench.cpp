@@ -0,0 +1,677 @@
+//
+// bench.cpp
+//
+// Renders a set of procedurally generated scenes that each stress one part
+// of the renderer, reporting ray throughput, acceleration structure build
+// time and peak memory use, and optionally comparing them to the results
+// of an earlier run.
+//
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "pbrt.h"
+#include "api.h"
+#include "geometry.h"
+#include "imageio.h"
+#include "rng.h"
+#include "sampling.h"
+#include "stringprint.h"
+
+using namespace pbrt;
+
+// JSON Declarations
+
+// A minimal JSON reader, sufficient for the statistics files written by
+// WriteStatsJSON() and for the baseline files written by this tool.
+// Array elements are stored as members with empty names.
+struct JSONValue {
+    enum class Type { Null, Bool, Number, String, Array, Object };
+    Type type = Type::Null;
+    double number = 0;
+    std::string string;
+    std::vector<std::pair<std::string, std::shared_ptr<JSONValue>>> members;
+
+    // Returns the member named _name_, or a null value if there isn't one.
+    const JSONValue &operator[](const std::string &name) const {
+        static const JSONValue null;
+        for (const auto &m : members)
+            if (m.first == name) return *m.second;
+        return null;
+    }
+    double Number(double def = 0) const {
+        return type == Type::Number ? number : def;
+    }
+};
+
+class JSONParser {
+  public:
+    JSONParser(const std::string &text) : text(text) {}
+    bool Parse(JSONValue *value) {
+        if (!ParseValue(value)) return false;
+        SkipSpace();
+        return pos == text.size();
+    }
+
+  private:
+    void SkipSpace() {
+        while (pos < text.size() && isspace((unsigned char)text[pos])) ++pos;
+    }
+    bool Expect(char c) {
+        SkipSpace();
+        if (pos == text.size() || text[pos] != c) return false;
+        ++pos;
+        return true;
+    }
+    bool ParseString(std::string *str) {
+        if (!Expect('"')) return false;
+        while (pos < text.size() && text[pos] != '"') {
+            char c = text[pos++];
+            if (c == '\\') {
+                if (pos == text.size()) return false;
+                switch (c = text[pos++]) {
+                case 'b': c = '\b'; break;
+                case 'f': c = '\f'; break;
+                case 'n': c = '\n'; break;
+                case 'r': c = '\r'; break;
+                case 't': c = '\t'; break;
+                case 'u': {
+                    // Only ASCII characters are needed here.
+                    if (pos + 4 > text.size()) return false;
+                    long code = strtol(text.substr(pos, 4).c_str(), nullptr,
+                                       16);
+                    pos += 4;
+                    c = code < 128 ? char(code) : '?';
+                    break;
+                }
+                default: break;
+                }
+            }
+            *str += c;
+        }
+        if (pos == text.size()) return false;
+        ++pos;
+        return true;
+    }
+    bool ParseValue(JSONValue *value) {
+        SkipSpace();
+        if (pos == text.size()) return false;
+        char c = text[pos];
+        if (c == '{' || c == '[') {
+            ++pos;
+            value->type = c == '{' ? JSONValue::Type::Object
+                                   : JSONValue::Type::Array;
+            char close = c == '{' ? '}' : ']';
+            if (Expect(close)) return true;
+            do {
+                std::string name;
+                if (value->type == JSONValue::Type::Object &&
+                    (!ParseString(&name) || !Expect(':')))
+                    return false;
+                std::shared_ptr<JSONValue> member =
+                    std::make_shared<JSONValue>();
+                if (!ParseValue(member.get())) return false;
+                value->members.push_back(std::make_pair(name, member));
+            } while (Expect(','));
+            return Expect(close);
+        } else if (c == '"') {
+            value->type = JSONValue::Type::String;
+            return ParseString(&value->string);
+        } else if (text.compare(pos, 4, "true") == 0 ||
+                   text.compare(pos, 5, "false") == 0) {
+            value->type = JSONValue::Type::Bool;
+            value->number = c == 't';
+            pos += c == 't' ? 4 : 5;
+            return true;
+        } else if (text.compare(pos, 4, "null") == 0) {
+            pos += 4;
+            return true;
+        }
+        const char *start = text.c_str() + pos;
+        char *end;
+        value->number = strtod(start, &end);
+        if (end == start) return false;
+        value->type = JSONValue::Type::Number;
+        pos += end - start;
+        return true;
+    }
+
+    const std::string &text;
+    size_t pos = 0;
+};
+
+static bool ReadJSON(const std::string &filename, JSONValue *value) {
+    std::ifstream in(filename);
+    if (!in) return false;
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return JSONParser(ss.str()).Parse(value);
+}
+
+// Benchmark Scene Declarations
+struct BenchSettings {
+    int spp = 16;
+    int resolution = 256;
+    int nThreads = 0;
+};
+
+struct BenchScene {
+    const char *name;
+    const char *description;
+    // The integrator's name and parameters.
+    const char *integrator;
+    // Returns the scene's world block, recording any files it creates in
+    // _tempFiles_ so that they can be removed afterward.
+    std::string (*world)(std::vector<std::string> *tempFiles);
+};
+
+// Benchmark Scene Utility Functions
+static std::string FloatArray(const char *type, const char *name,
+                              const std::vector<Float> &values) {
+    std::string str = StringPrintf("\"%s %s\" [", type, name);
+    for (Float v : values) str += StringPrintf(" %.6g", v);
+    return str + " ]\n";
+}
+
+static std::string IntArray(const char *name, const std::vector<int> &values) {
+    std::string str = StringPrintf("\"integer %s\" [", name);
+    for (int v : values) str += StringPrintf(" %d", v);
+    return str + " ]\n";
+}
+
+// Returns a triangle mesh of an _n_ by _n_ grid over [-_size_,_size_]^2
+// in the z=0 plane, displaced upward by _height_(x, y).
+template <typename F>
+static std::string GridMesh(int n, Float size, F height) {
+    std::vector<Float> p, uv;
+    for (int j = 0; j <= n; ++j)
+        for (int i = 0; i <= n; ++i) {
+            Float u = Float(i) / n, v = Float(j) / n;
+            Float x = Lerp(u, -size, size), y = Lerp(v, -size, size);
+            p.insert(p.end(), {x, y, height(x, y)});
+            uv.insert(uv.end(), {u, v});
+        }
+    std::vector<int> indices;
+    for (int j = 0; j < n; ++j)
+        for (int i = 0; i < n; ++i) {
+            int v00 = j * (n + 1) + i, v10 = v00 + 1, v01 = v00 + n + 1,
+                v11 = v01 + 1;
+            indices.insert(indices.end(), {v00, v10, v11, v00, v11, v01});
+        }
+    return "Shape \"trianglemesh\"\n" + IntArray("indices", indices) +
+           FloatArray("point", "P", p) + FloatArray("float", "uv", uv);
+}
+
+static std::string Ground(Float size) {
+    return GridMesh(1, size, [](Float, Float) { return Float(0); });
+}
+
+// Returns a triangle mesh of the box [-1,1]^2 x [0,1].
+static std::string BoxMesh() {
+    std::vector<Float> p;
+    for (int i = 0; i < 8; ++i)
+        p.insert(p.end(), {(i & 1) ? 1.f : -1.f, (i & 2) ? 1.f : -1.f,
+                           (i & 4) ? 1.f : 0.f});
+    return "Shape \"trianglemesh\"\n" +
+           IntArray("indices", {0, 2, 3, 0, 3, 1, 4, 5, 7, 4, 7, 6,
+                                0, 1, 5, 0, 5, 4, 2, 6, 7, 2, 7, 3,
+                                0, 4, 6, 0, 6, 2, 1, 3, 7, 1, 7, 5}) +
+           FloatArray("point", "P", p);
+}
+
+// Returns a triangle mesh approximating a sphere of radius _radius_, with
+// its vertices pushed in and out randomly by up to _jitter_.
+static std::string SphereMesh(int nTheta, int nPhi, Float radius,
+                              Float jitter, RNG &rng) {
+    std::vector<Float> p;
+    for (int t = 0; t <= nTheta; ++t)
+        for (int ph = 0; ph < nPhi; ++ph) {
+            Float theta = Pi * t / nTheta, phi = 2 * Pi * ph / nPhi;
+            Float r = radius * (1 + jitter * (2 * rng.UniformFloat() - 1));
+            p.insert(p.end(), {r * std::sin(theta) * std::cos(phi),
+                               r * std::sin(theta) * std::sin(phi),
+                               r * std::cos(theta)});
+        }
+    std::vector<int> indices;
+    for (int t = 0; t < nTheta; ++t)
+        for (int ph = 0; ph < nPhi; ++ph) {
+            int v00 = t * nPhi + ph, v01 = t * nPhi + (ph + 1) % nPhi;
+            int v10 = v00 + nPhi, v11 = v01 + nPhi;
+            indices.insert(indices.end(), {v00, v10, v11, v00, v11, v01});
+        }
+    return "Shape \"trianglemesh\"\n" + IntArray("indices", indices) +
+           FloatArray("point", "P", p);
+}
+
+// Benchmark Scene Definitions
+static const char *defaultLighting = R"(
+LightSource "infinite" "rgb L" [ .2 .25 .3 ]
+LightSource "distant" "point from" [ 2 -3 4 ] "point to" [ 0 0 0 ]
+    "rgb L" [ 2.5 2.4 2.2 ]
+)";
+
+// Half a million triangles in a single rolling-terrain mesh.
+static std::string TrianglesWorld(std::vector<std::string> *) {
+    return std::string(defaultLighting) +
+           "Material \"matte\" \"rgb Kd\" [ .4 .45 .35 ]\n" +
+           GridMesh(500, 4, [](Float x, Float y) {
+               return .3f * std::sin(3 * x) * std::cos(2 * y) +
+                      .05f * std::sin(17 * x + 11 * y);
+           });
+}
+
+// Twenty thousand instances of a four thousand triangle rock.
+static std::string InstancesWorld(std::vector<std::string> *) {
+    RNG rng(1);
+    std::string world = std::string(defaultLighting) +
+                        "Material \"matte\" \"rgb Kd\" [ .5 .5 .5 ]\n" +
+                        Ground(4) + "ObjectBegin \"rock\"\n" +
+                        "Material \"plastic\" \"rgb Kd\" [ .3 .25 .2 ]\n" +
+                        SphereMesh(32, 64, .05f, .2f, rng) + "ObjectEnd\n";
+    for (int i = 0; i < 20000; ++i)
+        world += StringPrintf(
+            "AttributeBegin\nTranslate %f %f 0\nRotate %f 0 0 1\n"
+            "Scale %f %f %f\nObjectInstance \"rock\"\nAttributeEnd\n",
+            8 * rng.UniformFloat() - 4, 8 * rng.UniformFloat() - 4,
+            360 * rng.UniformFloat(), .5f + 1.5f * rng.UniformFloat(),
+            .5f + 1.5f * rng.UniformFloat(), .5f + rng.UniformFloat());
+    return world;
+}
+
+// A thousand small spherical area lights over a field of boxes.
+static std::string LightsWorld(std::vector<std::string> *) {
+    RNG rng(2);
+    std::string world = "Material \"matte\" \"rgb Kd\" [ .5 .5 .5 ]\n" +
+                        Ground(4);
+    for (int i = 0; i < 200; ++i)
+        world += StringPrintf(
+            "AttributeBegin\nTranslate %f %f 0\nScale .1 .1 %f\n%s"
+            "AttributeEnd\n",
+            8 * rng.UniformFloat() - 4, 8 * rng.UniformFloat() - 4,
+            1 + 3 * rng.UniformFloat(), BoxMesh().c_str());
+    for (int i = 0; i < 1000; ++i) {
+        Float power = 2 + 20 * rng.UniformFloat() * rng.UniformFloat();
+        world += StringPrintf(
+            "AttributeBegin\nTranslate %f %f %f\n"
+            "AreaLightSource \"diffuse\" \"rgb L\" [ %f %f %f ]\n"
+            "Shape \"sphere\" \"float radius\" .02\nAttributeEnd\n",
+            8 * rng.UniformFloat() - 4, 8 * rng.UniformFloat() - 4,
+            .1f + .8f * rng.UniformFloat(), power * rng.UniformFloat(),
+            power * rng.UniformFloat(), power * rng.UniformFloat());
+    }
+    return world;
+}
+
+// Spheres and a ground plane with large, repeated image textures, so that
+// the texture lookups need filtering across many MIP map levels.
+static std::string TexturesWorld(std::vector<std::string> *tempFiles) {
+    const int nTextures = 4, res = 1024;
+    RNG rng(3);
+    std::string world = defaultLighting;
+    for (int t = 0; t < nTextures; ++t) {
+        // Sums of randomly oriented sinusoids with a sprinkling of noise.
+        std::vector<Float> rgb(3 * res * res);
+        Vector2f freq[3];
+        for (Vector2f &f : freq)
+            f = Vector2f(40 * rng.UniformFloat(), 40 * rng.UniformFloat());
+        for (int y = 0; y < res; ++y)
+            for (int x = 0; x < res; ++x)
+                for (int c = 0; c < 3; ++c)
+                    rgb[3 * (y * res + x) + c] =
+                        .5f + .3f * std::sin(2 * Pi * (freq[c].x * x +
+                                                       freq[c].y * y) / res) +
+                        .2f * rng.UniformFloat();
+        std::string filename = StringPrintf("pbrt_bench_texture%d.pfm", t);
+        WriteImage(filename, rgb.data(), Bounds2i(Point2i(0, 0),
+                                                  Point2i(res, res)),
+                   Point2i(res, res));
+        tempFiles->push_back(filename);
+        world += StringPrintf(
+            "Texture \"tex%d\" \"spectrum\" \"imagemap\" "
+            "\"string filename\" \"%s\" \"float uscale\" %d "
+            "\"float vscale\" %d\n",
+            t, filename.c_str(), 4 << t, 4 << t);
+    }
+    world += "Material \"matte\" \"texture Kd\" \"tex0\"\n" + Ground(4);
+    for (int i = 0; i < 24; ++i)
+        world += StringPrintf(
+            "AttributeBegin\nTranslate %f %f .5\n"
+            "Material \"plastic\" \"texture Kd\" \"tex%d\"\n"
+            "Shape \"sphere\" \"float radius\" .5\nAttributeEnd\n",
+            -3.5f + 1.4f * (i % 6), -2.5f + 1.6f * (i / 6),
+            i % nTextures);
+    return world;
+}
+
+// A scattering cloud in a 64^3 density grid.
+static std::string VolumesWorld(std::vector<std::string> *) {
+    const int res = 64;
+    std::vector<Float> density(res * res * res);
+    for (int z = 0; z < res; ++z)
+        for (int y = 0; y < res; ++y)
+            for (int x = 0; x < res; ++x) {
+                Point3f p((x + .5f) / res - .5f, (y + .5f) / res - .5f,
+                          (z + .5f) / res - .5f);
+                Float d = 1 - 2.5f * Distance(p, Point3f(0, 0, 0)) +
+                          .15f * std::sin(25 * p.x) * std::sin(31 * p.y) *
+                              std::sin(19 * p.z);
+                density[(z * res + y) * res + x] = std::max(d, Float(0));
+            }
+    return std::string(defaultLighting) +
+           "Material \"matte\" \"rgb Kd\" [ .5 .5 .5 ]\n" + Ground(4) +
+           "MakeNamedMedium \"cloud\" \"string type\" \"heterogeneous\"\n" +
+           StringPrintf("\"integer nx\" %d \"integer ny\" %d "
+                        "\"integer nz\" %d\n", res, res, res) +
+           "\"point p0\" [ -1.5 -1.5 0 ] \"point p1\" [ 1.5 1.5 3 ]\n"
+           "\"rgb sigma_a\" [ .5 .5 .5 ] \"rgb sigma_s\" [ 4 4 4 ]\n"
+           "\"float scale\" 2 \"float g\" .3\n" +
+           FloatArray("float", "density", density) +
+           "AttributeBegin\nMediumInterface \"cloud\" \"\"\nMaterial \"\"\n"
+           "Translate 0 0 1.5\nShape \"sphere\" \"float radius\" 1.5\n"
+           "AttributeEnd\n";
+}
+
+// Fifty thousand curly hairs on a sphere.
+static std::string HairWorld(std::vector<std::string> *) {
+    RNG rng(4);
+    std::string world = std::string(defaultLighting) +
+                        "AttributeBegin\nTranslate 0 0 1\n"
+                        "Material \"matte\" \"rgb Kd\" [ .3 .2 .15 ]\n"
+                        "Shape \"sphere\" \"float radius\" 1\n"
+                        "Material \"hair\" \"float eumelanin\" 1.3\n";
+    for (int i = 0; i < 50000; ++i) {
+        Vector3f n = UniformSampleSphere(
+            Point2f(rng.UniformFloat(), rng.UniformFloat()));
+        Vector3f t1, t2;
+        CoordinateSystem(n, &t1, &t2);
+        Float length = .3f + .3f * rng.UniformFloat();
+        Float curl = .15f * (2 * rng.UniformFloat() - 1);
+        Point3f p[4];
+        for (int j = 0; j < 4; ++j) {
+            Float s = j / 3.f;
+            Vector3f offset = n * (1 + s * length) +
+                              curl * s * ((j & 1) ? t1 : t2) -
+                              Vector3f(0, 0, .2f * s * s * length);
+            p[j] = Point3f(offset.x, offset.y, offset.z);
+        }
+        world += StringPrintf(
+            "Shape \"curve\" \"string type\" \"cylinder\" \"point P\" "
+            "[ %f %f %f %f %f %f %f %f %f %f %f %f ] \"float width0\" .006 "
+            "\"float width1\" .002\n",
+            p[0].x, p[0].y, p[0].z, p[1].x, p[1].y, p[1].z, p[2].x, p[2].y,
+            p[2].z, p[3].x, p[3].y, p[3].z);
+    }
+    return world + "AttributeEnd\n" +
+           "Material \"matte\" \"rgb Kd\" [ .5 .5 .5 ]\n" + Ground(4);
+}
+
+// The "lights" scene uses power-based light sampling, since building the
+// default spatial light distributions for it takes minutes.
+static const BenchScene scenes[] = {
+    {"triangles", "500k-triangle terrain mesh", "\"path\"", TrianglesWorld},
+    {"instances", "20k instances of a 4k-triangle mesh", "\"path\"",
+     InstancesWorld},
+    {"lights", "1000 spherical area lights",
+     "\"path\" \"string lightsamplestrategy\" \"power\"", LightsWorld},
+    {"textures", "large filtered image textures", "\"path\"", TexturesWorld},
+    {"volumes", "heterogeneous scattering medium", "\"volpath\"",
+     VolumesWorld},
+    {"hair", "50k hair curves", "\"path\"", HairWorld},
+};
+
+// Benchmark Driver Declarations
+struct BenchResult {
+    double buildSeconds = 0, renderSeconds = 0;
+    double mraysPerSecond = 0;
+    // Peak resident set size, in bytes, at the end of scene construction
+    // and at the end of rendering.
+    double buildPeakMemory = 0, renderPeakMemory = 0;
+};
+
+// Benchmark Driver Functions
+static void usage(const char *msg = nullptr, ...) {
+    if (msg) {
+        va_list args;
+        va_start(args, msg);
+        fprintf(stderr, "pbrt_bench: ");
+        vfprintf(stderr, msg, args);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, R"(usage: pbrt_bench [<options>]
+Renders procedurally generated benchmark scenes, reporting ray throughput,
+acceleration structure build time and peak memory use for each one.
+
+options:
+  --baseline <file>  Compare the results to those in the given file, as
+                     written by --outfile, and exit with an error if any
+                     scene has regressed.
+  --filter <str>     Only render scenes whose name contains <str>.
+  --list             List the available scenes and exit.
+  --nthreads <num>   Use specified number of threads for rendering.
+  --outfile <file>   Write the results to the given file in JSON format.
+  --resolution <n>   Image resolution (square). Default: 256
+  --spp <n>          Samples per pixel. Default: 16
+  --tolerance <pct>  Percentage change from the baseline that counts as a
+                     regression. Default: 10
+)");
+    exit(msg ? 1 : 0);
+}
+
+// Renders _scene_ in a child process, so that each scene's statistics and
+// peak memory use are independent of the others, and reads back the
+// statistics it wrote.
+static bool RenderScene(const BenchScene &scene,
+                        const BenchSettings &settings, BenchResult *result) {
+    std::string statsFile = StringPrintf("pbrt_bench_%s.json", scene.name);
+    std::string imageFile = StringPrintf("pbrt_bench_%s.pfm", scene.name);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "pbrt_bench: fork failed: %s\n", strerror(errno));
+        return false;
+    }
+    if (pid == 0) {
+        std::vector<std::string> tempFiles;
+        std::string world = scene.world(&tempFiles);
+        Options options;
+        options.nThreads = settings.nThreads;
+        options.quiet = true;
+        options.imageFile = imageFile;
+        options.statsJSONFile = statsFile;
+        pbrtInit(options);
+        pbrtParseString(
+            StringPrintf(
+                "LookAt 0 -7 4.5  0 0 .5  0 0 1\n"
+                "Camera \"perspective\" \"float fov\" 45\n"
+                "Film \"image\" \"integer xresolution\" %d "
+                "\"integer yresolution\" %d\n"
+                "Sampler \"halton\" \"integer pixelsamples\" %d\n"
+                "Integrator %s \"integer maxdepth\" 5\n"
+                "WorldBegin\n",
+                settings.resolution, settings.resolution, settings.spp,
+                scene.integrator) +
+            world + "WorldEnd\n");
+        pbrtCleanup();
+        for (const std::string &filename : tempFiles) remove(filename.c_str());
+        _exit(0);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "pbrt_bench: rendering \"%s\" failed\n", scene.name);
+        return false;
+    }
+    remove(imageFile.c_str());
+    JSONValue stats;
+    bool ok = ReadJSON(statsFile, &stats);
+    remove(statsFile.c_str());
+    if (!ok) {
+        fprintf(stderr, "pbrt_bench: %s: unable to read statistics\n",
+                statsFile.c_str());
+        return false;
+    }
+    result->buildSeconds = stats["wallTime"]["Scene construction"].Number();
+    result->renderSeconds = stats["wallTime"]["Rendering"].Number();
+    result->mraysPerSecond = 1e-6 * stats["rays"]["perSecond"].Number();
+    result->buildPeakMemory =
+        stats["phasePeakMemory"]["Scene construction"].Number();
+    result->renderPeakMemory = stats["phasePeakMemory"]["Rendering"].Number();
+    return true;
+}
+
+static bool WriteResults(
+    const std::string &filename, const BenchSettings &settings,
+    const std::vector<std::pair<std::string, BenchResult>> &results) {
+    FILE *f = fopen(filename.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "pbrt_bench: %s: %s\n", filename.c_str(),
+                strerror(errno));
+        return false;
+    }
+    fprintf(f, "{\n  \"spp\": %d,\n  \"resolution\": %d,\n  \"scenes\": {",
+            settings.spp, settings.resolution);
+    const char *sep = "";
+    for (const auto &r : results) {
+        fprintf(f,
+                "%s\n    \"%s\": {\"buildSeconds\": %.6f, "
+                "\"renderSeconds\": %.6f, \"mraysPerSecond\": %.6f, "
+                "\"buildPeakMemory\": %.0f, \"renderPeakMemory\": %.0f}",
+                sep, r.first.c_str(), r.second.buildSeconds,
+                r.second.renderSeconds, r.second.mraysPerSecond,
+                r.second.buildPeakMemory, r.second.renderPeakMemory);
+        sep = ",";
+    }
+    fprintf(f, "\n  }\n}\n");
+    fclose(f);
+    return true;
+}
+
+// Returns the relative change from _base_ to _value_ as a percentage.
+static double PercentChange(double value, double base) {
+    return base > 0 ? 100 * (value - base) / base : 0;
+}
+
+int main(int argc, char *argv[]) {
+    BenchSettings settings;
+    std::string filter, baselineFile, outFile;
+    double tolerance = 10;
+    bool list = false;
+    for (int i = 1; i < argc; ++i) {
+        auto value = [&]() {
+            if (i + 1 == argc) usage("missing value after %s", argv[i]);
+            return argv[++i];
+        };
+        if (!strcmp(argv[i], "--baseline") || !strcmp(argv[i], "-baseline"))
+            baselineFile = value();
+        else if (!strcmp(argv[i], "--filter") || !strcmp(argv[i], "-filter"))
+            filter = value();
+        else if (!strcmp(argv[i], "--list") || !strcmp(argv[i], "-list"))
+            list = true;
+        else if (!strcmp(argv[i], "--nthreads") ||
+                 !strcmp(argv[i], "-nthreads"))
+            settings.nThreads = atoi(value());
+        else if (!strcmp(argv[i], "--outfile") || !strcmp(argv[i], "-outfile"))
+            outFile = value();
+        else if (!strcmp(argv[i], "--resolution") ||
+                 !strcmp(argv[i], "-resolution"))
+            settings.resolution = atoi(value());
+        else if (!strcmp(argv[i], "--spp") || !strcmp(argv[i], "-spp"))
+            settings.spp = atoi(value());
+        else if (!strcmp(argv[i], "--tolerance") ||
+                 !strcmp(argv[i], "-tolerance"))
+            tolerance = atof(value());
+        else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-help") ||
+                 !strcmp(argv[i], "-h"))
+            usage();
+        else
+            usage("argument \"%s\" unknown", argv[i]);
+    }
+    if (settings.spp <= 0 || settings.resolution <= 0)
+        usage("--spp and --resolution must be positive");
+
+    if (list) {
+        for (const BenchScene &scene : scenes)
+            printf("%-12s %s\n", scene.name, scene.description);
+        return 0;
+    }
+
+    JSONValue baseline;
+    if (!baselineFile.empty()) {
+        if (!ReadJSON(baselineFile, &baseline)) {
+            fprintf(stderr, "pbrt_bench: %s: unable to read baseline\n",
+                    baselineFile.c_str());
+            return 1;
+        }
+        if (baseline["spp"].Number() != settings.spp ||
+            baseline["resolution"].Number() != settings.resolution)
+            fprintf(stderr, "pbrt_bench: warning: baseline was rendered "
+                    "with %g spp at %g^2 pixels\n", baseline["spp"].Number(),
+                    baseline["resolution"].Number());
+    }
+
+    printf("%-12s %10s %10s %10s %18s\n", "Scene", "Build (s)",
+           "Render (s)", "Mrays/s", "Peak MB (build/all)");
+    std::vector<std::pair<std::string, BenchResult>> results;
+    int nFailed = 0, nRegressed = 0;
+    for (const BenchScene &scene : scenes) {
+        if (std::string(scene.name).find(filter) == std::string::npos)
+            continue;
+        BenchResult result;
+        if (!RenderScene(scene, settings, &result)) {
+            ++nFailed;
+            continue;
+        }
+        results.push_back(std::make_pair(scene.name, result));
+        printf("%-12s %10.3f %10.3f %10.3f %8.1f / %7.1f\n", scene.name,
+               result.buildSeconds, result.renderSeconds,
+               result.mraysPerSecond, result.buildPeakMemory / (1 << 20),
+               result.renderPeakMemory / (1 << 20));
+
+        // Ray throughput should only go up and build time and memory
+        // use should only go down.
+        const JSONValue &base = baseline["scenes"][scene.name];
+        if (base.type != JSONValue::Type::Object) continue;
+        struct {
+            const char *name;
+            double value, base, sign;
+        } metrics[] = {
+            {"Mrays/s", result.mraysPerSecond,
+             base["mraysPerSecond"].Number(), -1},
+            {"build time", result.buildSeconds, base["buildSeconds"].Number(),
+             1},
+            {"peak memory", result.renderPeakMemory,
+             base["renderPeakMemory"].Number(), 1},
+        };
+        std::string comparison;
+        bool regressed = false;
+        for (const auto &m : metrics) {
+            double change = PercentChange(m.value, m.base);
+            bool worse = m.sign * change > tolerance;
+            regressed |= worse;
+            // (StringPrintf() doesn't handle "%%".)
+            comparison += std::string(comparison.empty() ? "" : ", ") +
+                          m.name + StringPrintf(" %+.1f", change) + "%" +
+                          (worse ? " (!)" : "");
+        }
+        printf("%-12s   vs. baseline: %s\n", "", comparison.c_str());
+        if (regressed) ++nRegressed;
+    }
+
+    if (!outFile.empty() && !WriteResults(outFile, settings, results))
+        return 1;
+    if (nRegressed > 0)
+        printf("%d scene%s regressed by more than %g%%.\n", nRegressed,
+               nRegressed > 1 ? "s" : "", tolerance);
+    return (nFailed > 0 || nRegressed > 0) ? 1 : 0;
+}
@@ -11,6 +11,7 @@
 #include <algorithm>
 #include "fileutil.h"
 #include "imageio.h"
+#include "mipmap.h"
 #include "pbrt.h"
 #include "spectrum.h"
 #include "parallel.h"
@@ -31,7 +32,7 @@ static void usage(const char *msg = nullptr, ...) {
     }
     fprintf(stderr, R"(usage: imgtool <command> [options] <filenames...>
 
-commands: assemble, cat, convert, diff, info, makesky
+commands: assemble, cat, convert, diff, info, makesky, maketiled
 
 assemble option:
     --outfile          Output image filename.
@@ -80,6 +81,16 @@ makesky options:
                        (Horizontal resolution is twice this value.)
                        Default: 2048
 
+maketiled options:
+    --format <f>       Storage format for texels: "float", "half", or "8bit".
+                       Default: half
+    --gamma <0|1>      Whether the input image's values are gamma corrected.
+                       Default: 1 for 8-bit PNG and TGA files, 0 otherwise.
+    --tilesize <n>     Width and height of tiles, in texels. Must be a power
+                       of two. Default: 32
+    --wrap <mode>      Texture wrap mode used when filtering MIP levels:
+                       "repeat", "black", or "clamp". Default: repeat
+
 )");
     exit(1);
 }
@@ -187,6 +198,100 @@ int makesky(int argc, char *argv[]) {
     return 0;
 }
 
+int maketiled(int argc, char *argv[]) {
+    TexelFormat format = TexelFormat::Half;
+    int tileSize = 32;
+    ImageWrap wrap = ImageWrap::Repeat;
+    int gamma = -1;
+    std::vector<const char *> filenames;
+
+    for (int i = 0; i < argc; ++i) {
+        if (argv[i][0] != '-') {
+            filenames.push_back(argv[i]);
+            continue;
+        }
+        // Split "--flag value" and "--flag=value" forms
+        const char *ptr = argv[i] + 1;
+        if (*ptr == '-') ++ptr;
+        std::string flag;
+        while (*ptr && *ptr != '=') flag += *ptr++;
+        if (!*ptr && i + 1 == argc)
+            usage("missing value after %s flag", argv[i]);
+        std::string value = (*ptr == '=') ? (ptr + 1) : argv[++i];
+
+        if (flag == "format") {
+            if (value == "float")
+                format = TexelFormat::Float;
+            else if (value == "half")
+                format = TexelFormat::Half;
+            else if (value == "8bit")
+                format = TexelFormat::Byte;
+            else
+                usage("--format must be \"float\", \"half\", or \"8bit\"");
+        } else if (flag == "gamma")
+            gamma = atoi(value.c_str()) != 0;
+        else if (flag == "tilesize") {
+            tileSize = atoi(value.c_str());
+            if (tileSize < 1 || tileSize > 128 || !IsPowerOf2(tileSize))
+                usage("--tilesize must be a power of two between 1 and 128");
+        } else if (flag == "wrap") {
+            if (value == "repeat")
+                wrap = ImageWrap::Repeat;
+            else if (value == "black")
+                wrap = ImageWrap::Black;
+            else if (value == "clamp")
+                wrap = ImageWrap::Clamp;
+            else
+                usage("--wrap must be \"repeat\", \"black\", or \"clamp\"");
+        } else
+            usage("unknown \"maketiled\" option %s", argv[i]);
+    }
+    if (filenames.size() < 2)
+        usage("must provide input and output filenames for \"maketiled\"");
+    if (filenames.size() > 2)
+        usage("excess filenames provided to \"maketiled\"");
+    const char *inFile = filenames[0], *outFile = filenames[1];
+    if (!HasExtension(outFile, ".mip"))
+        usage("output filename for \"maketiled\" must end in \".mip\"");
+    if (gamma == -1)
+        gamma = HasExtension(inFile, ".png") || HasExtension(inFile, ".tga");
+
+    Point2i res;
+    std::unique_ptr<RGBSpectrum[]> image = ReadImage(inFile, &res);
+    if (!image) {
+        fprintf(stderr, "%s: unable to read image\n", inFile);
+        return 1;
+    }
+
+    // Flip image in y and linearize it, matching _ImageTexture_
+    for (int y = 0; y < res.y / 2; ++y)
+        for (int x = 0; x < res.x; ++x)
+            std::swap(image[y * res.x + x], image[(res.y - 1 - y) * res.x + x]);
+    if (gamma)
+        for (int i = 0; i < res.x * res.y; ++i) {
+            Float rgb[3];
+            image[i].ToRGB(rgb);
+            for (int c = 0; c < 3; ++c) rgb[c] = InverseGammaCorrect(rgb[c]);
+            image[i] = RGBSpectrum::FromRGB(rgb);
+        }
+
+    ParallelInit();
+    int err = 0;
+    {
+        MIPMap<RGBSpectrum> mipmap(res, image.get(), false, 8.f, wrap, format,
+                                   tileSize);
+        if (!mipmap.WriteTiled(outFile)) {
+            fprintf(stderr, "%s: unable to write tiled image\n", outFile);
+            err = 1;
+        } else
+            printf("%s: %d MIP levels, %s texels, %dx%d tiles\n", outFile,
+                   mipmap.Levels(), TexelFormatName(mipmap.Format()),
+                   tileSize, tileSize);
+    }
+    ParallelCleanup();
+    return err;
+}
+
 int assemble(int argc, char *argv[]) {
     if (argc == 0) usage("no filenames provided to \"assemble\"?");
     const char *outfile = nullptr;
@@ -779,6 +884,8 @@ int main(int argc, char *argv[]) {
         return info(argc - 2, argv + 2);
     else if (!strcmp(argv[1], "makesky"))
         return makesky(argc - 2, argv + 2);
+    else if (!strcmp(argv[1], "maketiled"))
+        return maketiled(argc - 2, argv + 2);
     else
         usage("unknown command \"%s\"", argv[1]);
 
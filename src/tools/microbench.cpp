@@ -0,0 +1,432 @@
+//
+// microbench.cpp
+//
+// Microbenchmarks for pbrt's core kernels, measured in isolation.
+//
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "pbrt.h"
+#include "geometry.h"
+#include "interaction.h"
+#include "lowdiscrepancy.h"
+#include "mipmap.h"
+#include "parallel.h"
+#include "reflection.h"
+#include "rng.h"
+#include "sampling.h"
+#include "shapes/triangle.h"
+#include "transform.h"
+
+using namespace pbrt;
+
+// Benchmark Declarations
+class BenchmarkState {
+  public:
+    BenchmarkState(int64_t iterations, int64_t arg)
+        : remaining(iterations), arg(arg) {}
+    // Returns true until the requested number of iterations have run; the
+    // time between the first and last call is what gets measured, so any
+    // setup before the loop isn't counted.
+    bool KeepRunning() {
+        if (!started) {
+            started = true;
+            start = std::chrono::steady_clock::now();
+        }
+        if (remaining-- > 0) return true;
+        elapsed = std::chrono::steady_clock::now() - start;
+        return false;
+    }
+    int64_t Arg() const { return arg; }
+    double Seconds() const { return elapsed.count(); }
+
+  private:
+    int64_t remaining, arg;
+    bool started = false;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::duration<double> elapsed{0};
+};
+
+typedef void (*BenchmarkFunc)(BenchmarkState &state);
+
+struct Benchmark {
+    std::string name;
+    BenchmarkFunc func;
+    std::vector<int64_t> args;
+};
+
+static std::vector<Benchmark> &Benchmarks() {
+    static std::vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+struct BenchmarkRegistrar {
+    BenchmarkRegistrar(const char *name, BenchmarkFunc func,
+                       std::vector<int64_t> args = {0}) {
+        Benchmarks().push_back({name, func, args});
+    }
+};
+
+#define BENCHMARK(func, ...) \
+    static BenchmarkRegistrar func##Registrar(#func, func, ##__VA_ARGS__)
+
+// Keeps the compiler from optimizing away the computation of _value_.
+template <typename T>
+inline void DoNotOptimize(const T &value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile char sink;
+    sink = *reinterpret_cast<const volatile char *>(&value);
+#endif
+}
+
+// Benchmark Utility Functions
+static const int nRandom = 1 << 20;
+
+// Returns a table of uniform samples so that the benchmarks don't measure
+// the cost of generating them.
+static const std::vector<Float> &RandomFloats() {
+    static std::vector<Float> values;
+    if (values.empty()) {
+        RNG rng;
+        for (int i = 0; i < nRandom; ++i) values.push_back(rng.UniformFloat());
+    }
+    return values;
+}
+
+// Returns _n_ function values spanning several orders of magnitude, like
+// the powers of a scene's lights.
+static std::vector<Float> RandomFunction(int64_t n) {
+    std::vector<Float> func(n);
+    RNG rng(n);
+    for (Float &f : func) f = std::pow(10.f, 4 * rng.UniformFloat());
+    return func;
+}
+
+static const std::vector<int64_t> distributionSizes = {
+    100, 1000, 10000, 100000, 1000000, 10000000};
+
+// Returns a table of rays with origins in [-2,2]^3 and uniformly
+// distributed directions, about half of which hit the [-1,1]^3 box.
+static const std::vector<Ray> &RandomRays() {
+    static std::vector<Ray> rays;
+    if (rays.empty()) {
+        RNG rng;
+        for (int i = 0; i < nRandom; ++i) {
+            Point3f o(4 * rng.UniformFloat() - 2, 4 * rng.UniformFloat() - 2,
+                      4 * rng.UniformFloat() - 2);
+            Vector3f d = UniformSampleSphere(
+                Point2f(rng.UniformFloat(), rng.UniformFloat()));
+            rays.push_back(Ray(o, d));
+        }
+    }
+    return rays;
+}
+
+// Sampling Benchmarks
+static void Distribution1DSampleDiscrete(BenchmarkState &state) {
+    std::vector<Float> func = RandomFunction(state.Arg());
+    Distribution1D distrib(func.data(), func.size());
+    const std::vector<Float> &u = RandomFloats();
+    int i = 0;
+    while (state.KeepRunning()) {
+        Float pdf;
+        DoNotOptimize(distrib.SampleDiscrete(u[i++ & (nRandom - 1)], &pdf));
+        DoNotOptimize(pdf);
+    }
+}
+BENCHMARK(Distribution1DSampleDiscrete, distributionSizes);
+
+static void AliasDistribution1DSampleDiscrete(BenchmarkState &state) {
+    std::vector<Float> func = RandomFunction(state.Arg());
+    AliasDistribution1D distrib(func.data(), func.size());
+    const std::vector<Float> &u = RandomFloats();
+    int i = 0;
+    while (state.KeepRunning()) {
+        Float pdf;
+        DoNotOptimize(distrib.SampleDiscrete(u[i++ & (nRandom - 1)], &pdf));
+        DoNotOptimize(pdf);
+    }
+}
+BENCHMARK(AliasDistribution1DSampleDiscrete, distributionSizes);
+
+static void Distribution1DSampleContinuous(BenchmarkState &state) {
+    std::vector<Float> func = RandomFunction(state.Arg());
+    Distribution1D distrib(func.data(), func.size());
+    const std::vector<Float> &u = RandomFloats();
+    int i = 0;
+    while (state.KeepRunning()) {
+        Float pdf;
+        DoNotOptimize(
+            distrib.SampleContinuous(u[i++ & (nRandom - 1)], &pdf));
+        DoNotOptimize(pdf);
+    }
+}
+BENCHMARK(Distribution1DSampleContinuous, distributionSizes);
+
+static void AliasDistribution1DSampleContinuous(BenchmarkState &state) {
+    std::vector<Float> func = RandomFunction(state.Arg());
+    AliasDistribution1D distrib(func.data(), func.size());
+    const std::vector<Float> &u = RandomFloats();
+    int i = 0;
+    while (state.KeepRunning()) {
+        Float pdf;
+        DoNotOptimize(
+            distrib.SampleContinuous(u[i++ & (nRandom - 1)], &pdf));
+        DoNotOptimize(pdf);
+    }
+}
+BENCHMARK(AliasDistribution1DSampleContinuous, distributionSizes);
+
+// Low-Discrepancy Benchmarks
+
+// The argument gives the dimension (or prime base index) to sample in.
+static const std::vector<int64_t> sampleDimensions = {0, 1, 10, 100, 1000};
+
+static void ComputeRadicalInverse(BenchmarkState &state) {
+    int baseIndex = state.Arg();
+    uint64_t a = 0;
+    while (state.KeepRunning()) DoNotOptimize(RadicalInverse(baseIndex, a++));
+}
+BENCHMARK(ComputeRadicalInverse, sampleDimensions);
+
+static void ComputeSobolSample(BenchmarkState &state) {
+    int dimension = state.Arg();
+    int64_t index = 0;
+    while (state.KeepRunning()) DoNotOptimize(SobolSample(index++, dimension));
+}
+BENCHMARK(ComputeSobolSample, sampleDimensions);
+
+// Reflection Benchmarks
+static void ComputeFrDielectric(BenchmarkState &state) {
+    const std::vector<Float> &u = RandomFloats();
+    int i = 0;
+    while (state.KeepRunning())
+        DoNotOptimize(
+            FrDielectric(2 * u[i++ & (nRandom - 1)] - 1, 1.f, 1.5f));
+}
+BENCHMARK(ComputeFrDielectric);
+
+// Geometry Benchmarks
+static void Bounds3IntersectP(BenchmarkState &state) {
+    Bounds3f bounds(Point3f(-1, -1, -1), Point3f(1, 1, 1));
+    const std::vector<Ray> &rays = RandomRays();
+    int i = 0;
+    while (state.KeepRunning()) {
+        Float t0 = 0, t1 = 0;
+        DoNotOptimize(bounds.IntersectP(rays[i++ & (nRandom - 1)], &t0, &t1));
+        DoNotOptimize(t0);
+    }
+}
+BENCHMARK(Bounds3IntersectP);
+
+// The variant used in BVH traversal, with the ray's reciprocal direction
+// precomputed.
+static void Bounds3IntersectPInvDir(BenchmarkState &state) {
+    Bounds3f bounds(Point3f(-1, -1, -1), Point3f(1, 1, 1));
+    const std::vector<Ray> &rays = RandomRays();
+    std::vector<Vector3f> invDirs;
+    for (const Ray &r : rays)
+        invDirs.push_back(Vector3f(1 / r.d.x, 1 / r.d.y, 1 / r.d.z));
+    int i = 0;
+    while (state.KeepRunning()) {
+        int r = i++ & (nRandom - 1);
+        const Vector3f &invDir = invDirs[r];
+        int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+        DoNotOptimize(bounds.IntersectP(rays[r], invDir, dirIsNeg));
+    }
+}
+BENCHMARK(Bounds3IntersectPInvDir);
+
+// Returns 1024 random triangles in [-1,1]^3.
+static std::vector<std::shared_ptr<Shape>> RandomTriangles() {
+    static const Transform identity;
+    const int nTriangles = 1024;
+    RNG rng;
+    std::vector<Point3f> p;
+    std::vector<int> indices;
+    for (int i = 0; i < 3 * nTriangles; ++i) {
+        p.push_back(Point3f(2 * rng.UniformFloat() - 1,
+                            2 * rng.UniformFloat() - 1,
+                            2 * rng.UniformFloat() - 1));
+        indices.push_back(i);
+    }
+    return CreateTriangleMesh(&identity, &identity, false, nTriangles,
+                              indices.data(), p.size(), p.data(), nullptr,
+                              nullptr, nullptr, nullptr, nullptr);
+}
+
+static void TriangleIntersect(BenchmarkState &state) {
+    std::vector<std::shared_ptr<Shape>> triangles = RandomTriangles();
+    const std::vector<Ray> &rays = RandomRays();
+    int i = 0;
+    while (state.KeepRunning()) {
+        Float tHit;
+        SurfaceInteraction isect;
+        DoNotOptimize(triangles[i & (triangles.size() - 1)]->Intersect(
+            rays[i & (nRandom - 1)], &tHit, &isect));
+        DoNotOptimize(isect);
+        ++i;
+    }
+}
+BENCHMARK(TriangleIntersect);
+
+static void TriangleIntersectP(BenchmarkState &state) {
+    std::vector<std::shared_ptr<Shape>> triangles = RandomTriangles();
+    const std::vector<Ray> &rays = RandomRays();
+    int i = 0;
+    while (state.KeepRunning()) {
+        DoNotOptimize(triangles[i & (triangles.size() - 1)]->IntersectP(
+            rays[i & (nRandom - 1)]));
+        ++i;
+    }
+}
+BENCHMARK(TriangleIntersectP);
+
+// Texture Benchmarks
+
+// Returns a 1024x1024 MIP map of random colors.
+static std::unique_ptr<MIPMap<RGBSpectrum>> RandomMIPMap() {
+    const int res = 1024;
+    std::vector<RGBSpectrum> texels(res * res);
+    RNG rng;
+    for (RGBSpectrum &t : texels) {
+        Float rgb[3] = {rng.UniformFloat(), rng.UniformFloat(),
+                        rng.UniformFloat()};
+        t = RGBSpectrum::FromRGB(rgb);
+    }
+    return std::unique_ptr<MIPMap<RGBSpectrum>>(new MIPMap<RGBSpectrum>(
+        Point2i(res, res), texels.data(), false, 32.f));
+}
+
+static void MIPMapLookupTrilinear(BenchmarkState &state) {
+    std::unique_ptr<MIPMap<RGBSpectrum>> mipmap = RandomMIPMap();
+    const std::vector<Float> &u = RandomFloats();
+    int i = 0;
+    while (state.KeepRunning()) {
+        Point2f st(u[i & (nRandom - 1)], u[(i + 1) & (nRandom - 1)]);
+        Float width = .05f * u[(i + 2) & (nRandom - 1)];
+        DoNotOptimize(mipmap->Lookup(st, width));
+        i += 3;
+    }
+}
+BENCHMARK(MIPMapLookupTrilinear);
+
+// The argument gives the ratio of the filter ellipse's major axis to its
+// minor axis; the number of texels filtered grows with it. Lookups are
+// done with both the SSE EWA kernel and the scalar one.
+static const std::vector<int64_t> ewaAnisotropies = {1, 2, 4, 8, 16, 32};
+
+static void MIPMapEWA(BenchmarkState &state, bool vectorized) {
+    std::unique_ptr<MIPMap<RGBSpectrum>> mipmap = RandomMIPMap();
+    const std::vector<Float> &u = RandomFloats();
+    Float anisotropy = state.Arg();
+    int i = 0;
+    while (state.KeepRunning()) {
+        Point2f st(u[i & (nRandom - 1)], u[(i + 1) & (nRandom - 1)]);
+        Float scale = .02f * u[(i + 2) & (nRandom - 1)];
+        Float theta = 2 * Pi * u[(i + 3) & (nRandom - 1)];
+        Vector2f dstdx(scale * std::cos(theta), scale * std::sin(theta));
+        Vector2f dstdy(-dstdx.y / anisotropy, dstdx.x / anisotropy);
+        DoNotOptimize(mipmap->Lookup(st, dstdx, dstdy, vectorized));
+        i += 4;
+    }
+}
+
+static void MIPMapLookupEWA(BenchmarkState &state) { MIPMapEWA(state, true); }
+BENCHMARK(MIPMapLookupEWA, ewaAnisotropies);
+
+static void MIPMapLookupScalarEWA(BenchmarkState &state) {
+    MIPMapEWA(state, false);
+}
+BENCHMARK(MIPMapLookupScalarEWA, ewaAnisotropies);
+
+// Benchmark Driver
+static void usage(const char *msg = nullptr, ...) {
+    if (msg) {
+        va_list args;
+        va_start(args, msg);
+        fprintf(stderr, "pbrt_microbench: ");
+        vfprintf(stderr, msg, args);
+        fprintf(stderr, "\n");
+    }
+    fprintf(stderr, R"(usage: pbrt_microbench [<options>]
+Runs the benchmarks whose names contain the filter string, reporting the
+mean time per iteration.
+
+options:
+  --filter <str>     Only run benchmarks whose name contains <str>.
+  --list             List the available benchmarks and exit.
+  --mintime <s>      Minimum time to run each benchmark for. Default: 0.5
+)");
+    exit(msg ? 1 : 0);
+}
+
+// Runs _b_ with _arg_, increasing the iteration count until a run takes
+// at least _minTime_ seconds, and returns the time per iteration.
+static double RunBenchmark(const Benchmark &b, int64_t arg, double minTime) {
+    int64_t iterations = 1;
+    while (true) {
+        BenchmarkState state(iterations, arg);
+        b.func(state);
+        double seconds = state.Seconds();
+        if (seconds >= minTime || iterations >= (int64_t(1) << 40))
+            return seconds / iterations;
+        // Aim a little past _minTime_ so that the next run is usually
+        // the last one.
+        double scale = seconds > 0 ? 1.4 * minTime / seconds : 100;
+        iterations = std::max(iterations + 1,
+                              int64_t(iterations * std::min(scale, 100.)));
+    }
+}
+
+int main(int argc, char *argv[]) {
+    std::string filter;
+    double minTime = .5;
+    bool list = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--filter") || !strcmp(argv[i], "-filter")) {
+            if (i + 1 == argc) usage("missing value after %s", argv[i]);
+            filter = argv[++i];
+        } else if (!strcmp(argv[i], "--mintime") ||
+                   !strcmp(argv[i], "-mintime")) {
+            if (i + 1 == argc) usage("missing value after %s", argv[i]);
+            minTime = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--list") || !strcmp(argv[i], "-list"))
+            list = true;
+        else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-help") ||
+                 !strcmp(argv[i], "-h"))
+            usage();
+        else
+            usage("argument \"%s\" unknown", argv[i]);
+    }
+
+    // MIP map construction uses the worker threads.
+    ParallelInit();
+    if (!list)
+        printf("%-50s %14s %14s\n", "Benchmark", "ns/iter", "Miter/s");
+    for (const Benchmark &b : Benchmarks()) {
+        for (int64_t arg : b.args) {
+            std::string name = b.name;
+            if (b.args.size() > 1) name += "/" + std::to_string(arg);
+            if (name.find(filter) == std::string::npos) continue;
+            if (list) {
+                printf("%s\n", name.c_str());
+                continue;
+            }
+            double seconds = RunBenchmark(b, arg, minTime);
+            printf("%-50s %14.2f %14.2f\n", name.c_str(), 1e9 * seconds,
+                   1e-6 / seconds);
+            fflush(stdout);
+        }
+    }
+    ParallelCleanup();
+    return 0;
+}